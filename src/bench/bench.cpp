@@ -0,0 +1,128 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "utiltime.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <new>
+
+#include <boost/atomic.hpp>
+
+namespace benchmark {
+
+/** Heap allocations made by any thread, including check queue workers */
+static boost::atomic<uint64_t> nAllocations(0);
+
+uint64_t GetAllocationCount()
+{
+    return nAllocations.load(boost::memory_order_relaxed);
+}
+
+} // namespace benchmark
+
+void* operator new(std::size_t size)
+{
+    benchmark::nAllocations.fetch_add(1, boost::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) throw()
+{
+    free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+    free(p);
+}
+
+namespace benchmark {
+
+static double gettimedouble()
+{
+    return GetTimeMicros() * 0.000001;
+}
+
+BenchRunner::BenchmarkMap& BenchRunner::Benchmarks()
+{
+    static BenchmarkMap benchmarks;
+    return benchmarks;
+}
+
+BenchRunner::BenchRunner(const std::string& name, BenchFunction func)
+{
+    Benchmarks().insert(std::make_pair(name, func));
+}
+
+void BenchRunner::RunAll(const std::string& strFilter, double nElapsedTimeForOne)
+{
+    std::cout << "#Benchmark" << "," << "count" << "," << "min(ns)" << "," << "max(ns)" << "," << "average(ns)" << "," << "allocs" << "\n";
+
+    for (BenchmarkMap::iterator it = Benchmarks().begin(); it != Benchmarks().end(); ++it) {
+        if (it->first.find(strFilter) == std::string::npos)
+            continue;
+        State state(it->first, nElapsedTimeForOne);
+        it->second(state);
+    }
+}
+
+State::State(const std::string& nameIn, double maxElapsedIn) :
+    name(nameIn), maxElapsed(maxElapsedIn), count(0), lastCount(0), countMask(0), nBeginAllocations(0)
+{
+    minTime = std::numeric_limits<double>::max();
+    maxTime = 0;
+    beginTime = lastTime = 0;
+}
+
+bool State::KeepRunning()
+{
+    // Only read the clock every countMask+1 iterations, doubling the interval
+    // while it takes less than 1/16th of a second, so reading the clock
+    // doesn't dominate fast benchmarks.
+    if (count & countMask) {
+        count++;
+        return true;
+    }
+    double now = gettimedouble();
+    if (count == 0) {
+        beginTime = now;
+        nBeginAllocations = GetAllocationCount();
+    } else {
+        double elapsedOne = (now - lastTime) / (count - lastCount);
+        if (elapsedOne < minTime) minTime = elapsedOne;
+        if (elapsedOne > maxTime) maxTime = elapsedOne;
+        if (now - lastTime < 0.0625)
+            countMask = countMask * 2 + 1;
+    }
+    lastTime = now;
+    lastCount = count;
+
+    if (count == 0 || now - beginTime < maxElapsed) {
+        count++;
+        return true; // Keep going
+    }
+
+    // Output results
+    double average = (now - beginTime) / count;
+    double allocs = (double)(GetAllocationCount() - nBeginAllocations) / count;
+    std::cout << name << "," << count << "," << (int64_t)(minTime * 1e9) << "," << (int64_t)(maxTime * 1e9) << ","
+              << (int64_t)(average * 1e9) << "," << std::fixed << std::setprecision(1) << allocs << "\n";
+
+    return false;
+}
+
+} // namespace benchmark
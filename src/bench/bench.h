@@ -0,0 +1,81 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BENCH_BENCH_H
+#define BITCOIN_BENCH_BENCH_H
+
+#include <map>
+#include <stdint.h>
+#include <string>
+
+#include <boost/function.hpp>
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+/**
+ * Minimal benchmarking framework.
+ *
+ * A benchmark is a function taking a benchmark::State, which runs the code
+ * being measured for as long as State::KeepRunning() returns true:
+ *
+ * static void CodeToTime(benchmark::State& state)
+ * {
+ *     ... do any setup needed ...
+ *     while (state.KeepRunning()) {
+ *         ... do the thing being measured ...
+ *     }
+ *     ... do any cleanup needed ...
+ * }
+ *
+ * BENCHMARK(CodeToTime);
+ *
+ * Results are reported in nanoseconds per iteration, along with the number
+ * of heap allocations made per iteration.
+ */
+namespace benchmark {
+
+class State
+{
+private:
+    std::string name;
+    double maxElapsed;
+    double beginTime;
+    double lastTime, minTime, maxTime;
+    int64_t count;
+    int64_t lastCount;
+    int64_t countMask;
+    uint64_t nBeginAllocations;
+
+public:
+    State(const std::string& nameIn, double maxElapsedIn);
+
+    /** Whether the measured code should run (again). Prints the results when done. */
+    bool KeepRunning();
+};
+
+/** Number of heap allocations made through operator new since startup */
+uint64_t GetAllocationCount();
+
+typedef boost::function<void(State&)> BenchFunction;
+
+class BenchRunner
+{
+private:
+    typedef std::map<std::string, BenchFunction> BenchmarkMap;
+    static BenchmarkMap& Benchmarks();
+
+public:
+    BenchRunner(const std::string& name, BenchFunction func);
+
+    /** Run every registered benchmark whose name contains strFilter, each for about nElapsedTimeForOne seconds */
+    static void RunAll(const std::string& strFilter, double nElapsedTimeForOne);
+};
+
+} // namespace benchmark
+
+/** Register a benchmark function; BENCHMARK(foo) registers foo under the name "foo". */
+#define BENCHMARK(n) \
+    benchmark::BenchRunner BOOST_PP_CAT(bench_, BOOST_PP_CAT(__LINE__, n))(BOOST_PP_STRINGIZE(n), n);
+
+#endif // BITCOIN_BENCH_BENCH_H
@@ -0,0 +1,59 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "blind.h"
+#include "chainparams.h"
+#include "crypto/sha256.h"
+#include "key.h"
+#include "pubkey.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+int main(int argc, char** argv)
+{
+    ParseParameters(argc, argv);
+    if (mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help")) {
+        printf("Usage: bench_alpha [-filter=<substring>] [-time=<seconds>]\n\n"
+               "Runs every benchmark whose name contains <substring> (default: all)\n"
+               "for about <seconds> each (default: 1), printing the time (in nanoseconds)\n"
+               "and the number of heap allocations per iteration.\n");
+        return 0;
+    }
+
+    SHA256AutoDetect();
+    ECC_Verify_Start();
+    ECC_Blinding_Start();
+    ECC_Start();
+    SetupEnvironment();
+    fPrintToDebugLog = false;
+    SelectParams(CBaseChainParams::UNITTEST);
+    InitSignatureCache();
+
+    double nElapsedTimeForOne = 1.0;
+    try {
+        nElapsedTimeForOne = boost::lexical_cast<double>(GetArg("-time", "1"));
+    } catch (const boost::bad_lexical_cast&) {
+        fprintf(stderr, "Error: invalid -time\n");
+        return 1;
+    }
+
+    // Benchmarks touching block files get a data directory of their own
+    boost::filesystem::path pathTemp = GetTempPath() / strprintf("bench_alpha_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+
+    benchmark::BenchRunner::RunAll(GetArg("-filter", ""), nElapsedTimeForOne);
+
+    boost::filesystem::remove_all(pathTemp);
+    ECC_Stop();
+    ECC_Blinding_Stop();
+    ECC_Verify_Stop();
+    return 0;
+}
@@ -0,0 +1,66 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "ctdata.h"
+
+#include "blind.h"
+#include "coins.h"
+#include "key.h"
+
+#include <assert.h>
+
+/** Commitment tally and rangeproofs of a transaction with two blinded inputs and outputs */
+static void VerifyAmountsCT(benchmark::State& state)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CCoinsView viewBase;
+    CCoinsViewCache view(&viewBase);
+    CTransaction tx(CreateCTSpend(view, key, 0));
+    assert(view.VerifyAmounts(tx));
+
+    while (state.KeepRunning())
+        view.VerifyAmounts(tx);
+}
+
+/** Blinding two outputs (including their rangeproofs) */
+static void BlindOutputsCT(benchmark::State& state)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CMutableTransaction txTemplate;
+    txTemplate.vin.resize(1);
+    txTemplate.vout.resize(2);
+    txTemplate.vout[0].nValue = 60 * COIN;
+    txTemplate.vout[1].nValue = 40 * COIN;
+    std::vector<uint256> vInputBlinds(1, 1), vOutputBlinds(2);
+    std::vector<CPubKey> vOutputPubKeys(2, key.GetPubKey());
+
+    while (state.KeepRunning()) {
+        CMutableTransaction tx(txTemplate);
+        BlindOutputs(vInputBlinds, vOutputBlinds, vOutputPubKeys, tx);
+    }
+}
+
+/** Recovering the amount and blinding factor of an output sent to us */
+static void UnblindOutputCT(benchmark::State& state)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CCoinsView viewBase;
+    CCoinsViewCache view(&viewBase);
+    CMutableTransaction tx = CreateCTSpend(view, key, 0);
+
+    CAmount amount;
+    uint256 blind;
+    while (state.KeepRunning()) {
+        bool fUnblinded = UnblindOutput(key, tx.vout[0], amount, blind);
+        assert(fUnblinded);
+    }
+}
+
+BENCHMARK(VerifyAmountsCT);
+BENCHMARK(BlindOutputsCT);
+BENCHMARK(UnblindOutputCT);
@@ -0,0 +1,109 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "ctdata.h"
+
+#include "coins.h"
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "pow.h"
+#include "script/generic.hpp"
+#include "script/standard.h"
+#include "utiltime.h"
+
+#include <assert.h>
+
+/** Number of confidential transactions (two blinded inputs and outputs each) in the block */
+static const unsigned int NUM_BLOCK_TXS = 50;
+
+/**
+ * A block of confidential transactions spending coins added to view, whose
+ * proof is signed by two of a three key federation.
+ */
+static CBlock CreateCTBlock(CCoinsViewCache& view)
+{
+    CKey key;
+    key.MakeNewKey(true);
+
+    CBlock block;
+    block.nVersion = 3;
+    block.hashPrevBlock = view.GetBestBlock();
+    block.nTime = GetTime();
+
+    CMutableTransaction txCoinbase;
+    txCoinbase.vin.resize(1);
+    txCoinbase.vin[0].scriptSig = CScript() << 101 << OP_0;
+    txCoinbase.vout.resize(1);
+    txCoinbase.vout[0].nValue = NUM_BLOCK_TXS * CENT;
+    txCoinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    block.vtx.push_back(txCoinbase);
+    for (unsigned int i = 0; i < NUM_BLOCK_TXS; i++)
+        block.vtx.push_back(CreateCTSpend(view, key, i));
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    CBasicKeyStore keystore;
+    std::vector<CPubKey> vPubKeys;
+    for (int i = 0; i < 3; i++) {
+        CKey keyFederation;
+        keyFederation.MakeNewKey(true);
+        vPubKeys.push_back(keyFederation.GetPubKey());
+        if (i < 2)
+            keystore.AddKey(keyFederation);
+    }
+    block.proof.challenge = GetScriptForMultisig(2, vPubKeys);
+    GenericSignScript(keystore, block.GetBlockHeader(), block.proof.challenge, block.proof.solution);
+    assert(CheckProof(block));
+    return block;
+}
+
+/** Reading a block back from its block file, which checks its proof */
+static void ReadBlockFromDiskCheckProof(benchmark::State& state)
+{
+    CCoinsView viewDummy;
+    CCoinsViewCache view(&viewDummy);
+    CBlock block = CreateCTBlock(view);
+    CDiskBlockPos pos(0, 0);
+    bool fWritten = WriteBlockToDisk(block, pos);
+    assert(fWritten);
+
+    while (state.KeepRunning()) {
+        CBlock blockRead;
+        bool fRead = ReadBlockFromDisk(blockRead, pos);
+        assert(fRead);
+    }
+}
+
+/** Connecting the block to a coins view, verifying all its scripts and amounts */
+static void ConnectBlockCT(benchmark::State& state)
+{
+    LOCK(cs_main);
+    CCoinsView viewDummy;
+    CCoinsViewCache viewBase(&viewDummy);
+    uint256 hashPrev = 1;
+    viewBase.SetBestBlock(hashPrev);
+    CBlock block = CreateCTBlock(viewBase);
+    uint256 hashBlock = block.GetHash();
+
+    // Just enough of a chain for the block to build on
+    CBlockIndex indexPrev;
+    indexPrev.nHeight = 100;
+    indexPrev.phashBlock = &mapBlockIndex.insert(std::make_pair(hashPrev, &indexPrev)).first->first;
+    CBlockIndex index(block);
+    index.nHeight = 101;
+    index.pprev = &indexPrev;
+    index.phashBlock = &hashBlock;
+
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(&viewBase);
+        CValidationState validationState;
+        bool fConnected = ConnectBlock(block, validationState, &index, view, true);
+        assert(fConnected);
+    }
+    mapBlockIndex.erase(hashPrev);
+}
+
+BENCHMARK(ReadBlockFromDiskCheckProof);
+BENCHMARK(ConnectBlockCT);
@@ -0,0 +1,84 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "ctdata.h"
+
+#include "checkqueue.h"
+#include "coins.h"
+#include "hash.h"
+#include "key.h"
+#include "main.h"
+
+#include <assert.h>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+/** A check about as expensive as a signature cache hit */
+class CCheapCheck : public CCheck
+{
+private:
+    uint256 hash;
+
+public:
+    CCheapCheck(unsigned int n) : hash(n) {}
+
+    bool operator()()
+    {
+        hash = Hash(hash.begin(), hash.end());
+        return true;
+    }
+};
+
+/**
+ * Ten transactions' worth of checks, added one transaction at a time like
+ * ConnectBlock does: two (uncached) rangeproofs and a hundred cheap checks each,
+ * run on nThreads threads including the master.
+ */
+static void CheckQueueMixed(benchmark::State& state, int nThreads)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CCoinsView viewBase;
+    CCoinsViewCache view(&viewBase);
+    std::vector<CTransaction> vtx;
+    for (unsigned int i = 0; i < 10; i++)
+        vtx.push_back(CTransaction(CreateCTSpend(view, key, i)));
+
+    CCheckQueue<CCheck> queue(128, MAX_SCRIPTCHECK_THREADS);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CCheck>::Thread, &queue));
+
+    while (state.KeepRunning()) {
+        CCheckQueueControl<CCheck> control(&queue);
+        std::vector<CCheck*> vChecks;
+        for (unsigned int i = 0; i < vtx.size(); i++) {
+            for (unsigned int j = 0; j < vtx[i].vout.size(); j++)
+                vChecks.push_back(new CRangeproofCheck(vtx[i].vout[j].nValue, false));
+            for (unsigned int j = 0; j < 100; j++)
+                vChecks.push_back(new CCheapCheck(j));
+            control.Add(vChecks);
+        }
+        bool fOk = control.Wait();
+        assert(fOk);
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+static void CheckQueueMixed_01(benchmark::State& state) { CheckQueueMixed(state, 1); }
+static void CheckQueueMixed_02(benchmark::State& state) { CheckQueueMixed(state, 2); }
+static void CheckQueueMixed_04(benchmark::State& state) { CheckQueueMixed(state, 4); }
+static void CheckQueueMixed_08(benchmark::State& state) { CheckQueueMixed(state, 8); }
+static void CheckQueueMixed_16(benchmark::State& state) { CheckQueueMixed(state, 16); }
+
+BENCHMARK(CheckQueueMixed_01);
+BENCHMARK(CheckQueueMixed_02);
+BENCHMARK(CheckQueueMixed_04);
+BENCHMARK(CheckQueueMixed_08);
+BENCHMARK(CheckQueueMixed_16);
@@ -0,0 +1,40 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "ctdata.h"
+
+#include "coins.h"
+#include "key.h"
+#include "txdb.h"
+
+static const unsigned int NUM_COINS = 1000;
+
+/**
+ * Writing a cache of modified confidential coins to an in-memory coins
+ * database, as at the end of a block. Filling the cache, which reads the
+ * previous versions of the coins from the database, is included.
+ */
+static void CCoinsViewCacheFlush(benchmark::State& state)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CCoinsView viewDummy;
+    CCoinsViewCache viewTemplate(&viewDummy);
+    CTransaction tx(CreateCTSpend(viewTemplate, key, 0));
+    CCoins coins(tx, 1);
+
+    CCoinsViewDB viewDB(1 << 23, true);
+    uint256 hashBlock = 1;
+    while (state.KeepRunning()) {
+        CCoinsViewCache cache(&viewDB);
+        for (unsigned int i = 0; i < NUM_COINS; i++)
+            *cache.ModifyCoins(i + 1) = coins;
+        cache.SetBestBlock(hashBlock);
+        cache.Flush();
+        hashBlock++;
+    }
+}
+
+BENCHMARK(CCoinsViewCacheFlush);
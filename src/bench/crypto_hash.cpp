@@ -0,0 +1,62 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "muhash.h"
+#include "primitives/block.h"
+
+#include <vector>
+
+static const size_t NUM_BLOCKS = 1024;
+
+/** Double SHA256 of 64-byte inputs, one at a time */
+static void SHA256D64_1024_Single(benchmark::State& state)
+{
+    std::vector<unsigned char> in(64 * NUM_BLOCKS, 1), out(32 * NUM_BLOCKS);
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < NUM_BLOCKS; i++)
+            CHash256().Write(&in[64 * i], 64).Finalize(&out[32 * i]);
+    }
+}
+
+/** The same, through the batched (multi-way where available) interface */
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<unsigned char> in(64 * NUM_BLOCKS, 1), out(32 * NUM_BLOCKS);
+    while (state.KeepRunning())
+        SHA256D64(&out[0], &in[0], NUM_BLOCKS);
+}
+
+/** Merkle root of a block of 1000 transactions, from their (cached) hashes */
+static void BuildMerkleTree1000(benchmark::State& state)
+{
+    CBlock block;
+    block.vtx.resize(1000);
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        CMutableTransaction tx;
+        tx.nLockTime = i;
+        block.vtx[i] = tx;
+    }
+    while (state.KeepRunning())
+        block.BuildMerkleTree();
+}
+
+/** Adding an element to a rolling set hash, as for each output a block creates or spends */
+static void MuHash3072Insert(benchmark::State& state)
+{
+    CMuHash3072 muhash;
+    uint256 hash = 1;
+    while (state.KeepRunning()) {
+        muhash.Insert(hash);
+        hash++;
+    }
+}
+
+BENCHMARK(SHA256D64_1024_Single);
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(BuildMerkleTree1000);
+BENCHMARK(MuHash3072Insert);
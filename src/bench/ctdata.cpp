@@ -0,0 +1,60 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "ctdata.h"
+
+#include "blind.h"
+#include "coins.h"
+#include "key.h"
+#include "keystore.h"
+#include "script/sign.h"
+#include "script/standard.h"
+
+#include <assert.h>
+
+CMutableTransaction CreateCTSpend(CCoinsViewCache& view, const CKey& key, unsigned int nSeed)
+{
+    CPubKey pubkey = key.GetPubKey();
+    CScript scriptPubKey = GetScriptForDestination(pubkey.GetID());
+    std::vector<CPubKey> vOutputPubKeys(2, pubkey);
+    std::vector<uint256> vOutputBlinds(2);
+
+    // The coin being spent; only its outputs matter
+    CMutableTransaction txFrom;
+    txFrom.vin.resize(1);
+    txFrom.vin[0].prevout = COutPoint(nSeed + 1, 0);
+    txFrom.vout.resize(2);
+    txFrom.vout[0].nValue = 50 * COIN;
+    txFrom.vout[1].nValue = 50 * COIN;
+    txFrom.vout[0].scriptPubKey = txFrom.vout[1].scriptPubKey = scriptPubKey;
+    BlindOutputs(std::vector<uint256>(1), vOutputBlinds, vOutputPubKeys, txFrom);
+    CTransaction txFromFinal(txFrom);
+    *view.ModifyCoins(txFromFinal.GetHash()) = CCoins(txFromFinal, 1);
+
+    std::vector<uint256> vInputBlinds(2);
+    for (unsigned int i = 0; i < 2; i++) {
+        CAmount amount;
+        bool fUnblinded = UnblindOutput(key, txFrom.vout[i], amount, vInputBlinds[i]);
+        assert(fUnblinded);
+    }
+
+    CMutableTransaction tx;
+    tx.vin.resize(2);
+    tx.vin[0].prevout = COutPoint(txFromFinal.GetHash(), 0);
+    tx.vin[1].prevout = COutPoint(txFromFinal.GetHash(), 1);
+    tx.vout.resize(2);
+    tx.vout[0].nValue = 60 * COIN;
+    tx.vout[1].nValue = 40 * COIN - CENT;
+    tx.vout[0].scriptPubKey = tx.vout[1].scriptPubKey = scriptPubKey;
+    tx.nTxFee = CENT;
+    BlindOutputs(vInputBlinds, vOutputBlinds, vOutputPubKeys, tx);
+
+    CBasicKeyStore keystore;
+    keystore.AddKey(key);
+    for (unsigned int i = 0; i < 2; i++) {
+        bool fSigned = SignSignature(keystore, scriptPubKey, txFrom.vout[i].nValue, tx, i);
+        assert(fSigned);
+    }
+    return tx;
+}
@@ -0,0 +1,20 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BENCH_CTDATA_H
+#define BITCOIN_BENCH_CTDATA_H
+
+#include "primitives/transaction.h"
+
+class CCoinsViewCache;
+class CKey;
+
+/**
+ * Add a coin with two blinded outputs paying to key to view, and return a
+ * signed transaction spending both of them into two blinded outputs.
+ * nSeed makes the coins (and so the spends) distinct.
+ */
+CMutableTransaction CreateCTSpend(CCoinsViewCache& view, const CKey& key, unsigned int nSeed);
+
+#endif // BITCOIN_BENCH_CTDATA_H
@@ -0,0 +1,103 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "blind.h"
+#include "clientversion.h"
+#include "hash.h"
+#include "key.h"
+#include "primitives/transaction.h"
+#include "script/interpreter.h"
+#include "script/standard.h"
+#include "streams.h"
+
+/** A typical confidential transaction: two signed inputs and two blinded outputs with rangeproofs */
+static CMutableTransaction CreateCTTransaction()
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+
+    CMutableTransaction tx;
+    tx.vin.resize(2);
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        tx.vin[i].prevout = COutPoint(i + 1, 0);
+        tx.vin[i].scriptSig << std::vector<unsigned char>(72, 1) << ToByteVector(pubkey);
+    }
+    tx.vout.resize(2);
+    tx.vout[0].nValue = 60 * COIN;
+    tx.vout[1].nValue = 39 * COIN;
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+        tx.vout[i].scriptPubKey = GetScriptForDestination(pubkey.GetID());
+    tx.nTxFee = COIN;
+    std::vector<uint256> vInputBlinds(tx.vin.size()), vOutputBlinds(tx.vout.size());
+    std::vector<CPubKey> vOutputPubKeys(tx.vout.size(), pubkey);
+    BlindOutputs(vInputBlinds, vOutputBlinds, vOutputPubKeys, tx);
+    return tx;
+}
+
+static void HashTransactionCT(benchmark::State& state)
+{
+    CMutableTransaction mtx = CreateCTTransaction();
+    while (state.KeepRunning()) {
+        CTransaction tx(mtx);
+    }
+}
+
+/**
+ * Hashing with a separate serialization pass per digest, as before, for
+ * comparison. Blinded transactions have no Bitcoin transaction hash.
+ */
+static void HashTransactionCTPerDigest(benchmark::State& state)
+{
+    CMutableTransaction mtx = CreateCTTransaction();
+    CTransaction tx(mtx);
+    while (state.KeepRunning()) {
+        CTransaction txCopy(tx);
+        uint256 hash = SerializeHash(txCopy, SER_GETHASH, PROTOCOL_VERSION | SERIALIZE_VERSION_MASK_NO_WITNESS);
+        uint256 hashWitness = SerializeHash(txCopy, SER_GETHASH, PROTOCOL_VERSION | SERIALIZE_VERSION_MASK_ONLY_WITNESS);
+        Hash(hash.begin(), hash.end(), hashWitness.begin(), hashWitness.end());
+    }
+}
+
+static void DeserializeTransactionCT(benchmark::State& state)
+{
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << CTransaction(CreateCTTransaction());
+    while (state.KeepRunning()) {
+        CDataStream ss(ssTx);
+        CTransaction tx;
+        ss >> tx;
+    }
+}
+
+/** Signature hashes for both inputs, as when verifying the transaction */
+static void SignatureHashCT(benchmark::State& state)
+{
+    CTransaction tx(CreateCTTransaction());
+    CScript scriptCode = tx.vout[0].scriptPubKey;
+    while (state.KeepRunning()) {
+        for (unsigned int i = 0; i < tx.vin.size(); i++)
+            SignatureHash(scriptCode, tx.vout[i].nValue, tx, i, SIGHASH_ALL);
+    }
+}
+
+/** The same, with the signed outputs serialized once for all inputs */
+static void SignatureHashCTPrecomputed(benchmark::State& state)
+{
+    CTransaction tx(CreateCTTransaction());
+    CScript scriptCode = tx.vout[0].scriptPubKey;
+    while (state.KeepRunning()) {
+        PrecomputedTransactionData txdata(tx);
+        for (unsigned int i = 0; i < tx.vin.size(); i++)
+            SignatureHash(scriptCode, tx.vout[i].nValue, tx, i, SIGHASH_ALL, &txdata);
+    }
+}
+
+BENCHMARK(HashTransactionCT);
+BENCHMARK(HashTransactionCTPerDigest);
+BENCHMARK(DeserializeTransactionCT);
+BENCHMARK(SignatureHashCT);
+BENCHMARK(SignatureHashCTPrecomputed);
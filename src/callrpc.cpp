@@ -3,6 +3,8 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <boost/foreach.hpp>
+
 using namespace std;
 using namespace boost;
 using namespace boost::asio;
@@ -10,7 +12,8 @@ using namespace json_spirit;
 
 #define _(x) std::string(x) /* Keep the _() around in case gettext or such will be used later to translate non-UI */
 
-Object CallRPC(const string& strMethod, const Array& params, string port)
+/** Post strRequest to the RPC server on port and return the parsed reply */
+static Value PostRPC(const string& strRequest, string port)
 {
     if (mapArgs["-rpcuser"] == "" && mapArgs["-rpcpassword"] == "")
         throw runtime_error(strprintf(
@@ -39,7 +42,6 @@ Object CallRPC(const string& strMethod, const Array& params, string port)
     mapRequestHeaders["Authorization"] = string("Basic ") + strUserPass64;
 
     // Send request
-    string strRequest = JSONRPCRequest(strMethod, params, 1);
     string strPost = HTTPPost(strRequest, mapRequestHeaders);
     stream << strPost << std::flush;
 
@@ -63,32 +65,44 @@ Object CallRPC(const string& strMethod, const Array& params, string port)
     Value valReply;
     if (!read_string(strReply, valReply))
         throw runtime_error("couldn't parse reply from server");
-    const Object& reply = valReply.get_obj();
-    if (reply.empty())
-        throw runtime_error("expected reply to have result, error and id properties");
+    return valReply;
+}
 
-    return reply;
+Object CallRPC(const string& strMethod, const Array& params, string port)
+{
+    Value valReply = PostRPC(JSONRPCRequest(strMethod, params, 1), port);
+    if (valReply.type() != obj_type || valReply.get_obj().empty())
+        throw runtime_error("expected reply to have result, error and id properties");
+    return valReply.get_obj();
 }
 
-bool IsConfirmedBitcoinBlock(const uint256& hash, int nMinConfirmationDepth)
+Array CallRPCBatch(const string& strMethod, const vector<Array>& vParams, string port)
 {
-    try {
-        Array params;
-        params.push_back(hash.GetHex());
-        Object reply = CallRPC("getblock", params, GetArg("-rpcconnectport", "18332"));
-        if (find_value(reply, "error").type() != null_type)
-            return false;
-        Value result = find_value(reply, "result");
-        if (result.type() != obj_type)
-            return false;
-        result = find_value(result.get_obj(), "confirmations");
-        return result.type() == int_type && result.get_int64() >= nMinConfirmationDepth;
-    } catch (CConnectionFailed& e) {
-        LogPrintf("ERROR: Lost connection to alphad RPC, you will want to restart after fixing this!\n");
-        return false;
-    } catch (...) {
-        LogPrintf("ERROR: Failure connecting to alphad RPC, you will want to restart after fixing this!\n");
-        return false;
+    Array vRequest;
+    for (unsigned int i = 0; i < vParams.size(); i++) {
+        Object request;
+        request.push_back(Pair("method", strMethod));
+        request.push_back(Pair("params", vParams[i]));
+        request.push_back(Pair("id", (int)i));
+        vRequest.push_back(request);
     }
-    return true;
+    Value valReply = PostRPC(write_string(Value(vRequest), false) + "\n", port);
+    if (valReply.type() != array_type)
+        throw runtime_error("expected batch reply to be an array");
+
+    // Replies may come back in any order; put them in request order
+    Array vReply(vParams.size());
+    BOOST_FOREACH(const Value& reply, valReply.get_array()) {
+        if (reply.type() != obj_type)
+            throw runtime_error("expected reply to have result, error and id properties");
+        const Value& id = find_value(reply.get_obj(), "id");
+        if (id.type() != int_type || id.get_int64() < 0 || id.get_int64() >= (int64_t)vParams.size())
+            throw runtime_error("unexpected id in batch reply");
+        vReply[id.get_int()] = reply;
+    }
+    BOOST_FOREACH(const Value& reply, vReply)
+        if (reply.type() != obj_type)
+            throw runtime_error("batch reply is missing replies");
+    return vReply;
 }
+
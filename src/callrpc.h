@@ -8,9 +8,9 @@
 
 #include "rpcclient.h"
 #include "rpcprotocol.h"
-#include "uint256.h"
 
 #include <string>
+#include <vector>
 
 //
 // Exception thrown on connection error.  This error is used to determine
@@ -27,6 +27,7 @@ public:
 };
 
 json_spirit::Object CallRPC(const std::string& strMethod, const json_spirit::Array& params, std::string port="");
-bool IsConfirmedBitcoinBlock(const uint256& hash, int nMinConfirmationDepth);
+/** Call strMethod once for every entry of vParams in a single batch request; the replies are returned in the same order */
+json_spirit::Array CallRPCBatch(const std::string& strMethod, const std::vector<json_spirit::Array>& vParams, std::string port="");
 
 #endif // BITCOIN_CALLRPC_H
@@ -5,8 +5,67 @@
 
 #include "chain.h"
 
+#include "hash.h"
+
+#include <set>
+
+#include <boost/thread/mutex.hpp>
+
 using namespace std;
 
+namespace {
+    boost::mutex csInternedChallenges;
+    set<CScript> setInternedChallenges;
+    //! Bytes of the interned challenges themselves
+    uint64_t nInternedBytes = 0;
+    //! Bytes of the challenges of all block index entries, as if each had its own copy
+    uint64_t nIndexedChallengeBytes = 0;
+    uint64_t nIndexedSolutionBytes = 0;
+    uint64_t nIndexedEntries = 0;
+    //! Bytes of the solutions of block index entries still kept in memory
+    int64_t nHeldSolutionBytes = 0;
+}
+
+const CScript* InternChallenge(const CScript& challenge)
+{
+    boost::mutex::scoped_lock lock(csInternedChallenges);
+    pair<set<CScript>::iterator, bool> ret = setInternedChallenges.insert(challenge);
+    if (ret.second)
+        nInternedBytes += challenge.size();
+    return &*ret.first;
+}
+
+void AddBlockIndexMemoryStats(const CProof& proof)
+{
+    boost::mutex::scoped_lock lock(csInternedChallenges);
+    nIndexedChallengeBytes += proof.challenge.size();
+    nIndexedSolutionBytes += proof.solution.size();
+    nIndexedEntries++;
+}
+
+void AddHeldSolutionMemoryStats(int64_t nBytes)
+{
+    boost::mutex::scoped_lock lock(csInternedChallenges);
+    nHeldSolutionBytes += nBytes;
+}
+
+CBlockIndexMemoryStats GetBlockIndexMemoryStats()
+{
+    boost::mutex::scoped_lock lock(csInternedChallenges);
+    CBlockIndexMemoryStats memoryStats;
+    memoryStats.nChallenges = setInternedChallenges.size();
+    memoryStats.nChallengeBytesSaved = nIndexedChallengeBytes > nInternedBytes ? nIndexedChallengeBytes - nInternedBytes : 0;
+    memoryStats.nSolutionBytesSaved = (int64_t)nIndexedSolutionBytes - nHeldSolutionBytes -
+                                      (int64_t)(nIndexedEntries * sizeof(uint256));
+    return memoryStats;
+}
+
+void CBlockIndex::SetProof(const CProof& proof)
+{
+    pchallenge = InternChallenge(proof.challenge);
+    hashSolution = Hash(proof.solution.begin(), proof.solution.end());
+}
+
 /**
  * CChain implementation
  */
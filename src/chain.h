@@ -15,6 +15,35 @@
 
 #include <boost/foreach.hpp>
 
+/**
+ * Return a shared copy of a block challenge script. Nearly every block uses
+ * the same challenge, so block index entries point at a single interned copy
+ * instead of each holding their own. Interned scripts live until shutdown.
+ */
+const CScript* InternChallenge(const CScript& challenge);
+
+/** Memory the block index saves by interning challenges and leaving solutions on disk */
+struct CBlockIndexMemoryStats
+{
+    //! Number of distinct interned challenges
+    uint64_t nChallenges;
+    //! Script bytes not duplicated thanks to interning
+    uint64_t nChallengeBytesSaved;
+    //! Solution script bytes left on disk instead of in memory, less the
+    //! solutions still kept in memory and the hash of its solution each entry
+    //! keeps. Negative if that costs more than it saves.
+    int64_t nSolutionBytesSaved;
+};
+
+CBlockIndexMemoryStats GetBlockIndexMemoryStats();
+/**
+ * Count the proof of an entry added to the block index in the memory stats.
+ * Temporary CBlockIndex objects intern their challenge too, but aren't counted.
+ */
+void AddBlockIndexMemoryStats(const CProof& proof);
+//! Count nBytes more (or, if negative, fewer) of solution script kept in memory for block index entries
+void AddHeldSolutionMemoryStats(int64_t nBytes);
+
 struct CDiskBlockPos
 {
     int nFile;
@@ -85,6 +114,11 @@ enum BlockStatus {
     BLOCK_FAILED_VALID       =   32, //! stage after last reached validness failed
     BLOCK_FAILED_CHILD       =   64, //! descends from failed block
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
+
+    BLOCK_WITNESS_PRUNED     =  128, //! block data in blk*.dat is stored without witness (-prunewitness)
+    BLOCK_HAVE_WITNESS       =  256, //! block data in blk*.dat is stored without witness, which is in wit*.dat
+
+    BLOCK_PROOF_VALID        =  512, //! the signed block proof in this index entry has been verified
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -116,6 +150,9 @@ public:
     //! Byte offset within rev?????.dat where this block's undo data is stored
     unsigned int nUndoPos;
 
+    //! Byte offset within wit?????.dat where this block's witness data is stored
+    unsigned int nWitnessPos;
+
     //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
     uint256 nChainWork;
 
@@ -135,7 +172,11 @@ public:
     int nVersion;
     uint256 hashMerkleRoot;
     unsigned int nTime;
-    CProof proof;
+    //! interned challenge of the block proof (see InternChallenge)
+    const CScript* pchallenge;
+    //! hash of the block proof's solution. The solution itself is only kept
+    //! in the block tree database (see CDiskBlockIndex)
+    uint256 hashSolution;
 
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
@@ -149,6 +190,7 @@ public:
         nFile = 0;
         nDataPos = 0;
         nUndoPos = 0;
+        nWitnessPos = 0;
         nChainWork = 0;
         nTx = 0;
         nChainTx = 0;
@@ -158,7 +200,8 @@ public:
         nVersion       = 0;
         hashMerkleRoot = 0;
         nTime          = 0;
-        proof.SetNull();
+        pchallenge     = NULL;
+        hashSolution   = 0;
     }
 
     CBlockIndex()
@@ -173,7 +216,16 @@ public:
         nVersion       = block.nVersion;
         hashMerkleRoot = block.hashMerkleRoot;
         nTime          = block.nTime;
-        proof          = block.proof;
+        SetProof(block.proof);
+    }
+
+    /** Intern the challenge and remember the solution's hash */
+    void SetProof(const CProof& proof);
+
+    const CScript& GetChallenge() const
+    {
+        static const CScript challengeEmpty;
+        return pchallenge ? *pchallenge : challengeEmpty;
     }
 
     CDiskBlockPos GetBlockPos() const {
@@ -194,6 +246,16 @@ public:
         return ret;
     }
 
+    CDiskBlockPos GetWitnessPos() const {
+        CDiskBlockPos ret;
+        if (nStatus & BLOCK_HAVE_WITNESS) {
+            ret.nFile = nFile;
+            ret.nPos  = nWitnessPos;
+        }
+        return ret;
+    }
+
+    /** The block header, without the proof's solution */
     CBlockHeader GetBlockHeader() const
     {
         CBlockHeader block;
@@ -202,7 +264,7 @@ public:
             block.hashPrevBlock = pprev->GetBlockHash();
         block.hashMerkleRoot = hashMerkleRoot;
         block.nTime          = nTime;
-        block.proof          = proof;
+        block.proof.challenge = GetChallenge();
         return block;
     }
 
@@ -284,13 +346,16 @@ class CDiskBlockIndex : public CBlockIndex
 {
 public:
     uint256 hashPrev;
+    //! the full block proof, which the in-memory index doesn't keep
+    CProof proof;
 
     CDiskBlockIndex() {
         hashPrev = 0;
     }
 
-    explicit CDiskBlockIndex(CBlockIndex* pindex) : CBlockIndex(*pindex) {
+    CDiskBlockIndex(CBlockIndex* pindex, const CScript& solution) : CBlockIndex(*pindex) {
         hashPrev = (pprev ? pprev->GetBlockHash() : 0);
+        proof = CProof(GetChallenge(), solution);
     }
 
     ADD_SERIALIZE_METHODS;
@@ -309,6 +374,8 @@ public:
             READWRITE(VARINT(nDataPos));
         if (nStatus & BLOCK_HAVE_UNDO)
             READWRITE(VARINT(nUndoPos));
+        if (nStatus & BLOCK_HAVE_WITNESS)
+            READWRITE(VARINT(nWitnessPos));
 
         // block header
         READWRITE(this->nVersion);
@@ -151,6 +151,15 @@ public:
 
         convertSeed6(vFixedSeeds, pnSeed6_main, ARRAYLEN(pnSeed6_main));
 
+        //! The parent chain is bitcoin
+        parentChain.hashAnchor = bitcoinGenesisHash;
+        parentChain.nAnchorHeight = 0;
+        parentChain.bnProofOfWorkLimit = ~uint256(0) >> 32;
+        parentChain.nTargetTimespan = 14 * 24 * 60 * 60; // two weeks
+        parentChain.nTargetSpacing = 10 * 60;
+        parentChain.fAllowMinDifficultyBlocks = false;
+        parentChain.fNoRetargeting = false;
+
         fRequireRPCPassword = true;
         fMiningRequiresPeers = true;
         fAllowMinDifficultyBlocks = false;
@@ -206,6 +215,10 @@ public:
 
         convertSeed6(vFixedSeeds, pnSeed6_test, ARRAYLEN(pnSeed6_test));
 
+        //! The parent chain is bitcoin testnet3
+        parentChain.hashAnchor = uint256("0x000000000933ea01ad0ee984209779baaec3ced90fa3f408719526f8d77f4943");
+        parentChain.fAllowMinDifficultyBlocks = true;
+
         fRequireRPCPassword = true;
         fMiningRequiresPeers = true;
         fAllowMinDifficultyBlocks = true;
@@ -262,6 +275,11 @@ public:
         vFixedSeeds.clear(); //! Regtest mode doesn't have any fixed seeds.
         vSeeds.clear();  //! Regtest mode doesn't have any DNS seeds.
 
+        //! The parent chain is bitcoin regtest
+        parentChain.hashAnchor = uint256("0x0f9188f13cb7b2c71f2a335e3a4fc328bf5beb436012afca590b1a11466e2206");
+        parentChain.bnProofOfWorkLimit = ~uint256(0) >> 1;
+        parentChain.fNoRetargeting = true;
+
         fRequireRPCPassword = false;
         fMiningRequiresPeers = false;
         fAllowMinDifficultyBlocks = true;
@@ -21,6 +21,26 @@ struct CDNSSeedData {
     CDNSSeedData(const std::string &strName, const std::string &strHost) : name(strName), host(strHost) {}
 };
 
+/**
+ * Consensus rules of the parent (bitcoin) chain which parent chain headers
+ * are checked against, and the header they are anchored at.
+ */
+struct CParentChainParams {
+    //! Stored parent chain headers descend from this one, which is trusted as is
+    uint256 hashAnchor;
+    //! Height of the anchor; a retarget boundary unless fNoRetargeting
+    int nAnchorHeight;
+    uint256 bnProofOfWorkLimit;
+    int64_t nTargetTimespan;
+    int64_t nTargetSpacing;
+    //! A header more than twice the target spacing after its parent may have the easiest target
+    bool fAllowMinDifficultyBlocks;
+    //! The target never changes
+    bool fNoRetargeting;
+
+    int64_t Interval() const { return nTargetTimespan / nTargetSpacing; }
+};
+
 /**
  * CChainParams defines various tweakable parameters of a given instance of the
  * Bitcoin system. There are three: the main network on which people trade goods
@@ -79,6 +99,8 @@ public:
     const std::vector<CDNSSeedData>& DNSSeeds() const { return vSeeds; }
     const std::vector<unsigned char>& Base58Prefix(Base58Type type) const { return base58Prefixes[type]; }
     const std::vector<CAddress>& FixedSeeds() const { return vFixedSeeds; }
+    /** Rules of the parent chain whose blocks withdraws refer to, anchored at its genesis block */
+    const CParentChainParams& ParentChain() const { return parentChain; }
     virtual const Checkpoints::CCheckpointData& Checkpoints() const = 0;
     /**
      * Creates and returns a CChainParams* of the chosen chain. The caller has to delete the object.
@@ -107,6 +129,7 @@ protected:
     std::string strNetworkID;
     CBlock genesis;
     std::vector<CAddress> vFixedSeeds;
+    CParentChainParams parentChain;
     bool fRequireRPCPassword;
     bool fMiningRequiresPeers;
     bool fAllowMinDifficultyBlocks;
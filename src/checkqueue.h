@@ -6,9 +6,13 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <deque>
+#include <stdint.h>
 #include <vector>
 
+#include <boost/atomic.hpp>
 #include <boost/foreach.hpp>
+#include <boost/scoped_array.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -18,19 +22,38 @@ class CCheckQueueControl;
 
 /** 
  * Queue for verifications that have to be performed.
-  * The verifications are represented by a type T, which must provide an
-  * operator(), returning a bool.
+  * The verifications are represented by heap-allocated objects of type T,
+  * which must provide an operator(), returning a bool. T may be an abstract
+  * base class, so that different kinds of checks can share one queue. The
+  * queue takes ownership of the checks added to it and deletes them once
+  * they have been processed (or skipped, after a failure).
   *
   * One thread (the master) is assumed to push batches of verifications
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Added checks are spread over per-thread slots. Each thread takes work
+  * from its own slot, and steals from the others once that runs dry, so
+  * threads only contend on the shared state when they run out of work.
+  * Adding takes only the locks of the slots it adds to; the shared mutex is
+  * only taken to wake workers that are waiting for work.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    /**
+     * One thread's share of the queue. As the order of booleans doesn't
+     * matter, the owner takes from the back (LIFO) while other threads
+     * steal from the front.
+     */
+    struct Slot {
+        boost::mutex mutex;
+        std::deque<T*> deque;
+    };
+
+    //! Mutex to protect the inner state (but not the slots or the atomics)
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,25 +62,38 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! The slots; the master owns the first one. Threads beyond nSlots share slots.
+    boost::scoped_array<Slot> slots;
+    const unsigned int nSlots;
+
+    //! The number of worker threads (excluding the master) that are running.
+    boost::atomic<unsigned int> nWorkers;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! The number of slots ever handed work. Checks may remain in a slot whose worker exited, so
+    //! stealing covers all of these. Requires mutex.
+    unsigned int nSlotsUsed;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of workers waiting on condWorker, which Add must wake.
+    boost::atomic<unsigned int> nIdle;
 
     //! The temporary evaluation result.
-    bool fAllOk;
+    boost::atomic<bool> fAllOk;
+
+    //! The first check that failed since the last Wait, kept for the master.
+    T* pcheckFailed;
 
     /**
      * Number of verifications that haven't completed yet.
-     * This includes elements that are not anymore in queue, but still in
+     * This includes elements that are not anymore in a slot, but still in
      * worker's own batches.
      */
-    unsigned int nTodo;
+    boost::atomic<unsigned int> nTodo;
+
+    //! Incremented by every Add, so idle workers can tell whether there may be new work.
+    boost::atomic<uint64_t> nGeneration;
+
+    //! The slot the next Add starts distributing at. Only used by the master.
+    unsigned int nNextSlot;
 
     //! Whether we're shutting down.
     bool fQuit;
@@ -65,106 +101,228 @@ private:
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! The number of slots work is spread over: one per thread, up to nSlots.
+    unsigned int ActiveSlots() const
+    {
+        return std::min(nSlots, nWorkers + 1);
+    }
+
+    /**
+     * Move a batch of checks from slot nSlot into vChecks, or steal one from
+     * the other slots below nSteal if it is empty. Returns false if all were
+     * empty.
+     */
+    bool Take(unsigned int nSlot, unsigned int nActive, unsigned int nSteal, std::vector<T*>& vChecks)
+    {
+        {
+            Slot& slot = slots[nSlot];
+            boost::unique_lock<boost::mutex> lock(slot.mutex);
+            if (!slot.deque.empty()) {
+                // Aim for increasingly smaller batches as the slot drains, so
+                // all threads finish approximately simultaneously.
+                unsigned int nNow = std::max(1U, std::min(nBatchSize, (unsigned int)slot.deque.size() / (nActive + 1)));
+                vChecks.assign(slot.deque.end() - nNow, slot.deque.end());
+                slot.deque.erase(slot.deque.end() - nNow, slot.deque.end());
+                return true;
+            }
+        }
+        for (unsigned int i = 1; i < nSteal; i++) {
+            Slot& slot = slots[(nSlot + i) % nSteal];
+            boost::unique_lock<boost::mutex> lock(slot.mutex);
+            if (!slot.deque.empty()) {
+                // Steal half of what is left, so the owner keeps working too
+                unsigned int nNow = std::min(nBatchSize, (unsigned int)(slot.deque.size() + 1) / 2);
+                vChecks.assign(slot.deque.begin(), slot.deque.begin() + nNow);
+                slot.deque.erase(slot.deque.begin(), slot.deque.begin() + nNow);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //! Delete all checks still in the slots, returning how many there were. Requires mutex.
+    unsigned int Drain()
+    {
+        unsigned int nDropped = 0;
+        for (unsigned int i = 0; i < nSlots; i++) {
+            boost::unique_lock<boost::mutex> lock(slots[i].mutex);
+            BOOST_FOREACH (T* check, slots[i].deque)
+                delete check;
+            nDropped += slots[i].deque.size();
+            slots[i].deque.clear();
+        }
+        return nDropped;
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(unsigned int nSlot, bool fMaster = false, T** ppcheckFailed = NULL)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
-        std::vector<T> vChecks;
+        std::vector<T*> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
+        unsigned int nActive, nSteal;
+        uint64_t nSeen;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nActive = ActiveSlots();
+            nSteal = nSlotsUsed;
+            nSeen = nGeneration;
+        }
         do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master he can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
+            // execute work, without touching the shared state
+            unsigned int nDone = 0;
+            bool fOk = true;
+            T* pfailed = NULL;
+            while (fOk && Take(nSlot, nActive, nSteal, vChecks)) {
+                BOOST_FOREACH (T* check, vChecks) {
+                    if (fOk && !(*check)()) {
+                        fOk = false;
+                        pfailed = check;
+                        continue;
                     }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+                    delete check;
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                nDone += vChecks.size();
+                vChecks.clear();
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (!fOk) {
+                // The result is known; nothing still queued needs to run
+                fAllOk = false;
+                if (pcheckFailed == NULL)
+                    pcheckFailed = pfailed;
+                else
+                    delete pfailed;
+                nDone += Drain();
+            }
+            nTodo -= nDone;
+            if (fMaster) {
+                // Everything has been taken; wait for the workers' last batches
+                while (nTodo != 0)
+                    condMaster.wait(lock);
+                bool fRet = fAllOk;
+                if (ppcheckFailed != NULL)
+                    *ppcheckFailed = pcheckFailed;
+                else
+                    delete pcheckFailed;
+                // reset the status for new work later
+                fAllOk = true;
+                pcheckFailed = NULL;
+                return fRet;
+            }
+            if (nTodo == 0)
+                // We processed the last element; inform the master he can exit and return the result
+                condMaster.notify_one();
+            // Add only takes the mutex to wake workers it sees idle. Counting
+            // ourselves idle before checking for new work means that either it
+            // sees us, or we see what it added.
+            nIdle++;
+            try {
+                while (nGeneration == nSeen && !fQuit)
+                    condWorker.wait(lock);
+            } catch (...) {
+                nIdle--;
+                throw;
+            }
+            nIdle--;
+            if (fQuit)
+                return fAllOk;
+            nActive = ActiveSlots();
+            nSteal = nSlotsUsed;
+            nSeen = nGeneration;
         } while (true);
     }
 
+    //! Counts a worker thread as running while it is in scope, even when interrupted
+    class CWorkerGuard
+    {
+    private:
+        CCheckQueue& queue;
+
+    public:
+        unsigned int nSlot;
+
+        CWorkerGuard(CCheckQueue& queueIn) : queue(queueIn)
+        {
+            boost::unique_lock<boost::mutex> lock(queue.mutex);
+            nSlot = ++queue.nWorkers % queue.nSlots;
+            queue.nSlotsUsed = std::max(queue.nSlotsUsed, queue.ActiveSlots());
+        }
+
+        ~CWorkerGuard()
+        {
+            queue.nWorkers--;
+        }
+    };
+
 public:
-    //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    //! Create a new check queue, spreading work over up to nSlotsIn per-thread slots
+    CCheckQueue(unsigned int nBatchSizeIn, unsigned int nSlotsIn = 16) :
+        slots(new Slot[std::max(1U, nSlotsIn)]), nSlots(std::max(1U, nSlotsIn)), nWorkers(0), nSlotsUsed(1), nIdle(0),
+        fAllOk(true), pcheckFailed(NULL), nTodo(0), nGeneration(0), nNextSlot(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        CWorkerGuard guard(*this);
+        Loop(guard.nSlot);
     }
 
-    //! Wait until execution finishes, and return whether all evaluations where successful.
-    bool Wait()
+    /**
+     * Wait until execution finishes, and return whether all evaluations where successful.
+     * If not, and ppcheckFailed is given, it takes ownership of the first check that failed.
+     */
+    bool Wait(T** ppcheckFailed = NULL)
     {
-        return Loop(true);
+        return Loop(0, true, ppcheckFailed);
     }
 
-    //! Add a batch of checks to the queue
-    void Add(std::vector<T>& vChecks)
+    //! Add a batch of checks to the queue, taking ownership of them (vChecks is cleared)
+    void Add(std::vector<T*>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        if (!fAllOk) {
+            // A check already failed, so these don't need to run
+            BOOST_FOREACH (T* check, vChecks)
+                delete check;
+            vChecks.clear();
+            return;
         }
+        // Counted before they can be taken, so nTodo never drops below what
+        // is still in the slots
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+        // Hand out contiguous runs, continuing where the previous Add stopped,
+        // so that a stream of small batches still reaches every thread.
+        // All of these slots are below nSlotsUsed, so they are stolen from
+        // even once their workers have exited.
+        unsigned int nActive = ActiveSlots();
+        size_t nPerSlot = (vChecks.size() + nActive - 1) / nActive;
+        for (size_t nPos = 0; nPos < vChecks.size(); nPos += nPerSlot) {
+            size_t nNow = std::min(nPerSlot, vChecks.size() - nPos);
+            Slot& slot = slots[nNextSlot % nActive];
+            nNextSlot = (nNextSlot + 1) % nActive;
+            boost::unique_lock<boost::mutex> lockSlot(slot.mutex);
+            slot.deque.insert(slot.deque.end(), vChecks.begin() + nPos, vChecks.begin() + nPos + nNow);
+        }
+        nGeneration++;
+        if (nIdle > 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (vChecks.size() == 1)
+                condWorker.notify_one();
+            else if (vChecks.size() > 1)
+                condWorker.notify_all();
+        }
+        vChecks.clear();
     }
 
     ~CCheckQueue()
     {
+        delete pcheckFailed;
     }
 
     bool IsIdle()
     {
         boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return (nTodo == 0 && fAllOk == true);
     }
 
 };
@@ -190,19 +348,24 @@ public:
         }
     }
 
-    bool Wait()
+    bool Wait(T** ppcheckFailed = NULL)
     {
         if (pqueue == NULL)
             return true;
-        bool fRet = pqueue->Wait();
+        bool fRet = pqueue->Wait(ppcheckFailed);
         fDone = true;
         return fRet;
     }
 
-    void Add(std::vector<T>& vChecks)
+    void Add(std::vector<T*>& vChecks)
     {
-        if (pqueue != NULL)
+        if (pqueue != NULL) {
             pqueue->Add(vChecks);
+        } else {
+            BOOST_FOREACH (T* check, vChecks)
+                delete check;
+            vChecks.clear();
+        }
     }
 
     ~CCheckQueueControl()
@@ -4,6 +4,7 @@
 
 #include "coins.h"
 
+#include "hash.h"
 #include "random.h"
 
 #include <assert.h>
@@ -40,7 +41,7 @@ bool CCoins::Spend(const COutPoint &out, CTxInUndo &undo) {
     if (vout[out.n].IsNull())
         return false;
     undo = CTxInUndo(vout[out.n]);
-    vout[out.n].SetNull();
+    SetOutputNull(vout[out.n]);
     Cleanup();
     if (vout.size() == 0) {
         undo.nHeight = nHeight + 1;
@@ -56,12 +57,60 @@ bool CCoins::Spend(int nPos) {
     return Spend(out, undo);
 }
 
+/** The element an unspent output contributes to the commitment hash */
+static uint256 GetCommitmentElement(const COutPoint &outpoint, const CCoins &coins, const CTxOut &out)
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << outpoint;
+    ss << VARINT(coins.nVersion);
+    ss << VARINT((unsigned int)coins.nHeight * 2 + (coins.fCoinBase ? 1 : 0));
+    ss << out;
+    return ss.GetHash();
+}
+
+void CCoinsCommitment::AddOutput(const COutPoint &outpoint, const CCoins &coins, const CTxOut &out)
+{
+    nTransactionOutputs++;
+    if (out.nValue.IsAmount())
+        nTotalAmount += out.nValue.GetAmount();
+    else
+        nBlindedOutputs++;
+    muhash.Insert(GetCommitmentElement(outpoint, coins, out));
+}
+
+void CCoinsCommitment::RemoveOutput(const COutPoint &outpoint, const CCoins &coins, const CTxOut &out)
+{
+    nTransactionOutputs--;
+    if (out.nValue.IsAmount())
+        nTotalAmount -= out.nValue.GetAmount();
+    else
+        nBlindedOutputs--;
+    muhash.Remove(GetCommitmentElement(outpoint, coins, out));
+}
+
+void CCoinsCommitment::AddCoins(const uint256 &txid, const CCoins &coins)
+{
+    nTransactions++;
+    for (unsigned int i = 0; i < coins.vout.size(); i++)
+        if (!coins.vout[i].IsNull())
+            AddOutput(COutPoint(txid, i), coins, coins.vout[i]);
+}
+
+void CCoinsCommitment::RemoveCoins(const uint256 &txid, const CCoins &coins)
+{
+    nTransactions--;
+    for (unsigned int i = 0; i < coins.vout.size(); i++)
+        if (!coins.vout[i].IsNull())
+            RemoveOutput(COutPoint(txid, i), coins, coins.vout[i]);
+}
+
 
 bool CCoinsView::GetCoins(const uint256 &txid, CCoins &coins) const { return false; }
 bool CCoinsView::HaveCoins(const uint256 &txid) const { return false; }
 COutPoint CCoinsView::GetWithdrawSpent(const std::pair<uint256, COutPoint> &outpoint) const { return COutPoint(); }
 uint256 CCoinsView::GetBestBlock() const { return uint256(0); }
-bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+bool CCoinsView::GetCommitment(CCoinsCommitment &commitment) const { return false; }
+bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsCommitment *pcommitment) { return false; }
 bool CCoinsView::GetStats(CCoinsStats &stats) const { return false; }
 
 
@@ -71,12 +120,13 @@ bool CCoinsViewBacked::HaveCoins(const uint256 &txid) const { return base->HaveC
 COutPoint CCoinsViewBacked::GetWithdrawSpent(const std::pair<uint256, COutPoint> &outpoint) const { return base->GetWithdrawSpent(outpoint); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
-bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+bool CCoinsViewBacked::GetCommitment(CCoinsCommitment &commitment) const { return base->GetCommitment(commitment); }
+bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsCommitment *pcommitment) { return base->BatchWrite(mapCoins, hashBlock, pcommitment); }
 bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStats(stats); }
 
 CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), hashBlock(0) { }
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), hashBlock(0), fCommitmentFetched(false), fHaveCommitment(false), cachedCoinsUsage(0) { }
 
 CCoinsViewCache::~CCoinsViewCache()
 {
@@ -96,6 +146,8 @@ CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const
         return cacheCoins.end();
     CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(make_txentry(txid), CCoinsCacheEntry())).first;
     tmp.swap(ret->second.coins);
+    ret->second.SetUnspentInBase();
+    cachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
     if (ret->second.coins.IsPruned()) {
         // The parent only has an empty entry for this txid; we can consider our
         // version as fresh.
@@ -116,6 +168,7 @@ bool CCoinsViewCache::GetCoins(const uint256 &txid, CCoins &coins) const {
 CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
     assert(!hasModifier);
     std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(make_txentry(txid), CCoinsCacheEntry()));
+    size_t cachedCoinUsage = 0;
     if (ret.second) {
         if (!base->GetCoins(txid, ret.first->second.coins)) {
             // The parent view does not have this entry; mark it as fresh.
@@ -124,11 +177,15 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
         } else if (ret.first->second.coins.IsPruned()) {
             // The parent view only has a pruned entry for this; mark it as fresh.
             ret.first->second.flags = CCoinsCacheEntry::FRESH;
+        } else {
+            ret.first->second.SetUnspentInBase();
         }
+    } else {
+        cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
     }
     // Assume that whenever ModifyCoins is called, the entry will be modified.
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first);
+    return CCoinsModifier(*this, ret.first, cachedCoinUsage);
 }
 
 const CCoins* CCoinsViewCache::AccessCoins(const uint256 &txid) const {
@@ -190,42 +247,71 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
-bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
+CCoinsCommitment* CCoinsViewCache::FetchCommitment() const {
+    if (!fCommitmentFetched) {
+        fHaveCommitment = base->GetCommitment(commitment);
+        fCommitmentFetched = true;
+    }
+    return fHaveCommitment ? &commitment : NULL;
+}
+
+bool CCoinsViewCache::GetCommitment(CCoinsCommitment &commitmentOut) const {
+    const CCoinsCommitment *pcommitment = FetchCommitment();
+    if (pcommitment == NULL)
+        return false;
+    commitmentOut = *pcommitment;
+    return true;
+}
+
+CCoinsCommitment* CCoinsViewCache::ModifyCommitment() {
+    return FetchCommitment();
+}
+
+bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn, const CCoinsCommitment *pcommitment) {
     assert(!hasModifier);
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
             bool fIsWithdraw = it->second.flags & CCoinsCacheEntry::WITHDRAW;
+            bool fEmpty = fIsWithdraw ? it->second.withdrawSpent.IsNull() : it->second.coins.IsPruned();
             CCoinsMap::iterator itUs = cacheCoins.find(it->first);
             if (itUs == cacheCoins.end()) {
-                if ((fIsWithdraw && !it->second.withdrawSpent.IsNull()) ||
-                        (!fIsWithdraw && !it->second.coins.IsPruned())) {
+                if (!fEmpty || !(it->second.flags & CCoinsCacheEntry::FRESH)) {
                     // The parent cache does not have an entry, while the child
-                    // cache does have (a non-pruned) one. Move the data up, and
-                    // mark it as fresh (if the grandparent did have it, we
-                    // would have pulled it in at first GetCoins).
-                    assert(it->second.flags & CCoinsCacheEntry::FRESH);
+                    // cache does have one. Move the data up, and mark it as
+                    // fresh if it is in the child (if the grandparent did have
+                    // it, we would have pulled it in at first GetCoins).
+                    // An entry the child kept after a Sync may have been dropped
+                    // here since, while the grandparent still has it. Such an
+                    // entry isn't fresh, and is moved up even when pruned, so
+                    // that the grandparent's copy gets deleted.
                     CCoinsCacheEntry& entry = cacheCoins[it->first];
-                    entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+                    entry.flags = CCoinsCacheEntry::DIRTY | (it->second.flags & (CCoinsCacheEntry::FRESH | CCoinsCacheEntry::REPLACED));
+                    entry.vUnspentInBase.swap(it->second.vUnspentInBase);
                     if (fIsWithdraw) {
                         entry.withdrawSpent = it->second.withdrawSpent;
                         entry.flags |= CCoinsCacheEntry::WITHDRAW;
-                    } else
+                    } else {
                         entry.coins.swap(it->second.coins);
+                        cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
+                    }
                 }
             } else {
-                if ((itUs->second.flags & CCoinsCacheEntry::FRESH) &&
-                        ((fIsWithdraw && it->second.withdrawSpent.IsNull()) || (!fIsWithdraw && it->second.coins.IsPruned()))) {
+                if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && fEmpty) {
                     // The grandparent does not have an entry, and the child is
                     // modified and being pruned. This means we can just delete
                     // it from the parent.
+                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
                     if (fIsWithdraw)
                         itUs->second.withdrawSpent = it->second.withdrawSpent;
-                    else
+                    else {
+                        cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                         itUs->second.coins.swap(it->second.coins);
-                    itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                        cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
+                    }
+                    itUs->second.flags |= CCoinsCacheEntry::DIRTY | (it->second.flags & CCoinsCacheEntry::REPLACED);
                 }
             }
         }
@@ -233,19 +319,73 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
         mapCoins.erase(itOld);
     }
     hashBlock = hashBlockIn;
+    if (pcommitment != NULL) {
+        commitment = *pcommitment;
+        fCommitmentFetched = fHaveCommitment = true;
+    }
     return true;
 }
 
 bool CCoinsViewCache::Flush() {
-    bool fOk = base->BatchWrite(cacheCoins, hashBlock);
+    bool fOk = base->BatchWrite(cacheCoins, hashBlock, fHaveCommitment ? &commitment : NULL);
     cacheCoins.clear();
+    cachedCoinsUsage = 0;
     return fOk;
 }
 
+bool CCoinsViewCache::Sync() {
+    CCoinsMap mapModified;
+    TakeModified(mapModified);
+    return base->BatchWrite(mapModified, hashBlock, fHaveCommitment ? &commitment : NULL);
+}
+
+void CCoinsViewCache::TakeModified(CCoinsMap &mapModified) {
+    assert(!hasModifier);
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
+            it++;
+            continue;
+        }
+        bool fIsWithdraw = it->second.flags & CCoinsCacheEntry::WITHDRAW;
+        bool fEmpty = fIsWithdraw ? it->second.withdrawSpent.IsNull() : it->second.coins.IsPruned();
+        if (fEmpty && (it->second.flags & CCoinsCacheEntry::FRESH)) {
+            // Neither we nor the parent have it; there is nothing to write or keep.
+            cachedCoinsUsage -= it->second.coins.DynamicMemoryUsage();
+            CCoinsMap::iterator itOld = it++;
+            cacheCoins.erase(itOld);
+            continue;
+        }
+        mapModified.insert(*it);
+        // Not fresh anymore: the parent may still have the entry until mapModified is written.
+        it->second.SetUnspentInBase();
+        it->second.flags &= CCoinsCacheEntry::WITHDRAW;
+        it++;
+    }
+}
+
+void CCoinsViewCache::Trim(size_t nMaxUsage) {
+    assert(!hasModifier);
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end() && DynamicMemoryUsage() > nMaxUsage;) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            it++;
+            continue;
+        }
+        cachedCoinsUsage -= it->second.coins.DynamicMemoryUsage();
+        CCoinsMap::iterator itOld = it++;
+        cacheCoins.erase(itOld);
+    }
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
 
+size_t CCoinsViewCache::DynamicMemoryUsage() const {
+    // Each map node holds an entry plus a couple of pointers, and each bucket one pointer.
+    return cacheCoins.size() * (sizeof(CCoinsMap::value_type) + 2 * sizeof(void*)) +
+           cacheCoins.bucket_count() * sizeof(void*) + cachedCoinsUsage;
+}
+
 const CTxOut &CCoinsViewCache::GetOutputFor(const CTxIn& input) const
 {
     const CCoins* coins = AccessCoins(input.prevout.hash);
@@ -255,7 +395,13 @@ const CTxOut &CCoinsViewCache::GetOutputFor(const CTxIn& input) const
 
 extern secp256k1_context* secp256k1_bitcoin_verify_context;
 
-bool CCoinsViewCache::VerifyAmounts(const CTransaction& tx, const CAmount& excess) const
+bool VerifyRangeproof(const CTxOutValue& val)
+{
+    uint64_t min_value, max_value;
+    return secp256k1_rangeproof_verify(secp256k1_bitcoin_verify_context, &min_value, &max_value, &val.vchCommitment[0], val.vchRangeproof.data(), val.vchRangeproof.size());
+}
+
+bool CCoinsViewCache::VerifyAmounts(const CTransaction& tx, const CAmount& excess, std::vector<const CTxOutValue*> *pvRangeproofs) const
 {
     CAmount nPlainAmount = excess;
     std::vector<unsigned char> vchData;
@@ -309,13 +455,14 @@ bool CCoinsViewCache::VerifyAmounts(const CTransaction& tx, const CAmount& exces
     if ((!vpchCommitsIn.empty()) && vpchCommitsOut.size() == 1 && nPlainAmount <= 0 && fNullRangeproof)
         return true;
 
-    uint64_t min_value, max_value;
     for (size_t i = 0; i < tx.vout.size(); ++i)
     {
         const CTxOutValue& val = tx.vout[i].nValue;
         if (val.IsAmount())
             continue;
-        if (!secp256k1_rangeproof_verify(secp256k1_bitcoin_verify_context, &min_value, &max_value, &val.vchCommitment[0], val.vchRangeproof.data(), val.vchRangeproof.size()))
+        if (pvRangeproofs)
+            pvRangeproofs->push_back(&val);
+        else if (!VerifyRangeproof(val))
             return false;
     }
 
@@ -372,7 +519,7 @@ double CCoinsViewCache::GetPriority(const CTransaction &tx, int nHeight) const
     return tx.ComputePriority(dResult);
 }
 
-CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_) : cache(cache_), it(it_) {
+CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage) : cache(cache_), it(it_), cachedCoinUsage(usage) {
     assert(!cache.hasModifier);
     cache.hasModifier = true;
 }
@@ -382,7 +529,14 @@ CCoinsModifier::~CCoinsModifier()
     assert(cache.hasModifier);
     cache.hasModifier = false;
     it->second.coins.Cleanup();
+    cache.cachedCoinsUsage -= cachedCoinUsage; // Subtract the old usage
     if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
         cache.cacheCoins.erase(it);
+    } else {
+        // Outputs added after it was pruned belong to a new transaction with the same txid
+        if (it->second.coins.IsPruned())
+            it->second.flags |= CCoinsCacheEntry::REPLACED;
+        // If the coin still exists after the modification, add the new usage
+        cache.cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
     }
 }
@@ -6,7 +6,9 @@
 #ifndef BITCOIN_COINS_H
 #define BITCOIN_COINS_H
 
+#include "amount.h"
 #include "compressor.h"
+#include "muhash.h"
 #include "serialize.h"
 #include "uint256.h"
 #include "undo.h"
@@ -24,7 +26,8 @@
  * - VARINT(nVersion)
  * - VARINT(nCode)
  * - unspentness bitvector, for vout[2] and further; least significant byte first
- * - the non-spent CTxOuts (via CTxOutCompressor)
+ * - the non-spent CTxOuts (via CTxOutCompressor; explicit amounts are prefixed
+ *   with a 0x01 byte, which the examples below, taken from Bitcoin, omit)
  * - VARINT(nHeight)
  *
  * The nCode value consists of:
@@ -108,6 +111,15 @@ public:
     //! empty constructor
     CCoins() : fCoinBase(false), vout(0), nHeight(0), nVersion(0) { }
 
+    //! mark an output spent, releasing the memory of its script, commitment and rangeproof
+    static void SetOutputNull(CTxOut &out) {
+        CTxOut empty;
+        out.nValue.vchCommitment.swap(empty.nValue.vchCommitment);
+        out.nValue.vchRangeproof.swap(empty.nValue.vchRangeproof);
+        out.nValue.vchNonceCommitment.swap(empty.nValue.vchNonceCommitment);
+        out.scriptPubKey.swap(empty.scriptPubKey);
+    }
+
     //!remove spent outputs at the end of vout
     void Cleanup() {
         while (vout.size() > 0 && vout.back().IsNull())
@@ -116,10 +128,20 @@ public:
             std::vector<CTxOut>().swap(vout);
     }
 
+    //! Approximate heap memory used by the outputs, including their CT commitments and rangeproofs
+    size_t DynamicMemoryUsage() const {
+        size_t ret = vout.capacity() * sizeof(CTxOut);
+        BOOST_FOREACH(const CTxOut &out, vout) {
+            ret += out.scriptPubKey.capacity();
+            ret += out.nValue.vchCommitment.capacity() + out.nValue.vchRangeproof.capacity() + out.nValue.vchNonceCommitment.capacity();
+        }
+        return ret;
+    }
+
     void ClearUnspendable() {
         BOOST_FOREACH(CTxOut &txout, vout) {
             if (txout.scriptPubKey.IsUnspendable())
-                txout.SetNull();
+                SetOutputNull(txout);
         }
         Cleanup();
     }
@@ -283,15 +305,26 @@ struct CCoinsCacheEntry
 {
     CCoins coins; // The actual cached data.
     COutPoint withdrawSpent;
+    //! Which outputs the parent view has unspent, so that writing only needs to touch the changed ones.
+    std::vector<bool> vUnspentInBase;
     unsigned char flags;
 
     enum Flags {
         DIRTY    = (1 << 0), // This cache entry is potentially different from the version in the parent view.
         FRESH    = (1 << 1), // The parent view does not have this entry (or it is pruned).
         WITHDRAW = (1 << 2), // represents a withdraw (coins is actually empty/useless, look at withdrawSpent instead)
+        REPLACED = (1 << 3), // The entry was pruned since vUnspentInBase was set, so its outputs may be new ones.
     };
 
     CCoinsCacheEntry() : coins(), withdrawSpent(), flags(0) {}
+
+    //! Record that the parent view now has exactly the outputs of coins unspent
+    void SetUnspentInBase() {
+        vUnspentInBase.resize(coins.vout.size());
+        for (unsigned int i = 0; i < coins.vout.size(); i++)
+            vUnspentInBase[i] = !coins.vout[i].IsNull();
+        flags &= ~REPLACED;
+    }
 };
 
 typedef boost::unordered_map<CCoinsMapKey, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
@@ -308,6 +341,46 @@ struct CCoinsStats
     CCoinsStats() : nHeight(0), hashBlock(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), hashSerialized(0) {}
 };
 
+/**
+ * Totals and a rolling hash of an unspent output set (withdraw records aside),
+ * updated along with every change to the set, so that they are available
+ * without walking it.
+ */
+class CCoinsCommitment
+{
+public:
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    //! Outputs whose amount is blinded, and so isn't part of nTotalAmount
+    uint64_t nBlindedOutputs;
+    CAmount nTotalAmount;
+    //! Hash of the set of (outpoint, transaction metadata, output) of all unspent outputs
+    CMuHash3072 muhash;
+
+    CCoinsCommitment() : nTransactions(0), nTransactionOutputs(0), nBlindedOutputs(0), nTotalAmount(0) {}
+
+    //! Account for one output of coins becoming unspent or spent
+    void AddOutput(const COutPoint &outpoint, const CCoins &coins, const CTxOut &out);
+    void RemoveOutput(const COutPoint &outpoint, const CCoins &coins, const CTxOut &out);
+
+    //! Account for a transaction with all the unspent outputs of coins entering or leaving the set
+    void AddCoins(const uint256 &txid, const CCoins &coins);
+    void RemoveCoins(const uint256 &txid, const CCoins &coins);
+
+    uint256 GetHash() const { return muhash.GetHash(); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nTransactions);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nBlindedOutputs);
+        READWRITE(nTotalAmount);
+        READWRITE(muhash);
+    }
+};
+
 
 /** Abstract view on the open txout dataset. */
 class CCoinsView
@@ -327,9 +400,13 @@ public:
     //! Retrieve the block hash whose state this CCoinsView currently represents
     virtual uint256 GetBestBlock() const;
 
-    //! Do a bulk modification (multiple CCoins changes + BestBlock change).
+    //! Retrieve the commitment to the set, if this view keeps one
+    virtual bool GetCommitment(CCoinsCommitment &commitment) const;
+
+    //! Do a bulk modification (multiple CCoins changes + BestBlock change,
+    //! and commitment change unless pcommitment is NULL).
     //! The passed mapCoins can be modified.
-    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsCommitment *pcommitment);
 
     //! Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats &stats) const;
@@ -351,8 +428,10 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     COutPoint GetWithdrawSpent(const std::pair<uint256, COutPoint> &outpoint) const;
     uint256 GetBestBlock() const;
+    CCoinsView *GetBackend() const { return base; }
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool GetCommitment(CCoinsCommitment &commitment) const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsCommitment *pcommitment);
     bool GetStats(CCoinsStats &stats) const;
 };
 
@@ -369,7 +448,8 @@ class CCoinsModifier
 private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
+    size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
     CCoins* operator->() { return &it->second.coins; }
@@ -378,7 +458,14 @@ public:
     friend class CCoinsViewCache;
 };
 
-/** CCoinsView that adds a memory cache for transactions to another CCoinsView */
+/**
+ * CCoinsView that adds a memory cache for transactions to another CCoinsView.
+ *
+ * Entries hold the unspent outputs of a whole transaction, even where the
+ * base view stores one entry per output (see CCoinsViewDB). Spent outputs
+ * keep only an empty slot, and vUnspentInBase limits writes to the base to
+ * the outputs that changed.
+ */
 class CCoinsViewCache : public CCoinsViewBacked
 {
 protected:
@@ -392,6 +479,18 @@ protected:
     mutable uint256 hashBlock;
     mutable CCoinsMap cacheCoins;
 
+    /**
+     * The commitment to the set as seen through this cache, fetched from the
+     * base view when first needed. fHaveCommitment is false if the base view
+     * doesn't keep one.
+     */
+    mutable CCoinsCommitment commitment;
+    mutable bool fCommitmentFetched;
+    mutable bool fHaveCommitment;
+
+    /* Cached dynamic memory usage for the inner CCoins objects. */
+    mutable size_t cachedCoinsUsage;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
     ~CCoinsViewCache();
@@ -403,7 +502,14 @@ public:
     void MaybeSetWithdrawSpent(const std::pair<uint256, COutPoint> &outpoint, COutPoint spender);
     uint256 GetBestBlock() const;
     void SetBestBlock(const uint256 &hashBlock);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool GetCommitment(CCoinsCommitment &commitment) const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsCommitment *pcommitment);
+
+    /**
+     * Return the commitment to the set, to be updated along with changes to
+     * coins, or NULL if the base view doesn't keep one.
+     */
+    CCoinsCommitment* ModifyCommitment();
 
     /**
      * Return a pointer to CCoins in the cache, or NULL if not found. This is
@@ -426,17 +532,41 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base, but keep all
+     * entries cached (unmodified from now on).
+     * If false is returned, the state of this cache (and its backing view) will be undefined.
+     */
+    bool Sync();
+
+    /**
+     * Move copies of the modified entries into mapModified, for writing them
+     * to the base view with BatchWrite later, and mark them unmodified. Entries
+     * emptied since the last write stay cached until the next Trim or Flush,
+     * so that until mapModified has been written, no lookup reaches an entry
+     * of the base view which is about to change.
+     */
+    void TakeModified(CCoinsMap &mapModified);
+
+    //! Drop unmodified entries until the cache uses at most nMaxUsage bytes (or none are left)
+    void Trim(size_t nMaxUsage);
+
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
+    //! Calculate the size of the cache (in bytes)
+    size_t DynamicMemoryUsage() const;
+
     /**
      * Verify the transaction's outputs spend exactly what its inputs provide, plus some excess amount.
      *
      * @param[in] tx    transaction for which we are checking totals
      * @param[in] excess additional amount to consider (eg, fees)
+     * @param[out] pvRangeproofs if not NULL, the blinded output values whose rangeproofs still
+     *                           need checking are appended here instead of being verified inline
      * @return  True if totals are identical
      */
-    bool VerifyAmounts(const CTransaction& tx, const CAmount& excess) const;
+    bool VerifyAmounts(const CTransaction& tx, const CAmount& excess, std::vector<const CTxOutValue*> *pvRangeproofs = NULL) const;
     bool VerifyAmounts(const CTransaction& tx) const;
 
     //! Check whether all prevouts of the transaction are present in the UTXO set represented by this view
@@ -452,6 +582,10 @@ public:
 private:
     CCoinsMap::iterator FetchCoins(const uint256 &txid);
     CCoinsMap::const_iterator FetchCoins(const uint256 &txid) const;
+    CCoinsCommitment* FetchCommitment() const;
 };
 
+/** Verify the rangeproof of a blinded output value against its commitment */
+bool VerifyRangeproof(const CTxOutValue& val);
+
 #endif // BITCOIN_COINS_H
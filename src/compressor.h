@@ -6,6 +6,7 @@
 #ifndef BITCOIN_COMPRESSOR_H
 #define BITCOIN_COMPRESSOR_H
 
+#include "amount.h"
 #include "primitives/transaction.h"
 #include "script/script.h"
 #include "serialize.h"
@@ -91,10 +92,21 @@ public:
     }
 };
 
-/** wrapper for CTxOut that provides a more compact serialization */
+/** wrapper for CTxOut that provides a more compact serialization
+ *
+ *  Explicit amounts without a rangeproof or nonce commitment are written as
+ *  the byte COMPRESSED_AMOUNT followed by VARINT(CompressAmount(amount)).
+ *  Other values, blinded or not, are written in full: the rangeproof and
+ *  nonce commitment of an output are part of the signature hash of any
+ *  input spending it, so they cannot be dropped. A serialized
+ *  value commitment never starts with COMPRESSED_AMOUNT, so entries written
+ *  in full by older versions (explicit amounts included) still read back.
+ */
 class CTxOutCompressor
 {
 private:
+    static const unsigned char COMPRESSED_AMOUNT = 0x01;
+
     CTxOut &txout;
 
 public:
@@ -107,19 +119,35 @@ public:
 
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
-#if 0  // TODO: Actually compress numeric values at least
+        CTxOutValue& value = txout.nValue;
         if (!ser_action.ForRead()) {
-            assert(txout.nValue.IsAmount());  // FIXME
-            uint64_t nVal = CompressAmount(txout.nValue.GetAmount());
-            READWRITE(VARINT(nVal));
+            if (value.IsAmount() && MoneyRange(value.GetAmount()) &&
+                value.vchRangeproof.empty() && value.vchNonceCommitment.empty()) {
+                unsigned char chType = COMPRESSED_AMOUNT;
+                uint64_t nVal = CompressAmount(value.GetAmount());
+                READWRITE(chType);
+                READWRITE(VARINT(nVal));
+            } else {
+                READWRITE(value);
+            }
         } else {
-            uint64_t nVal = 0;
-            READWRITE(VARINT(nVal));
-            txout.nValue = DecompressAmount(nVal);
+            unsigned char chType = 0;
+            READWRITE(chType);
+            if (chType == COMPRESSED_AMOUNT) {
+                uint64_t nVal = 0;
+                READWRITE(VARINT(nVal));
+                value.SetToAmount(DecompressAmount(nVal));
+                value.vchRangeproof.clear();
+                value.vchNonceCommitment.clear();
+            } else {
+                // Full CTxOutValue, of which we already consumed the first byte.
+                value.vchCommitment.resize(CTxOutValue::nCommitmentSize);
+                value.vchCommitment[0] = chType;
+                READWRITE(REF(CFlatData(&value.vchCommitment[1], &value.vchCommitment[CTxOutValue::nCommitmentSize])));
+                READWRITE(value.vchRangeproof);
+                READWRITE(value.vchNonceCommitment);
+            }
         }
-#else
-        READWRITE(txout.nValue);
-#endif
         CScriptCompressor cscript(REF(txout.scriptPubKey));
         READWRITE(cscript);
     }
@@ -8,6 +8,31 @@
 
 #include <string.h>
 
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#if defined(ENABLE_SHANI)
+namespace sha256_shani
+{
+void Transform(uint32_t* s, const unsigned char* chunk);
+}
+#endif
+
+#if defined(ENABLE_SSE41)
+namespace sha256d64_sse41
+{
+void Transform_4way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
+#if defined(ENABLE_AVX2)
+namespace sha256d64_avx2
+{
+void Transform_8way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
 // Internal implementation code.
 namespace
 {
@@ -128,6 +153,51 @@ void Transform(uint32_t* s, const unsigned char* chunk)
 }
 
 } // namespace sha256
+
+typedef void (*TransformType)(uint32_t*, const unsigned char*);
+typedef void (*TransformD64Type)(unsigned char*, const unsigned char*);
+
+/** The block transform, and the multi-way double hashes of 64-byte inputs (NULL if unavailable). */
+TransformType Transform = sha256::Transform;
+TransformD64Type TransformD64_4way = NULL;
+TransformD64Type TransformD64_8way = NULL;
+
+/** Double SHA-256 of a single 64-byte input, using the selected block transform. */
+void TransformD64(unsigned char* out, const unsigned char* in)
+{
+    static const unsigned char padding1[64] = {0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0};
+    unsigned char buf[64] = {0};
+    uint32_t s[8];
+
+    // The 64-byte input, then a block of padding.
+    sha256::Initialize(s);
+    Transform(s, in);
+    Transform(s, padding1);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(buf + 4 * i, s[i]);
+
+    // The 32-byte digest, padded, in a single block.
+    buf[32] = 0x80;
+    buf[62] = 0x01;
+    sha256::Initialize(s);
+    Transform(s, buf);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(out + 4 * i, s[i]);
+}
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+/** Whether the OS saves the AVX registers on context switches. */
+bool AVXEnabled()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+#endif
+
 } // namespace
 
 
@@ -147,12 +217,12 @@ CSHA256& CSHA256::Write(const unsigned char* data, size_t len)
         memcpy(buf + bufsize, data, 64 - bufsize);
         bytes += 64 - bufsize;
         data += 64 - bufsize;
-        sha256::Transform(s, buf);
+        Transform(s, buf);
         bufsize = 0;
     }
     while (end >= data + 64) {
         // Process full chunks directly from the source.
-        sha256::Transform(s, data);
+        Transform(s, data);
         bytes += 64;
         data += 64;
     }
@@ -187,3 +257,75 @@ CSHA256& CSHA256::Reset()
     sha256::Initialize(s);
     return *this;
 }
+
+std::string SHA256AutoDetect(int nAllowed)
+{
+    std::string ret = "standard";
+    Transform = sha256::Transform;
+    TransformD64_4way = NULL;
+    TransformD64_8way = NULL;
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+    uint32_t eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return ret;
+    bool fSSE41 = (ecx >> 19) & 1;
+    bool fAVX = ((ecx >> 27) & 1) && ((ecx >> 28) & 1) && AVXEnabled(); // OSXSAVE and AVX
+    bool fAVX2 = false, fSHANI = false;
+    if (__get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        fAVX2 = fAVX && ((ebx >> 5) & 1);
+        fSHANI = (ebx >> 29) & 1;
+    }
+    (void)fSSE41;
+    (void)fAVX2;
+    (void)fSHANI;
+
+#if defined(ENABLE_SHANI)
+    // The SHA extensions are faster on a single stream than the multi-way code is on many.
+    if (fSHANI && fSSE41 && (nAllowed & SHA256_USE_SHANI)) {
+        Transform = sha256_shani::Transform;
+        return "shani(1way)";
+    }
+#endif
+#if defined(ENABLE_SSE41)
+    if (fSSE41 && (nAllowed & SHA256_USE_SSE41)) {
+        TransformD64_4way = sha256d64_sse41::Transform_4way;
+        ret += ",sse41(4way)";
+    }
+#endif
+#if defined(ENABLE_AVX2)
+    if (fAVX2 && (nAllowed & SHA256_USE_AVX2)) {
+        TransformD64_8way = sha256d64_avx2::Transform_8way;
+        ret += ",avx2(8way)";
+    }
+#endif
+#endif
+    return ret;
+}
+
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks)
+{
+    if (TransformD64_8way) {
+        while (blocks >= 8) {
+            TransformD64_8way(out, in);
+            out += 256;
+            in += 512;
+            blocks -= 8;
+        }
+    }
+    if (TransformD64_4way) {
+        while (blocks >= 4) {
+            TransformD64_4way(out, in);
+            out += 128;
+            in += 256;
+            blocks -= 4;
+        }
+    }
+    while (blocks) {
+        TransformD64(out, in);
+        out += 32;
+        in += 64;
+        --blocks;
+    }
+}
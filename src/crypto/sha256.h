@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -25,4 +26,24 @@ public:
     CSHA256& Reset();
 };
 
+/** Hardware SHA-256 implementations which SHA256AutoDetect may pick from. */
+enum
+{
+    SHA256_USE_SSE41 = (1 << 0),
+    SHA256_USE_AVX2 = (1 << 1),
+    SHA256_USE_SHANI = (1 << 2),
+    SHA256_USE_ALL = SHA256_USE_SSE41 | SHA256_USE_AVX2 | SHA256_USE_SHANI,
+};
+
+/** Select the fastest SHA-256 implementation the CPU supports, among the allowed ones.
+ *  Not thread safe; call it once at startup before hashing anything.
+ *  Returns a description of the selected implementation.
+ */
+std::string SHA256AutoDetect(int nAllowed = SHA256_USE_ALL);
+
+/** Compute the double SHA-256 of each of a number of 64-byte blocks.
+ *  in holds blocks * 64 bytes, out receives blocks * 32 bytes.
+ */
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
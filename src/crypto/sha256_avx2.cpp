@@ -0,0 +1,59 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// 8-way double SHA-256 of 64-byte inputs using AVX2. Only called if the CPU supports it.
+
+#ifdef ENABLE_AVX2
+
+#include "crypto/common.h"
+
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace {
+
+struct Vec8
+{
+    typedef __m256i T;
+    static const int LANES = 8;
+
+    static inline T K(uint32_t x) { return _mm256_set1_epi32(x); }
+    static inline T Add(T x, T y) { return _mm256_add_epi32(x, y); }
+    static inline T Xor(T x, T y) { return _mm256_xor_si256(x, y); }
+    static inline T And(T x, T y) { return _mm256_and_si256(x, y); }
+    static inline T Or(T x, T y) { return _mm256_or_si256(x, y); }
+    static inline T ShR(T x, int n) { return _mm256_srli_epi32(x, n); }
+    static inline T ShL(T x, int n) { return _mm256_slli_epi32(x, n); }
+
+    static inline T Read(const unsigned char* in)
+    {
+        return _mm256_set_epi32(ReadBE32(in + 448), ReadBE32(in + 384), ReadBE32(in + 320), ReadBE32(in + 256),
+                                ReadBE32(in + 192), ReadBE32(in + 128), ReadBE32(in + 64), ReadBE32(in));
+    }
+
+    static inline void Write(unsigned char* out, T v)
+    {
+        WriteBE32(out, _mm256_extract_epi32(v, 0));
+        WriteBE32(out + 32, _mm256_extract_epi32(v, 1));
+        WriteBE32(out + 64, _mm256_extract_epi32(v, 2));
+        WriteBE32(out + 96, _mm256_extract_epi32(v, 3));
+        WriteBE32(out + 128, _mm256_extract_epi32(v, 4));
+        WriteBE32(out + 160, _mm256_extract_epi32(v, 5));
+        WriteBE32(out + 192, _mm256_extract_epi32(v, 6));
+        WriteBE32(out + 224, _mm256_extract_epi32(v, 7));
+    }
+};
+
+} // namespace
+
+#include "crypto/sha256_multiway.h"
+
+namespace sha256d64_avx2 {
+void Transform_8way(unsigned char* out, const unsigned char* in)
+{
+    sha256_multiway::Impl<Vec8>::TransformD64(out, in);
+}
+} // namespace sha256d64_avx2
+
+#endif
@@ -0,0 +1,120 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_SHA256_MULTIWAY_H
+#define BITCOIN_CRYPTO_SHA256_MULTIWAY_H
+
+// Multi-buffer double SHA-256 of 64-byte inputs, written once against a
+// vector type V and instantiated by each SIMD implementation (which is
+// compiled with its own instruction set flags). Lane i of a vector holds
+// the state of the i-th input. V provides, as static members:
+//  - T: the vector type, and LANES, the number of 32-bit lanes in it
+//  - K(x): every lane set to x
+//  - Add, Xor, And, Or, ShR, ShL: lane-wise operations
+//  - Read(in): word 0 of each input (at in, in + 64, ...), from big endian
+//  - Write(out, v): each lane as word 0 of an output (at out, out + 32, ...), big endian
+
+#include <stdint.h>
+
+namespace {
+namespace sha256_multiway {
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static const uint32_t INIT[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+template<typename V>
+struct Impl
+{
+    typedef typename V::T T;
+
+    static inline T Add(T a, T b, T c) { return V::Add(V::Add(a, b), c); }
+    static inline T Add(T a, T b, T c, T d) { return V::Add(V::Add(a, b), V::Add(c, d)); }
+    static inline T Add(T a, T b, T c, T d, T e) { return V::Add(Add(a, b, c), V::Add(d, e)); }
+    static inline T Xor(T a, T b, T c) { return V::Xor(V::Xor(a, b), c); }
+    static inline T Rot(T x, int n) { return V::Or(V::ShR(x, n), V::ShL(x, 32 - n)); }
+
+    static inline T Ch(T x, T y, T z) { return V::Xor(z, V::And(x, V::Xor(y, z))); }
+    static inline T Maj(T x, T y, T z) { return V::Or(V::And(x, y), V::And(z, V::Or(x, y))); }
+    static inline T Sigma0(T x) { return Xor(Rot(x, 2), Rot(x, 13), Rot(x, 22)); }
+    static inline T Sigma1(T x) { return Xor(Rot(x, 6), Rot(x, 11), Rot(x, 25)); }
+    static inline T sigma0(T x) { return Xor(Rot(x, 7), Rot(x, 18), V::ShR(x, 3)); }
+    static inline T sigma1(T x) { return Xor(Rot(x, 17), Rot(x, 19), V::ShR(x, 10)); }
+
+    /** Compress one 16-word block w into the state s, in every lane. */
+    static void Transform(T* s, T* w)
+    {
+        T a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+        for (int i = 0; i < 64; i++) {
+            if (i >= 16)
+                w[i & 15] = Add(w[i & 15], sigma1(w[(i - 2) & 15]), w[(i - 7) & 15], sigma0(w[(i - 15) & 15]));
+            T t1 = Add(h, Sigma1(e), Ch(e, f, g), V::K(K[i]), w[i & 15]);
+            T t2 = V::Add(Sigma0(a), Maj(a, b, c));
+            h = g;
+            g = f;
+            f = e;
+            e = V::Add(d, t1);
+            d = c;
+            c = b;
+            b = a;
+            a = V::Add(t1, t2);
+        }
+        s[0] = V::Add(s[0], a);
+        s[1] = V::Add(s[1], b);
+        s[2] = V::Add(s[2], c);
+        s[3] = V::Add(s[3], d);
+        s[4] = V::Add(s[4], e);
+        s[5] = V::Add(s[5], f);
+        s[6] = V::Add(s[6], g);
+        s[7] = V::Add(s[7], h);
+    }
+
+    /** Double SHA-256 of V::LANES 64-byte inputs at in, writing V::LANES 32-byte digests to out. */
+    static void TransformD64(unsigned char* out, const unsigned char* in)
+    {
+        T s[8], w[16];
+
+        // The input block
+        for (int i = 0; i < 8; i++)
+            s[i] = V::K(INIT[i]);
+        for (int i = 0; i < 16; i++)
+            w[i] = V::Read(in + 4 * i);
+        Transform(s, w);
+
+        // Padding of the first hash: a 64-byte message
+        w[0] = V::K(0x80000000);
+        for (int i = 1; i < 15; i++)
+            w[i] = V::K(0);
+        w[15] = V::K(512);
+        Transform(s, w);
+
+        // The second hash, of the 32-byte digest
+        for (int i = 0; i < 8; i++) {
+            w[i] = s[i];
+            s[i] = V::K(INIT[i]);
+        }
+        w[8] = V::K(0x80000000);
+        for (int i = 9; i < 15; i++)
+            w[i] = V::K(0);
+        w[15] = V::K(256);
+        Transform(s, w);
+
+        for (int i = 0; i < 8; i++)
+            V::Write(out + 4 * i, s[i]);
+    }
+};
+
+} // namespace sha256_multiway
+} // namespace
+
+#endif // BITCOIN_CRYPTO_SHA256_MULTIWAY_H
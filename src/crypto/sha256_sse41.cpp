@@ -0,0 +1,54 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// 4-way double SHA-256 of 64-byte inputs using SSE4.1. Only called if the CPU supports it.
+
+#ifdef ENABLE_SSE41
+
+#include "crypto/common.h"
+
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace {
+
+struct Vec4
+{
+    typedef __m128i T;
+    static const int LANES = 4;
+
+    static inline T K(uint32_t x) { return _mm_set1_epi32(x); }
+    static inline T Add(T x, T y) { return _mm_add_epi32(x, y); }
+    static inline T Xor(T x, T y) { return _mm_xor_si128(x, y); }
+    static inline T And(T x, T y) { return _mm_and_si128(x, y); }
+    static inline T Or(T x, T y) { return _mm_or_si128(x, y); }
+    static inline T ShR(T x, int n) { return _mm_srli_epi32(x, n); }
+    static inline T ShL(T x, int n) { return _mm_slli_epi32(x, n); }
+
+    static inline T Read(const unsigned char* in)
+    {
+        return _mm_set_epi32(ReadBE32(in + 192), ReadBE32(in + 128), ReadBE32(in + 64), ReadBE32(in));
+    }
+
+    static inline void Write(unsigned char* out, T v)
+    {
+        WriteBE32(out, _mm_extract_epi32(v, 0));
+        WriteBE32(out + 32, _mm_extract_epi32(v, 1));
+        WriteBE32(out + 64, _mm_extract_epi32(v, 2));
+        WriteBE32(out + 96, _mm_extract_epi32(v, 3));
+    }
+};
+
+} // namespace
+
+#include "crypto/sha256_multiway.h"
+
+namespace sha256d64_sse41 {
+void Transform_4way(unsigned char* out, const unsigned char* in)
+{
+    sha256_multiway::Impl<Vec4>::TransformD64(out, in);
+}
+} // namespace sha256d64_sse41
+
+#endif
@@ -14,12 +14,15 @@
 #include "blind.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
+#include "crypto/sha256.h"
 #include "key.h"
 #include "main.h"
 #include "miner.h"
 #include "net.h"
+#include "parentchain.h"
 #include "pubkey.h"
 #include "rpcserver.h"
+#include "script/sigcache.h"
 #include "script/standard.h"
 #include "txdb.h"
 #include "ui_interface.h"
@@ -134,7 +137,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 
 void Shutdown()
@@ -159,6 +161,8 @@ void Shutdown()
 #endif
     StopNode();
     UnregisterNodeSignals(GetNodeSignals());
+    StopParentChainConfirmations();
+    StopParentHeaderStore();
 
     if (fFeeEstimatesInitialized)
     {
@@ -171,6 +175,7 @@ void Shutdown()
         fFeeEstimatesInitialized = false;
     }
 
+    StopPruneWitness();
     {
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
@@ -240,12 +245,21 @@ bool static Bind(const CService &addr, unsigned int flags) {
     return true;
 }
 
+/** Retry connecting blocks which were waiting for parent chain confirmations */
+static void ReconsiderDeferredBlocks()
+{
+    CValidationState state;
+    ActivateBestChain(state);
+}
+
 std::string HelpMessage(HelpMessageMode mode)
 {
     // When adding new options to the categories, please keep and ensure alphabetical ordering.
     string strUsage = _("Options:") + "\n";
     strUsage += "  -?                     " + _("This help message") + "\n";
     strUsage += "  -alertnotify=<cmd>     " + _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)") + "\n";
+    strUsage += "  -asyncflush            " + strprintf(_("Write the UTXO set to disk in a background thread, validating against the cache meanwhile (default: %u)"), 0) + "\n";
+    strUsage += "  -blindtrust            " + strprintf(_("Accept withdraw proofs without checking that their parent chain block is confirmed (default: %u)"), 1) + "\n";
     strUsage += "  -blocknotify=<cmd>     " + _("Execute command when the best block changes (%s in cmd is replaced by block hash)") + "\n";
     strUsage += "  -checkblocks=<n>       " + strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), 288) + "\n";
     strUsage += "  -checklevel=<n>        " + strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), 3) + "\n";
@@ -261,14 +275,21 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000??.dat file") + " " + _("on startup") + "\n";
     strUsage += "  -maxorphantx=<n>       " + strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS) + "\n";
     strUsage += "  -par=<n>               " + strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS) + "\n";
+    strUsage += "  -parentchainrefresh=<n> " + strprintf(_("With -blindtrust=0, refresh cached parent chain confirmations every <n> seconds (default: %d)"), DEFAULT_PARENTCHAIN_REFRESH) + "\n";
+    strUsage += "  -parentheaders         " + strprintf(_("With -blindtrust=0, check withdraw proofs against parent chain headers imported with importparentheaders instead of asking a parent chain daemon (default: %u)"), 0) + "\n";
+    strUsage += "  -parentheadersanchor=<height>:<hash> " + _("With -parentheaders, start the parent chain header store at this header instead of the parent chain genesis block; the height must be a multiple of the retarget interval") + "\n";
 #ifndef WIN32
     strUsage += "  -pid=<file>            " + strprintf(_("Specify pid file (default: %s)"), "bitcoind.pid") + "\n";
 #endif
+    strUsage += "  -prunewitness=<n>      " + strprintf(_("Store blocks more than <n> blocks deep without their witness data, to reduce storage (0 = disabled, otherwise at least %d). "
+            "Such blocks are only served stripped to peers and the wallet; incompatible with -txindex, and -reindex will redownload them (default: %u)"), MIN_PRUNE_WITNESS_DEPTH, 0) + "\n";
     strUsage += "  -reindex               " + _("Rebuild block chain index from current blk000??.dat files") + " " + _("on startup") + "\n";
 #if !defined(WIN32)
     strUsage += "  -sysperms              " + _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)") + "\n";
 #endif
     strUsage += "  -txindex               " + strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), 0) + "\n";
+    strUsage += "  -witnessfiles          " + strprintf(_("Store the witness data of new blocks in separate wit?????.dat files, so that reads which don't need it avoid loading it. "
+            "-reindex will redownload such blocks (default: %u)"), 0) + "\n";
 
     strUsage += "\n" + _("Connection options:") + "\n";
     strUsage += "  -addnode=<ip>          " + _("Add a node to connect to and attempt to keep the connection open") + "\n";
@@ -338,7 +359,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -debug=<category>      " + strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + "\n";
     strUsage += "                         " + _("If <category> is not supplied, output all debugging information.") + "\n";
     strUsage += "                         " + _("<category> can be:");
-    strUsage +=                                 " addrman, alert, bench, coindb, db, lock, rand, rpc, selectcoins, mempool, net"; // Don't translate these and qt below
+    strUsage +=                                 " addrman, alert, bench, coindb, db, lock, rand, rpc, selectcoins, mempool, net, parentchain"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
         strUsage += ", qt";
     strUsage += ".\n";
@@ -355,7 +376,8 @@ std::string HelpMessage(HelpMessageMode mode)
     {
         strUsage += "  -limitfreerelay=<n>    " + strprintf(_("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default:%u)"), 15) + "\n";
         strUsage += "  -relaypriority         " + strprintf(_("Require high priority for relaying free or low-fee transactions (default:%u)"), 1) + "\n";
-        strUsage += "  -maxsigcachesize=<n>   " + strprintf(_("Limit size of signature cache to <n> entries (default: %u)"), 50000) + "\n";
+        strUsage += "  -maxsigcachemb=<n>     " + strprintf(_("Limit size of signature cache to <n> MiB (default: %u)"), DEFAULT_MAX_SIG_CACHE_SIZE) + "\n";
+        strUsage += "  -maxrangeproofcachesize=<n> " + strprintf(_("Limit size of rangeproof verification cache to <n> entries (default: %u)"), DEFAULT_MAX_RANGEPROOF_CACHE_SIZE) + "\n";
     }
     strUsage += "  -minrelaytxfee=<amt>   " + strprintf(_("Fees (in BTC/Kb) smaller than this are considered zero fee for relaying (default: %s)"), FormatMoney(::minRelayTxFee.GetFeePerK())) + "\n";
     strUsage += "  -printtoconsole        " + _("Send trace/debug info to console instead of debug.log file") + "\n";
@@ -386,6 +408,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -rpcuser=<user>        " + _("Username for JSON-RPC connections") + "\n";
     strUsage += "  -rpcpassword=<pw>      " + _("Password for JSON-RPC connections") + "\n";
     strUsage += "  -rpcport=<port>        " + strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), 8332, 4241) + "\n";
+    strUsage += "  -rpcconnectport=<port> " + strprintf(_("Ask the parent chain daemon for block confirmations over JSON-RPC on <port> (default: %u)"), 18332) + "\n";
     strUsage += "  -rpcallowip=<ip>       " + _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times") + "\n";
     strUsage += "  -rpcthreads=<n>        " + strprintf(_("Set the number of threads to service RPC calls (default: %d)"), 4) + "\n";
     strUsage += "  -rpckeepalive          " + strprintf(_("RPC support for HTTP persistent connections (default: %d)"), 1) + "\n";
@@ -671,6 +694,16 @@ bool AppInit2(boost::thread_group& threadGroup)
     if (GetBoolArg("-benchmark", false))
         InitWarning(_("Warning: Unsupported argument -benchmark ignored, use -debug=bench."));
 
+    // -maxsigcachesize used to count entries; the cache is sized in MiB now
+    if (mapArgs.count("-maxsigcachesize")) {
+        int64_t nEntries = std::min(std::max((int64_t)0, GetArg("-maxsigcachesize", 0)), (MAX_MAX_SIG_CACHE_SIZE << 20) / (int64_t)CSignatureCache::ENTRY_SIZE);
+        int64_t nMiB = (nEntries * CSignatureCache::ENTRY_SIZE + (1 << 20) - 1) >> 20;
+        if (SoftSetArg("-maxsigcachemb", strprintf("%d", nMiB)))
+            InitWarning(strprintf(_("Warning: Deprecated argument -maxsigcachesize=%d (entries) taken as -maxsigcachemb=%d."), nEntries, nMiB));
+        else
+            InitWarning(_("Warning: Deprecated argument -maxsigcachesize ignored, as -maxsigcachemb is set."));
+    }
+
     // Checkmempool and checkblockindex default to true in regtest mode
     mempool.setSanityCheck(GetBoolArg("-checkmempool", Params().DefaultConsistencyChecks()));
     fCheckBlockIndex = GetBoolArg("-checkblockindex", Params().DefaultConsistencyChecks());
@@ -685,6 +718,19 @@ bool AppInit2(boost::thread_group& threadGroup)
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    fWitnessFiles = GetBoolArg("-witnessfiles", false);
+    fAsyncFlush = GetBoolArg("-asyncflush", false);
+
+    nPruneWitnessDepth = GetArg("-prunewitness", 0);
+    if (nPruneWitnessDepth < 0)
+        return InitError(_("Invalid value for -prunewitness: must not be negative"));
+    if (nPruneWitnessDepth > 0) {
+        if (nPruneWitnessDepth < MIN_PRUNE_WITNESS_DEPTH)
+            return InitError(strprintf(_("Invalid value for -prunewitness: must be at least %d"), MIN_PRUNE_WITNESS_DEPTH));
+        if (GetBoolArg("-txindex", false))
+            return InitError(_("-prunewitness is incompatible with -txindex"));
+    }
+
     fServer = GetBoolArg("-server", false);
 #ifdef ENABLE_WALLET
     bool fDisableWallet = GetBoolArg("-disablewallet", false);
@@ -779,10 +825,14 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
 
+    // Pick the fastest SHA256 implementation the CPU supports
+    std::string strSHA256Impl = SHA256AutoDetect();
+
     // Initialize elliptic curve code
     ECC_Blinding_Start();
     ECC_Verify_Start();
     ECC_Start();
+    InitSignatureCache();
 
     // Sanity check
     if (!InitSanityCheck())
@@ -809,6 +859,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     LogPrintf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     LogPrintf("Bitcoin version %s (%s)\n", FormatFullVersion(), CLIENT_DATE);
     LogPrintf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
+    LogPrintf("Using the '%s' SHA256 implementation\n", strSHA256Impl);
 #ifdef ENABLE_WALLET
     LogPrintf("Using BerkeleyDB version %s\n", DbEnv::version(0, 0, 0));
 #endif
@@ -826,6 +877,29 @@ bool AppInit2(boost::thread_group& threadGroup)
             threadGroup.create_thread(&ThreadScriptCheck);
     }
 
+    if (GetBoolArg("-parentheaders", false)) {
+        CParentChainParams parentParams = Params().ParentChain();
+        if (mapArgs.count("-parentheadersanchor")) {
+            const std::string& strAnchor = mapArgs["-parentheadersanchor"];
+            size_t nColon = strAnchor.find(':');
+            int32_t nHeight = -1;
+            if (nColon == std::string::npos || !ParseInt32(strAnchor.substr(0, nColon), &nHeight) || nHeight < 0 ||
+                strAnchor.size() - nColon - 1 != 64 || !IsHex(strAnchor.substr(nColon + 1)))
+                return InitError(strprintf(_("Invalid -parentheadersanchor '%s': must be <height>:<hash>"), strAnchor));
+            if (!parentParams.fNoRetargeting && nHeight % parentParams.Interval() != 0)
+                return InitError(strprintf(_("Invalid -parentheadersanchor '%s': the height must be a multiple of %d"), strAnchor, parentParams.Interval()));
+            parentParams.nAnchorHeight = nHeight;
+            parentParams.hashAnchor = uint256(strAnchor.substr(nColon + 1));
+        }
+        if (!StartParentHeaderStore(GetDataDir() / "parentheaders.dat", parentParams))
+            return InitError(_("Error loading parentheaders.dat"));
+    } else if (!GetBoolArg("-blindtrust", true)) {
+        int64_t nRefresh = GetArg("-parentchainrefresh", DEFAULT_PARENTCHAIN_REFRESH);
+        if (nRefresh <= 0)
+            return InitError(_("Invalid value for -parentchainrefresh: must be positive"));
+        StartParentChainConfirmations(threadGroup, new CParentChainRPCBackend(GetArg("-rpcconnectport", "18332")), nRefresh, &ReconsiderDeferredBlocks);
+    }
+
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
      * that the server is there and will be ready later).  Warmup mode will
@@ -1031,7 +1105,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     nTotalCache -= nBlockTreeDBCache;
     size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
     nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    nCoinCacheUsage = nTotalCache; // the rest is for the in-memory UTXO cache, measured in bytes
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1057,6 +1131,11 @@ bool AppInit2(boost::thread_group& threadGroup)
                 if (fReindex)
                     pblocktree->WriteReindexing(true);
 
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+
                 if (!LoadBlockIndex()) {
                     strLoadError = _("Error loading block database");
                     break;
@@ -1123,6 +1202,10 @@ bool AppInit2(boost::thread_group& threadGroup)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    // Without the witness of old blocks we can't serve the full chain to peers
+    if (nPruneWitnessDepth > 0 || fHavePrunedWitness)
+        nLocalServices &= ~NODE_NETWORK;
+
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
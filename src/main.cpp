@@ -13,18 +13,22 @@
 #include "init.h"
 #include "merkleblock.h"
 #include "net.h"
+#include "parentchain.h"
 #include "pow.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "validationstats.h"
 
+#include <memory>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace boost;
@@ -50,9 +54,13 @@ int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
+int nPruneWitnessDepth = 0;
+bool fHavePrunedWitness = false;
+bool fWitnessFiles = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
-unsigned int nCoinCacheSize = 5000;
+bool fAsyncFlush = false;
+size_t nCoinCacheUsage = 5000 * 300;
 
 //TODO: Require reindex if this changes
 std::set<uint256> sidechainWithdrawsTracked;
@@ -104,6 +112,12 @@ namespace {
 
     CBlockIndex *pindexBestInvalid;
 
+    /**
+     * Block the UTXO set was loaded from a snapshot at, if any. It has no undo
+     * data, and blocks below it may have no data at all.
+     */
+    CBlockIndex *pindexSnapshot = NULL;
+
     /**
      * The set of all CBlockIndex entries with BLOCK_VALID_TRANSACTIONS (for itself and all ancestors) and
      * as good as our current tip or better. Entries may be failed, though.
@@ -151,8 +165,23 @@ namespace {
     /** Dirty block index entries. */
     set<CBlockIndex*> setDirtyBlockIndex;
 
+    /** Proof solutions of block index entries which haven't been written to the block tree database yet. */
+    map<const CBlockIndex*, CScript> mapUnwrittenSolutions;
+
+    /**
+     * Proof solutions of block index entries recently written or read back,
+     * least recently used first, so that serving recent headers or rewriting
+     * an entry whose status changed rarely needs a database read.
+     */
+    typedef list<pair<const CBlockIndex*, CScript> > RecentSolutionList;
+    RecentSolutionList listRecentSolutions;
+    map<const CBlockIndex*, RecentSolutionList::iterator> mapRecentSolutions;
+
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
+
+    /** Set at startup and whenever a block file is completed, so the next flush looks for files to strip. */
+    bool fCheckForWitnessPruning = true;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -545,6 +574,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1026,6 +1056,8 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                         bool* pfMissingInputs, bool fRejectInsaneFee)
 {
     AssertLockHeld(cs_main);
+    CValidationTimer timer(VALIDATION_MEMPOOL_ACCEPT);
+    RecordMempoolStage(MEMPOOL_RECEIVED);
     if (pfMissingInputs)
         *pfMissingInputs = false;
 
@@ -1043,6 +1075,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         return state.DoS(0,
                          error("AcceptToMemoryPool : nonstandard transaction: %s", reason),
                          REJECT_NONSTANDARD, reason);
+    RecordMempoolStage(MEMPOOL_CHECKED);
 
     // is it already in the memory pool?
     uint256 hash = tx.GetHash();
@@ -1095,13 +1128,27 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 
         // Bring the best block into scope
         view.GetBestBlock();
+        RecordMempoolStage(MEMPOOL_INPUTS_FOUND);
 
             nFees = tx.nTxFee;
-            if (!view.VerifyAmounts(tx, nFees))
+            std::vector<const CTxOutValue*> vRangeproofs;
+            int64_t nAmountsStart = GetTimeMicros();
+            bool fAmountsOk = view.VerifyAmounts(tx, nFees, &vRangeproofs);
+            RecordValidationTime(VALIDATION_VERIFY_AMOUNTS, GetTimeMicros() - nAmountsStart);
+            if (!fAmountsOk)
                 return state.DoS(0,
                                  error("AcceptToMemoryPool : input amounts do not match output amounts %s",
                                        hash.ToString()),
                                  REJECT_NONSTANDARD, "bad-txns-amount-mismatch");
+            // Verified proofs are remembered so ConnectBlock can skip them later.
+            BOOST_FOREACH(const CTxOutValue* pval, vRangeproofs) {
+                if (!CachingRangeproofChecker(true).VerifyRangeproof(*pval))
+                    return state.DoS(0,
+                                     error("AcceptToMemoryPool : rangeproof verification failed %s",
+                                           hash.ToString()),
+                                     REJECT_NONSTANDARD, "bad-txns-rangeproof-invalid");
+            }
+        RecordMempoolStage(MEMPOOL_AMOUNTS_VERIFIED);
 
         // we have all inputs cached now, so switch back to dummy, so we don't need to keep lock on mempool
         view.SetBackend(dummy);
@@ -1184,10 +1231,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
             return error("AcceptToMemoryPool: : insane fees %s, %d > %d",
                          hash.ToString(),
                          nFees, ::minRelayTxFee.GetFee(nSize) * 10000);
+        RecordMempoolStage(MEMPOOL_POLICY_PASSED);
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true))
+        // The rangeproofs were verified along with the amounts above.
+        if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, NULL, false))
         {
             return error("AcceptToMemoryPool: : ConnectInputs failed %s", hash.ToString());
         }
@@ -1201,13 +1250,14 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, NULL, false))
         {
             return error("AcceptToMemoryPool: : BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
         }
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry);
+        RecordMempoolStage(MEMPOOL_ACCEPTED);
     }
 
     SyncWithWallets(tx, NULL);
@@ -1216,7 +1266,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 }
 
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
-bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock, bool fAllowSlow)
+bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock, bool fAllowSlow, bool fWitness)
 {
     CBlockIndex *pindexSlow = NULL;
     {
@@ -1235,8 +1285,14 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
                 if (file.IsNull())
                     return error("%s: OpenBlockFile failed", __func__);
                 CBlockHeader header;
+                CBlockIndex* pindex = NULL;
                 try {
                     file >> header;
+                    BlockMap::iterator mi = mapBlockIndex.find(header.GetHash());
+                    if (mi != mapBlockIndex.end())
+                        pindex = mi->second;
+                    if (pindex && (pindex->nStatus & BLOCK_HAVE_WITNESS))
+                        file.SetVersion(CLIENT_VERSION | SERIALIZE_VERSION_MASK_NO_WITNESS);
                     fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
                     file >> txOut;
                 } catch (std::exception &e) {
@@ -1245,11 +1301,14 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
                 hashBlock = header.GetHash();
                 if (txOut.GetHash() != hash)
                     return error("%s : txid mismatch", __func__);
-                return true;
+                // The witness is only stored per block, so fetch it along with the rest of the block
+                if (!fWitness || !pindex || !(pindex->nStatus & BLOCK_HAVE_WITNESS))
+                    return true;
+                pindexSlow = pindex;
             }
         }
 
-        if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
+        if (fAllowSlow && !pindexSlow) { // use coin database to locate block that contains transaction, and scan it
             int nHeight = -1;
             {
                 CCoinsViewCache &view = *pcoinsTip;
@@ -1264,7 +1323,7 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
 
     if (pindexSlow) {
         CBlock block;
-        if (ReadBlockFromDisk(block, pindexSlow)) {
+        if (ReadBlockFromDisk(block, pindexSlow, fWitness)) {
             BOOST_FOREACH(const CTransaction &tx, block.vtx) {
                 if (tx.GetHash() == hash) {
                     txOut = tx;
@@ -1288,16 +1347,33 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
 // CBlock and CBlockIndex
 //
 
-bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos)
+/**
+ * Witness-stripped blocks are stored under a different message start, so that
+ * -reindex/-loadblock skip them rather than parsing them as full blocks.
+ */
+static void GetStrippedMessageStart(MessageStartChars& pchMessageStart)
+{
+    memcpy(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE);
+    pchMessageStart[0] ^= 0xff;
+}
+
+bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, bool fStripWitness)
 {
+    CValidationTimer timer(VALIDATION_WRITE_DISK);
+
     // Open history file to append
-    CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
+    CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION | (fStripWitness ? SERIALIZE_VERSION_MASK_NO_WITNESS : 0));
     if (fileout.IsNull())
         return error("WriteBlockToDisk : OpenBlockFile failed");
 
     // Write index header
     unsigned int nSize = fileout.GetSerializeSize(block);
-    fileout << FLATDATA(Params().MessageStart()) << nSize;
+    MessageStartChars pchMessageStart;
+    if (fStripWitness)
+        GetStrippedMessageStart(pchMessageStart);
+    else
+        memcpy(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE);
+    fileout << FLATDATA(pchMessageStart) << nSize;
 
     // Write block
     long fileOutPos = ftell(fileout.Get());
@@ -1309,12 +1385,12 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos)
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+static bool ReadBlockDataFromDisk(CBlock& block, const CDiskBlockPos& pos, bool fWitnessStripped)
 {
     block.SetNull();
 
     // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION | (fWitnessStripped ? SERIALIZE_VERSION_MASK_NO_WITNESS : 0));
     if (filein.IsNull())
         return error("ReadBlockFromDisk : OpenBlockFile failed");
 
@@ -1326,6 +1402,14 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
         return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
 
+    return true;
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, bool fWitnessStripped)
+{
+    if (!ReadBlockDataFromDisk(block, pos, fWitnessStripped))
+        return false;
+
     // Check the header
     if (!CheckProof(block))
         return error("ReadBlockFromDisk : Errors in block header");
@@ -1333,12 +1417,33 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, bool fWitness)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
+    if (!ReadBlockDataFromDisk(block, pindex->GetBlockPos(), pindex->nStatus & (BLOCK_WITNESS_PRUNED | BLOCK_HAVE_WITNESS)))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*) : GetHash() doesn't match index");
+    // The block hash doesn't commit to the proof's solution, so only skip
+    // re-verifying it if it is the one that was verified when the header was accepted.
+    if (!(pindex->nStatus & BLOCK_PROOF_VALID) ||
+        Hash(block.proof.solution.begin(), block.proof.solution.end()) != pindex->hashSolution) {
+        if (!CheckProof(block))
+            return error("ReadBlockFromDisk : Errors in block header");
+    }
+    if (fWitness && !ReadBlockWitnessFromDisk(block, pindex))
+        return false;
+    return true;
+}
+
+bool ReadBlockWitnessFromDisk(CBlock& block, const CBlockIndex* pindex)
+{
+    if (!(pindex->nStatus & BLOCK_HAVE_WITNESS))
+        return true;
+    CBlockWitness blockwitness;
+    if (!blockwitness.ReadFromDisk(pindex->GetWitnessPos(), pindex->GetBlockHash()))
+        return false;
+    if (!blockwitness.ApplyTo(block))
+        return error("ReadBlockWitnessFromDisk : witness doesn't match block %s", pindex->GetBlockHash().ToString());
     return true;
 }
 
@@ -1514,6 +1619,8 @@ void static InvalidBlockFound(CBlockIndex *pindex, const CValidationState &state
 
 void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, CTxUndo &txundo, int nHeight)
 {
+    CCoinsCommitment *pcommitment = inputs.ModifyCommitment();
+
     // mark inputs spent
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
@@ -1529,28 +1636,98 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
                 if (sidechainWithdrawsTracked.count(0) || sidechainWithdrawsTracked.count(outpoint.first))
                     inputs.MaybeSetWithdrawSpent(outpoint, COutPoint(tx.GetHash(), i));
             }
+            if (pcommitment)
+                pcommitment->RemoveOutput(txin.prevout, *coins, coins->vout[txin.prevout.n]);
             assert(coins->Spend(txin.prevout, txundo.vprevout.back()));
+            if (pcommitment && coins->IsPruned())
+                pcommitment->nTransactions--;
         }
     }
 
     // add outputs
-    inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
+    CCoinsModifier outs = inputs.ModifyCoins(tx.GetHash());
+    if (pcommitment && !outs->IsPruned()) // an unspent duplicate being overwritten
+        pcommitment->RemoveCoins(tx.GetHash(), *outs);
+    outs->FromTx(tx, nHeight);
+    if (pcommitment && !outs->IsPruned())
+        pcommitment->AddCoins(tx.GetHash(), *outs);
 }
 
 bool CScriptCheck::operator()() {
+    CValidationTimer timer(IsWithdraw() ? VALIDATION_WITHDRAW : VALIDATION_SCRIPT);
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
-    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, nValueIn, nValueInPreviousIn, nTxFee, nSpendHeight, cacheStore), &error)) {
+    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, nValueIn, nValueInPreviousIn, nTxFee, nSpendHeight, cacheStore, txdata.get()), &error)) {
         return ::error("CScriptCheck(): %s:%d VerifySignature failed: %s", ptxTo->GetHash().ToString(), nIn, ScriptErrorString(error));
     }
     return true;
 }
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks)
+bool CScriptCheck::RunBatched(CSignatureBatch& batch) {
+    const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
+    return VerifyScript(scriptSig, scriptPubKey, nFlags, BatchingTransactionSignatureChecker(ptxTo, nIn, nValueIn, nValueInPreviousIn, nTxFee, nSpendHeight, batch, txdata.get()), &error);
+}
+
+CScriptBatchCheck::~CScriptBatchCheck() {
+    BOOST_FOREACH(CScriptCheck* check, vChecks)
+        delete check;
+}
+
+bool CScriptBatchCheck::operator()() {
+    int64_t nStart = GetTimeMicros();
+    CSignatureBatch batch;
+    bool fOk = true;
+    for (unsigned int i = 0; fOk && i < vChecks.size(); i++)
+        fOk = vChecks[i]->RunBatched(batch);
+    if (fOk && batch.Verify()) {
+        int64_t nMicros = GetTimeMicros() - nStart;
+        unsigned int nWithdraws = 0;
+        BOOST_FOREACH(const CScriptCheck* check, vChecks)
+            nWithdraws += check->IsWithdraw();
+        int64_t nWithdrawMicros = nMicros * nWithdraws / vChecks.size();
+        RecordValidationTime(VALIDATION_WITHDRAW, nWithdrawMicros, nWithdraws);
+        RecordValidationTime(VALIDATION_SCRIPT, nMicros - nWithdrawMicros, vChecks.size() - nWithdraws);
+        return true;
+    }
+
+    // Either a script failed or a signature in the batch is bad; a script may
+    // also have taken a different path than it would with the real results.
+    BOOST_FOREACH(CScriptCheck* check, vChecks) {
+        if (!(*check)()) {
+            error = check->GetScriptError();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CProofBatchCheck::operator()() {
+    int64_t nStart = GetTimeMicros();
+    CSignatureBatch batch;
+    bool fOk = true;
+    for (unsigned int i = 0; fOk && i < vHeaders.size(); i++)
+        fOk = CheckProof(*vHeaders[i], batch);
+    if (!fOk || !batch.Verify())
+        return false;
+    RecordValidationTime(VALIDATION_CHECK_PROOF, GetTimeMicros() - nStart, vHeaders.size());
+    BOOST_FOREACH(char* pfValid, vValid)
+        *pfValid = true;
+    return true;
+}
+
+bool CRangeproofCheck::operator()() {
+    if (!CachingRangeproofChecker(cacheStore).VerifyRangeproof(*pval)) {
+        error = SCRIPT_ERR_RANGEPROOF;
+        return ::error("CRangeproofCheck(): rangeproof verification failed");
+    }
+    return true;
+}
+
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CCheck*> *pvChecks, bool fRangeproofs)
 {
     if (!tx.IsCoinBase())
     {
         if (pvChecks)
-            pvChecks->reserve(tx.vin.size());
+            pvChecks->reserve(pvChecks->size() + tx.vin.size() + tx.vout.size());
 
         // This doesn't trigger the DoS code on purpose; if it did, it would make it easier
         // for an attacker to attempt to split the network.
@@ -1585,10 +1762,30 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
             return state.DoS(100, error("CheckInputs() : nTxFee out of range"),
                              REJECT_INVALID, "bad-txns-fee-outofrange");
 
-        if (!inputs.VerifyAmounts(tx, nTxFee))
+        // The commitment tally is cheap and always checked inline; the rangeproofs
+        // are deferred along with the script checks when a queue is in use, and
+        // go through the rangeproof cache either way.
+        std::vector<const CTxOutValue*> vRangeproofs;
+        int64_t nAmountsStart = GetTimeMicros();
+        bool fAmountsOk = inputs.VerifyAmounts(tx, nTxFee, &vRangeproofs);
+        RecordValidationTime(VALIDATION_VERIFY_AMOUNTS, GetTimeMicros() - nAmountsStart);
+        if (!fAmountsOk)
             return state.DoS(100, error("CheckInputs() : %s value in != value out",
                                         tx.GetHash().ToString()),
                              REJECT_INVALID, "bad-txns-amount-mismatch");
+        if (!fRangeproofs)
+            vRangeproofs.clear();
+        BOOST_FOREACH(const CTxOutValue* pval, vRangeproofs) {
+            if (pvChecks) {
+                pvChecks->push_back(new CRangeproofCheck(*pval, cacheStore));
+            } else {
+                CRangeproofCheck check(*pval, cacheStore);
+                if (!check())
+                    return state.DoS(100, error("CheckInputs() : %s rangeproof verification failed",
+                                                tx.GetHash().ToString()),
+                                     REJECT_INVALID, "bad-txns-rangeproof-invalid");
+            }
+        }
 
         // The first loop above does all the inexpensive checks.
         // Only if ALL inputs pass do we perform expensive signature checks.
@@ -1598,6 +1795,8 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         // before the last block chain checkpoint. This is safe because block merkle hashes are
         // still computed and checked, and any change will be caught at the next checkpoint.
         if (fScriptChecks) {
+            // The parts of the signature hash common to all inputs are only serialized once
+            boost::shared_ptr<const PrecomputedTransactionData> txdata(new PrecomputedTransactionData(tx));
             CTxOutValue prevValueIn = -1;
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
@@ -1605,11 +1804,13 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                 assert(coins);
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, prevValueIn, nTxFee, nSpendHeight, flags, cacheStore);
                 if (pvChecks) {
-                    pvChecks->push_back(CScriptCheck());
-                    check.swap(pvChecks->back());
-                } else if (!check()) {
+                    pvChecks->push_back(new CScriptCheck(*coins, tx, i, prevValueIn, nTxFee, nSpendHeight, flags, cacheStore, txdata));
+                    prevValueIn = coins->vout[tx.vin[i].prevout.n].nValue;
+                    continue;
+                }
+                CScriptCheck check(*coins, tx, i, prevValueIn, nTxFee, nSpendHeight, flags, cacheStore, txdata);
+                if (!check()) {
                     if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
                         // Check whether the failure was caused by a
                         // non-mandatory script verification check, such as
@@ -1618,7 +1819,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
                         CScriptCheck check(*coins, tx, i, prevValueIn, nTxFee, nSpendHeight,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
+                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, txdata);
                         if (check())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
                     }
@@ -1629,6 +1830,8 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                     // as to the correct behavior - we may want to continue
                     // peering with non-upgraded nodes even after a soft-fork
                     // super-majority vote has passed.
+                    if (check.GetScriptError() == SCRIPT_ERR_WITHDRAW_VERIFY_BLOCKPENDING)
+                        return state.DoS(0, false, REJECT_INVALID, "withdraw-lookup-pending", true);
                     return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
                 }
                 prevValueIn = coins->vout[tx.vin[i].prevout.n].nValue;
@@ -1660,6 +1863,8 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock() : block and undo data inconsistent");
 
+    CCoinsCommitment *pcommitment = view.ModifyCommitment();
+
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
@@ -1684,6 +1889,8 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
             fClean = fClean && error("DisconnectBlock() : added transaction mismatch? database corrupted");
 
         // remove outputs
+        if (pcommitment && !outs->IsPruned())
+            pcommitment->RemoveCoins(hash, *outs);
         outs->Clear();
         }
 
@@ -1698,8 +1905,11 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
                 CCoinsModifier coins = view.ModifyCoins(out.hash);
                 if (undo.nHeight != 0) {
                     // undo data contains height: this is the last output of the prevout tx being spent
-                    if (!coins->IsPruned())
+                    if (!coins->IsPruned()) {
                         fClean = fClean && error("DisconnectBlock() : undo data overwriting existing transaction");
+                        if (pcommitment)
+                            pcommitment->RemoveCoins(out.hash, *coins);
+                    }
                     coins->Clear();
                     coins->fCoinBase = undo.fCoinBase;
                     coins->nHeight = undo.nHeight - 1;
@@ -1708,8 +1918,16 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
                     if (coins->IsPruned())
                         fClean = fClean && error("DisconnectBlock() : undo data adding output to missing transaction");
                 }
-                if (coins->IsAvailable(out.n))
+                if (coins->IsAvailable(out.n)) {
                     fClean = fClean && error("DisconnectBlock() : undo data overwriting existing output");
+                    if (pcommitment)
+                        pcommitment->RemoveOutput(out, *coins, coins->vout[out.n]);
+                }
+                if (pcommitment) {
+                    if (coins->IsPruned())
+                        pcommitment->nTransactions++;
+                    pcommitment->AddOutput(out, *coins, undo.txout);
+                }
                 if (coins->vout.size() < out.n+1)
                     coins->vout.resize(out.n+1);
                 coins->vout[out.n] = undo.txout;
@@ -1764,11 +1982,25 @@ void static FlushBlockFile(bool fFinalize = false)
         FileCommit(fileOld);
         fclose(fileOld);
     }
+
+    fileOld = OpenWitnessFile(posOld, true);
+    if (fileOld) {
+        FileCommit(fileOld);
+        fclose(fileOld);
+    }
 }
 
+bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAddSize, unsigned int nHeight, uint64_t nTime, bool fKnown);
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static CCheckQueue<CCheck> scriptcheckqueue(128, MAX_SCRIPTCHECK_THREADS);
+
+/**
+ * Number of script checks ConnectBlock groups into one CScriptBatchCheck. Large
+ * enough for batch verification to pay off, small enough to keep all script
+ * check threads busy on typical blocks.
+ */
+static const unsigned int SCRIPT_CHECK_BATCH_SIZE = 32;
 
 void ThreadScriptCheck() {
     RenameThread("bitcoin-scriptch");
@@ -1784,6 +2016,7 @@ static int64_t nTimeTotal = 0;
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, vector<CTransaction> *pvProofTxn)
 {
     AssertLockHeld(cs_main);
+    CValidationTimer timer(VALIDATION_CONNECT_BLOCK);
     // Check it again in case a previous version let a bad block in
     if (!CheckBlock(block, state, !fJustCheck, !fJustCheck))
         return false;
@@ -1843,13 +2076,16 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    CCheckQueueControl<CCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    boost::scoped_ptr<CScriptBatchCheck> pbatch(new CScriptBatchCheck());
 
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
     int nInputs = 0;
     unsigned int nSigOps = 0;
     CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
+    // Transaction offsets are into the block as stored, which may be witness-stripped
+    int nTxPosVersion = CLIENT_VERSION | ((pindex->nStatus & BLOCK_HAVE_WITNESS) ? SERIALIZE_VERSION_MASK_NO_WITNESS : 0);
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
@@ -1882,10 +2118,28 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             nFees += tx.nTxFee;
 
-            std::vector<CScriptCheck> vChecks;
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, nScriptCheckThreads ? &vChecks : NULL))
+            std::vector<CCheck*> vChecks;
+            if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, fScriptChecks && nScriptCheckThreads ? &vChecks : NULL)) {
+                BOOST_FOREACH(CCheck* check, vChecks)
+                    delete check;
                 return false;
-            control.Add(vChecks);
+            }
+            // Script checks are grouped so their signatures get batch verified.
+            std::vector<CCheck*> vQueue;
+            BOOST_FOREACH(CCheck* check, vChecks) {
+                CScriptCheck* pscriptcheck = dynamic_cast<CScriptCheck*>(check);
+                if (!pscriptcheck) {
+                    vQueue.push_back(check);
+                    continue;
+                }
+                pbatch->Add(pscriptcheck);
+                if (pbatch->size() >= SCRIPT_CHECK_BATCH_SIZE) {
+                    CScriptBatchCheck* pfull = new CScriptBatchCheck();
+                    pfull->swap(*pbatch);
+                    vQueue.push_back(pfull);
+                }
+            }
+            control.Add(vQueue);
 
             // Auto-generate double-spend withdraw proofs (if neccessary)
             if (pvProofTxn && sidechainWithdrawsTracked.size() > 0) {
@@ -1924,7 +2178,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                                     dsBlockHash = block.GetHash();
                                     txSet.insert(doubleSpent.hash);
                                 } else {
-                                    assert(ReadBlockFromDisk(dsBlock, mapBlockIndex[dsBlockHash]));
+                                    // Only needed for its merkle tree
+                                    assert(ReadBlockFromDisk(dsBlock, mapBlockIndex[dsBlockHash], false));
                                     dsTxSet.insert(doubleSpent.hash);
                                 }
 
@@ -1999,7 +2254,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         UpdateCoins(tx, state, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
 
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, nTxPosVersion);
     }
     int64_t nTime1 = GetTimeMicros(); nTimeConnect += nTime1 - nTimeStart;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime1 - nTimeStart) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime1 - nTimeStart) / (nInputs-1), nTimeConnect * 0.000001);
@@ -2010,8 +2265,23 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                                GetBlockValue(pindex->nHeight, nFees)),
                                REJECT_INVALID, "bad-cb-amount");
 
-    if (!control.Wait())
+    if (pbatch->size() > 0) {
+        CScriptBatchCheck* pfull = new CScriptBatchCheck();
+        pfull->swap(*pbatch);
+        std::vector<CCheck*> vQueue(1, pfull);
+        control.Add(vQueue);
+    }
+    CCheck* pcheckFailed = NULL;
+    if (!control.Wait(&pcheckFailed)) {
+        // A withdraw whose parent chain block confirmations aren't cached yet
+        // doesn't make the block invalid; it is retried once they are.
+        boost::scoped_ptr<CCheck> checkFailed(pcheckFailed);
+        if (checkFailed.get() && checkFailed->GetScriptError() == SCRIPT_ERR_WITHDRAW_VERIFY_BLOCKPENDING)
+            return state.DoS(0, false, REJECT_INVALID, "withdraw-lookup-pending", true);
+        if (checkFailed.get() && checkFailed->GetScriptError() == SCRIPT_ERR_RANGEPROOF)
+            return state.DoS(100, false, REJECT_INVALID, "bad-txns-rangeproof-invalid");
         return state.DoS(100, false);
+    }
     int64_t nTime2 = GetTimeMicros(); nTimeVerify += nTime2 - nTimeStart;
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs-1), nTimeVerify * 0.000001);
 
@@ -2058,6 +2328,337 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     return true;
 }
 
+/** The background rewrite of a block file without witness (see PruneWitnessFile), if any */
+static boost::thread* pthreadPruneWitness = NULL;
+//! Set by the rewrite, under cs_main, once it is over
+static bool fPruneWitnessDone = false;
+//! Set at shutdown, after which no rewrite is started anymore
+static bool fPruneWitnessStopped = false;
+//! The file whose blocks were rewritten, to delete once the block index has been written, or -1
+static int nPruneWitnessFileToDelete = -1;
+
+/** A block of the file being rewritten, with its index entry as it was when the rewrite started */
+struct CPruneWitnessBlock
+{
+    CBlockIndex* pindex;
+    CBlockIndex indexOld;
+    bool fStrip;
+
+    CPruneWitnessBlock(CBlockIndex* pindexIn, bool fStripIn) : pindex(pindexIn), indexOld(*pindexIn), fStrip(fStripIn) {}
+};
+
+/** The room claimed by a rewrite in one block file and its undo file */
+struct CPruneWitnessSpace
+{
+    unsigned int nBlocks;
+    unsigned int nBlockStart, nBlockEnd, nBlockClaimed;
+    unsigned int nUndoStart, nUndoEnd, nUndoClaimed;
+
+    CPruneWitnessSpace() : nBlocks(0), nBlockStart(0), nBlockEnd(0), nBlockClaimed(0), nUndoStart(0), nUndoEnd(0), nUndoClaimed(0) {}
+
+    void Claim(const CDiskBlockPos& blockPos, unsigned int nBlockSize, const CDiskBlockPos& undoPos, unsigned int nUndoSize)
+    {
+        if (nBlocks++ == 0)
+            nBlockStart = blockPos.nPos;
+        nBlockEnd = blockPos.nPos + nBlockSize;
+        nBlockClaimed += nBlockSize;
+        if (nUndoSize == 0)
+            return;
+        if (nUndoClaimed == 0)
+            nUndoStart = undoPos.nPos;
+        nUndoEnd = undoPos.nPos + nUndoSize;
+        nUndoClaimed += nUndoSize;
+    }
+
+    /**
+     * Hand the room back, where nothing else was stored after or between the
+     * copies. The file's height and time range stay as widened by the copies.
+     */
+    void Release(CBlockFileInfo& info) const
+    {
+        if (info.nSize == nBlockEnd && nBlockEnd - nBlockStart == nBlockClaimed) {
+            info.nSize = nBlockStart;
+            info.nBlocks -= nBlocks;
+        }
+        if (nUndoClaimed > 0 && info.nUndoSize == nUndoEnd && nUndoEnd - nUndoStart == nUndoClaimed)
+            info.nUndoSize = nUndoStart;
+    }
+};
+
+/**
+ * Copy the blocks of file nFile (and their undo data) into the current block
+ * file, and only then point their index entries at the copies, in one short
+ * cs_main section. Blocks are read and written without holding cs_main; the
+ * rewrite is given up if any of the entries changed meanwhile. The room the
+ * copies of a rewrite given up took is then reused, unless other blocks were
+ * stored after them; in that case the copies are left in the file unused.
+ */
+static void ThreadPruneWitness(int nFile, std::vector<CPruneWitnessBlock> vBlocks)
+{
+    RenameThread("bitcoin-prunewit");
+    bool fOk = true;
+    std::vector<CBlockIndex> vIndexNew;
+    std::map<int, CPruneWitnessSpace> mapSpace;
+    try {
+        BOOST_FOREACH(const CPruneWitnessBlock& item, vBlocks) {
+            boost::this_thread::interruption_point();
+            const CBlockIndex& indexOld = item.indexOld;
+            CBlock block;
+            if (!ReadBlockFromDisk(block, &indexOld, !item.fStrip)) {
+                AbortNode("Failed to read block");
+                fOk = false;
+                break;
+            }
+            unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION | (item.fStrip ? SERIALIZE_VERSION_MASK_NO_WITNESS : 0));
+            bool fUndo = indexOld.nStatus & BLOCK_HAVE_UNDO;
+            CBlockUndo blockundo;
+            if (fUndo && !blockundo.ReadFromDisk(indexOld.GetUndoPos(), indexOld.pprev->GetBlockHash())) {
+                AbortNode("Failed to read undo data");
+                fOk = false;
+                break;
+            }
+            CDiskBlockPos blockPos, undoPos;
+            {
+                // Only claiming the room for the copies needs the lock
+                LOCK(cs_main);
+                CValidationState state;
+                bool fClaimed = FindBlockPos(state, blockPos, nBlockSize+8, indexOld.nHeight, block.GetBlockTime(), false);
+                unsigned int nUndoSize = fClaimed && fUndo ? ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION) + 40 : 0;
+                if (nUndoSize > 0)
+                    fClaimed = FindUndoPos(state, blockPos.nFile, undoPos, nUndoSize);
+                // Running out of disk space fails a claim only after the room was taken
+                mapSpace[blockPos.nFile].Claim(blockPos, nBlockSize+8, undoPos, nUndoSize);
+                if (!fClaimed) {
+                    error("%s : FindBlockPos or FindUndoPos failed", __func__);
+                    fOk = false;
+                    break;
+                }
+            }
+            if (!WriteBlockToDisk(block, blockPos, item.fStrip)) {
+                AbortNode("Failed to write block");
+                fOk = false;
+                break;
+            }
+            if (fUndo && !blockundo.WriteToDisk(undoPos, indexOld.pprev->GetBlockHash())) {
+                AbortNode("Failed to write undo data");
+                fOk = false;
+                break;
+            }
+            CBlockIndex indexNew = indexOld;
+            indexNew.nStatus &= ~BLOCK_HAVE_WITNESS;
+            if (item.fStrip)
+                indexNew.nStatus |= BLOCK_WITNESS_PRUNED;
+            if (fUndo)
+                indexNew.nUndoPos = undoPos.nPos;
+            indexNew.nFile = blockPos.nFile;
+            indexNew.nDataPos = blockPos.nPos;
+            vIndexNew.push_back(indexNew);
+        }
+        if (fOk) {
+            // The copies must be on disk before the index refers to them
+            BOOST_FOREACH(const PAIRTYPE(int, CPruneWitnessSpace)& item, mapSpace) {
+                CDiskBlockPos pos(item.first, 0);
+                FILE* file = OpenBlockFile(pos);
+                if (file) {
+                    FileCommit(file);
+                    fclose(file);
+                }
+                file = OpenUndoFile(pos);
+                if (file) {
+                    FileCommit(file);
+                    fclose(file);
+                }
+            }
+        }
+    } catch (const boost::thread_interrupted&) {
+        fOk = false;
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+        fOk = false;
+    }
+
+    LOCK(cs_main);
+    for (unsigned int i = 0; fOk && i < vBlocks.size(); i++) {
+        const CPruneWitnessBlock& item = vBlocks[i];
+        const CBlockIndex* pindex = item.pindex;
+        // Give up if the block was stored, connected or marked invalid meanwhile,
+        // or if a block whose witness would be dropped left the active chain.
+        if (pindex->nStatus != item.indexOld.nStatus || pindex->nFile != item.indexOld.nFile ||
+            pindex->nDataPos != item.indexOld.nDataPos || pindex->nUndoPos != item.indexOld.nUndoPos ||
+            (item.fStrip && !(pindex->nStatus & BLOCK_WITNESS_PRUNED) && !chainActive.Contains(pindex))) {
+            LogPrint("prune", "Block %s changed while stripping witness data from blk%05u.dat, retrying later\n", pindex->GetBlockHash().ToString(), nFile);
+            fOk = false;
+        }
+    }
+    if (fOk) {
+        for (unsigned int i = 0; i < vBlocks.size(); i++) {
+            CBlockIndex* pindex = vBlocks[i].pindex;
+            pindex->nStatus = vIndexNew[i].nStatus;
+            pindex->nFile = vIndexNew[i].nFile;
+            pindex->nDataPos = vIndexNew[i].nDataPos;
+            pindex->nUndoPos = vIndexNew[i].nUndoPos;
+            setDirtyBlockIndex.insert(pindex);
+        }
+        {
+            LOCK(cs_LastBlockFile);
+            vinfoBlockFile[nFile].SetNull();
+            setDirtyFileInfo.insert(nFile);
+        }
+        if (!fHavePrunedWitness) {
+            pblocktree->WriteFlag("prunedwitness", true);
+            fHavePrunedWitness = true;
+        }
+        nPruneWitnessFileToDelete = nFile;
+    } else {
+        LOCK(cs_LastBlockFile);
+        BOOST_FOREACH(const PAIRTYPE(int, CPruneWitnessSpace)& item, mapSpace) {
+            item.second.Release(vinfoBlockFile[item.first]);
+            setDirtyFileInfo.insert(item.first);
+        }
+    }
+    fPruneWitnessDone = true;
+}
+
+/**
+ * Start rewriting the blocks (and undo data) of one completed block file that
+ * lies entirely more than -prunewitness blocks below the tip into the current
+ * block file, stripping the witness of blocks in the active chain. Blocks
+ * outside the active chain keep their witness, so they can still be connected
+ * should a reorganization need them. The rewrite runs in the background (see
+ * ThreadPruneWitness); the file is deleted by the first flush that writes the
+ * block index after it is done.
+ */
+void static PruneWitnessFile()
+{
+    AssertLockHeld(cs_main);
+    if (pthreadPruneWitness != NULL) {
+        if (!fPruneWitnessDone)
+            return;
+        pthreadPruneWitness->join();
+        delete pthreadPruneWitness;
+        pthreadPruneWitness = NULL;
+    }
+    if (!fCheckForWitnessPruning || fPruneWitnessStopped || nPruneWitnessFileToDelete >= 0)
+        return;
+    if (nPruneWitnessDepth <= 0 || fReindex || fImporting || chainActive.Tip() == NULL)
+        return;
+    int nPruneHeight = chainActive.Height() - nPruneWitnessDepth;
+
+    int nFile = 0;
+    if (nPruneHeight > 0) {
+        LOCK(cs_LastBlockFile);
+        while (nFile < nLastBlockFile && (vinfoBlockFile[nFile].nBlocks == 0 || vinfoBlockFile[nFile].nHeightLast > (unsigned int)nPruneHeight))
+            nFile++;
+    }
+    if (nPruneHeight <= 0 || nFile == nLastBlockFile) {
+        fCheckForWitnessPruning = false;
+        return;
+    }
+
+    std::vector<CPruneWitnessBlock> vBlocks;
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex) {
+        CBlockIndex* pindex = item.second;
+        // A block whose witness is gone already can only be stored stripped again
+        if ((pindex->nStatus & BLOCK_HAVE_DATA) && pindex->nFile == nFile)
+            vBlocks.push_back(CPruneWitnessBlock(pindex, chainActive.Contains(pindex) || (pindex->nStatus & BLOCK_WITNESS_PRUNED)));
+    }
+
+    LogPrint("prune", "Stripping witness data from %u blocks in blk%05u.dat\n", vBlocks.size(), nFile);
+    fPruneWitnessDone = false;
+    pthreadPruneWitness = new boost::thread(boost::bind(&ThreadPruneWitness, nFile, vBlocks));
+}
+
+void StopPruneWitness()
+{
+    boost::thread* pthread = NULL;
+    {
+        LOCK(cs_main);
+        fPruneWitnessStopped = true;
+        std::swap(pthread, pthreadPruneWitness);
+    }
+    // The rewrite takes cs_main, so it must not be waited for while holding it
+    if (pthread != NULL) {
+        pthread->interrupt();
+        pthread->join();
+        delete pthread;
+    }
+}
+
+/** Remember the solution of a block index entry that is on disk, forgetting the least recently used one if needed */
+void static CacheBlockSolution(const CBlockIndex* pindex, const CScript& solution)
+{
+    AssertLockHeld(cs_main);
+    map<const CBlockIndex*, RecentSolutionList::iterator>::iterator it = mapRecentSolutions.find(pindex);
+    if (it != mapRecentSolutions.end()) {
+        listRecentSolutions.splice(listRecentSolutions.end(), listRecentSolutions, it->second);
+        return;
+    }
+    mapRecentSolutions[pindex] = listRecentSolutions.insert(listRecentSolutions.end(), make_pair(pindex, solution));
+    AddHeldSolutionMemoryStats(solution.size());
+    if (listRecentSolutions.size() > MAX_RECENT_BLOCK_SOLUTIONS) {
+        AddHeldSolutionMemoryStats(-(int64_t)listRecentSolutions.front().second.size());
+        mapRecentSolutions.erase(listRecentSolutions.front().first);
+        listRecentSolutions.pop_front();
+    }
+}
+
+/** The block index only keeps the proof's solution on disk; read it back. */
+bool static ReadBlockSolution(const CBlockIndex* pindex, CScript& solution)
+{
+    AssertLockHeld(cs_main);
+    map<const CBlockIndex*, CScript>::const_iterator it = mapUnwrittenSolutions.find(pindex);
+    if (it != mapUnwrittenSolutions.end()) {
+        solution = it->second;
+        return true;
+    }
+    map<const CBlockIndex*, RecentSolutionList::iterator>::iterator itRecent = mapRecentSolutions.find(pindex);
+    if (itRecent != mapRecentSolutions.end()) {
+        solution = itRecent->second->second;
+        listRecentSolutions.splice(listRecentSolutions.end(), listRecentSolutions, itRecent->second);
+        return true;
+    }
+    CDiskBlockIndex diskindex;
+    if (!pblocktree->ReadBlockIndex(pindex->GetBlockHash(), diskindex))
+        return error("%s : no block index record for %s", __func__, pindex->GetBlockHash().ToString());
+    solution = diskindex.proof.solution;
+    CacheBlockSolution(pindex, solution);
+    return true;
+}
+
+/** The coin database write running in the background with -asyncflush, if any */
+static boost::thread* pthreadCoinsWrite = NULL;
+//! The entries it is writing, the block they are the state at, and the commitment to that state
+static CCoinsMap mapCoinsWrite;
+static uint256 hashCoinsWrite;
+static CCoinsCommitment commitmentCoinsWrite;
+static bool fCommitmentCoinsWrite = false;
+//! Cleared when a background write fails; the coin database mustn't be written to after that
+static bool fCoinsWriteOk = true;
+
+static void ThreadCoinsWrite(CCoinsView* pview)
+{
+    RenameThread("bitcoin-coinswrite");
+    try {
+        if (!pview->BatchWrite(mapCoinsWrite, hashCoinsWrite, fCommitmentCoinsWrite ? &commitmentCoinsWrite : NULL))
+            fCoinsWriteOk = false;
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+        fCoinsWriteOk = false;
+    }
+    mapCoinsWrite.clear();
+}
+
+/** Wait for the background coin database write (if any), and return whether all of them succeeded */
+static bool WaitForCoinsWrite()
+{
+    if (pthreadCoinsWrite != NULL) {
+        pthreadCoinsWrite->join();
+        delete pthreadCoinsWrite;
+        pthreadCoinsWrite = NULL;
+    }
+    return fCoinsWriteOk;
+}
+
 enum FlushStateMode {
     FLUSH_STATE_IF_NEEDED,
     FLUSH_STATE_PERIODIC,
@@ -2073,8 +2674,11 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     LOCK(cs_main);
     static int64_t nLastWrite = 0;
     try {
-    if ((mode == FLUSH_STATE_ALWAYS) ||
-        ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+    PruneWitnessFile();
+    int nFileToDelete = nPruneWitnessFileToDelete;
+    bool fCacheLarge = pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage;
+    if ((mode == FLUSH_STATE_ALWAYS) || nFileToDelete >= 0 ||
+        ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && fCacheLarge) ||
         (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
         // Typical CCoins structures on disk are around 100 bytes in size.
         // Pushing a new one to the database can cause it to be written
@@ -2098,14 +2702,46 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
             return state.Abort("Failed to write to block index");
         }
         for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
-             if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(*it))) {
+             CScript solution;
+             if (!ReadBlockSolution(*it, solution) || !pblocktree->WriteBlockIndex(CDiskBlockIndex(*it, solution))) {
                  return state.Abort("Failed to write to block index");
              }
+             if (mapUnwrittenSolutions.erase(*it)) {
+                 AddHeldSolutionMemoryStats(-(int64_t)solution.size());
+                 CacheBlockSolution(*it, solution);
+             }
              setDirtyBlockIndex.erase(it++);
         }
         pblocktree->Sync();
-        // Finally flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // Only now that nothing refers to it anymore, drop the file whose blocks were rewritten without witness.
+        if (nFileToDelete >= 0) {
+            CDiskBlockPos pos(nFileToDelete, 0);
+            boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
+            boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
+            boost::filesystem::remove(GetBlockPosFilename(pos, "wit"));
+            LogPrint("prune", "Deleted blk%05u.dat, rev%05u.dat and wit%05u.dat\n", nFileToDelete, nFileToDelete, nFileToDelete);
+            nPruneWitnessFileToDelete = -1;
+        }
+        // Finally write the chainstate (which may refer to block index entries).
+        // Only one write can be in flight, and none may follow a failed one.
+        int64_t nFlushStart = GetTimeMicros();
+        if (!WaitForCoinsWrite())
+            return state.Abort("Failed to write to coin database");
+        // Keep the cache warm: only write what was modified, and only drop
+        // unmodified entries as far as needed to make room.
+        if (fCacheLarge)
+            pcoinsTip->Trim(nCoinCacheUsage / 2);
+        bool fFlushed = true;
+        if (fAsyncFlush && mode != FLUSH_STATE_ALWAYS) {
+            pcoinsTip->TakeModified(mapCoinsWrite);
+            hashCoinsWrite = pcoinsTip->GetBestBlock();
+            fCommitmentCoinsWrite = pcoinsTip->GetCommitment(commitmentCoinsWrite);
+            pthreadCoinsWrite = new boost::thread(boost::bind(&ThreadCoinsWrite, pcoinsTip->GetBackend()));
+        } else {
+            fFlushed = pcoinsTip->Sync();
+        }
+        RecordValidationTime(VALIDATION_FLUSH_COINS, GetTimeMicros() - nFlushStart);
+        if (!fFlushed)
             return state.Abort("Failed to write to coin database");
         // Update best block in wallet (so we can detect restored wallets).
         if (mode != FLUSH_STATE_IF_NEEDED) {
@@ -2122,6 +2758,9 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
 void FlushStateToDisk() {
     CValidationState state;
     FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
+    // Even if that failed early, nothing may still be writing afterwards
+    LOCK(cs_main);
+    WaitForCoinsWrite();
 }
 
 /** Update chainActive and related internal data structures. */
@@ -2132,10 +2771,10 @@ void static UpdateTip(CBlockIndex *pindexNew) {
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n",
       chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble())/log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
       DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-      Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+      Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1<<20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -2167,6 +2806,8 @@ void static UpdateTip(CBlockIndex *pindexNew) {
 bool static DisconnectTip(CValidationState &state) {
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
+    if (pindexDelete == pindexSnapshot)
+        return state.Abort("Cannot disconnect the block the UTXO set was loaded at");
     mempool.check(pcoinsTip);
     // Read block from disk.
     CBlock block;
@@ -2353,8 +2994,9 @@ static void PruneBlockIndexCandidates() {
 /**
  * Try to make some progress towards making pindexMostWork the active block.
  * pblock is either NULL or a pointer to a CBlock corresponding to pindexMostWork.
+ * fDeferred is set if a block could not be checked yet and should be retried later.
  */
-static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMostWork, const CBlock *pblock) {
+static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMostWork, const CBlock *pblock, bool& fDeferred) {
     AssertLockHeld(cs_main);
     bool fInvalidFound = false;
     const CBlockIndex *pindexOldTip = chainActive.Tip();
@@ -2390,6 +3032,8 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
                 // The block violates a consensus rule.
                 if (!state.CorruptionPossible())
                     InvalidChainFound(vpindexToConnect.back());
+                else
+                    fDeferred = true;
                 state = CValidationState();
                 fInvalidFound = true;
                 fContinue = false;
@@ -2426,6 +3070,7 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
 bool ActivateBestChain(CValidationState &state, const CBlock *pblock) {
     CBlockIndex *pindexNewTip = NULL;
     CBlockIndex *pindexMostWork = NULL;
+    bool fDeferred = false;
     do {
         boost::this_thread::interruption_point();
 
@@ -2438,7 +3083,7 @@ bool ActivateBestChain(CValidationState &state, const CBlock *pblock) {
             if (pindexMostWork == NULL || pindexMostWork == chainActive.Tip())
                 return true;
 
-            if (!ActivateBestChainStep(state, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : NULL))
+            if (!ActivateBestChainStep(state, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : NULL, fDeferred))
                 return false;
 
             pindexNewTip = chainActive.Tip();
@@ -2460,7 +3105,7 @@ bool ActivateBestChain(CValidationState &state, const CBlock *pblock) {
             // Notify external listeners about the new tip.
             uiInterface.NotifyBlockTip(hashNewTip);
         }
-    } while(pindexMostWork != chainActive.Tip());
+    } while(pindexMostWork != chainActive.Tip() && !fDeferred);
     CheckBlockIndex();
 
     // Write changes periodically to disk, after relay.
@@ -2553,6 +3198,9 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
     pindexNew->nSequenceId = 0;
+    mapUnwrittenSolutions[pindexNew] = block.proof.solution;
+    AddHeldSolutionMemoryStats(block.proof.solution.size());
+    AddBlockIndexMemoryStats(block.proof);
     BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
     BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
@@ -2632,6 +3280,7 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
             LogPrintf("Leaving block file %i: %s\n", nFile, vinfoBlockFile[nFile].ToString());
             FlushBlockFile(true);
             nFile++;
+            fCheckForWitnessPruning = true;
             if (vinfoBlockFile.size() <= nFile) {
                 vinfoBlockFile.resize(nFile + 1);
             }
@@ -2716,6 +3365,9 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
 {
     // These are checks that are independent of context.
 
+    if (block.fChecked)
+        return true;
+
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
     if (!CheckBlockHeader(block, state, fCheckPOW))
@@ -2769,6 +3421,9 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         return state.DoS(100, error("CheckBlock() : out-of-bounds SigOpCount"),
                          REJECT_INVALID, "bad-blk-sigops", true);
 
+    if (fCheckPOW && fCheckMerkleRoot)
+        block.fChecked = true;
+
     return true;
 }
 
@@ -2851,7 +3506,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex)
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, bool fCheckProof)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -2868,7 +3523,8 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
         return true;
     }
 
-    if (!CheckBlockHeader(block, state))
+    CValidationTimer timer(VALIDATION_CHECK_HEADER);
+    if (!CheckBlockHeader(block, state, fCheckProof))
         return false;
 
     // Get prev block index
@@ -2885,8 +3541,11 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
     if (!ContextualCheckBlockHeader(block, state, pindexPrev))
         return false;
 
-    if (pindex == NULL)
+    if (pindex == NULL) {
         pindex = AddToBlockIndex(block);
+        // The proof has been verified; remember that for later reads
+        pindex->nStatus |= BLOCK_PROOF_VALID;
+    }
 
     if (ppindex)
         *ppindex = pindex;
@@ -2894,13 +3553,54 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
     return true;
 }
 
+/**
+ * Verify the signed block proofs of the headers we don't know yet, in groups
+ * of PROOF_CHECK_BATCH_SIZE with their signatures batched, spread over the
+ * script check threads. vProofValid is set for each header whose proof was
+ * found valid; the others still need checking, so a group with a bad proof
+ * costs one extra verification of that group.
+ */
+static void CheckHeaderProofs(const std::vector<CBlockHeader>& headers, std::vector<char>& vProofValid)
+{
+    AssertLockHeld(cs_main);
+    vProofValid.assign(headers.size(), false);
+    std::vector<CCheck*> vChecks;
+    CProofBatchCheck* pcheck = NULL;
+    for (unsigned int i = 0; i < headers.size(); i++) {
+        if (mapBlockIndex.count(headers[i].GetHash()))
+            continue;
+        if (pcheck == NULL) {
+            pcheck = new CProofBatchCheck();
+            vChecks.push_back(pcheck);
+        }
+        pcheck->Add(headers[i], vProofValid[i]);
+        if (pcheck->size() >= PROOF_CHECK_BATCH_SIZE)
+            pcheck = NULL;
+    }
+
+    if (nScriptCheckThreads == 0) {
+        // Stop at the first bad group, like the check queue does
+        bool fOk = true;
+        BOOST_FOREACH(CCheck* check, vChecks) {
+            if (fOk)
+                fOk = (*check)();
+            delete check;
+        }
+        return;
+    }
+    CCheckQueueControl<CCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
 bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex, CDiskBlockPos* dbp)
 {
     AssertLockHeld(cs_main);
 
     CBlockIndex *&pindex = *ppindex;
 
-    if (!AcceptBlockHeader(block, state, &pindex))
+    // A checked block has had its proof verified already
+    if (!AcceptBlockHeader(block, state, &pindex, !block.fChecked))
         return false;
 
     if (pindex->nStatus & BLOCK_HAVE_DATA) {
@@ -2921,17 +3621,27 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
 
     // Write block to history file
     try {
-        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        // With -witnessfiles the witness goes to wit?????.dat, next to the stripped block
+        bool fSplitWitness = fWitnessFiles && dbp == NULL;
+        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION | (fSplitWitness ? SERIALIZE_VERSION_MASK_NO_WITNESS : 0));
         CDiskBlockPos blockPos;
         if (dbp != NULL)
             blockPos = *dbp;
         if (!FindBlockPos(state, blockPos, nBlockSize+8, nHeight, block.GetBlockTime(), dbp != NULL))
             return error("AcceptBlock() : FindBlockPos failed");
         if (dbp == NULL)
-            if (!WriteBlockToDisk(block, blockPos))
+            if (!WriteBlockToDisk(block, blockPos, fSplitWitness))
                 return state.Abort("Failed to write block");
+        CDiskBlockPos witnessPos(blockPos.nFile, 0);
+        if (fSplitWitness)
+            if (!CBlockWitness(block).WriteToDisk(witnessPos, block.GetHash()))
+                return state.Abort("Failed to write block witness");
         if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
             return error("AcceptBlock() : ReceivedBlockTransactions failed");
+        if (fSplitWitness) {
+            pindex->nWitnessPos = witnessPos.nPos;
+            pindex->nStatus |= BLOCK_HAVE_WITNESS;
+        }
     } catch(std::runtime_error &e) {
         return state.Abort(std::string("System error: ") + e.what());
     }
@@ -3113,6 +3823,10 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly) {
     return OpenDiskFile(pos, "rev", fReadOnly);
 }
 
+FILE* OpenWitnessFile(const CDiskBlockPos &pos, bool fReadOnly) {
+    return OpenDiskFile(pos, "wit", fReadOnly);
+}
+
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix)
 {
     return GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, pos.nFile);
@@ -3145,6 +3859,10 @@ bool static LoadBlockIndexDB()
 
     boost::this_thread::interruption_point();
 
+    uint256 hashSnapshot = 0;
+    unsigned int nSnapshotChainTx = 0;
+    pblocktree->ReadSnapshotBase(hashSnapshot, nSnapshotChainTx);
+
     // Calculate nChainWork
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
@@ -3170,6 +3888,12 @@ bool static LoadBlockIndexDB()
                 pindex->nChainTx = pindex->nTx;
             }
         }
+        // Blocks on top of a UTXO snapshot count from it, whatever is known below it
+        if (pindex->GetBlockHash() == hashSnapshot) {
+            pindexSnapshot = pindex;
+            if (!pindex->nChainTx)
+                pindex->nChainTx = nSnapshotChainTx;
+        }
         if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->nChainTx || pindex->pprev == NULL))
             setBlockIndexCandidates.insert(pindex);
         if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
@@ -3224,6 +3948,9 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("LoadBlockIndexDB(): transaction index %s\n", fTxIndex ? "enabled" : "disabled");
 
+    // Check whether any blocks have been stored without witness data
+    pblocktree->ReadFlag("prunedwitness", fHavePrunedWitness);
+
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
@@ -3240,6 +3967,221 @@ bool static LoadBlockIndexDB()
     return true;
 }
 
+bool LoadUTXOSnapshot(CAutoFile &file, const uint256 &hashExpected, CCoinsStats &stats, std::string &strError)
+{
+    LOCK(cs_main);
+    CCoinsSnapshotHeader header;
+    try {
+        unsigned char pchMessageStart[MESSAGE_START_SIZE];
+        file >> FLATDATA(pchMessageStart) >> header;
+    } catch (std::exception &e) {
+        strError = "Snapshot file is truncated";
+        return false;
+    }
+    BlockMap::iterator mi = mapBlockIndex.find(header.hashBlock);
+    if (mi == mapBlockIndex.end()) {
+        strError = strprintf("Snapshot block %s is not in the block index yet", header.hashBlock.ToString());
+        return false;
+    }
+    CBlockIndex *pindex = mi->second;
+    if (pindex->nStatus & BLOCK_FAILED_MASK) {
+        strError = "Snapshot block is invalid";
+        return false;
+    }
+    if (pindex->nHeight <= chainActive.Height() || pindex->GetAncestor(chainActive.Height()) != chainActive.Tip()) {
+        strError = "Snapshot block does not extend the active chain";
+        return false;
+    }
+
+    // Nothing cached may hide the new set
+    FlushStateToDisk();
+    if (!pcoinsTip->Flush()) {
+        strError = "Failed to flush coin cache";
+        return false;
+    }
+    if (!pblocktree->WriteSnapshotBase(header.hashBlock, header.nChainTx) ||
+        !pcoinsdbview->LoadSnapshot(file, hashExpected, header, stats, strError)) {
+        if (strError.empty())
+            strError = "Failed to write to block index database";
+        // Past the point of no return there is no UTXO set to go on with
+        if (pcoinsdbview->IsLoadingSnapshot())
+            return AbortNode("Failed to load UTXO snapshot: " + strError);
+        pblocktree->WriteSnapshotBase(pindexSnapshot ? pindexSnapshot->GetBlockHash() : uint256(0), pindexSnapshot ? pindexSnapshot->nChainTx : 0);
+        return false;
+    }
+    stats.nHeight = pindex->nHeight;
+    // Start over with an empty cache, which reads the best block and commitment of the new set
+    CCoinsView *pcoinsBase = pcoinsTip->GetBackend();
+    delete pcoinsTip;
+    pcoinsTip = new CCoinsViewCache(pcoinsBase);
+    pindexSnapshot = pindex;
+
+    if (!pindex->nChainTx) {
+        pindex->nChainTx = header.nChainTx;
+        // Blocks on top of it which arrived earlier can be connected now
+        deque<CBlockIndex*> queue;
+        queue.push_back(pindex);
+        while (!queue.empty()) {
+            CBlockIndex *pindexLinked = queue.front();
+            queue.pop_front();
+            if (pindexLinked != pindex) {
+                pindexLinked->nChainTx = pindexLinked->pprev->nChainTx + pindexLinked->nTx;
+                setBlockIndexCandidates.insert(pindexLinked);
+            }
+            std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindexLinked);
+            while (range.first != range.second) {
+                std::multimap<CBlockIndex*, CBlockIndex*>::iterator it = range.first;
+                queue.push_back(it->second);
+                range.first++;
+                mapBlocksUnlinked.erase(it);
+            }
+        }
+    }
+    chainActive.SetTip(pindex);
+    PruneBlockIndexCandidates();
+    mempool.clear();
+    mempool.AddTransactionsUpdated(1);
+    LogPrintf("%s: UTXO set loaded at block %s height=%d, %u transactions\n", __func__,
+        header.hashBlock.ToString(), pindex->nHeight, (unsigned int)stats.nTransactions);
+    return true;
+}
+
+namespace {
+
+/** A block VerifyDB is working through, and the outcome of the checks done on it ahead of time */
+struct CVerifyBlock
+{
+    CBlockIndex* pindex;
+    CBlock block;
+    bool fDone;
+    //! What the checks found wrong, or empty if it passed them
+    std::string strError;
+
+    CVerifyBlock(CBlockIndex* pindexIn) : pindex(pindexIn), fDone(false) {}
+};
+
+/**
+ * Worker pool running the checks of VerifyDB which only concern a block by
+ * itself: reading it (level 0), CheckBlock (level 1) and reading its undo
+ * data (level 2). They run ahead of VerifyDB, which takes the blocks back in
+ * order for the in-memory disconnect and reconnect steps, as each of those
+ * depends on the one before. Blocks which passed CheckBlock are marked as
+ * such, so ConnectBlock doesn't check them again.
+ */
+class CVerifyDBPrefetch
+{
+private:
+    boost::mutex mutex;
+    //! Signalled whenever a block is checked or taken
+    boost::condition_variable cond;
+    const std::vector<CBlockIndex*> vIndex;
+    const int nCheckLevel;
+    //! Index into vIndex of the next block to start on
+    size_t nNext;
+    //! Blocks started on and not taken yet, in order
+    std::deque<CVerifyBlock*> queue;
+    bool fStop;
+    boost::thread_group threads;
+
+    void ThreadCheck();
+    void Check(CVerifyBlock& item) const;
+
+public:
+    //! Start checking the blocks of vIndexIn, in that order, up to nCheckLevelIn (at most 2)
+    CVerifyDBPrefetch(const std::vector<CBlockIndex*>& vIndexIn, int nCheckLevelIn);
+    //! Stop all threads and drop the blocks not taken yet
+    ~CVerifyDBPrefetch();
+
+    //! Wait for the next block in order to be checked and take it, or return NULL at the end
+    CVerifyBlock* Next();
+};
+
+CVerifyDBPrefetch::CVerifyDBPrefetch(const std::vector<CBlockIndex*>& vIndexIn, int nCheckLevelIn) :
+    vIndex(vIndexIn), nCheckLevel(nCheckLevelIn), nNext(0), fStop(false)
+{
+    for (int i = 0; i < std::max(1, nScriptCheckThreads); i++)
+        threads.create_thread(boost::bind(&CVerifyDBPrefetch::ThreadCheck, this));
+}
+
+CVerifyDBPrefetch::~CVerifyDBPrefetch()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+    }
+    cond.notify_all();
+    threads.join_all();
+    BOOST_FOREACH(CVerifyBlock* pitem, queue)
+        delete pitem;
+}
+
+void CVerifyDBPrefetch::Check(CVerifyBlock& item) const
+{
+    // The block index isn't modified while VerifyDB holds cs_main, except
+    // for blocks it reconnects, which have been taken from the queue by then.
+    const CBlockIndex* pindex = item.pindex;
+    // check level 0: read from disk
+    if (!ReadBlockFromDisk(item.block, pindex)) {
+        item.strError = "ReadBlockFromDisk failed";
+        return;
+    }
+    // check level 1: verify block validity
+    CValidationState state;
+    if (nCheckLevel >= 1 && !CheckBlock(item.block, state)) {
+        item.strError = "found bad block";
+        return;
+    }
+    // check level 2: verify undo validity
+    if (nCheckLevel >= 2) {
+        CBlockUndo undo;
+        CDiskBlockPos pos = pindex->GetUndoPos();
+        if (!pos.IsNull() && !undo.ReadFromDisk(pos, pindex->pprev->GetBlockHash()))
+            item.strError = "found bad undo data";
+    }
+}
+
+void CVerifyDBPrefetch::ThreadCheck()
+{
+    RenameThread("bitcoin-verifydb");
+    while (true) {
+        CVerifyBlock* pitem;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fStop && nNext < vIndex.size() && queue.size() >= VERIFYDB_PREFETCH_BLOCKS)
+                cond.wait(lock);
+            if (fStop || nNext == vIndex.size())
+                return;
+            pitem = new CVerifyBlock(vIndex[nNext++]);
+            queue.push_back(pitem);
+        }
+        try {
+            Check(*pitem);
+        } catch (const std::exception &e) {
+            pitem->strError = e.what();
+        }
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            pitem->fDone = true;
+        }
+        cond.notify_all();
+    }
+}
+
+CVerifyBlock* CVerifyDBPrefetch::Next()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (queue.empty() ? nNext < vIndex.size() : !queue.front()->fDone)
+        cond.wait(lock);
+    if (queue.empty())
+        return NULL;
+    CVerifyBlock* pitem = queue.front();
+    queue.pop_front();
+    cond.notify_all();
+    return pitem;
+}
+
+} // anon namespace
+
 CVerifyDB::CVerifyDB()
 {
     uiInterface.ShowProgress(_("Verifying blocks..."), 0);
@@ -3263,62 +4205,80 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
         nCheckDepth = chainActive.Height();
     nCheckLevel = std::max(0, std::min(4, nCheckLevel));
     LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
+
+    // Collect the blocks to verify, from the tip down
+    std::vector<CBlockIndex*> vIndex;
+    for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev)
+    {
+        if (pindex->nHeight < chainActive.Height()-nCheckDepth || pindex->nHeight == 0)
+            break;
+        // There is no undo data for the block a UTXO snapshot was loaded at
+        if (pindex == pindexSnapshot) {
+            LogPrintf("VerifyDB(): block verification stopping at height %d (UTXO snapshot)\n", pindex->nHeight);
+            break;
+        }
+        // Witness-stripped blocks can neither be checked nor disconnected
+        if (pindex->nStatus & BLOCK_WITNESS_PRUNED) {
+            LogPrintf("VerifyDB(): block verification stopping at height %d (witness pruned)\n", pindex->nHeight);
+            break;
+        }
+        vIndex.push_back(pindex);
+    }
+
     CCoinsViewCache coins(coinsview);
     CBlockIndex* pindexState = chainActive.Tip();
     CBlockIndex* pindexFailure = NULL;
     int nGoodTransactions = 0;
     CValidationState state;
-    for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev)
     {
-        boost::this_thread::interruption_point();
-        uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
-        if (pindex->nHeight < chainActive.Height()-nCheckDepth || pindex->nHeight == 0)
-            break;
-        CBlock block;
-        // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex))
-            return error("VerifyDB() : *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state))
-            return error("VerifyDB() : *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
-            CDiskBlockPos pos = pindex->GetUndoPos();
-            if (!pos.IsNull()) {
-                if (!undo.ReadFromDisk(pos, pindex->pprev->GetBlockHash()))
-                    return error("VerifyDB() : *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+        // check levels 0 to 2 are done by the workers
+        CVerifyDBPrefetch prefetch(vIndex, std::min(2, nCheckLevel));
+        while (true)
+        {
+            boost::this_thread::interruption_point();
+            boost::scoped_ptr<CVerifyBlock> pitem(prefetch.Next());
+            if (!pitem)
+                break;
+            CBlockIndex* pindex = pitem->pindex;
+            uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
+            if (!pitem->strError.empty())
+                return error("VerifyDB() : *** %s at %d, hash=%s", pitem->strError, pindex->nHeight, pindex->GetBlockHash().ToString());
+            // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
+            if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
+                bool fClean = true;
+                if (!DisconnectBlock(pitem->block, state, pindex, coins, &fClean))
+                    return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+                pindexState = pindex->pprev;
+                if (!fClean) {
+                    nGoodTransactions = 0;
+                    pindexFailure = pindex;
+                } else
+                    nGoodTransactions += pitem->block.vtx.size();
             }
+            if (ShutdownRequested())
+                return true;
         }
-        // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
-            bool fClean = true;
-            if (!DisconnectBlock(block, state, pindex, coins, &fClean))
-                return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            pindexState = pindex->pprev;
-            if (!fClean) {
-                nGoodTransactions = 0;
-                pindexFailure = pindex;
-            } else
-                nGoodTransactions += block.vtx.size();
-        }
-        if (ShutdownRequested())
-            return true;
     }
     if (pindexFailure)
         return error("VerifyDB() : *** coin database inconsistencies found (last %i blocks, %i good transactions before that)\n", chainActive.Height() - pindexFailure->nHeight + 1, nGoodTransactions);
 
-    // check level 4: try reconnecting blocks
+    // check level 4: try reconnecting blocks, with the workers reading and checking them ahead
     if (nCheckLevel >= 4) {
-        CBlockIndex *pindex = pindexState;
-        while (pindex != chainActive.Tip()) {
+        vIndex.clear();
+        for (CBlockIndex* pindex = chainActive.Next(pindexState); pindex; pindex = chainActive.Next(pindex))
+            vIndex.push_back(pindex);
+        CVerifyDBPrefetch prefetch(vIndex, 1);
+        while (true) {
             boost::this_thread::interruption_point();
+            boost::scoped_ptr<CVerifyBlock> pitem(prefetch.Next());
+            if (!pitem)
+                break;
+            CBlockIndex* pindex = pitem->pindex;
             uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * 50))));
-            pindex = chainActive.Next(pindex);
-            CBlock block;
-            if (!ReadBlockFromDisk(block, pindex))
-                return error("VerifyDB() : *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            if (!ConnectBlock(block, state, pindex, coins))
+            if (!pitem->strError.empty())
+                return error("VerifyDB() : *** %s at %d, hash=%s", pitem->strError, pindex->nHeight, pindex->GetBlockHash().ToString());
+            // Script checks run on the script check threads, as when connecting any block
+            if (!ConnectBlock(pitem->block, state, pindex, coins))
                 return error("VerifyDB() : *** found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
         }
     }
@@ -3331,9 +4291,17 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
 void UnloadBlockIndex()
 {
     mapBlockIndex.clear();
+    BOOST_FOREACH(const PAIRTYPE(const CBlockIndex*, CScript)& item, mapUnwrittenSolutions)
+        AddHeldSolutionMemoryStats(-(int64_t)item.second.size());
+    mapUnwrittenSolutions.clear();
+    BOOST_FOREACH(const PAIRTYPE(const CBlockIndex*, CScript)& item, listRecentSolutions)
+        AddHeldSolutionMemoryStats(-(int64_t)item.second.size());
+    listRecentSolutions.clear();
+    mapRecentSolutions.clear();
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
     pindexBestInvalid = NULL;
+    pindexSnapshot = NULL;
 }
 
 bool LoadBlockIndex()
@@ -3385,20 +4353,107 @@ bool InitBlockIndex() {
 
 
 
-bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
+namespace {
+
+/** A block on its way through the import pipeline */
+struct CImportBlock
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+    //! The serialized block, until it is parsed
+    std::vector<char> vData;
+    unsigned int nSize;
+    CDiskBlockPos pos;
+    CBlock block;
+    bool fParsed;
+    //! Whether it deserialized. It may still have failed CheckBlock, which connecting it repeats.
+    bool fValid;
 
-    int nLoaded = 0;
+    CImportBlock() : nSize(0), fParsed(false), fValid(false) {}
+};
+
+/**
+ * Pipeline importing the blocks of one file. A reader thread locates them
+ * with large sequential reads, parser threads deserialize them and run the
+ * context-free checks (CheckBlock, including the block proof) in parallel,
+ * and the importing thread takes them back in file order to connect them.
+ * Blocks which passed CheckBlock are marked as such, so connecting them
+ * doesn't check them again.
+ */
+class CBlockImportPipeline
+{
+private:
+    boost::mutex mutex;
+    //! Signalled whenever a block is read, parsed or taken, and when reading ends
+    boost::condition_variable cond;
+    //! Blocks read and not taken yet, in file order. The first nTaken went to the parsers.
+    std::deque<CImportBlock*> queue;
+    size_t nTaken;
+    size_t nQueuedSize;
+    bool fReadDone;
+    bool fStop;
+    int nParsers;
+    boost::thread_group threads;
+
+    //! Per-stage statistics; times are what each stage spent working rather than waiting
+    int64_t nStartTime;
+    uint64_t nFileSize;
+    uint64_t nBytesRead;
+    unsigned int nRead, nParsed, nConnected;
+    int64_t nReadTime, nParseTime, nConnectWaitTime;
+
+    void ThreadRead(FILE* fileIn, int nFile);
+    void ThreadParse();
+
+public:
+    //! Start reading fileIn, which the pipeline takes over, from its current position
+    CBlockImportPipeline(FILE* fileIn, int nFile);
+    //! Stop all threads and drop the blocks not taken yet
+    ~CBlockImportPipeline();
+
+    //! Wait for the next block in file order to be parsed and take it, or return NULL at the end
+    CImportBlock* Next();
+
+    void LogProgress();
+};
+
+CBlockImportPipeline::CBlockImportPipeline(FILE* fileIn, int nFile) :
+    nTaken(0), nQueuedSize(0), fReadDone(false), fStop(false), nParsers(std::max(1, nScriptCheckThreads)),
+    nStartTime(GetTimeMicros()), nFileSize(0), nBytesRead(0), nRead(0), nParsed(0), nConnected(0),
+    nReadTime(0), nParseTime(0), nConnectWaitTime(0)
+{
+    long nPos = ftell(fileIn);
+    if (nPos >= 0 && fseek(fileIn, 0, SEEK_END) == 0) {
+        long nEnd = ftell(fileIn);
+        if (nEnd >= nPos)
+            nFileSize = nEnd - nPos;
+        fseek(fileIn, nPos, SEEK_SET);
+    }
+    threads.create_thread(boost::bind(&CBlockImportPipeline::ThreadRead, this, fileIn, nFile));
+    for (int i = 0; i < nParsers; i++)
+        threads.create_thread(boost::bind(&CBlockImportPipeline::ThreadParse, this));
+}
+
+CBlockImportPipeline::~CBlockImportPipeline()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+    }
+    cond.notify_all();
+    threads.join_all();
+    BOOST_FOREACH(CImportBlock* pblock, queue)
+        delete pblock;
+}
+
+void CBlockImportPipeline::ThreadRead(FILE* fileIn, int nFile)
+{
+    RenameThread("bitcoin-blkread");
+    int64_t nWaitTime = 0;
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+        // Allow rewinding over a whole record plus the start of the next
+        CBufferedFile blkdat(fileIn, BLOCK_IMPORT_BUFFER_SIZE, MAX_BLOCK_SIZE+16, SER_DISK, CLIENT_VERSION);
         uint64_t nRewind = blkdat.GetPos();
         while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
-
             blkdat.SetPos(nRewind);
             nRewind++; // start one byte further next time, in case of failure
             blkdat.SetLimit(); // remove former limit
@@ -3419,16 +4474,172 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
                 // no valid block header found; don't complain
                 break;
             }
+            CImportBlock* pblock = new CImportBlock();
             try {
-                // read block
+                // read block, leaving it to the parsers to deserialize
                 uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
+                pblock->pos = CDiskBlockPos(nFile, nBlockPos);
+                pblock->nSize = nSize;
+                pblock->vData.resize(nSize);
                 blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
+                blkdat.read(&pblock->vData[0], nSize);
+                // The block isn't deserialized yet, so only skip past it if
+                // another record (witness-stripped or not), the zero padding
+                // of a preallocated file, or the end of the file follows. A
+                // record torn by a crash may claim a length running over
+                // blocks written after it; those are found by scanning on
+                // from one byte past its start, as if it had failed to
+                // deserialize.
+                uint64_t nRecordEnd = blkdat.GetPos();
+                blkdat.SetLimit();
+                bool fBoundary = true;
+                try {
+                    unsigned char buf[MESSAGE_START_SIZE];
+                    blkdat >> FLATDATA(buf);
+                    MessageStartChars pchStripped;
+                    GetStrippedMessageStart(pchStripped);
+                    static const unsigned char pchPadding[MESSAGE_START_SIZE] = {};
+                    fBoundary = memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE) == 0 ||
+                                memcmp(buf, pchStripped, MESSAGE_START_SIZE) == 0 ||
+                                memcmp(buf, pchPadding, MESSAGE_START_SIZE) == 0;
+                } catch (const std::exception &) {
+                    // end of file
+                }
+                if (fBoundary)
+                    nRewind = nRecordEnd;
+            } catch (const std::exception &e) {
+                LogPrintf("%s : Deserialize or I/O error - %s\n", __func__, e.what());
+                delete pblock;
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            int64_t nWaitStart = GetTimeMicros();
+            while (!fStop && !queue.empty() && nQueuedSize + nSize > BLOCK_IMPORT_QUEUE_SIZE)
+                cond.wait(lock);
+            nWaitTime += GetTimeMicros() - nWaitStart;
+            if (fStop) {
+                delete pblock;
+                break;
+            }
+            queue.push_back(pblock);
+            nQueuedSize += nSize;
+            nRead++;
+            nBytesRead = nRewind;
+            nReadTime = GetTimeMicros() - nStartTime - nWaitTime;
+            cond.notify_all();
+        }
+    } catch (const std::exception &e) {
+        LogPrintf("%s : %s\n", __func__, e.what());
+    }
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fReadDone = true;
+    cond.notify_all();
+}
+
+void CBlockImportPipeline::ThreadParse()
+{
+    RenameThread("bitcoin-blkparse");
+    while (true) {
+        CImportBlock* pblock;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fStop && nTaken == queue.size() && !fReadDone)
+                cond.wait(lock);
+            if (fStop || nTaken == queue.size())
+                return;
+            pblock = queue[nTaken++];
+        }
+        int64_t nStart = GetTimeMicros();
+        try {
+            CDataStream ss(pblock->vData, SER_DISK, CLIENT_VERSION);
+            ss >> pblock->block;
+            pblock->fValid = true;
+        } catch (const std::exception &e) {
+            LogPrintf("%s : Deserialize or I/O error - %s\n", __func__, e.what());
+        }
+        std::vector<char>().swap(pblock->vData);
+        // Whatever happens here, the block must be marked parsed, or Next() waits for it forever
+        if (pblock->fValid) {
+            try {
+                CValidationState state;
+                CheckBlock(pblock->block, state);
+            } catch (const std::exception &e) {
+                // Connecting the block checks it again, and fails the same way there
+                LogPrintf("%s : CheckBlock error - %s\n", __func__, e.what());
+            } catch (...) {
+                LogPrintf("%s : CheckBlock error\n", __func__);
+            }
+        }
+        int64_t nTime = GetTimeMicros() - nStart;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            pblock->fParsed = true;
+            nParsed++;
+            nParseTime += nTime;
+        }
+        cond.notify_all();
+    }
+}
+
+CImportBlock* CBlockImportPipeline::Next()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    int64_t nWaitStart = GetTimeMicros();
+    while (queue.empty() ? !fReadDone : !queue.front()->fParsed)
+        cond.wait(lock);
+    nConnectWaitTime += GetTimeMicros() - nWaitStart;
+    if (queue.empty())
+        return NULL;
+    CImportBlock* pblock = queue.front();
+    queue.pop_front();
+    nTaken--;
+    nQueuedSize -= pblock->nSize;
+    nConnected++;
+    cond.notify_all();
+    return pblock;
+}
+
+void CBlockImportPipeline::LogProgress()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    // Each stage's rate is what it sustains while busy, so the slowest one is the bottleneck
+    int64_t nConnectTime = GetTimeMicros() - nStartTime - nConnectWaitTime;
+    LogPrintf("Block import: %s read, %u blocks connected (height %d); read %.1f MB/s, parse %.1f blocks/s on %d threads, connect %.1f blocks/s\n",
+        nFileSize ? strprintf("%d%%", (int)(nBytesRead * 100 / nFileSize)) : strprintf("%u MB", (unsigned int)(nBytesRead >> 20)),
+        nConnected, chainActive.Height(),
+        nReadTime > 0 ? nBytesRead / (double)nReadTime : 0.0,
+        nParseTime > 0 ? nParsed * 1000000.0 * nParsers / nParseTime : 0.0, nParsers,
+        nConnectTime > 0 ? nConnected * 1000000.0 / nConnectTime : 0.0);
+}
+
+} // anon namespace
+
+bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
+{
+    // Map of disk positions for blocks with unknown parent (only used for reindex)
+    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+    int64_t nStart = GetTimeMillis();
+
+    int nLoaded = 0;
+    try {
+        CBlockImportPipeline pipeline(fileIn, dbp ? dbp->nFile : -1);
+        int64_t nLastProgress = nStart;
+        while (true) {
+            boost::this_thread::interruption_point();
+            boost::scoped_ptr<CImportBlock> pimport(pipeline.Next());
+            if (!pimport)
+                break;
+            if (GetTimeMillis() - nLastProgress > 10000) {
+                pipeline.LogProgress();
+                nLastProgress = GetTimeMillis();
+            }
+            if (!pimport->fValid)
+                continue;
+            try {
+                if (dbp)
+                    dbp->nPos = pimport->pos.nPos;
+                CBlock& block = pimport->block;
 
                 // detect out of order blocks, and store them for later
                 uint256 hash = block.GetHash();
@@ -3479,6 +4690,7 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
                 LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
             }
         }
+        pipeline.LogProgress();
     } catch(std::runtime_error &e) {
         AbortNode(std::string("System error: ") + e.what());
     }
@@ -3495,6 +4707,10 @@ void static CheckBlockIndex()
 
     LOCK(cs_main);
 
+    // The checks below assume all blocks in the active chain were received
+    if (pindexSnapshot)
+        return;
+
     // During a reindex, we read the genesis block and call CheckBlockIndex before ActivateBestChain,
     // so we have the genesis block in mapBlockIndex but no active chain.  (A few of the tests when
     // iterating the block tree require that chainActive has been initialized.)
@@ -3737,7 +4953,7 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_STRIPPED_BLOCK)
             {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
@@ -3755,6 +4971,16 @@ void static ProcessGetData(CNode* pfrom)
                             LogPrintf("ProcessGetData(): ignoring request from peer=%i for old block that isn't in the main chain\n", pfrom->GetId());
                         }
                     }
+                    // The active chain can have blocks we never had the data for, below a loaded UTXO snapshot
+                    if (send && !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                        LogPrint("net", "ProcessGetData(): ignoring request from peer=%i for block %s we don't have the data for\n", pfrom->GetId(), inv.hash.ToString());
+                        send = false;
+                    }
+                    // Blocks stored without witness can only be served stripped
+                    if (send && inv.type != MSG_STRIPPED_BLOCK && (mi->second->nStatus & BLOCK_WITNESS_PRUNED)) {
+                        LogPrint("net", "ProcessGetData(): ignoring request from peer=%i for witness pruned block %s\n", pfrom->GetId(), inv.hash.ToString());
+                        send = false;
+                    }
                 }
                 if (send)
                 {
@@ -3764,6 +4990,12 @@ void static ProcessGetData(CNode* pfrom)
                         assert(!"cannot load block from disk");
                     if (inv.type == MSG_BLOCK)
                         pfrom->PushMessage("block", block);
+                    else if (inv.type == MSG_STRIPPED_BLOCK)
+                    {
+                        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_VERSION_MASK_NO_WITNESS);
+                        ssBlock << block;
+                        pfrom->PushMessage("strippedblock", ssBlock);
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
                         LOCK(pfrom->cs_filter);
@@ -4221,6 +5453,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         for (; pindex; pindex = chainActive.Next(pindex))
         {
             vHeaders.push_back(pindex->GetBlockHeader());
+            if (!ReadBlockSolution(pindex, vHeaders.back().proof.solution))
+                return error("getheaders : failed to read the proof of block %s", pindex->GetBlockHash().ToString());
             if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
                 break;
         }
@@ -4359,14 +5593,20 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         }
 
+        // Verify all new proofs up front, in parallel; the ones that didn't
+        // verify that way are checked one by one below.
+        std::vector<char> vProofValid;
+        CheckHeaderProofs(headers, vProofValid);
+
         CBlockIndex *pindexLast = NULL;
-        BOOST_FOREACH(const CBlockHeader& header, headers) {
+        for (unsigned int i = 0; i < headers.size(); i++) {
+            const CBlockHeader& header = headers[i];
             CValidationState state;
             if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, &pindexLast)) {
+            if (!AcceptBlockHeader(header, state, &pindexLast, !vProofValid[i])) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -5014,6 +6254,8 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
 
 bool CBlockUndo::WriteToDisk(CDiskBlockPos &pos, const uint256 &hashBlock)
 {
+    CValidationTimer timer(VALIDATION_WRITE_DISK);
+
     // Open history file to append
     CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
     if (fileout.IsNull())
@@ -5066,6 +6308,111 @@ bool CBlockUndo::ReadFromDisk(const CDiskBlockPos &pos, const uint256 &hashBlock
     return true;
 }
 
+CTxWitness::CTxWitness(const CTransaction& tx)
+{
+    vScriptSig.reserve(tx.vin.size());
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        vScriptSig.push_back(txin.scriptSig);
+    vRangeproof.reserve(tx.vout.size());
+    vNonceCommitment.reserve(tx.vout.size());
+    BOOST_FOREACH(const CTxOut& txout, tx.vout) {
+        vRangeproof.push_back(txout.nValue.vchRangeproof);
+        vNonceCommitment.push_back(txout.nValue.vchNonceCommitment);
+    }
+}
+
+bool CTxWitness::ApplyTo(CTransaction& tx) const
+{
+    if (vScriptSig.size() != tx.vin.size() || vRangeproof.size() != tx.vout.size() || vNonceCommitment.size() != tx.vout.size())
+        return false;
+    CMutableTransaction mtx(tx);
+    for (unsigned int i = 0; i < mtx.vin.size(); i++)
+        mtx.vin[i].scriptSig = vScriptSig[i];
+    for (unsigned int i = 0; i < mtx.vout.size(); i++) {
+        mtx.vout[i].nValue.vchRangeproof = vRangeproof[i];
+        mtx.vout[i].nValue.vchNonceCommitment = vNonceCommitment[i];
+    }
+    CTransaction txFull(mtx);
+    if (txFull.GetFullHash() != tx.GetFullHash())
+        return false;
+    tx = txFull;
+    return true;
+}
+
+CBlockWitness::CBlockWitness(const CBlock& block)
+{
+    vtxwit.reserve(block.vtx.size());
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+        vtxwit.push_back(CTxWitness(block.vtx[i]));
+}
+
+bool CBlockWitness::ApplyTo(CBlock& block) const
+{
+    if (block.vtx.empty() || vtxwit.size() != block.vtx.size() - 1)
+        return false;
+    for (unsigned int i = 0; i < vtxwit.size(); i++)
+        if (!vtxwit[i].ApplyTo(block.vtx[i + 1]))
+            return false;
+    return true;
+}
+
+bool CBlockWitness::WriteToDisk(CDiskBlockPos &pos, const uint256 &hashBlock)
+{
+    CValidationTimer timer(VALIDATION_WRITE_DISK);
+
+    // Open witness file to append
+    CAutoFile fileout(OpenWitnessFile(pos), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        return error("CBlockWitness::WriteToDisk : OpenWitnessFile failed");
+    if (fseek(fileout.Get(), 0, SEEK_END))
+        return error("CBlockWitness::WriteToDisk : fseek failed");
+
+    // Write index header
+    unsigned int nSize = fileout.GetSerializeSize(*this);
+    fileout << FLATDATA(Params().MessageStart()) << nSize;
+
+    // Write witness data
+    long fileOutPos = ftell(fileout.Get());
+    if (fileOutPos < 0)
+        return error("CBlockWitness::WriteToDisk : ftell failed");
+    pos.nPos = (unsigned int)fileOutPos;
+    fileout << *this;
+
+    // calculate & write checksum
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    hasher << hashBlock;
+    hasher << *this;
+    fileout << hasher.GetHash();
+
+    return true;
+}
+
+bool CBlockWitness::ReadFromDisk(const CDiskBlockPos &pos, const uint256 &hashBlock)
+{
+    // Open witness file to read
+    CAutoFile filein(OpenWitnessFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("CBlockWitness::ReadFromDisk : OpenWitnessFile failed");
+
+    uint256 hashChecksum;
+    try {
+        filein >> *this;
+        filein >> hashChecksum;
+    }
+    catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    // Verify checksum (rangeproofs aren't covered by the witness hash ApplyTo() checks)
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    hasher << hashBlock;
+    hasher << *this;
+    if (hashChecksum != hasher.GetHash())
+        return error("CBlockWitness::ReadFromDisk : Checksum mismatch");
+
+    return true;
+}
+
  std::string CBlockFileInfo::ToString() const {
      return strprintf("CBlockFileInfo(blocks=%u, size=%u, heights=%u...%u, time=%s...%s)", nBlocks, nSize, nHeightFirst, nHeightLast, DateTimeStrFormat("%Y-%m-%d", nTimeFirst), DateTimeStrFormat("%Y-%m-%d", nTimeLast));
  }
@@ -35,13 +35,16 @@
 #include <utility>
 #include <vector>
 
+#include <boost/shared_ptr.hpp>
 #include <boost/unordered_map.hpp>
 
 class CBlockIndex;
+class CAutoFile;
 class CBlockTreeDB;
 class CBloomFilter;
+class CCoinsViewDB;
 class CInv;
-class CScriptCheck;
+class CCheck;
 class CValidationInterface;
 class CValidationState;
 
@@ -69,6 +72,12 @@ static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** Size of the buffer block files are imported through, which bounds the size of each read */
+static const unsigned int BLOCK_IMPORT_BUFFER_SIZE = 16 * MAX_BLOCK_SIZE;
+/** Serialized size of the blocks an import holds between reading and connecting them */
+static const unsigned int BLOCK_IMPORT_QUEUE_SIZE = 32 * MAX_BLOCK_SIZE;
+/** Number of blocks VerifyDB reads and checks ahead of the one it is disconnecting or reconnecting */
+static const unsigned int VERIFYDB_PREFETCH_BLOCKS = 64;
 /** Coinbase transaction outputs can only be spent after this number of new blocks (network rule) */
 static const int COINBASE_MATURITY = 1;
 /** Maximum number of script-checking threads allowed */
@@ -82,6 +91,10 @@ static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached their tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 2000;
+/** Number of block proof solutions kept in memory after being written or read back (see ReadBlockSolution) */
+static const unsigned int MAX_RECENT_BLOCK_SOLUTIONS = 4 * MAX_HEADERS_RESULTS;
+/** Number of received headers whose proofs are verified together, with their signatures batched. */
+static const unsigned int PROOF_CHECK_BATCH_SIZE = 16;
 /** Size of the "block download window": how far ahead of our current height do we fetch?
  *  Larger windows tolerate larger download speed differences between peer, but increase the potential
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
@@ -89,6 +102,8 @@ static const unsigned int MAX_HEADERS_RESULTS = 2000;
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 /** Time to wait (in seconds) between writing blockchain state to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 3600;
+/** Minimum depth (in blocks) of blocks stored without witness data by -prunewitness. */
+static const int MIN_PRUNE_WITNESS_DEPTH = 288;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 
@@ -122,9 +137,13 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern int nPruneWitnessDepth;
+extern bool fHavePrunedWitness;
+extern bool fWitnessFiles;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern bool fAsyncFlush;
+extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 
 /** Set of sidechains for which we will automatically create double-spend fraud proofs for */
@@ -168,6 +187,8 @@ bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
 FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 /** Open an undo file (rev?????.dat) */
 FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
+/** Open a witness file (wit?????.dat) */
+FILE* OpenWitnessFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 /** Translation to a filesystem path */
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
@@ -193,8 +214,8 @@ void ThreadScriptCheck();
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core */
 std::string GetWarnings(std::string strFor);
-/** Retrieve a transaction (from memory pool, or from disk, if possible) */
-bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock, bool fAllowSlow = false);
+/** Retrieve a transaction (from memory pool, or from disk, if possible). Without fWitness, the witness of transactions in blocks may be left out */
+bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock, bool fAllowSlow = false, bool fWitness = true);
 /** Find the best known block, and make it the tip of the block chain */
 bool ActivateBestChain(CValidationState &state, const CBlock *pblock = NULL);
 CAmount GetBlockValue(int nHeight, const CAmount& nFees);
@@ -209,6 +230,13 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** Stop the background rewrite of a block file without witness, if any. Must be called without holding cs_main. */
+void StopPruneWitness();
+/**
+ * Replace the UTXO set with a snapshot taken on top of the current tip, and
+ * make the snapshot block the tip. History below it is not validated.
+ */
+bool LoadUTXOSnapshot(CAutoFile &file, const uint256 &hashExpected, CCoinsStats &stats, std::string &strError);
 
 
 /** (try to) add transaction to memory pool **/
@@ -289,11 +317,12 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& ma
 
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
- * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
- * instead of being performed inline.
+ * This does not modify the UTXO set. If pvChecks is not NULL, script and rangeproof checks are
+ * pushed onto it instead of being performed inline; ownership of the pushed checks passes to the caller.
+ * Without fRangeproofs, the rangeproofs of blinded outputs are assumed to have been verified already.
  */
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
-                 unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks = NULL);
+                 unsigned int flags, bool cacheStore, std::vector<CCheck*> *pvChecks = NULL, bool fRangeproofs = true);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, CTxUndo &txundo, int nHeight);
@@ -323,6 +352,52 @@ public:
     bool ReadFromDisk(const CDiskBlockPos &pos, const uint256 &hashBlock);
 };
 
+/** Witness data of a transaction, as stored in wit?????.dat */
+class CTxWitness
+{
+public:
+    std::vector<CScript> vScriptSig; // for each input
+    std::vector<std::vector<unsigned char> > vRangeproof; // for each output
+    std::vector<std::vector<unsigned char> > vNonceCommitment; // for each output
+
+    CTxWitness() {}
+    explicit CTxWitness(const CTransaction& tx);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(vScriptSig);
+        READWRITE(vRangeproof);
+        READWRITE(vNonceCommitment);
+    }
+
+    /** Put the witness back into the witness-stripped tx, checking its inputs' witness against the witness hash */
+    bool ApplyTo(CTransaction& tx) const;
+};
+
+/** Witness data of a CBlock whose body is stored witness-stripped */
+class CBlockWitness
+{
+public:
+    std::vector<CTxWitness> vtxwit; // for all but the coinbase
+
+    CBlockWitness() {}
+    explicit CBlockWitness(const CBlock& block);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(vtxwit);
+    }
+
+    bool ApplyTo(CBlock& block) const;
+
+    bool WriteToDisk(CDiskBlockPos &pos, const uint256 &hashBlock);
+    bool ReadFromDisk(const CDiskBlockPos &pos, const uint256 &hashBlock);
+};
+
 enum {
     /* Interpret sequence numbers as relative lock-time constraints. */
     LOCKTIME_VERIFY_SEQUENCE = (1 << 0),
@@ -344,11 +419,28 @@ int64_t LockTime(const CTransaction &tx, int flags, const CCoinsView* pCoinsView
  */
 int64_t CheckLockTime(const CTransaction &tx, int flags = -1);
 
+/**
+ * Base class for a single verification that can be deferred onto the
+ * script check queue. Instances are heap-allocated; the queue owns them.
+ */
+class CCheck
+{
+protected:
+    ScriptError error;
+
+public:
+    CCheck() : error(SCRIPT_ERR_UNKNOWN_ERROR) {}
+    virtual ~CCheck() {}
+    virtual bool operator()() = 0;
+
+    ScriptError GetScriptError() const { return error; }
+};
+
 /** 
  * Closure representing one script verification
  * Note that this stores references to the spending transaction 
  */
-class CScriptCheck
+class CScriptCheck : public CCheck
 {
 private:
     CScript scriptPubKey;
@@ -360,39 +452,97 @@ private:
     int nSpendHeight;
     unsigned int nFlags;
     bool cacheStore;
-    ScriptError error;
+    //! Shared by the checks of all inputs of ptxTo
+    boost::shared_ptr<const PrecomputedTransactionData> txdata;
 
 public:
-    CScriptCheck(): ptxTo(0), nIn(0), nValueIn(-1), nValueInPreviousIn(-1), nTxFee(-1), nSpendHeight(-1), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, CTxOutValue nValueInPreviousInIn, CAmount nTxFeeIn, int nSpendHeightIn, unsigned int nFlagsIn, bool cacheIn) :
+    CScriptCheck(): ptxTo(0), nIn(0), nValueIn(-1), nValueInPreviousIn(-1), nTxFee(-1), nSpendHeight(-1), nFlags(0), cacheStore(false) {}
+    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, CTxOutValue nValueInPreviousInIn, CAmount nTxFeeIn, int nSpendHeightIn, unsigned int nFlagsIn, bool cacheIn,
+                 const boost::shared_ptr<const PrecomputedTransactionData>& txdataIn = boost::shared_ptr<const PrecomputedTransactionData>()) :
         scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
         ptxTo(&txToIn), nIn(nInIn), nValueIn(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
         nValueInPreviousIn(nValueInPreviousInIn), nTxFee(nTxFeeIn), nSpendHeight(nSpendHeightIn),
-        nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) { }
+        nFlags(nFlagsIn), cacheStore(cacheIn), txdata(txdataIn) { }
 
     bool operator()();
 
-    void swap(CScriptCheck &check) {
-        scriptPubKey.swap(check.scriptPubKey);
-        std::swap(ptxTo, check.ptxTo);
-        std::swap(nIn, check.nIn);
-        std::swap(nValueIn, check.nValueIn);
-        std::swap(nValueInPreviousIn, check.nValueInPreviousIn);
-        std::swap(nTxFee, check.nTxFee);
-        std::swap(nSpendHeight, check.nSpendHeight);
-        std::swap(nFlags, check.nFlags);
-        std::swap(cacheStore, check.cacheStore);
-        std::swap(error, check.error);
-    }
+    /**
+     * Run the script, queueing the signatures it requires in batch instead of
+     * verifying them. A true result only means the input is valid if the
+     * batch verifies too.
+     */
+    bool RunBatched(CSignatureBatch& batch);
 
-    ScriptError GetScriptError() const { return error; }
+    //! Whether the input spends a withdraw lock
+    bool IsWithdraw() const { return scriptPubKey.IsWithdrawLock(0); }
+};
+
+/**
+ * Closure verifying a group of script checks with their signatures batched:
+ * the scripts are run with verification of the signatures they require
+ * deferred, then all queued signatures are verified at once. If anything
+ * fails, each check is run again on its own to find the offending input.
+ */
+class CScriptBatchCheck : public CCheck
+{
+private:
+    std::vector<CScriptCheck*> vChecks;
+
+public:
+    ~CScriptBatchCheck();
+
+    //! Add a check to the group, which takes ownership of it.
+    void Add(CScriptCheck* check) { vChecks.push_back(check); }
+    size_t size() const { return vChecks.size(); }
+
+    void swap(CScriptBatchCheck& check) { vChecks.swap(check.vChecks); }
+
+    bool operator()();
+};
+
+/**
+ * Closure verifying the signed block proofs of a group of headers, with the
+ * signatures they require batched. If everything verifies, the valid flag of
+ * each header is set; otherwise they are left alone and the caller has to
+ * check the proofs on its own. Stores references to the headers and flags,
+ * which must outlive the check.
+ */
+class CProofBatchCheck : public CCheck
+{
+private:
+    std::vector<const CBlockHeader*> vHeaders;
+    std::vector<char*> vValid;
+
+public:
+    void Add(const CBlockHeader& header, char& fValid) { vHeaders.push_back(&header); vValid.push_back(&fValid); }
+    size_t size() const { return vHeaders.size(); }
+
+    bool operator()();
+};
+
+/**
+ * Closure representing the rangeproof verification of one blinded output.
+ * Note that this stores a reference to the output value, which must outlive the check
+ */
+class CRangeproofCheck : public CCheck
+{
+private:
+    const CTxOutValue *pval;
+    bool cacheStore;
+
+public:
+    CRangeproofCheck(const CTxOutValue& valIn, bool cacheIn) : pval(&valIn), cacheStore(cacheIn) { }
+
+    bool operator()();
 };
 
 
 /** Functions for disk access for blocks */
-bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos);
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
-bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, bool fStripWitness = false);
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, bool fWitnessStripped = false);
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, bool fWitness = true);
+/** Load the witness of a block read with fWitness = false, if it is stored separately */
+bool ReadBlockWitnessFromDisk(CBlock& block, const CBlockIndex* pindex);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -419,7 +569,7 @@ bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex
 
 /** Store block on disk. If dbp is provided, the file is known to already reside on disk */
 bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex **pindex, CDiskBlockPos* dbp = NULL);
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL);
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL, bool fCheckProof = true);
 
 
 
@@ -563,6 +713,9 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Global variable that points to the coin database pcoinsTip is backed by (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
@@ -0,0 +1,142 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "muhash.h"
+
+#include "crypto/sha256.h"
+
+#include <stdexcept>
+#include <string.h>
+
+namespace {
+
+/** The modulus, the largest 3072-bit safe prime */
+class CMuHashModulus
+{
+public:
+    BIGNUM *p;
+
+    CMuHashModulus() {
+        p = BN_new();
+        if (p == NULL || !BN_one(p) || !BN_lshift(p, p, 3072) || !BN_sub_word(p, 1103717))
+            throw std::runtime_error("CMuHashModulus : BN setup failed");
+    }
+
+    ~CMuHashModulus() {
+        BN_free(p);
+    }
+};
+
+CMuHashModulus modulus;
+
+void CheckBN(int ret)
+{
+    if (!ret)
+        throw std::runtime_error("CMuHash3072 : BN operation failed");
+}
+
+/** Expand a 256-bit hash into a 3072-bit number, by hashing it with a counter */
+BIGNUM* ExpandElement(const uint256 &hashElement)
+{
+    unsigned char buf[CMuHash3072::BYTE_SIZE];
+    for (unsigned char i = 0; i < CMuHash3072::BYTE_SIZE / CSHA256::OUTPUT_SIZE; i++)
+        CSHA256().Write(hashElement.begin(), 32).Write(&i, 1).Finalize(buf + i * CSHA256::OUTPUT_SIZE);
+    BIGNUM *num = BN_bin2bn(buf, sizeof(buf), NULL);
+    if (num == NULL)
+        throw std::runtime_error("CMuHash3072 : BN_bin2bn failed");
+    return num;
+}
+
+BIGNUM* Copy(const BIGNUM *num)
+{
+    if (num == NULL)
+        return NULL;
+    BIGNUM *ret = BN_dup(num);
+    if (ret == NULL)
+        throw std::runtime_error("CMuHash3072 : BN_dup failed");
+    return ret;
+}
+
+} // anon namespace
+
+CMuHash3072::CMuHash3072() : numerator(NULL), denominator(NULL) {}
+
+CMuHash3072::CMuHash3072(const CMuHash3072 &other) : numerator(Copy(other.numerator)), denominator(Copy(other.denominator)) {}
+
+CMuHash3072& CMuHash3072::operator=(const CMuHash3072 &other)
+{
+    if (this != &other) {
+        BIGNUM *numeratorNew = Copy(other.numerator);
+        BIGNUM *denominatorNew = Copy(other.denominator);
+        BN_free(numerator);
+        BN_free(denominator);
+        numerator = numeratorNew;
+        denominator = denominatorNew;
+    }
+    return *this;
+}
+
+CMuHash3072::~CMuHash3072()
+{
+    BN_free(numerator);
+    BN_free(denominator);
+}
+
+void CMuHash3072::Multiply(BIGNUM *&num, const uint256 &hashElement)
+{
+    BIGNUM *element = ExpandElement(hashElement);
+    if (num == NULL) {
+        num = element;
+        return;
+    }
+    BN_CTX *ctx = BN_CTX_new();
+    int ret = ctx != NULL && BN_mod_mul(num, num, element, modulus.p, ctx);
+    BN_CTX_free(ctx);
+    BN_free(element);
+    CheckBN(ret);
+}
+
+void CMuHash3072::GetValue(unsigned char value[BYTE_SIZE]) const
+{
+    BN_CTX *ctx = BN_CTX_new();
+    BIGNUM *result = BN_new();
+    BIGNUM *inverse = NULL;
+    int ret = ctx != NULL && result != NULL;
+    if (ret)
+        ret = numerator != NULL ? BN_nnmod(result, numerator, modulus.p, ctx) : BN_one(result);
+    if (ret && denominator != NULL) {
+        inverse = BN_mod_inverse(NULL, denominator, modulus.p, ctx);
+        ret = inverse != NULL && BN_mod_mul(result, result, inverse, modulus.p, ctx);
+    }
+    if (ret) {
+        // Big endian, padded to the full size
+        int nBytes = BN_num_bytes(result);
+        memset(value, 0, BYTE_SIZE);
+        BN_bn2bin(result, value + BYTE_SIZE - nBytes);
+    }
+    BN_free(inverse);
+    BN_free(result);
+    BN_CTX_free(ctx);
+    CheckBN(ret);
+}
+
+void CMuHash3072::SetValue(const unsigned char value[BYTE_SIZE])
+{
+    BIGNUM *numeratorNew = BN_bin2bn(value, BYTE_SIZE, NULL);
+    if (numeratorNew == NULL)
+        throw std::runtime_error("CMuHash3072 : BN_bin2bn failed");
+    BN_free(numerator);
+    BN_free(denominator);
+    numerator = numeratorNew;
+    denominator = NULL;
+}
+
+uint256 CMuHash3072::GetHash() const
+{
+    unsigned char value[BYTE_SIZE];
+    GetValue(value);
+    uint256 hash;
+    CSHA256().Write(value, BYTE_SIZE).Finalize(hash.begin());
+    return hash;
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MUHASH_H
+#define BITCOIN_MUHASH_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <openssl/bn.h>
+
+/**
+ * Hash of a multiset of elements which is updated in constant time as
+ * elements are added or removed, in any order. Each element is expanded to a
+ * number modulo the prime 2^3072 - 1103717, and the set is the product of
+ * its elements (removals multiply a separate denominator, which is only
+ * inverted when the hash is taken).
+ */
+class CMuHash3072
+{
+public:
+    static const size_t BYTE_SIZE = 384;
+
+private:
+    //! NULL stands for 1, so that empty instances don't allocate
+    BIGNUM *numerator;
+    BIGNUM *denominator;
+
+    static void Multiply(BIGNUM *&num, const uint256 &hashElement);
+    void GetValue(unsigned char value[BYTE_SIZE]) const;
+    void SetValue(const unsigned char value[BYTE_SIZE]);
+
+public:
+    CMuHash3072();
+    CMuHash3072(const CMuHash3072 &other);
+    CMuHash3072& operator=(const CMuHash3072 &other);
+    ~CMuHash3072();
+
+    //! Add an element, given as a hash of its contents
+    void Insert(const uint256 &hashElement) { Multiply(numerator, hashElement); }
+    //! Remove an element which was inserted before
+    void Remove(const uint256 &hashElement) { Multiply(denominator, hashElement); }
+
+    uint256 GetHash() const;
+
+    friend bool operator==(const CMuHash3072 &a, const CMuHash3072 &b) { return a.GetHash() == b.GetHash(); }
+    friend bool operator!=(const CMuHash3072 &a, const CMuHash3072 &b) { return !(a == b); }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const { return BYTE_SIZE; }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const {
+        unsigned char value[BYTE_SIZE];
+        GetValue(value);
+        s.write((const char*)value, BYTE_SIZE);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion) {
+        unsigned char value[BYTE_SIZE];
+        s.read((char*)value, BYTE_SIZE);
+        SetValue(value);
+    }
+};
+
+#endif // BITCOIN_MUHASH_H
@@ -0,0 +1,442 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "parentchain.h"
+
+#include "callrpc.h"
+#include "clientversion.h"
+#include "streams.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <assert.h>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
+using namespace json_spirit;
+using namespace std;
+
+void CParentChainRPCBackend::GetConfirmations(const vector<uint256>& vHash, vector<int>& vConfirmations)
+{
+    vector<Array> vParams;
+    BOOST_FOREACH(const uint256& hash, vHash) {
+        Array params;
+        params.push_back(hash.GetHex());
+        vParams.push_back(params);
+    }
+    Array vReply = CallRPCBatch("getblock", vParams, strPort);
+
+    vConfirmations.clear();
+    BOOST_FOREACH(const Value& reply, vReply) {
+        // An unknown block is an error reply; a block reorged out of the
+        // parent chain reports -1 confirmations.
+        int nConfirmations = -1;
+        const Value& result = find_value(reply.get_obj(), "result");
+        if (find_value(reply.get_obj(), "error").type() == null_type && result.type() == obj_type) {
+            const Value& confirmations = find_value(result.get_obj(), "confirmations");
+            if (confirmations.type() == int_type)
+                nConfirmations = confirmations.get_int();
+        }
+        vConfirmations.push_back(nConfirmations);
+    }
+}
+
+CParentChainConfirmations::CParentChainConfirmations(CParentChainBackend* backendIn, int64_t nRefreshIntervalIn) :
+    backend(backendIn), nRefreshInterval(nRefreshIntervalIn), nPendingLookups(0)
+{
+}
+
+bool CParentChainConfirmations::IsConfirmed(const uint256& hash, int nMinConfirmations, bool& fPending)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    map<uint256, CEntry>::const_iterator it = mapEntries.find(hash);
+    if (it != mapEntries.end()) {
+        fPending = false;
+        return it->second.nConfirmations >= nMinConfirmations;
+    }
+    fPending = true;
+    nPendingLookups++;
+    if (setPending.insert(hash).second)
+        condQueued.notify_one();
+    return false;
+}
+
+bool CParentChainConfirmations::Refresh(int64_t nNow)
+{
+    // Queued lookups first, then at most one batch of stale entries.
+    vector<uint256> vHash;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        vHash.assign(setPending.begin(), setPending.end());
+        size_t nMax = vHash.size() + MAX_PARENTCHAIN_BATCH;
+        for (list<uint256>::const_iterator it = listRefreshed.begin(); it != listRefreshed.end() && vHash.size() < nMax; it++) {
+            if (mapEntries.find(*it)->second.nTimeUpdated + nRefreshInterval > nNow)
+                break;
+            vHash.push_back(*it);
+        }
+    }
+
+    bool fResolved = false;
+    bool fOk = true;
+    for (size_t nStart = 0; nStart < vHash.size(); nStart += MAX_PARENTCHAIN_BATCH) {
+        vector<uint256> vBatch(vHash.begin() + nStart, vHash.begin() + min(vHash.size(), nStart + MAX_PARENTCHAIN_BATCH));
+        vector<int> vConfirmations;
+        try {
+            backend->GetConfirmations(vBatch, vConfirmations);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: parent chain lookup failed: %s\n", __func__, e.what());
+            fOk = false;
+            break;
+        }
+        if (vConfirmations.size() != vBatch.size()) {
+            LogPrintf("%s: parent chain returned %u answers for %u lookups\n", __func__, vConfirmations.size(), vBatch.size());
+            fOk = false;
+            break;
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        for (size_t i = 0; i < vBatch.size(); i++) {
+            pair<map<uint256, CEntry>::iterator, bool> ret = mapEntries.insert(make_pair(vBatch[i], CEntry()));
+            CEntry& entry = ret.first->second;
+            if (ret.second)
+                entry.itRefreshed = listRefreshed.insert(listRefreshed.end(), vBatch[i]);
+            else
+                listRefreshed.splice(listRefreshed.end(), listRefreshed, entry.itRefreshed);
+            entry.nConfirmations = vConfirmations[i];
+            entry.nTimeUpdated = nNow;
+            if (setPending.erase(vBatch[i]))
+                fResolved = true;
+        }
+        // Forget the least recently refreshed entries; they are looked up again when needed.
+        while (mapEntries.size() > MAX_PARENTCHAIN_CACHE) {
+            mapEntries.erase(listRefreshed.front());
+            listRefreshed.pop_front();
+        }
+    }
+    LogPrint("parentchain", "%s: looked up %u blocks%s\n", __func__, vHash.size(), fOk ? "" : " (failed)");
+
+    if (fResolved && !fnResolved.empty())
+        fnResolved();
+    return fOk;
+}
+
+void CParentChainConfirmations::ThreadRefresh()
+{
+    RenameThread("bitcoin-parent");
+    int64_t nBackoff = 0;
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (setPending.empty())
+                condQueued.timed_wait(lock, boost::posix_time::seconds(1));
+        }
+        boost::this_thread::interruption_point();
+        if (Refresh(GetTime())) {
+            nBackoff = 0;
+        } else {
+            // Don't hammer a parent chain daemon which is down; lookups stay pending meanwhile.
+            nBackoff = min(max(nBackoff * 2, (int64_t)1), (int64_t)60);
+            MilliSleep(nBackoff * 1000);
+        }
+    }
+}
+
+void CParentChainConfirmations::SetResolvedCallback(const boost::function<void()>& fn)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    fnResolved = fn;
+}
+
+uint64_t CParentChainConfirmations::GetPendingLookups() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return nPendingLookups;
+}
+
+size_t CParentChainConfirmations::GetPendingCount() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return setPending.size();
+}
+
+/** Expected number of hashes needed to find a header with the given compact target */
+static uint256 GetHeaderWork(const CBlockHeader& header)
+{
+    uint256 bnTarget;
+    bool fNegative;
+    bool fOverflow;
+    bnTarget.SetCompact(header.bitcoinproof.challenge, &fNegative, &fOverflow);
+    if (fNegative || fOverflow || bnTarget == 0)
+        return 0;
+    // We need to compute 2**256 / (bnTarget+1), but we can't represent 2**256
+    // as it's too large for a uint256. However, as 2**256 is at least as large
+    // as bnTarget+1, it is equal to ((2**256 - bnTarget - 1) / (bnTarget+1)) + 1,
+    // or ~bnTarget / (bnTarget+1) + 1.
+    return (~bnTarget / (bnTarget + 1)) + 1;
+}
+
+CParentHeaderStore::CParentHeaderStore(const boost::filesystem::path& pathHeadersIn, const CParentChainParams& paramsIn) :
+    pathHeaders(pathHeadersIn), params(paramsIn), nPendingLookups(0)
+{
+}
+
+uint32_t CParentHeaderStore::GetNextWorkRequired(const CHeaderIndex* pindexPrev, uint32_t nTime) const
+{
+    uint32_t nProofOfWorkLimit = params.bnProofOfWorkLimit.GetCompact();
+    if (params.fNoRetargeting)
+        return pindexPrev->nBits;
+
+    // Only change once per interval
+    if ((params.nAnchorHeight + pindexPrev->nHeight + 1) % params.Interval() != 0) {
+        if (params.fAllowMinDifficultyBlocks) {
+            // A header more than twice the target spacing late may have the easiest target
+            if (nTime > pindexPrev->nTime + params.nTargetSpacing * 2)
+                return nProofOfWorkLimit;
+            // Otherwise the target of the last header which didn't make use of that
+            const CHeaderIndex* pindex = pindexPrev;
+            while (pindex->pprev && (params.nAnchorHeight + pindex->nHeight) % params.Interval() != 0 && pindex->nBits == nProofOfWorkLimit)
+                pindex = pindex->pprev;
+            return pindex->nBits;
+        }
+        return pindexPrev->nBits;
+    }
+
+    // Go back to the first header of the interval; the anchor is on an
+    // interval boundary, so it is stored.
+    const CHeaderIndex* pindexFirst = pindexPrev;
+    for (int i = 0; pindexFirst && i < params.Interval() - 1; i++)
+        pindexFirst = pindexFirst->pprev;
+    assert(pindexFirst);
+
+    int64_t nActualTimespan = (int64_t)pindexPrev->nTime - (int64_t)pindexFirst->nTime;
+    nActualTimespan = std::max(nActualTimespan, params.nTargetTimespan / 4);
+    nActualTimespan = std::min(nActualTimespan, params.nTargetTimespan * 4);
+
+    uint256 bnNew;
+    bnNew.SetCompact(pindexPrev->nBits);
+    bnNew *= nActualTimespan;
+    bnNew /= params.nTargetTimespan;
+    if (bnNew > params.bnProofOfWorkLimit)
+        bnNew = params.bnProofOfWorkLimit;
+    return bnNew.GetCompact();
+}
+
+bool CParentHeaderStore::CheckHeader(const CBlockHeader& header, const CHeaderIndex* pindexPrev, string& strError) const
+{
+    uint256 hash = header.GetHash();
+    if (pindexPrev == NULL && hash != params.hashAnchor) {
+        strError = "header " + hash.ToString() + " is not the parent chain anchor " + params.hashAnchor.ToString();
+        return false;
+    }
+    if (pindexPrev != NULL && header.bitcoinproof.challenge != GetNextWorkRequired(pindexPrev, header.nTime)) {
+        strError = "header " + hash.ToString() + " has the wrong target";
+        return false;
+    }
+
+    uint256 bnTarget;
+    bool fNegative;
+    bool fOverflow;
+    bnTarget.SetCompact(header.bitcoinproof.challenge, &fNegative, &fOverflow);
+    if (fNegative || fOverflow || bnTarget == 0 || bnTarget > params.bnProofOfWorkLimit || hash > bnTarget) {
+        strError = "header " + hash.ToString() + " has invalid proof of work";
+        return false;
+    }
+    return true;
+}
+
+CParentHeaderStore::CHeaderIndex* CParentHeaderStore::Insert(const CBlockHeader& header, const uint256& nChainWork)
+{
+    std::pair<map<uint256, CHeaderIndex>::iterator, bool> ret = mapHeaders.insert(make_pair(header.GetHash(), CHeaderIndex()));
+    CHeaderIndex* pindex = &ret.first->second;
+    pindex->phashBlock = &ret.first->first;
+    map<uint256, CHeaderIndex>::iterator mi = mapHeaders.find(header.hashPrevBlock);
+    pindex->pprev = (mi == mapHeaders.end() || mapHeaders.size() == 1) ? NULL : &mi->second;
+    pindex->nHeight = pindex->pprev ? pindex->pprev->nHeight + 1 : 0;
+    pindex->nTime = header.nTime;
+    pindex->nBits = header.bitcoinproof.challenge;
+    pindex->nChainWork = nChainWork;
+
+    if (vChain.empty() || pindex->nChainWork > vChain.back()->nChainWork) {
+        // Switch the best chain over to the fork containing the new header
+        vChain.resize(pindex->nHeight + 1);
+        for (CHeaderIndex* pwalk = pindex; pwalk && vChain[pwalk->nHeight] != pwalk; pwalk = pwalk->pprev)
+            vChain[pwalk->nHeight] = pwalk;
+    }
+    return pindex;
+}
+
+bool CParentHeaderStore::Load()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    FILE* file = fopen(pathHeaders.string().c_str(), "rb+");
+    if (!file)
+        return true; // No headers yet
+    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+
+    unsigned int nRecords = 0;
+    try {
+        while (true) {
+            CBlockHeader header;
+            header.SetBitcoinBlock();
+            uint256 nChainWork;
+            filein >> header >> nChainWork;
+            map<uint256, CHeaderIndex>::const_iterator mi = mapHeaders.find(header.hashPrevBlock);
+            if (!mapHeaders.empty() && mi == mapHeaders.end())
+                return error("%s : header %s in %s doesn't connect", __func__, header.GetHash().ToString(), pathHeaders.string());
+            string strError;
+            if (!CheckHeader(header, mapHeaders.empty() ? NULL : &mi->second, strError))
+                return error("%s : %s in %s", __func__, strError, pathHeaders.string());
+            Insert(header, nChainWork);
+            nRecords++;
+        }
+    } catch (const std::exception&) {
+        // End of file; drop a record which was only partially written
+        fseek(filein.Get(), 0, SEEK_END);
+        if (ftell(filein.Get()) != (long)(nRecords * RECORD_SIZE)) {
+            LogPrintf("%s: truncating partial record at the end of %s\n", __func__, pathHeaders.string());
+            TruncateFile(filein.Get(), nRecords * RECORD_SIZE);
+        }
+    }
+    LogPrintf("Loaded %u parent chain headers, best %s height=%d\n", nRecords,
+              vChain.empty() ? "none" : vChain.back()->phashBlock->ToString(), params.nAnchorHeight + (int)vChain.size() - 1);
+    return true;
+}
+
+bool CParentHeaderStore::AddHeaders(const vector<CBlockHeader>& vHeaders, int& nAdded, string& strError)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nAdded = 0;
+    FILE* file = fopen(pathHeaders.string().c_str(), "ab");
+    if (!file) {
+        strError = "cannot open " + pathHeaders.string();
+        return false;
+    }
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+
+    bool fOk = true;
+    BOOST_FOREACH(const CBlockHeader& header, vHeaders) {
+        uint256 hash = header.GetHash();
+        if (mapHeaders.count(hash))
+            continue;
+        if (!header.IsBitcoinBlock()) {
+            strError = "header " + hash.ToString() + " has invalid proof of work";
+            fOk = false;
+            break;
+        }
+        map<uint256, CHeaderIndex>::const_iterator mi = mapHeaders.find(header.hashPrevBlock);
+        if (!mapHeaders.empty() && mi == mapHeaders.end()) {
+            strError = "header " + hash.ToString() + " doesn't connect to a stored header";
+            fOk = false;
+            break;
+        }
+        if (!CheckHeader(header, mapHeaders.empty() ? NULL : &mi->second, strError)) {
+            fOk = false;
+            break;
+        }
+        uint256 nChainWork = (mi == mapHeaders.end() ? 0 : mi->second.nChainWork) + GetHeaderWork(header);
+        fileout << header << nChainWork;
+        Insert(header, nChainWork);
+        nAdded++;
+    }
+    FileCommit(fileout.Get());
+    return fOk;
+}
+
+int CParentHeaderStore::GetConfirmations(const uint256& hash) const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    map<uint256, CHeaderIndex>::const_iterator mi = mapHeaders.find(hash);
+    if (mi == mapHeaders.end())
+        return -1;
+    const CHeaderIndex& index = mi->second;
+    if (vChain[index.nHeight] != &index)
+        return 0;
+    return (int)vChain.size() - index.nHeight;
+}
+
+bool CParentHeaderStore::IsConfirmed(const uint256& hash, int nMinConfirmations, bool& fPending)
+{
+    int nConfirmations = GetConfirmations(hash);
+    fPending = nConfirmations < 0;
+    if (fPending) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nPendingLookups++;
+    }
+    return nConfirmations >= nMinConfirmations;
+}
+
+int CParentHeaderStore::Height() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return params.nAnchorHeight + (int)vChain.size() - 1;
+}
+
+uint256 CParentHeaderStore::GetBestHash() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return vChain.empty() ? uint256(0) : *vChain.back()->phashBlock;
+}
+
+uint64_t CParentHeaderStore::GetPendingLookups() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return nPendingLookups;
+}
+
+namespace {
+
+CParentChainBackend* pparentchainbackend = NULL;
+CParentChainConfirmations* pparentchainconfirmations = NULL;
+CParentHeaderStore* pparentheaderstore = NULL;
+
+} // anon namespace
+
+bool StartParentHeaderStore(const boost::filesystem::path& path, const CParentChainParams& params)
+{
+    assert(pparentheaderstore == NULL);
+    pparentheaderstore = new CParentHeaderStore(path, params);
+    return pparentheaderstore->Load();
+}
+
+void StopParentHeaderStore()
+{
+    delete pparentheaderstore;
+    pparentheaderstore = NULL;
+}
+
+CParentHeaderStore* GetParentHeaderStore()
+{
+    return pparentheaderstore;
+}
+
+void StartParentChainConfirmations(boost::thread_group& threadGroup, CParentChainBackend* backend, int64_t nRefreshInterval, const boost::function<void()>& fnResolved)
+{
+    assert(pparentchainconfirmations == NULL);
+    pparentchainbackend = backend;
+    pparentchainconfirmations = new CParentChainConfirmations(backend, nRefreshInterval);
+    pparentchainconfirmations->SetResolvedCallback(fnResolved);
+    threadGroup.create_thread(boost::bind(&CParentChainConfirmations::ThreadRefresh, pparentchainconfirmations));
+}
+
+void StopParentChainConfirmations()
+{
+    delete pparentchainconfirmations;
+    pparentchainconfirmations = NULL;
+    delete pparentchainbackend;
+    pparentchainbackend = NULL;
+}
+
+bool IsConfirmedBitcoinBlock(const uint256& hash, int nMinConfirmationDepth, bool& fPending)
+{
+    fPending = false;
+    if (pparentheaderstore != NULL)
+        return pparentheaderstore->IsConfirmed(hash, nMinConfirmationDepth, fPending);
+    if (pparentchainconfirmations != NULL)
+        return pparentchainconfirmations->IsConfirmed(hash, nMinConfirmationDepth, fPending);
+    return false;
+}
+
@@ -0,0 +1,207 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_PARENTCHAIN_H
+#define BITCOIN_PARENTCHAIN_H
+
+#include "chainparams.h"
+#include "primitives/block.h"
+#include "uint256.h"
+
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace boost
+{
+class thread_group;
+} // namespace boost
+
+/** How often (in seconds) cached parent chain confirmation counts are refreshed */
+static const int64_t DEFAULT_PARENTCHAIN_REFRESH = 30;
+/** Maximum number of block hashes asked for in a single batch */
+static const unsigned int MAX_PARENTCHAIN_BATCH = 200;
+/** Maximum number of block hashes kept in the confirmation cache */
+static const unsigned int MAX_PARENTCHAIN_CACHE = 10000;
+
+/** Source of parent chain confirmation counts (e.g. a bitcoind RPC server). */
+class CParentChainBackend
+{
+public:
+    /**
+     * Look up the confirmation count of each of vHash, in order. A block the
+     * parent chain doesn't know (or has reorged out) has -1 confirmations.
+     * Throws if the backend could not be reached.
+     */
+    virtual void GetConfirmations(const std::vector<uint256>& vHash, std::vector<int>& vConfirmations) = 0;
+    virtual ~CParentChainBackend() {}
+};
+
+/** Backend that asks the parent chain daemon over JSON-RPC, one batch request per lookup. */
+class CParentChainRPCBackend : public CParentChainBackend
+{
+private:
+    std::string strPort;
+
+public:
+    CParentChainRPCBackend(const std::string& strPortIn) : strPort(strPortIn) {}
+    void GetConfirmations(const std::vector<uint256>& vHash, std::vector<int>& vConfirmations);
+};
+
+/**
+ * Cache of parent chain confirmation counts, used by OP_WITHDRAWPROOFVERIFY.
+ * Lookups are answered from memory only: a block hash which has not been
+ * seen yet is queued and reported as pending, and a background thread
+ * resolves the queue (and refreshes stale entries) in batches. This keeps a
+ * slow or unreachable parent chain daemon from stalling validation.
+ */
+class CParentChainConfirmations
+{
+private:
+    struct CEntry
+    {
+        int nConfirmations;
+        int64_t nTimeUpdated;
+        //! Position in listRefreshed
+        std::list<uint256>::iterator itRefreshed;
+    };
+
+    mutable boost::mutex mutex;
+    boost::condition_variable condQueued;
+    CParentChainBackend* backend;
+    int64_t nRefreshInterval;
+    std::map<uint256, CEntry> mapEntries;
+    //! Hashes of mapEntries, least recently refreshed first
+    std::list<uint256> listRefreshed;
+    std::set<uint256> setPending;
+    //! Number of lookups which returned pending so far
+    uint64_t nPendingLookups;
+    //! Called after a refresh resolved pending lookups
+    boost::function<void()> fnResolved;
+
+public:
+    CParentChainConfirmations(CParentChainBackend* backendIn, int64_t nRefreshIntervalIn = DEFAULT_PARENTCHAIN_REFRESH);
+
+    /**
+     * Whether hash is known to have at least nMinConfirmations on the parent
+     * chain. If the hash has not been looked up yet it is queued, fPending is
+     * set and false is returned; the caller should retry later.
+     */
+    bool IsConfirmed(const uint256& hash, int nMinConfirmations, bool& fPending);
+
+    /**
+     * Ask the backend about all queued hashes and entries older than the
+     * refresh interval, in batches. Returns false if the backend failed.
+     */
+    bool Refresh(int64_t nNow);
+
+    /** Run Refresh() whenever lookups are queued or entries become stale, until interrupted. */
+    void ThreadRefresh();
+
+    void SetResolvedCallback(const boost::function<void()>& fn);
+    uint64_t GetPendingLookups() const;
+    size_t GetPendingCount() const;
+};
+
+/**
+ * Local store of parent chain (bitcoin) headers, so that withdraw proofs can
+ * be checked for depth without asking a parent chain daemon.
+ *
+ * Headers are kept in a flat file of fixed size records (the 80 byte header
+ * followed by the cumulative work of the chain ending at it), appended in the
+ * order they were accepted. Only the header tree (hash, parent, height,
+ * time, target and work) is kept in memory. The first header stored must be
+ * the configured anchor, which is trusted as is; every later header must
+ * connect to a stored one and carry the target the parent chain's retarget
+ * rules require, and proof of work meeting it.
+ */
+class CParentHeaderStore
+{
+public:
+    /** Size of a record in the header file */
+    static const unsigned int RECORD_SIZE = 80 + 32;
+
+private:
+    struct CHeaderIndex
+    {
+        const uint256* phashBlock;
+        CHeaderIndex* pprev;
+        //! Counted from the anchor
+        int nHeight;
+        uint32_t nTime;
+        uint32_t nBits;
+        uint256 nChainWork;
+    };
+
+    mutable boost::mutex mutex;
+    boost::filesystem::path pathHeaders;
+    CParentChainParams params;
+    std::map<uint256, CHeaderIndex> mapHeaders;
+    //! The chain with the most work, indexed by height
+    std::vector<CHeaderIndex*> vChain;
+    //! Number of lookups for headers not in the store so far
+    uint64_t nPendingLookups;
+
+    CHeaderIndex* Insert(const CBlockHeader& header, const uint256& nChainWork);
+    /** Target the parent chain requires of a header with time nTime on top of pindexPrev */
+    uint32_t GetNextWorkRequired(const CHeaderIndex* pindexPrev, uint32_t nTime) const;
+    /** Check header against the parent chain rules, as the child of pindexPrev or (if NULL) as the anchor */
+    bool CheckHeader(const CBlockHeader& header, const CHeaderIndex* pindexPrev, std::string& strError) const;
+
+public:
+    CParentHeaderStore(const boost::filesystem::path& pathHeadersIn, const CParentChainParams& paramsIn);
+
+    /**
+     * Read all records of the header file, checking them like new ones.
+     * Returns false if the file is corrupt or doesn't start at the anchor.
+     */
+    bool Load();
+
+    /**
+     * Append headers (in order) to the store and its file. Headers already
+     * stored are skipped. Stops at the first header which doesn't connect,
+     * has the wrong target or lacks proof of work, setting strError. nAdded
+     * is the number of new headers.
+     */
+    bool AddHeaders(const std::vector<CBlockHeader>& vHeaders, int& nAdded, std::string& strError);
+
+    /** Number of confirmations of hash on the best header chain; 0 if not on it, -1 if unknown */
+    int GetConfirmations(const uint256& hash) const;
+
+    /**
+     * Whether hash has at least nMinConfirmations on the best header chain. A
+     * header which is not stored yet sets fPending, as it may simply not have
+     * been imported yet.
+     */
+    bool IsConfirmed(const uint256& hash, int nMinConfirmations, bool& fPending);
+
+    /** Parent chain height of the best stored header; anchor height - 1 if there is none */
+    int Height() const;
+    uint256 GetBestHash() const;
+    uint64_t GetPendingLookups() const;
+};
+
+/** Use a header store at path for confirmation checks, instead of asking a parent chain daemon. */
+bool StartParentHeaderStore(const boost::filesystem::path& path, const CParentChainParams& params);
+void StopParentHeaderStore();
+/** The global header store, or NULL if not in use */
+CParentHeaderStore* GetParentHeaderStore();
+
+/** Start the global confirmation cache and its refresh thread on boost::thread_group. Takes ownership of backend. */
+void StartParentChainConfirmations(boost::thread_group& threadGroup, CParentChainBackend* backend, int64_t nRefreshInterval, const boost::function<void()>& fnResolved);
+void StopParentChainConfirmations();
+
+/**
+ * Check parent chain confirmations through the global header store or
+ * confirmation cache. Without either (-blindtrust) nothing is confirmed.
+ */
+bool IsConfirmedBitcoinBlock(const uint256& hash, int nMinConfirmationDepth, bool& fPending);
+
+#endif // BITCOIN_PARENTCHAIN_H
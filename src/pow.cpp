@@ -14,6 +14,7 @@
 #include "script/standard.h"
 #include "uint256.h"
 #include "util.h"
+#include "validationstats.h"
 
 #ifdef ENABLE_WALLET
 #include "wallet.h"
@@ -28,12 +29,12 @@ CScript CombineBlockSignatures(const CBlockHeader& header, const CScript& script
 
 bool CheckChallenge(const CBlockHeader& block, const CBlockIndex& indexLast)
 {
-    return block.proof.challenge == indexLast.proof.challenge;
+    return block.proof.challenge == indexLast.GetChallenge();
 }
 
 void ResetChallenge(CBlockHeader& block, const CBlockIndex& indexLast)
 {
-    block.proof.challenge = indexLast.proof.challenge;
+    block.proof.challenge = indexLast.GetChallenge();
 }
 
 
@@ -58,11 +59,19 @@ bool CheckBitcoinProof(const CBlockHeader& block)
 
 bool CheckProof(const CBlockHeader& block)
 {
+    CValidationTimer timer(VALIDATION_CHECK_PROOF);
     if (block.GetHash() == Params().HashGenesisBlock())
        return true;
     return GenericVerifyScript(block.proof.solution, block.proof.challenge, SCRIPT_VERIFY_P2SH, block);
 }
 
+bool CheckProof(const CBlockHeader& block, CSignatureBatch& batch)
+{
+    if (block.GetHash() == Params().HashGenesisBlock())
+       return true;
+    return GenericVerifyScriptBatched(block.proof.solution, block.proof.challenge, SCRIPT_VERIFY_P2SH, block, batch);
+}
+
 #ifdef ENABLE_WALLET
 bool GenerateProof(CBlockHeader *pblock, CWallet *pwallet)
 {
@@ -87,12 +96,12 @@ double GetChallengeDifficulty(const CBlockIndex* blockindex)
 
 std::string GetChallengeStr(const CBlockIndex& block)
 {
-    return block.proof.challenge.ToString();
+    return block.GetChallenge().ToString();
 }
 
 std::string GetChallengeStrHex(const CBlockIndex& block)
 {
-    return block.proof.challenge.ToString();
+    return block.GetChallenge().ToString();
 }
 
 uint32_t GetNonce(const CBlockHeader& block)
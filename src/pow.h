@@ -13,6 +13,7 @@ class CBlockHeader;
 class CBlockIndex;
 class CProof;
 class CScript;
+class CSignatureBatch;
 class CWallet;
 class uint256;
 
@@ -20,6 +21,8 @@ class uint256;
 bool CheckBitcoinProof(const CBlockHeader& block);
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
 bool CheckProof(const CBlockHeader& block);
+/** Like CheckProof, but queues the signatures in batch; the proof is only valid if the batch verifies too */
+bool CheckProof(const CBlockHeader& block, CSignatureBatch& batch);
 /** Scans nonces looking for a hash with at least some zero bits */
 bool GenerateProof(CBlockHeader* pblock, CWallet* pwallet);
 void ResetProof(CBlockHeader& block);
@@ -5,6 +5,7 @@
 
 #include "primitives/block.h"
 
+#include "crypto/sha256.h"
 #include "hash.h"
 #include "tinyformat.h"
 #include "utilstrencodings.h"
@@ -75,16 +76,17 @@ uint256 CBlock::BuildMerkleTree(bool* fMutated) const
     bool mutated = false;
     for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
     {
-        for (int i = 0; i < nSize; i += 2)
-        {
-            int i2 = std::min(i+1, nSize-1);
-            if (i2 == i + 1 && i2 + 1 == nSize && vMerkleTree[j+i] == vMerkleTree[j+i2]) {
-                // Two identical hashes at the end of the list at a particular level.
-                mutated = true;
-            }
-            vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                       BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
-        }
+        // Two identical hashes at the end of the list at a particular level.
+        if (nSize % 2 == 0 && vMerkleTree[j+nSize-2] == vMerkleTree[j+nSize-1])
+            mutated = true;
+        // Hash all complete pairs of the level at once; uint256s are contiguous
+        // in the vector, so each pair is one 64-byte input.
+        int nNext = j + nSize;
+        vMerkleTree.resize(nNext + (nSize + 1) / 2);
+        SHA256D64(vMerkleTree[nNext].begin(), vMerkleTree[j].begin(), nSize / 2);
+        if (nSize % 2 == 1)
+            vMerkleTree.back() = Hash(BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]),
+                                      BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]));
         j += nSize;
     }
     if (fMutated) {
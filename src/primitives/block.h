@@ -168,6 +168,8 @@ public:
 
     // memory only
     mutable std::vector<uint256> vMerkleTree;
+    //! Whether CheckBlock (with the proof and merkle root) passed, so it needn't run again
+    mutable bool fChecked;
 
     CBlock()
     {
@@ -195,6 +197,7 @@ public:
         CBlockHeader::SetNull();
         vtx.clear();
         vMerkleTree.clear();
+        fChecked = false;
     }
 
     CBlockHeader GetBlockHeader() const
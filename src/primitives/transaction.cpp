@@ -150,16 +150,68 @@ void CTransaction::UpdateHash() const
     for (unsigned int i = 0; i < vout.size(); i++)
         if (!vout[i].nValue.IsAmount())
             maybeBitcoinTx = false;
-    if (maybeBitcoinTx)
-        *const_cast<uint256*>(&hashBitcoin) = SerializeHash(*this, SER_GETHASH, PROTOCOL_VERSION | SERIALIZE_VERSION_MASK_BITCOIN_TX);
 
-    if (IsCoinBase()) {
-        *const_cast<uint256*>(&hash) = SerializeHash(*this, SER_GETHASH, PROTOCOL_VERSION);
-    } else {
-        *const_cast<uint256*>(&hash) = SerializeHash(*this, SER_GETHASH, PROTOCOL_VERSION | SERIALIZE_VERSION_MASK_NO_WITNESS);
+    // Walk the transaction once, feeding each field to every digest it is
+    // part of, instead of serializing the whole transaction once per digest.
+    // This has to match the layout of CTransaction::SerializationOp for each
+    // of the three serialization versions.
+    CHashWriter ssBitcoin(SER_GETHASH, PROTOCOL_VERSION | SERIALIZE_VERSION_MASK_BITCOIN_TX);
+    CHashWriter ssTx(SER_GETHASH, IsCoinBase() ? PROTOCOL_VERSION : PROTOCOL_VERSION | SERIALIZE_VERSION_MASK_NO_WITNESS);
+    CHashWriter ssWitness(SER_GETHASH, PROTOCOL_VERSION | SERIALIZE_VERSION_MASK_ONLY_WITNESS);
+
+    // A coinbase's txid keeps its scriptSig, so up to the end of vin it
+    // serializes the same as its Bitcoin hash, which can then continue from
+    // the txid's midstate. Other transactions' txids leave the scriptSigs out.
+    bool fSharedInputs = maybeBitcoinTx && IsCoinBase();
+    ssTx << nVersion;
+    if (maybeBitcoinTx && !fSharedInputs)
+        ssBitcoin << nVersion;
+    WriteCompactSize(ssTx, vin.size());
+    WriteCompactSize(ssWitness, vin.size());
+    if (maybeBitcoinTx && !fSharedInputs)
+        WriteCompactSize(ssBitcoin, vin.size());
+    for (std::vector<CTxIn>::const_iterator it = vin.begin(); it != vin.end(); ++it) {
+        ssTx << *it;
+        ssWitness << *it;
+        if (maybeBitcoinTx && !fSharedInputs)
+            ssBitcoin << *it;
+    }
+    if (fSharedInputs) {
+        ssBitcoin = ssTx;
+        ssBitcoin.nVersion = PROTOCOL_VERSION | SERIALIZE_VERSION_MASK_BITCOIN_TX;
+    }
+    ssTx << nTxFee;
+    WriteCompactSize(ssTx, vout.size());
+    if (maybeBitcoinTx)
+        WriteCompactSize(ssBitcoin, vout.size());
+    for (std::vector<CTxOut>::const_iterator it = vout.begin(); it != vout.end(); ++it) {
+        ssTx << *it;
+        if (maybeBitcoinTx)
+            ssBitcoin << *it;
+    }
+    ssTx << nLockTime;
+    if (maybeBitcoinTx) {
+        ssBitcoin << nLockTime;
+        *const_cast<uint256*>(&hashBitcoin) = ssBitcoin.GetHash();
     }
-    *const_cast<uint256*>(&hashWitness) = SerializeHash(*this, SER_GETHASH, PROTOCOL_VERSION | SERIALIZE_VERSION_MASK_ONLY_WITNESS);
+
+    *const_cast<uint256*>(&hash) = ssTx.GetHash();
+    *const_cast<uint256*>(&hashWitness) = ssWitness.GetHash();
     // Update full hash combining the normalized txid with the hash of the witness
+    UpdateFullHash();
+}
+
+void CTransaction::UpdateStrippedHash(const uint256& hashWitnessIn) const
+{
+    // The witness is gone, so neither it nor the Bitcoin serialization can be rehashed
+    *const_cast<uint256*>(&hashBitcoin) = 0;
+    *const_cast<uint256*>(&hash) = SerializeHash(*this, SER_GETHASH, PROTOCOL_VERSION | SERIALIZE_VERSION_MASK_NO_WITNESS);
+    *const_cast<uint256*>(&hashWitness) = hashWitnessIn;
+    UpdateFullHash();
+}
+
+void CTransaction::UpdateFullHash() const
+{
     CHash256 hasher;
     hasher.Write((unsigned char*)&hash, hash.size());
     hasher.Write((unsigned char*)&hashWitness, hashWitness.size());
@@ -179,7 +231,9 @@ CTransaction& CTransaction::operator=(const CTransaction &tx) {
     *const_cast<std::vector<CTxOut>*>(&vout) = tx.vout;
     *const_cast<unsigned int*>(&nLockTime) = tx.nLockTime;
     *const_cast<uint256*>(&hash) = tx.hash;
+    *const_cast<uint256*>(&hashWitness) = tx.hashWitness;
     *const_cast<uint256*>(&hashFull) = tx.hashFull;
+    *const_cast<uint256*>(&hashBitcoin) = tx.hashBitcoin;
     return *this;
 }
 
@@ -134,7 +134,8 @@ public:
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
         bool fWitness = (nVersion & SERIALIZE_VERSION_MASK_NO_WITNESS) == 0;
         bool fOnlyWitness = nVersion & SERIALIZE_VERSION_MASK_ONLY_WITNESS;
-        assert((nType != SER_GETHASH && !fOnlyWitness && fWitness) || nType == SER_GETHASH);
+        // Witness-stripped (NO_WITNESS) serialization is driven by CTransaction
+        assert((nType != SER_GETHASH && !fOnlyWitness) || nType == SER_GETHASH);
         if (!fOnlyWitness) READWRITE(prevout);
         if (fWitness)      READWRITE(scriptSig);
         if (!fOnlyWitness) READWRITE(nSequence);
@@ -235,6 +236,8 @@ private:
     const uint256 hashFull; // Including witness
     const uint256 hashBitcoin; // For Bitcoin Transactions
     void UpdateHash() const;
+    void UpdateStrippedHash(const uint256& hashWitnessIn) const;
+    void UpdateFullHash() const;
 
 public:
     static const int32_t CURRENT_VERSION=1;
@@ -266,14 +269,31 @@ public:
         bool fOnlyWitness = nVersion & SERIALIZE_VERSION_MASK_ONLY_WITNESS;
         bool fBitcoinTx = nVersion & SERIALIZE_VERSION_MASK_BITCOIN_TX;
         assert(!fBitcoinTx || (fBitcoinTx && fWitness && !fOnlyWitness));
-        assert((nType != SER_GETHASH && !fOnlyWitness && fWitness) || nType == SER_GETHASH);
+        assert((nType != SER_GETHASH && !fOnlyWitness) || nType == SER_GETHASH);
+        // Witness-stripped storage (NO_WITNESS outside of hashing): a marker
+        // byte, then either the full transaction (coinbases, whose txid
+        // commits to their witness) or the transaction without witness
+        // followed by its witness hash, so GetFullHash() survives stripping.
+        bool fStripped = false;
+        if (nType != SER_GETHASH && !fWitness) {
+            unsigned char nStripped = !IsCoinBase();
+            READWRITE(nStripped);
+            fStripped = nStripped != 0;
+            if (!fStripped)
+                nVersion &= ~SERIALIZE_VERSION_MASK_NO_WITNESS;
+        }
         if (!fOnlyWitness)                READWRITE(*const_cast<int32_t*>(&this->nVersion));
                                           READWRITE(*const_cast<std::vector<CTxIn>*>(&vin));
         if (!fBitcoinTx && !fOnlyWitness) READWRITE(*const_cast<CAmount*>(&nTxFee));
         if (!fOnlyWitness)                READWRITE(*const_cast<std::vector<CTxOut>*>(&vout));
         if (!fOnlyWitness)                READWRITE(*const_cast<uint32_t*>(&nLockTime));
-        if (ser_action.ForRead())
-            UpdateHash();
+        if (fStripped)                    READWRITE(*const_cast<uint256*>(&hashWitness));
+        if (ser_action.ForRead()) {
+            if (fStripped)
+                UpdateStrippedHash(hashWitness);
+            else
+                UpdateHash();
+        }
     }
 
     bool IsNull() const {
@@ -147,6 +147,9 @@ enum {
     // Nodes may always request a MSG_FILTERED_BLOCK in a getdata, however,
     // MSG_FILTERED_BLOCK should not appear in any invs except as a part of getdata.
     MSG_FILTERED_BLOCK,
+    // Blocks without their transactions' witness data, answered with a
+    // "strippedblock" message. Served even for -prunewitness'ed blocks.
+    MSG_STRIPPED_BLOCK,
 };
 
 #endif // BITCOIN_PROTOCOL_H
@@ -24,6 +24,37 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
     return true;
 }
 
+bool CSignatureBatch::Add(const CPubKey& pubkey, const uint256& hash, const std::vector<unsigned char>& vchSig) {
+    if (!pubkey.IsValid())
+        return false;
+    if (vchSig.size() != 64)
+        return false;
+    secp256k1_pubkey parsed;
+    if (!secp256k1_ec_pubkey_parse(secp256k1_bitcoin_verify_context, &parsed, pubkey.begin(), pubkey.size()))
+        return false;
+    entries.push_back(Entry());
+    Entry& entry = entries.back();
+    assert(sizeof(parsed) == sizeof(entry.pubkey));
+    memcpy(entry.pubkey, &parsed, sizeof(entry.pubkey));
+    memcpy(entry.sig, &vchSig[0], sizeof(entry.sig));
+    entry.hash = hash;
+    return true;
+}
+
+bool CSignatureBatch::Verify() const {
+    if (entries.empty())
+        return true;
+    std::vector<const unsigned char*> sigs(entries.size());
+    std::vector<const unsigned char*> msgs(entries.size());
+    std::vector<const secp256k1_pubkey*> pubkeys(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        sigs[i] = entries[i].sig;
+        msgs[i] = entries[i].hash.begin();
+        pubkeys[i] = (const secp256k1_pubkey*)entries[i].pubkey;
+    }
+    return secp256k1_schnorr_verify_batch(secp256k1_bitcoin_verify_context, &sigs[0], &msgs[0], &pubkeys[0], entries.size()) == 1;
+}
+
 bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
     if (vchSig.size() != 65)
         return false;
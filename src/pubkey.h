@@ -203,6 +203,35 @@ struct CExtPubKey {
     bool Derive(CExtPubKey& out, unsigned int nChild) const;
 };
 
+/**
+ * A set of (public key, hash, signature) triples to be verified together.
+ * Verifying them as a batch is much cheaper than calling CPubKey::Verify on
+ * each, but a failure does not tell which signature was invalid.
+ */
+class CSignatureBatch
+{
+private:
+    struct Entry {
+        unsigned char pubkey[64]; //!< parsed secp256k1_pubkey
+        unsigned char sig[64];
+        uint256 hash;
+    };
+    std::vector<Entry> entries;
+
+public:
+    /**
+     * Queue a signature for verification. Returns false if it can be rejected
+     * right away, in which case CPubKey::Verify would have returned false too.
+     */
+    bool Add(const CPubKey& pubkey, const uint256& hash, const std::vector<unsigned char>& vchSig);
+
+    //! Verify all queued signatures; true only if every one of them is valid.
+    bool Verify() const;
+
+    size_t size() const { return entries.size(); }
+    void clear() { entries.clear(); }
+};
+
 /** Initialize the elliptic curve support. May not be called twice without calling ECC_Stop first. */
 void ECC_Verify_Start(void);
 
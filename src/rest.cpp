@@ -115,7 +115,7 @@ static bool rest_block(AcceptedConnection* conn,
             throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
     }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | ((pblockindex->nStatus & BLOCK_WITNESS_PRUNED) ? SERIALIZE_VERSION_MASK_NO_WITNESS : 0));
     ssBlock << block;
 
     switch (rf) {
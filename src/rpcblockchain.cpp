@@ -5,13 +5,19 @@
 
 #include "checkpoints.h"
 #include "main.h"
+#include "parentchain.h"
 #include "pow.h"
 #include "rpcserver.h"
+#include "script/sigcache.h"
 #include "sync.h"
+#include "txdb.h"
 #include "util.h"
+#include "validationstats.h"
 
 #include <stdint.h>
 
+#include <boost/filesystem.hpp>
+
 #include "json/json_spirit_value.h"
 
 using namespace json_spirit;
@@ -256,6 +262,7 @@ Value getblock(const Array& params, bool fHelp)
             "}\n"
             "\nResult (for verbose=false):\n"
             "\"data\"             (string) A string that is serialized, hex-encoded data for block 'hash'.\n"
+            "                             Blocks stripped by -prunewitness are returned without witness data.\n"
             "\nExamples:\n"
             + HelpExampleCli("getblock", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
             + HelpExampleRpc("getblock", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
@@ -279,7 +286,8 @@ Value getblock(const Array& params, bool fHelp)
 
     if (!fVerbose)
     {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+        // Witness pruned blocks are returned in the stripped serialization
+        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | ((pblockindex->nStatus & BLOCK_WITNESS_PRUNED) ? SERIALIZE_VERSION_MASK_NO_WITNESS : 0));
         ssBlock << block;
         std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
         return strHex;
@@ -290,38 +298,181 @@ Value getblock(const Array& params, bool fHelp)
 
 Value gettxoutsetinfo(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( full )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "These are kept up to date as blocks are connected, so this returns at once,\n"
+            "unless full is true: then the whole set is walked for its serialized size\n"
+            "and hash, which may take some time.\n"
+            "\nArguments:\n"
+            "1. full    (boolean, optional, default=false) Also compute bytes_serialized and hash_serialized\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
-            "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
-            "  \"total_amount\": x.xxx          (numeric) The total amount\n"
+            "  \"blinded_txouts\": n,    (numeric) The number of outputs with a blinded amount\n"
+            "  \"total_amount\": x.xxx,  (numeric) The total amount of the outputs which aren't blinded\n"
+            "  \"muhash\": \"hash\",      (string) Hash of the set, which doesn't depend on the order it was built in\n"
+            "  \"bytes_serialized\": n,  (numeric) The serialized size (only with full)\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash of the set and its spent withdraws (only with full)\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "true")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    bool fFull = false;
+    if (params.size() > 0)
+        fFull = params[0].get_bool();
+
     Object ret;
 
+    CCoinsCommitment commitment;
+    if (pcoinsTip->GetCommitment(commitment)) {
+        BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
+        ret.push_back(Pair("height", (int64_t)it->second->nHeight));
+        ret.push_back(Pair("bestblock", it->first.GetHex()));
+        ret.push_back(Pair("transactions", (int64_t)commitment.nTransactions));
+        ret.push_back(Pair("txouts", (int64_t)commitment.nTransactionOutputs));
+        ret.push_back(Pair("blinded_txouts", (int64_t)commitment.nBlindedOutputs));
+        ret.push_back(Pair("total_amount", ValueFromAmount(commitment.nTotalAmount)));
+        ret.push_back(Pair("muhash", commitment.GetHash().GetHex()));
+    }
+    if (fFull) {
+        CCoinsStats stats;
+        FlushStateToDisk();
+        if (pcoinsTip->GetStats(stats)) {
+            if (ret.empty()) {
+                ret.push_back(Pair("height", (int64_t)stats.nHeight));
+                ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+                ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+                ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+            }
+            ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
+            ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+        }
+    }
+    return ret;
+}
+
+/** Snapshot paths are relative to the data directory */
+static boost::filesystem::path GetSnapshotPath(const Value& param)
+{
+    boost::filesystem::path path(param.get_str());
+    if (!path.is_complete())
+        path = GetDataDir() / path;
+    return path;
+}
+
+Value dumptxoutset(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrite the unspent transaction output set at the current tip to a snapshot file,\n"
+            "which a new node can start from with loadtxoutset.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"   (string, required) the file to create; relative paths are in the data directory\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"path\",          (string) the absolute path of the snapshot\n"
+            "  \"height\":n,               (numeric) the height of the block the snapshot was taken at\n"
+            "  \"bestblock\": \"hex\",       (string) the hash of that block\n"
+            "  \"transactions\": n,        (numeric) The number of transactions\n"
+            "  \"txouts\": n,              (numeric) The number of output transactions\n"
+            "  \"hash_serialized\": \"hash\", (string) The serialized hash, to pass to loadtxoutset\n"
+            "  \"bytes\": n                (numeric) the size of the snapshot file\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path = GetSnapshotPath(params[0]);
+    boost::filesystem::path pathTmp = path.string() + ".incomplete";
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
     CCoinsStats stats;
-    FlushStateToDisk();
-    if (pcoinsTip->GetStats(stats)) {
-        ret.push_back(Pair("height", (int64_t)stats.nHeight));
-        ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
-        ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
-        ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
-        ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
-        ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+    {
+        // No block may be connected and flushed between the flush and the dump
+        LOCK(cs_main);
+        FlushStateToDisk();
+        CAutoFile file(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull())
+            throw JSONRPCError(RPC_MISC_ERROR, "Cannot open " + pathTmp.string() + " for writing");
+        if (!pcoinsdbview->DumpSnapshot(file, stats) || fflush(file.Get()) != 0) {
+            file.fclose();
+            boost::filesystem::remove(pathTmp);
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to write snapshot");
+        }
+        FileCommit(file.Get());
     }
+    RenameOver(pathTmp, path);
+
+    Object ret;
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("height", (int64_t)stats.nHeight));
+    ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+    ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+    ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+    ret.push_back(Pair("bytes", (int64_t)boost::filesystem::file_size(path)));
+    return ret;
+}
+
+Value loadtxoutset(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "loadtxoutset \"path\" \"hash\"\n"
+            "\nReplace the unspent transaction output set with a snapshot written by dumptxoutset,\n"
+            "and continue syncing from the block it was taken at. The header of that block must\n"
+            "already be known, and it must extend the current tip. Blocks below it are not validated,\n"
+            "so only load snapshots whose hash was obtained from a node you trust.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"   (string, required) the snapshot file; relative paths are in the data directory\n"
+            "2. \"hash\"   (string, required) the expected hash_serialized of the snapshot\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\":n,               (numeric) the height of the new tip\n"
+            "  \"bestblock\": \"hex\",       (string) the hash of the new tip\n"
+            "  \"transactions\": n,        (numeric) The number of transactions loaded\n"
+            "  \"txouts\": n               (numeric) The number of outputs loaded\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\" \"hash\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\", \"hash\"")
+        );
+
+    boost::filesystem::path path = GetSnapshotPath(params[0]);
+    uint256 hashExpected = ParseHashV(params[1], "hash");
+
+    CCoinsStats stats;
+    string strError;
+    {
+        CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open " + path.string());
+        if (!LoadUTXOSnapshot(file, hashExpected, stats, strError))
+            throw JSONRPCError(RPC_VERIFY_ERROR, strError);
+    }
+
+    // Connect whatever is already known on top of the snapshot
+    CValidationState state;
+    ActivateBestChain(state);
+
+    Object ret;
+    ret.push_back(Pair("height", (int64_t)stats.nHeight));
+    ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+    ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
     return ret;
 }
 
@@ -445,7 +596,12 @@ Value getblockchaininfo(const Array& params, bool fHelp)
             "  \"bestblockhash\": \"...\", (string) the hash of the currently best block\n"
             "  \"difficulty\": xxxxxx,     (numeric) the current difficulty\n"
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
-            "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"chainwork\": \"xxxx\",    (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"blockindexmemory\": {     (object) memory saved by the block index\n"
+            "    \"challenges\": xxxx,       (numeric) number of distinct block challenges, each stored once\n"
+            "    \"challengebytessaved\": xxxx, (numeric) challenge script bytes not duplicated in memory\n"
+            "    \"solutionbytessaved\": xxxx   (numeric) block solution bytes left on disk, less those still in memory and the solution hashes kept instead\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getblockchaininfo", "")
@@ -460,6 +616,12 @@ Value getblockchaininfo(const Array& params, bool fHelp)
     obj.push_back(Pair("difficulty",            (double)GetDifficulty()));
     obj.push_back(Pair("verificationprogress",  Checkpoints::GuessVerificationProgress(chainActive.Tip())));
     obj.push_back(Pair("chainwork",             chainActive.Tip()->nChainWork.GetHex()));
+    CBlockIndexMemoryStats memoryStats = GetBlockIndexMemoryStats();
+    Object memory;
+    memory.push_back(Pair("challenges",          (int64_t)memoryStats.nChallenges));
+    memory.push_back(Pair("challengebytessaved", (int64_t)memoryStats.nChallengeBytesSaved));
+    memory.push_back(Pair("solutionbytessaved",  (int64_t)memoryStats.nSolutionBytesSaved));
+    obj.push_back(Pair("blockindexmemory",      memory));
     return obj;
 }
 
@@ -576,6 +738,11 @@ Value getmempoolinfo(const Array& params, bool fHelp)
             "{\n"
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
+            "  \"rangeproofcache\": {         (json object) Rangeproof verification cache\n"
+            "     \"size\": xxxxx             (numeric) Number of cached valid rangeproofs\n"
+            "     \"hits\": xxxxx             (numeric) Lookups answered from the cache\n"
+            "     \"misses\": xxxxx           (numeric) Lookups that required a full verification\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
@@ -586,6 +753,78 @@ Value getmempoolinfo(const Array& params, bool fHelp)
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
 
+    CRangeproofCacheStats stats = GetRangeproofCacheStats();
+    Object rangeproofcache;
+    rangeproofcache.push_back(Pair("size", (int64_t) stats.nEntries));
+    rangeproofcache.push_back(Pair("hits", (int64_t) stats.nHits));
+    rangeproofcache.push_back(Pair("misses", (int64_t) stats.nMisses));
+    ret.push_back(Pair("rangeproofcache", rangeproofcache));
+
+    return ret;
+}
+
+Value getvalidationstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getvalidationstats ( reset )\n"
+            "\nReturns latency statistics of the phases of block and transaction validation,\n"
+            "and how far transactions got on their way into the memory pool.\n"
+            "\nArguments:\n"
+            "1. reset             (boolean, optional, default=false) Start collecting anew after returning the statistics\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"since\": xxxxx                (numeric) Time the statistics were started, in seconds since 1 Jan 1970 GMT\n"
+            "  \"phases\": {\n"
+            "    \"phase\": {                  (json object) One of checkheader, checkproof, verifyamounts, rangeproof,\n"
+            "                                 script, withdraw, connectblock, flushcoins, writedisk, mempoolaccept\n"
+            "      \"count\": xxxxx            (numeric) Number of times it ran (batches count each item)\n"
+            "      \"total_us\": xxxxx         (numeric) Total time, in microseconds\n"
+            "      \"p50_us\": xxxxx           (numeric) Median time, in microseconds (an upper estimate)\n"
+            "      \"p99_us\": xxxxx           (numeric) 99th percentile time, in microseconds (an upper estimate)\n"
+            "      \"max_us\": xxxxx           (numeric) Longest time, in microseconds\n"
+            "    }, ...\n"
+            "  },\n"
+            "  \"mempool\": {                  (json object) Number of transactions reaching each stage of acceptance\n"
+            "    \"received\": xxxxx\n"
+            "    \"checked\": xxxxx            (numeric) Passed the context-free and standardness checks\n"
+            "    \"inputsfound\": xxxxx        (numeric) All inputs available\n"
+            "    \"amountsverified\": xxxxx    (numeric) Amounts and rangeproofs verified\n"
+            "    \"policypassed\": xxxxx       (numeric) Passed the fee, priority and sigop policy\n"
+            "    \"accepted\": xxxxx           (numeric) Scripts verified and added to the pool\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getvalidationstats", "")
+            + HelpExampleCli("getvalidationstats", "true")
+            + HelpExampleRpc("getvalidationstats", "")
+        );
+
+    bool fReset = false;
+    if (params.size() > 0)
+        fReset = params[0].get_bool();
+
+    CValidationStats stats = fReset ? GetAndResetValidationStats() : GetValidationStats();
+
+    Object ret;
+    ret.push_back(Pair("since", stats.nSince));
+    Object phases;
+    for (int i = 0; i < VALIDATION_PHASE_COUNT; i++) {
+        const CLatencyHistogram& histogram = stats.phases[i];
+        Object phase;
+        phase.push_back(Pair("count", (int64_t) histogram.nCount));
+        phase.push_back(Pair("total_us", histogram.nTotal));
+        phase.push_back(Pair("p50_us", histogram.Percentile(0.5)));
+        phase.push_back(Pair("p99_us", histogram.Percentile(0.99)));
+        phase.push_back(Pair("max_us", histogram.nMax));
+        phases.push_back(Pair(GetValidationPhaseName((ValidationPhase)i), phase));
+    }
+    ret.push_back(Pair("phases", phases));
+    Object mempoolstages;
+    for (int i = 0; i < MEMPOOL_STAGE_COUNT; i++)
+        mempoolstages.push_back(Pair(GetMempoolStageName((MempoolStage)i), (int64_t) stats.nMempoolStages[i]));
+    ret.push_back(Pair("mempool", mempoolstages));
+
     return ret;
 }
 
@@ -665,3 +904,61 @@ Value reconsiderblock(const Array& params, bool fHelp)
 
     return Value::null;
 }
+
+Value importparentheaders(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "importparentheaders \"hexheaders\"\n"
+            "\nAdd parent chain block headers to the local header store used by -parentheaders.\n"
+            "The first header imported must be the anchor (the parent chain genesis block, unless -parentheadersanchor is set);\n"
+            "later ones must connect to a stored header and follow the parent chain's difficulty rules.\n"
+            "\nArguments:\n"
+            "1. \"hexheaders\"  (string, required) one or more serialized 80 byte headers, hex encoded and concatenated, in chain order\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"imported\": n,           (numeric) the number of new headers stored\n"
+            "  \"height\": n,             (numeric) the parent chain height of the best stored header\n"
+            "  \"bestblockhash\": \"hash\" (string) the hash of the best stored header\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("importparentheaders", "\"hexheaders\"")
+            + HelpExampleRpc("importparentheaders", "\"hexheaders\"")
+        );
+
+    CParentHeaderStore* pstore = GetParentHeaderStore();
+    if (pstore == NULL)
+        throw JSONRPCError(RPC_MISC_ERROR, "Parent chain header store not enabled (use -parentheaders)");
+
+    if (!IsHex(params[0].get_str()))
+        throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Header data must be hexadecimal");
+    CDataStream ssHeaders(ParseHex(params[0].get_str()), SER_NETWORK, PROTOCOL_VERSION);
+    vector<CBlockHeader> vHeaders;
+    while (!ssHeaders.empty()) {
+        CBlockHeader header;
+        header.SetBitcoinBlock();
+        try {
+            ssHeaders >> header;
+        } catch (const std::exception&) {
+            throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Header decode failed");
+        }
+        vHeaders.push_back(header);
+    }
+
+    int nAdded = 0;
+    string strError;
+    bool fOk = pstore->AddHeaders(vHeaders, nAdded, strError);
+    if (nAdded > 0) {
+        // Retry blocks whose withdraws were waiting for these headers
+        CValidationState state;
+        ActivateBestChain(state);
+    }
+    if (!fOk)
+        throw JSONRPCError(RPC_VERIFY_ERROR, strprintf("%s (%d headers imported)", strError, nAdded));
+
+    Object obj;
+    obj.push_back(Pair("imported",      nAdded));
+    obj.push_back(Pair("height",        pstore->Height()));
+    obj.push_back(Pair("bestblockhash", pstore->GetBestHash().GetHex()));
+    return obj;
+}
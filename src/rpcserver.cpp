@@ -265,11 +265,15 @@ static const CRPCCommand vRPCCommands[] =
     { "blockchain",         "getchaintips",           &getchaintips,           true,      false,      false },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true,      false,      false },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,      true,       false },
+    { "blockchain",         "getvalidationstats",     &getvalidationstats,     true,      true,       false },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true,      false,      false },
     { "blockchain",         "gettxout",               &gettxout,               true,      false,      false },
+    { "blockchain",         "importparentheaders",    &importparentheaders,    true,      false,      false },
     { "blockchain",         "gettxoutproof",          &gettxoutproof,          true,      false,      false },
     { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true,      false,      false },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      false,      false },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true,      false,      false },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           false,     true,       false },
     { "blockchain",         "verifychain",            &verifychain,            true,      false,      false },
     { "blockchain",         "invalidateblock",        &invalidateblock,        true,      true,       false },
     { "blockchain",         "reconsiderblock",        &reconsiderblock,        true,      true,       false },
@@ -27,6 +27,28 @@ public:
     }
 };
 
+/**
+ * Signature checker that queues the signatures a script requires to be valid
+ * in a CSignatureBatch instead of verifying them, assuming they are valid. A
+ * script passing with it is only valid once the batch verifies too. Other
+ * signatures (like the ones a CHECKMULTISIG may skip) are verified right
+ * away, as a bad one there changes the path the script takes.
+ */
+class BatchingSimpleSignatureChecker : public SimpleSignatureChecker
+{
+public:
+    CSignatureBatch& batch;
+
+    BatchingSimpleSignatureChecker(const uint256& hashIn, CSignatureBatch& batchIn) : SimpleSignatureChecker(hashIn), batch(batchIn) {};
+    bool CheckRequiredSig(const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const
+    {
+        CPubKey pubkey(vchPubKey);
+        if (vchSig.empty())
+            return false;
+        return batch.Add(pubkey, hash, vchSig);
+    }
+};
+
 class SimpleSignatureCreator : public BaseSignatureCreator
 {
     SimpleSignatureChecker checker;
@@ -49,6 +71,12 @@ bool GenericVerifyScript(const CScript& scriptSig, const CScript& scriptPubKey,
     return VerifyScript(scriptSig, scriptPubKey, flags, SimpleSignatureChecker(SerializeHash(data)));
 }
 
+template<typename T>
+bool GenericVerifyScriptBatched(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const T& data, CSignatureBatch& batch)
+{
+    return VerifyScript(scriptSig, scriptPubKey, flags, BatchingSimpleSignatureChecker(SerializeHash(data), batch));
+}
+
 template<typename T>
 bool GenericSignScript(const CKeyStore& keystore, const T& data, const CScript& fromPubKey, CScript& scriptSig)
 {
@@ -9,7 +9,7 @@
 
 #define FEDERATED_PEG_SIDECHAIN_ONLY
 #ifdef FEDERATED_PEG_SIDECHAIN_ONLY
-#include "callrpc.h"
+#include "parentchain.h"
 #endif
 
 #include "primitives/transaction.h"
@@ -1105,7 +1105,12 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                         return false;
                     }
 
-                    fSuccess = checker.CheckSig(vchSig, vchPubKey, scriptCode);
+                    // Only CHECKSIGVERIFY is known to need the signature to be
+                    // valid, so only its signature may be deferred to a batch.
+                    if (opcode == OP_CHECKSIGVERIFY)
+                        fSuccess = checker.CheckRequiredSig(vchSig, vchPubKey, scriptCode);
+                    else
+                        fSuccess = checker.CheckSig(vchSig, vchPubKey, scriptCode);
 
                     popstack(stack);
                     popstack(stack);
@@ -1171,8 +1176,11 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                             return false;
                         }
 
-                        // Check signature
-                        bool fOk = checker.CheckSig(vchSig, vchPubKey, scriptCode);
+                        // Check signature. Once there are as many keys left as
+                        // signatures, any failure fails CHECKMULTISIGVERIFY.
+                        bool fOk = opcode == OP_CHECKMULTISIGVERIFY && nSigsCount == nKeysCount
+                                       ? checker.CheckRequiredSig(vchSig, vchPubKey, scriptCode)
+                                       : checker.CheckSig(vchSig, vchPubKey, scriptCode);
 
                         if (fOk) {
                             isig++;
@@ -1569,8 +1577,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
                                     return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_SECONDSCRIPT);
 
 #ifdef FEDERATED_PEG_SIDECHAIN_ONLY
-                                if (!GetBoolArg("-blindtrust", true) && !checker.IsConfirmedBitcoinBlock(merkleBlock.header.GetHash(), flags & SCRIPT_VERIFY_INCREASE_CONFIRMATIONS_REQUIRED))
-                                    return set_error(serror, SCRIPT_ERR_WITHDRAW_VERIFY_BLOCKCONFIRMED);
+                                bool fPending = false;
+                                if (!GetBoolArg("-blindtrust", true) && !checker.IsConfirmedBitcoinBlock(merkleBlock.header.GetHash(), flags & SCRIPT_VERIFY_INCREASE_CONFIRMATIONS_REQUIRED, fPending))
+                                    return set_error(serror, fPending ? SCRIPT_ERR_WITHDRAW_VERIFY_BLOCKPENDING : SCRIPT_ERR_WITHDRAW_VERIFY_BLOCKCONFIRMED);
 #endif
                             } catch (std::exception& e) {
                                 // Probably invalid encoding of something which was deserialized
@@ -1792,13 +1801,15 @@ private:
     const bool fAnyoneCanPay;  //! whether the hashtype has the SIGHASH_ANYONECANPAY flag set
     const bool fHashSingle;    //! whether the hashtype is SIGHASH_SINGLE
     const bool fHashNone;      //! whether the hashtype is SIGHASH_NONE
+    const PrecomputedTransactionData* txdata; //! serialized outputs of txTo, if precomputed
 
 public:
-    CTransactionSignatureSerializer(const CTransaction &txToIn, const CScript &scriptCodeIn, const CTxOutValue &nValueIn, unsigned int nInIn, int nHashTypeIn) :
+    CTransactionSignatureSerializer(const CTransaction &txToIn, const CScript &scriptCodeIn, const CTxOutValue &nValueIn, unsigned int nInIn, int nHashTypeIn, const PrecomputedTransactionData* txdataIn) :
         txTo(txToIn), scriptCode(scriptCodeIn), nValue(nValueIn), nIn(nInIn),
         fAnyoneCanPay(!!(nHashTypeIn & SIGHASH_ANYONECANPAY)),
         fHashSingle((nHashTypeIn & 0x1f) == SIGHASH_SINGLE),
-        fHashNone((nHashTypeIn & 0x1f) == SIGHASH_NONE) {}
+        fHashNone((nHashTypeIn & 0x1f) == SIGHASH_NONE),
+        txdata(txdataIn) {}
 
     /** Serialize the passed scriptCode, skipping OP_CODESEPARATORs */
     template<typename S>
@@ -1852,6 +1863,15 @@ public:
     /** Serialize an output of txTo */
     template<typename S>
     void SerializeOutput(S &s, unsigned int nOutput, int nType, int nVersion) const {
+        if (txdata) {
+            if (fHashSingle && nOutput != nIn) {
+                s.write((const char*)&txdata->vchBlankOutput[0], txdata->vchBlankOutput.size());
+            } else {
+                unsigned int nBegin = nOutput ? txdata->vOutputEnd[nOutput - 1] : 0;
+                s.write((const char*)&txdata->vchOutputs[nBegin], txdata->vOutputEnd[nOutput] - nBegin);
+            }
+            return;
+        }
         if (fHashSingle && nOutput != nIn)
             // Do not lock-in the txout payee at other indices as txin
             ::Serialize(s, CTxOut(), nType, nVersion | SERIALIZE_VERSION_MASK_PREHASH);
@@ -1872,8 +1892,13 @@ public:
         // Serialize vout
         unsigned int nOutputs = fHashNone ? 0 : (fHashSingle ? nIn+1 : txTo.vout.size());
         ::WriteCompactSize(s, nOutputs);
-        for (unsigned int nOutput = 0; nOutput < nOutputs; nOutput++)
-             SerializeOutput(s, nOutput, nType, nVersion);
+        if (txdata && !fHashSingle && nOutputs) {
+            // All outputs, in one piece
+            s.write((const char*)&txdata->vchOutputs[0], txdata->vchOutputs.size());
+        } else {
+            for (unsigned int nOutput = 0; nOutput < nOutputs; nOutput++)
+                 SerializeOutput(s, nOutput, nType, nVersion);
+        }
         // Serialize nLockTime
         ::Serialize(s, txTo.nLockTime, nType, nVersion);
     }
@@ -1881,7 +1906,23 @@ public:
 
 } // anon namespace
 
-uint256 SignatureHash(const CScript& scriptCode, const CTxOutValue& nAmount, const CTransaction& txTo, unsigned int nIn, int nHashType)
+PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& tx)
+{
+    // Serialized the same way CTransactionSignatureSerializer::SerializeOutput does
+    CDataStream ss(SER_GETHASH, SERIALIZE_VERSION_MASK_PREHASH);
+    vOutputEnd.reserve(tx.vout.size());
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        ss << tx.vout[i];
+        vOutputEnd.push_back(ss.size());
+    }
+    vchOutputs.assign(ss.begin(), ss.end());
+
+    ss.clear();
+    ss << CTxOut();
+    vchBlankOutput.assign(ss.begin(), ss.end());
+}
+
+uint256 SignatureHash(const CScript& scriptCode, const CTxOutValue& nAmount, const CTransaction& txTo, unsigned int nIn, int nHashType, const PrecomputedTransactionData* txdata)
 {
     if (nIn >= txTo.vin.size()) {
         //  nIn out of range
@@ -1897,7 +1938,7 @@ uint256 SignatureHash(const CScript& scriptCode, const CTxOutValue& nAmount, con
     }
 
     // Wrapper to serialize only the necessary parts of the transaction being signed
-    CTransactionSignatureSerializer txTmp(txTo, scriptCode, nAmount, nIn, nHashType);
+    CTransactionSignatureSerializer txTmp(txTo, scriptCode, nAmount, nIn, nHashType, txdata);
 
     // Serialize and hash
     CHashWriter ss(SER_GETHASH, 0);
@@ -1920,20 +1961,30 @@ bool TransactionNoWithdrawsSignatureChecker::VerifySignature(const std::vector<u
     return pubkey.Verify(sighash, vchSig);
 }
 
-bool TransactionNoWithdrawsSignatureChecker::CheckSig(const vector<unsigned char>& vchSigIn, const vector<unsigned char>& vchPubKey, const CScript& scriptCode) const
+bool TransactionNoWithdrawsSignatureChecker::PrepareSig(const vector<unsigned char>& vchSigIn, const vector<unsigned char>& vchPubKey, const CScript& scriptCode, vector<unsigned char>& vchSig, CPubKey& pubkey, uint256& sighash) const
 {
-    CPubKey pubkey(vchPubKey);
+    pubkey = CPubKey(vchPubKey);
     if (!pubkey.IsValid())
         return false;
 
     // Hash type is one byte tacked on to the end of the signature
-    vector<unsigned char> vchSig(vchSigIn);
+    vchSig = vchSigIn;
     if (vchSig.empty())
         return false;
     int nHashType = vchSig.back();
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, GetValueIn(), *txTo, nIn, nHashType);
+    sighash = SignatureHash(scriptCode, GetValueIn(), *txTo, nIn, nHashType, txdata);
+    return true;
+}
+
+bool TransactionNoWithdrawsSignatureChecker::CheckSig(const vector<unsigned char>& vchSigIn, const vector<unsigned char>& vchPubKey, const CScript& scriptCode) const
+{
+    vector<unsigned char> vchSig;
+    CPubKey pubkey;
+    uint256 sighash;
+    if (!PrepareSig(vchSigIn, vchPubKey, scriptCode, vchSig, pubkey, sighash))
+        return false;
 
     if (!VerifySignature(vchSig, pubkey, sighash))
         return false;
@@ -2019,9 +2070,9 @@ CTxOutValue TransactionSignatureChecker::GetValueInPrevIn() const
 }
 
 #ifdef FEDERATED_PEG_SIDECHAIN_ONLY
-bool TransactionSignatureChecker::IsConfirmedBitcoinBlock(const uint256& hash, bool fConservativeConfirmationRequirements) const
+bool TransactionSignatureChecker::IsConfirmedBitcoinBlock(const uint256& hash, bool fConservativeConfirmationRequirements, bool& fPending) const
 {
-    return ::IsConfirmedBitcoinBlock(hash, fConservativeConfirmationRequirements ? 10 : 8);
+    return ::IsConfirmedBitcoinBlock(hash, fConservativeConfirmationRequirements ? 10 : 8, fPending);
 }
 #endif
 
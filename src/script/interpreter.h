@@ -87,7 +87,25 @@ enum
     SCRIPT_VERIFY_INCREASE_CONFIRMATIONS_REQUIRED = (1U << 12)
 };
 
-uint256 SignatureHash(const CScript &scriptCode, const CTxOutValue& nValue, const CTransaction& txTo, unsigned int nIn, int nHashType);
+/**
+ * The parts of a transaction's signature hash serialization which are the
+ * same for every input being signed, computed once per transaction. Each
+ * output is serialized with its rangeproof prehashed, which would otherwise
+ * be hashed again for every input checked.
+ */
+struct PrecomputedTransactionData
+{
+    //! The outputs, serialized back to back as they are signed
+    std::vector<unsigned char> vchOutputs;
+    //! The end of each output within vchOutputs
+    std::vector<unsigned int> vOutputEnd;
+    //! A blanked out output, as signed with SIGHASH_SINGLE
+    std::vector<unsigned char> vchBlankOutput;
+
+    explicit PrecomputedTransactionData(const CTransaction& tx);
+};
+
+uint256 SignatureHash(const CScript &scriptCode, const CTxOutValue& nValue, const CTransaction& txTo, unsigned int nIn, int nHashType, const PrecomputedTransactionData* txdata = NULL);
 
 class BaseSignatureChecker
 {
@@ -97,6 +115,18 @@ public:
         return false;
     }
 
+    /**
+     * Check a signature the script cannot succeed without. A checker may
+     * assume such a signature valid and verify it later, as a bad one fails
+     * the script either way. Signatures which may legitimately fail, like
+     * those a CHECKMULTISIG tries against keys it then skips, go through
+     * CheckSig, which must return the real result.
+     */
+    virtual bool CheckRequiredSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const
+    {
+        return CheckSig(scriptSig, vchPubKey, scriptCode);
+    }
+
     virtual bool CheckLockTime(const CScriptNum& nLockTime, bool fSequence = false) const
     {
          return false;
@@ -122,8 +152,10 @@ public:
 
 #define FEDERATED_PEG_SIDECHAIN_ONLY
 #ifdef FEDERATED_PEG_SIDECHAIN_ONLY
-    virtual bool IsConfirmedBitcoinBlock(const uint256& hash, bool fConservativeConfirmationRequirements) const
+    /** fPending is set if the answer isn't known yet and the check should be retried later */
+    virtual bool IsConfirmedBitcoinBlock(const uint256& hash, bool fConservativeConfirmationRequirements, bool& fPending) const
     {
+        fPending = false;
         return false;
     }
 #endif
@@ -137,10 +169,13 @@ protected:
     const CTransaction* txTo;
     const CTxOutValue nInValue;
     const unsigned int nIn;
+    const PrecomputedTransactionData* txdata;
     virtual bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
+    //! Split off the hash type and compute the signature hash; false if the signature can be rejected right away
+    bool PrepareSig(const std::vector<unsigned char>& vchSigIn, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, std::vector<unsigned char>& vchSig, CPubKey& pubkey, uint256& sighash) const;
 
 public:
-    TransactionNoWithdrawsSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CTxOutValue& nInValueIn) : txTo(txToIn), nInValue(nInValueIn), nIn(nInIn) {}
+    TransactionNoWithdrawsSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CTxOutValue& nInValueIn, const PrecomputedTransactionData* txdataIn = NULL) : txTo(txToIn), nInValue(nInValueIn), nIn(nInIn), txdata(txdataIn) {}
     bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const;
     bool CheckLockTime(const CScriptNum& nLockTime, bool fSequence = false) const;
     CTxOutValue GetValueIn() const;
@@ -163,13 +198,13 @@ private:
     const int nSpendHeight;
 
 public:
-    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, CTxOutValue nInValueIn, CTxOutValue nInMinusOneValueIn, CAmount nTransactionFeeIn, int nSpendHeightIn) : TransactionNoWithdrawsSignatureChecker(txToIn, nInIn, nInValueIn), nInMinusOneValue(nInMinusOneValueIn), nTransactionFee(nTransactionFeeIn), nSpendHeight(nSpendHeightIn) {}
+    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, CTxOutValue nInValueIn, CTxOutValue nInMinusOneValueIn, CAmount nTransactionFeeIn, int nSpendHeightIn, const PrecomputedTransactionData* txdataIn = NULL) : TransactionNoWithdrawsSignatureChecker(txToIn, nInIn, nInValueIn, txdataIn), nInMinusOneValue(nInMinusOneValueIn), nTransactionFee(nTransactionFeeIn), nSpendHeight(nSpendHeightIn) {}
     CTxOut GetOutputOffsetFromCurrent(const int offset) const;
     COutPoint GetPrevOut() const;
     CTxOutValue GetValueInPrevIn() const;
     CAmount GetTransactionFee() const;
 #ifdef FEDERATED_PEG_SIDECHAIN_ONLY
-    bool IsConfirmedBitcoinBlock(const uint256& hash, bool fConservativeConfirmationRequirements) const;
+    bool IsConfirmedBitcoinBlock(const uint256& hash, bool fConservativeConfirmationRequirements, bool& fPending) const;
 #endif
 };
 
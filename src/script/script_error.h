@@ -59,6 +59,7 @@ typedef enum ScriptError_t
     SCRIPT_ERR_WITHDRAW_VERIFY_LOCKTIME,
     SCRIPT_ERR_WITHDRAW_VERIFY_SECONDSCRIPT,
     SCRIPT_ERR_WITHDRAW_VERIFY_BLOCKCONFIRMED,
+    SCRIPT_ERR_WITHDRAW_VERIFY_BLOCKPENDING,
     SCRIPT_ERR_WITHDRAW_VALUES_HIDDEN,
     SCRIPT_ERR_REORG_VERIFY_FORMAT,
     SCRIPT_ERR_REORG_VERIFY_FRAUD_BLOCK,
@@ -67,6 +68,9 @@ typedef enum ScriptError_t
     SCRIPT_ERR_REORG_VERIFY_FRAUD_OUTPUT,
     SCRIPT_ERR_REORG_VALUES_HIDDEN,
 
+    /* confidential transactions */
+    SCRIPT_ERR_RANGEPROOF,
+
     SCRIPT_ERR_ERROR_COUNT
 } ScriptError;
 
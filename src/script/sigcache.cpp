@@ -5,86 +5,259 @@
 
 #include "sigcache.h"
 
+#include "coins.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
+#include "validationstats.h"
+
+#include <algorithm>
+#include <string.h>
 
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
 
-namespace {
+CSignatureCache::CSignatureCache() : nonce(GetRandHash()), nSlots(0), nEntries(0)
+{
+    for (size_t i = 0; i < SEQUENCE_LOCKS; i++)
+        vSequence[i].store(0, boost::memory_order_relaxed);
+}
 
-/**
- * Valid signature cache, to avoid doing expensive signature checking
- * twice for every transaction (once when accepted into memory pool, and
- * again when accepted into the block chain)
- */
-class CSignatureCache
-{
-private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
-
-public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
-    {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
-        return false;
+size_t CSignatureCache::Slot(const uint256& entry, unsigned int n) const
+{
+    // Map 32 bits of the (uniformly random) digest onto the table.
+    return ((uint64_t)ReadLE32(entry.begin() + 4 * n) * nSlots) >> 32;
+}
+
+uint256 CSignatureCache::ReadSlot(size_t nSlot) const
+{
+    const boost::atomic<uint32_t>& sequence = vSequence[nSlot % SEQUENCE_LOCKS];
+    uint64_t words[WORDS_PER_SLOT];
+    while (true) {
+        uint32_t nSequence = sequence.load(boost::memory_order_acquire);
+        for (unsigned int i = 0; i < WORDS_PER_SLOT; i++)
+            words[i] = vWords[nSlot * WORDS_PER_SLOT + i].load(boost::memory_order_relaxed);
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        if (!(nSequence & 1) && sequence.load(boost::memory_order_relaxed) == nSequence)
+            break;
     }
+    uint256 entry;
+    memcpy(entry.begin(), words, sizeof(words));
+    return entry;
+}
+
+void CSignatureCache::WriteSlot(size_t nSlot, const uint256& entry)
+{
+    uint64_t words[WORDS_PER_SLOT];
+    memcpy(words, entry.begin(), sizeof(words));
+    boost::atomic<uint32_t>& sequence = vSequence[nSlot % SEQUENCE_LOCKS];
+    uint32_t nSequence = sequence.load(boost::memory_order_relaxed);
+    sequence.store(nSequence + 1, boost::memory_order_relaxed);
+    boost::atomic_thread_fence(boost::memory_order_release);
+    for (unsigned int i = 0; i < WORDS_PER_SLOT; i++)
+        vWords[nSlot * WORDS_PER_SLOT + i].store(words[i], boost::memory_order_relaxed);
+    sequence.store(nSequence + 2, boost::memory_order_release);
+}
+
+void CSignatureCache::Setup(size_t nBytes)
+{
+    boost::unique_lock<boost::mutex> lock(cs_sigcache);
+    nSlots = nBytes / ENTRY_SIZE;
+    vWords.reset(nSlots ? new boost::atomic<uint64_t>[nSlots * WORDS_PER_SLOT] : NULL);
+    vErasable.reset(nSlots ? new boost::atomic<unsigned char>[nSlots] : NULL);
+    for (size_t i = 0; i < nSlots * WORDS_PER_SLOT; i++)
+        vWords[i].store(0, boost::memory_order_relaxed);
+    for (size_t i = 0; i < nSlots; i++)
+        vErasable[i].store(0, boost::memory_order_relaxed);
+    nEntries = 0;
+}
+
+size_t CSignatureCache::Capacity()
+{
+    return nSlots;
+}
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
-    {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+size_t CSignatureCache::Size() const
+{
+    return nEntries.load(boost::memory_order_relaxed);
+}
+
+void CSignatureCache::ComputeEntry(uint256 &entry, const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey) const
+{
+    CSHA256 hasher;
+    hasher.Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(pubkey.begin(), pubkey.size());
+    if (!vchSig.empty())
+        hasher.Write(&vchSig[0], vchSig.size());
+    hasher.Finalize(entry.begin());
+}
+
+void CSignatureCache::ComputeEntry(uint256 &entry, const CTxOutValue& value) const
+{
+    // The same size per entry regardless of proof size
+    CSHA256 hasher;
+    hasher.Write(nonce.begin(), 32);
+    if (!value.vchCommitment.empty())
+        hasher.Write(&value.vchCommitment[0], value.vchCommitment.size());
+    if (!value.vchRangeproof.empty())
+        hasher.Write(&value.vchRangeproof[0], value.vchRangeproof.size());
+    hasher.Finalize(entry.begin());
+}
+
+bool CSignatureCache::Get(const uint256 &entry, bool fErase)
+{
+    if (nSlots == 0)
+        return false;
+    for (unsigned int n = 0; n < SLOTS_PER_ENTRY; n++) {
+        size_t nSlot = Slot(entry, n);
+        if (ReadSlot(nSlot) == entry) {
+            // Only a hint for Set(), so it doesn't matter if the entry has
+            // been moved or replaced in the meantime.
+            if (fErase)
+                vErasable[nSlot].store(1, boost::memory_order_relaxed);
+            return true;
         }
+    }
+    return false;
+}
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+void CSignatureCache::Set(const uint256 &entryIn)
+{
+    boost::unique_lock<boost::mutex> lock(cs_sigcache);
+    if (nSlots == 0)
+        return;
+
+    uint256 entry = entryIn;
+    size_t nLast = nSlots;
+    for (unsigned int nMoves = 0; nMoves <= MAX_MOVES; nMoves++) {
+        for (unsigned int n = 0; n < SLOTS_PER_ENTRY; n++) {
+            size_t nSlot = Slot(entry, n);
+            uint256 occupant = ReadSlot(nSlot);
+            if (occupant == entry)
+                return;
+            if (occupant == 0 || vErasable[nSlot].load(boost::memory_order_relaxed)) {
+                if (occupant == 0)
+                    nEntries++;
+                WriteSlot(nSlot, entry);
+                vErasable[nSlot].store(0, boost::memory_order_relaxed);
+                return;
+            }
+        }
+        // No free slot: displace an occupant that is not the one we
+        // just moved here, and go on to find a place for it.
+        unsigned int n = GetRand(SLOTS_PER_ENTRY);
+        size_t nSlot = Slot(entry, n);
+        if (nSlot == nLast)
+            nSlot = Slot(entry, (n + 1) % SLOTS_PER_ENTRY);
+        uint256 displaced = ReadSlot(nSlot);
+        WriteSlot(nSlot, entry);
+        entry = displaced;
+        nLast = nSlot;
     }
-};
+    // Whatever is left in hand after MAX_MOVES is evicted.
+}
+
+namespace {
+
+CSignatureCache& GetSignatureCache()
+{
+    static CSignatureCache signatureCache;
+    return signatureCache;
+}
+
+CSignatureCache& GetRangeproofCache()
+{
+    static CSignatureCache rangeproofCache;
+    return rangeproofCache;
+}
+
+//! Rangeproof cache lookups, counted once per proof a transaction or block needed verified
+boost::atomic<uint64_t> nRangeproofHits(0);
+boost::atomic<uint64_t> nRangeproofMisses(0);
 
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
-    static CSignatureCache signatureCache;
+    CSignatureCache& signatureCache = GetSignatureCache();
 
-    if (signatureCache.Get(sighash, vchSig, pubkey))
+    uint256 entry;
+    signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
+
+    // Checks that do not store are made while connecting a block; the
+    // signature will not be needed again, so let its slot be reused.
+    if (signatureCache.Get(entry, !store))
         return true;
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
 
     if (store)
-        signatureCache.Set(sighash, vchSig, pubkey);
+        signatureCache.Set(entry);
+    return true;
+}
+
+bool BatchingTransactionSignatureChecker::CheckRequiredSig(const std::vector<unsigned char>& vchSigIn, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const
+{
+    std::vector<unsigned char> vchSig;
+    CPubKey pubkey;
+    uint256 sighash;
+    if (!PrepareSig(vchSigIn, vchPubKey, scriptCode, vchSig, pubkey, sighash))
+        return false;
+
+    CSignatureCache& signatureCache = GetSignatureCache();
+
+    uint256 entry;
+    signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
+    if (signatureCache.Get(entry, true))
+        return true;
+
+    return batch.Add(pubkey, sighash, vchSig);
+}
+
+bool CachingRangeproofChecker::VerifyRangeproof(const CTxOutValue& value) const
+{
+    CValidationTimer timer(VALIDATION_RANGEPROOF);
+    CSignatureCache& rangeproofCache = GetRangeproofCache();
+
+    uint256 entry;
+    rangeproofCache.ComputeEntry(entry, value);
+
+    // As for signatures, proofs checked without storing are in a block being
+    // connected, and their slots may be reused.
+    if (rangeproofCache.Get(entry, !store)) {
+        nRangeproofHits.fetch_add(1, boost::memory_order_relaxed);
+        return true;
+    }
+    nRangeproofMisses.fetch_add(1, boost::memory_order_relaxed);
+
+    if (!::VerifyRangeproof(value))
+        return false;
+
+    if (store)
+        rangeproofCache.Set(entry);
     return true;
 }
+
+CRangeproofCacheStats GetRangeproofCacheStats()
+{
+    CRangeproofCacheStats stats;
+    stats.nHits = nRangeproofHits.load(boost::memory_order_relaxed);
+    stats.nMisses = nRangeproofMisses.load(boost::memory_order_relaxed);
+    stats.nEntries = GetRangeproofCache().Size();
+    return stats;
+}
+
+void InitSignatureCache()
+{
+    int64_t nMaxCacheSize = std::max((int64_t)0, GetArg("-maxsigcachemb", DEFAULT_MAX_SIG_CACHE_SIZE));
+    nMaxCacheSize = std::min(nMaxCacheSize, MAX_MAX_SIG_CACHE_SIZE);
+    GetSignatureCache().Setup(nMaxCacheSize << 20);
+    LogPrintf("Using %u MiB out of %u requested for signature cache, able to store %u elements\n",
+              (unsigned)(GetSignatureCache().Capacity() * CSignatureCache::ENTRY_SIZE >> 20), (unsigned)nMaxCacheSize, (unsigned)GetSignatureCache().Capacity());
+
+    int64_t nMaxRangeproofs = std::max((int64_t)0, GetArg("-maxrangeproofcachesize", DEFAULT_MAX_RANGEPROOF_CACHE_SIZE));
+    nMaxRangeproofs = std::min(nMaxRangeproofs, (MAX_MAX_SIG_CACHE_SIZE << 20) / (int64_t)CSignatureCache::ENTRY_SIZE);
+    GetRangeproofCache().Setup(nMaxRangeproofs * CSignatureCache::ENTRY_SIZE);
+}
@@ -6,11 +6,92 @@
 #ifndef BITCOIN_SCRIPT_SIGCACHE_H
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
+#include "pubkey.h"
 #include "script/interpreter.h"
+#include "uint256.h"
 
+#include <stdint.h>
 #include <vector>
 
-class CPubKey;
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/mutex.hpp>
+
+//! Default size of the signature cache, in MiB
+static const int64_t DEFAULT_MAX_SIG_CACHE_SIZE = 32;
+//! Upper bound for -maxsigcachemb, in MiB
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 16384;
+//! Default size of the rangeproof cache, in entries. A block carries at most a
+//! few thousand blinded outputs, so this keeps a couple of blocks' worth of
+//! mempool proofs around.
+static const int64_t DEFAULT_MAX_RANGEPROOF_CACHE_SIZE = 50000;
+
+/**
+ * Valid signature cache, to avoid doing expensive signature checking
+ * twice for every transaction (once when accepted into memory pool, and
+ * again when accepted into the block chain).
+ *
+ * Rather than the (signature hash, signature, public key) tuple itself, the
+ * cache stores a salted SHA256 digest of it in a fixed size table. Each
+ * digest may live in one of SLOTS_PER_ENTRY slots picked by its own bits;
+ * inserting into a full neighbourhood moves an occupant to another of its
+ * slots, cuckoo style, and a bounded number of such moves drops the last
+ * displaced entry, so eviction is pseudo-random and cannot be targeted by
+ * an attacker who does not know the salt.
+ *
+ * Lookups take no lock. Slots are stored as atomic words, and each is
+ * guarded by one of SEQUENCE_LOCKS sequence counters that writers bump
+ * before and after changing it; a reader that sees the counter move retries
+ * the slot. Writers are serialized by cs_sigcache.
+ *
+ * A second instance caches the rangeproofs that verified, keyed by a salted
+ * digest of the commitment and the proof.
+ */
+class CSignatureCache
+{
+public:
+    //! Bytes of memory per entry: the digest and its erasable flag
+    static const size_t ENTRY_SIZE = 32 + 1;
+
+private:
+    static const unsigned int SLOTS_PER_ENTRY = 8;
+    static const unsigned int MAX_MOVES = 16;
+    static const size_t SEQUENCE_LOCKS = 4096;
+    static const unsigned int WORDS_PER_SLOT = 4;
+
+    uint256 nonce;
+    size_t nSlots;
+    //! The digest in each slot, as WORDS_PER_SLOT words
+    boost::scoped_array<boost::atomic<uint64_t> > vWords;
+    //! Set for entries seen in a connected block, which may be overwritten first.
+    boost::scoped_array<boost::atomic<unsigned char> > vErasable;
+    //! Odd while a writer is changing one of the slots the counter guards
+    boost::atomic<uint32_t> vSequence[SEQUENCE_LOCKS];
+    //! Number of occupied slots
+    boost::atomic<size_t> nEntries;
+    boost::mutex cs_sigcache;
+
+    size_t Slot(const uint256& entry, unsigned int n) const;
+    uint256 ReadSlot(size_t nSlot) const;
+    //! Requires cs_sigcache
+    void WriteSlot(size_t nSlot, const uint256& entry);
+
+public:
+    CSignatureCache();
+
+    //! Resize the table to nBytes worth of entries, dropping its contents.
+    //! Must not run concurrently with lookups.
+    void Setup(size_t nBytes);
+    size_t Capacity();
+    size_t Size() const;
+
+    void ComputeEntry(uint256 &entry, const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey) const;
+    void ComputeEntry(uint256 &entry, const CTxOutValue& value) const;
+
+    /** Whether entry is cached. With fErase, its slot may be reused by the next Set(). */
+    bool Get(const uint256 &entry, bool fErase);
+    void Set(const uint256 &entry);
+};
 
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
@@ -18,9 +99,59 @@ private:
     bool store;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, CTxOutValue nInValueIn, CTxOutValue nInMinusOneValueIn, CAmount nTransactionFeeIn, int nSpendHeightIn, bool storeIn=true) : TransactionSignatureChecker(txToIn, nInIn, nInValueIn, nInMinusOneValueIn, nTransactionFeeIn, nSpendHeightIn), store(storeIn) {}
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, CTxOutValue nInValueIn, CTxOutValue nInMinusOneValueIn, CAmount nTransactionFeeIn, int nSpendHeightIn, bool storeIn=true, const PrecomputedTransactionData* txdataIn=NULL) : TransactionSignatureChecker(txToIn, nInIn, nInValueIn, nInMinusOneValueIn, nTransactionFeeIn, nSpendHeightIn, txdataIn), store(storeIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/** Allocate the signature and rangeproof caches, sized by -maxsigcachemb and -maxrangeproofcachesize. Call once at startup. */
+void InitSignatureCache();
+
+/**
+ * Signature checker for block connection which assumes every signature the
+ * script cannot succeed without is valid, unless already cached, and queues
+ * it in a CSignatureBatch. Other signatures are verified right away. A script
+ * that passes with this checker is only valid once the batch verifies; if
+ * either fails, the script must be run again with a
+ * CachingTransactionSignatureChecker to get the real outcome.
+ */
+class BatchingTransactionSignatureChecker : public CachingTransactionSignatureChecker
+{
+private:
+    CSignatureBatch& batch;
+
+public:
+    BatchingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, CTxOutValue nInValueIn, CTxOutValue nInMinusOneValueIn, CAmount nTransactionFeeIn, int nSpendHeightIn, CSignatureBatch& batchIn, const PrecomputedTransactionData* txdataIn=NULL) : CachingTransactionSignatureChecker(txToIn, nInIn, nInValueIn, nInMinusOneValueIn, nTransactionFeeIn, nSpendHeightIn, false, txdataIn), batch(batchIn) {}
+
+    bool CheckRequiredSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const;
+};
+
+/**
+ * Rangeproof checker backed by a cache of proofs that already verified, so
+ * that a blinded output checked on mempool acceptance is not checked again
+ * when its block is connected.
+ */
+class CachingRangeproofChecker
+{
+private:
+    bool store;
+
+public:
+    CachingRangeproofChecker(bool storeIn=true) : store(storeIn) {}
+
+    bool VerifyRangeproof(const CTxOutValue& value) const;
+};
+
+struct CRangeproofCacheStats
+{
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nEntries;
+
+    CRangeproofCacheStats() : nHits(0), nMisses(0), nEntries(0) {}
+};
+
+/** Return the lookup counters and current size of the rangeproof cache */
+CRangeproofCacheStats GetRangeproofCacheStats();
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
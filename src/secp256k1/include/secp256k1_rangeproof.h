@@ -94,6 +94,30 @@ SECP256K1_WARN_UNUSED_RESULT int secp256k1_rangeproof_verify(
   int plen
 ) SECP256K1_ARG_NONNULL(1) SECP256K1_ARG_NONNULL(2) SECP256K1_ARG_NONNULL(3) SECP256K1_ARG_NONNULL(4) SECP256K1_ARG_NONNULL(5);
 
+/** Verify a batch of proofs that committed values are within a range.
+ * Returns 1: Every value is within the range [0..2^64), the specifically proven ranges are in the min/max value outputs.
+ *         0: At least one proof failed or other error.
+ * In:   ctx: pointer to a context object, initialized for range-proof and commitment (cannot be NULL)
+ *       commits: array of n pointers to the 33-byte commitments being proved. (cannot be NULL)
+ *       proofs: array of n pointers to character arrays with the proofs. (cannot be NULL)
+ *       plens: array of n proof lengths in bytes. (cannot be NULL)
+ *       n: number of (commitment, proof) pairs.
+ * Out:  min_values: array of n unsigned int64s which will be updated with the minimum value each commit could have. (cannot be NULL)
+ *       max_values: array of n unsigned int64s which will be updated with the maximum value each commit could have. (cannot be NULL)
+ *
+ * This is faster than n calls to secp256k1_rangeproof_verify, as the ring signatures of several proofs are checked
+ * together and share their field inversions.
+ */
+SECP256K1_WARN_UNUSED_RESULT int secp256k1_rangeproof_verify_batch(
+  const secp256k1_context* ctx,
+  uint64_t *min_values,
+  uint64_t *max_values,
+  const unsigned char * const *commits,
+  const unsigned char * const *proofs,
+  const int *plens,
+  int n
+) SECP256K1_ARG_NONNULL(1) SECP256K1_ARG_NONNULL(2) SECP256K1_ARG_NONNULL(3) SECP256K1_ARG_NONNULL(4) SECP256K1_ARG_NONNULL(5) SECP256K1_ARG_NONNULL(6);
+
 /** Verify a range proof proof and rewind the proof to recover information sent by its author.
  *  Returns 1: Value is within the range [0..2^64), the specifically proven range is in the min/max value outputs, and the value and blinding were recovered.
  *          0: Proof failed, rewind failed, or other error.
@@ -48,6 +48,28 @@ SECP256K1_API SECP256K1_WARN_UNUSED_RESULT int secp256k1_schnorr_verify(
   const secp256k1_pubkey *pubkey
 ) SECP256K1_ARG_NONNULL(1) SECP256K1_ARG_NONNULL(2) SECP256K1_ARG_NONNULL(3) SECP256K1_ARG_NONNULL(4);
 
+/** Verify a batch of signatures created by secp256k1_schnorr_sign at once.
+ *  This is considerably faster than verifying them one by one, but does not
+ *  tell which signature is invalid if the batch fails.
+ *  Returns: 1: all signatures are correct (or n is 0)
+ *           0: at least one signature is incorrect
+ *  Args:    ctx:       a secp256k1 context object, initialized for verification.
+ *  In:      sig64s:    array of n pointers to 64-byte signatures (cannot be NULL
+ *                      unless n is 0)
+ *           msg32s:    array of n pointers to the 32-byte message hashes being
+ *                      verified (cannot be NULL unless n is 0)
+ *           pubkeys:   array of n pointers to the public keys to verify with
+ *                      (cannot be NULL unless n is 0)
+ *           n:         the number of signatures
+ */
+SECP256K1_API SECP256K1_WARN_UNUSED_RESULT int secp256k1_schnorr_verify_batch(
+  const secp256k1_context* ctx,
+  const unsigned char * const *sig64s,
+  const unsigned char * const *msg32s,
+  const secp256k1_pubkey * const *pubkeys,
+  size_t n
+) SECP256K1_ARG_NONNULL(1);
+
 /** Recover an EC public key from a Schnorr signature created using
  *  secp256k1_schnorr_sign.
  *  Returns: 1: public key successfully recovered (which guarantees a correct
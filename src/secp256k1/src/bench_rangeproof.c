@@ -10,14 +10,21 @@
 #include "util.h"
 #include "bench.h"
 
+#define BENCH_RANGEPROOF_BATCH 64
+
 typedef struct {
-    secp256k1_context_t* ctx;
+    secp256k1_context* ctx;
     unsigned char commit[33];
     unsigned char proof[5134];
     unsigned char blind[32];
     int len;
     int min_bits;
     uint64_t v;
+    unsigned char commits[BENCH_RANGEPROOF_BATCH][33];
+    unsigned char proofs[BENCH_RANGEPROOF_BATCH][5134];
+    const unsigned char *commitp[BENCH_RANGEPROOF_BATCH];
+    const unsigned char *proofp[BENCH_RANGEPROOF_BATCH];
+    int lens[BENCH_RANGEPROOF_BATCH];
 } bench_rangeproof_t;
 
 static void bench_rangeproof_setup(void* arg) {
@@ -49,6 +56,43 @@ static void bench_rangeproof(void* arg) {
     }
 }
 
+static void bench_rangeproof_batch_setup(void* arg) {
+    int i;
+    int j;
+    uint64_t minv[BENCH_RANGEPROOF_BATCH];
+    uint64_t maxv[BENCH_RANGEPROOF_BATCH];
+    bench_rangeproof_t *data = (bench_rangeproof_t*)arg;
+
+    for (i = 0; i < BENCH_RANGEPROOF_BATCH; i++) {
+        for (j = 0; j < 32; j++) data->blind[j] = i + j + 1;
+        CHECK(secp256k1_pedersen_commit(data->ctx, data->commits[i], data->blind, i));
+        data->lens[i] = 5134;
+        CHECK(secp256k1_rangeproof_sign(data->ctx, data->proofs[i], &data->lens[i], 0, data->commits[i], data->blind, data->commits[i], 0, data->min_bits, i));
+        data->commitp[i] = data->commits[i];
+        data->proofp[i] = data->proofs[i];
+    }
+    CHECK(secp256k1_rangeproof_verify_batch(data->ctx, minv, maxv, data->commitp, data->proofp, data->lens, BENCH_RANGEPROOF_BATCH));
+}
+
+static void bench_rangeproof_serial(void* arg) {
+    int i;
+    bench_rangeproof_t *data = (bench_rangeproof_t*)arg;
+
+    for (i = 0; i < BENCH_RANGEPROOF_BATCH; i++) {
+        uint64_t minv;
+        uint64_t maxv;
+        CHECK(secp256k1_rangeproof_verify(data->ctx, &minv, &maxv, data->commitp[i], data->proofp[i], data->lens[i]));
+    }
+}
+
+static void bench_rangeproof_batch(void* arg) {
+    uint64_t minv[BENCH_RANGEPROOF_BATCH];
+    uint64_t maxv[BENCH_RANGEPROOF_BATCH];
+    bench_rangeproof_t *data = (bench_rangeproof_t*)arg;
+
+    CHECK(secp256k1_rangeproof_verify_batch(data->ctx, minv, maxv, data->commitp, data->proofp, data->lens, BENCH_RANGEPROOF_BATCH));
+}
+
 int main(void) {
     bench_rangeproof_t data;
 
@@ -60,6 +104,10 @@ int main(void) {
 
     run_benchmark("rangeproof_verify_bit", bench_rangeproof, bench_rangeproof_setup, NULL, &data, 10, 1000 * data.min_bits);
 
+    bench_rangeproof_batch_setup(&data);
+    run_benchmark("rangeproof_verify_serial", bench_rangeproof_serial, NULL, NULL, &data, 10, BENCH_RANGEPROOF_BATCH);
+    run_benchmark("rangeproof_verify_batch", bench_rangeproof_batch, NULL, NULL, &data, 10, BENCH_RANGEPROOF_BATCH);
+
     secp256k1_context_destroy(data.ctx);
     return 0;
 }
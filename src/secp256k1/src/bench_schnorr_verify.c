@@ -58,7 +58,25 @@ static void benchmark_schnorr_verify(void* arg) {
     }
 }
 
+static void benchmark_schnorr_verify_batch(void* arg) {
+    int i, k;
+    benchmark_schnorr_verify_t* data = (benchmark_schnorr_verify_t*)arg;
+    secp256k1_pubkey pubkeys[64];
+    const secp256k1_pubkey *pubs[64];
+    const unsigned char *sigs[64];
+    const unsigned char *msgs[64];
 
+    /* Parse the keys on every round, as a single verification has to. */
+    for (i = 0; i < 20000 / data->numsigs; i++) {
+        for (k = 0; k < data->numsigs; k++) {
+            CHECK(secp256k1_ec_pubkey_parse(data->ctx, &pubkeys[k], data->sigs[k].pubkey, data->sigs[k].pubkeylen));
+            pubs[k] = &pubkeys[k];
+            sigs[k] = data->sigs[k].sig;
+            msgs[k] = data->msg;
+        }
+        CHECK(secp256k1_schnorr_verify_batch(data->ctx, sigs, msgs, pubs, data->numsigs) == 1);
+    }
+}
 
 int main(void) {
     benchmark_schnorr_verify_t data;
@@ -68,6 +86,13 @@ int main(void) {
     data.numsigs = 1;
     run_benchmark("schnorr_verify", benchmark_schnorr_verify, benchmark_schnorr_init, NULL, &data, 10, 20000);
 
+    data.numsigs = 4;
+    run_benchmark("schnorr_verify_batch4", benchmark_schnorr_verify_batch, benchmark_schnorr_init, NULL, &data, 10, 20000);
+    data.numsigs = 16;
+    run_benchmark("schnorr_verify_batch16", benchmark_schnorr_verify_batch, benchmark_schnorr_init, NULL, &data, 10, 20000);
+    data.numsigs = 64;
+    run_benchmark("schnorr_verify_batch64", benchmark_schnorr_verify_batch, benchmark_schnorr_init, NULL, &data, 10, 20000);
+
     secp256k1_context_destroy(data.ctx);
     return 0;
 }
@@ -17,6 +17,10 @@
 int secp256k1_borromean_verify(const secp256k1_ecmult_context* ecmult_ctx, secp256k1_scalar *evalues, const unsigned char *e0, const secp256k1_scalar *s,
  const secp256k1_gej *pubs, const int *rsizes, int nrings, const unsigned char *m, int mlen);
 
+int secp256k1_borromean_verify_batch(const secp256k1_ecmult_context* ecmult_ctx, const secp256k1_callback* cb,
+ const unsigned char * const *e0, const secp256k1_scalar * const *s, const secp256k1_gej * const *pubs, const int * const *rsizes,
+ const int *nrings, const unsigned char * const *m, int mlen, int n);
+
 int secp256k1_borromean_sign(const secp256k1_ecmult_context* ecmult_ctx, const secp256k1_ecmult_gen_context *ecmult_gen_ctx,
  unsigned char *e0, secp256k1_scalar *s, const secp256k1_gej *pubs, const secp256k1_scalar *k, const secp256k1_scalar *sec,
  const int *rsizes, const int *secidx, int nrings, const unsigned char *m, int mlen);
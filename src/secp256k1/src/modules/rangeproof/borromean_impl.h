@@ -106,6 +106,156 @@ int secp256k1_borromean_verify(const secp256k1_ecmult_context* ecmult_ctx, secp2
     return memcmp(e0, tmp, 32) == 0;
 }
 
+/** Verifies n independent Borromean ring signatures at once, with the same equation as secp256k1_borromean_verify.
+ *  Every r value has to be computed explicitly to be hashed, so the ecmults cannot be merged. Instead the rings of all
+ *  signatures are walked in lockstep, and the affine conversion of all r values at one ring position shares a single
+ *  field inversion. Returns 1 only if every signature is valid.
+ */
+int secp256k1_borromean_verify_batch(const secp256k1_ecmult_context* ecmult_ctx, const secp256k1_callback* cb,
+ const unsigned char * const *e0, const secp256k1_scalar * const *s, const secp256k1_gej * const *pubs, const int * const *rsizes,
+ const int *nrings, const unsigned char * const *m, int mlen, int n) {
+    secp256k1_scalar *ens;
+    secp256k1_gej *rgej;
+    secp256k1_fe *az;
+    secp256k1_fe *azi;
+    unsigned char (*rlast)[33];
+    int *rsig;
+    int *rring;
+    int *rpos;
+    int *rsize;
+    int *active;
+    int *ok;
+    secp256k1_ge rge;
+    secp256k1_sha256_t sha256_e0;
+    unsigned char tmp[33];
+    int total;
+    int maxsize;
+    int nactive;
+    int i;
+    int j;
+    int k;
+    int x;
+    int count;
+    size_t size;
+    int overflow;
+    int ret;
+    VERIFY_CHECK(ecmult_ctx != NULL);
+    VERIFY_CHECK(e0 != NULL);
+    VERIFY_CHECK(s != NULL);
+    VERIFY_CHECK(pubs != NULL);
+    VERIFY_CHECK(rsizes != NULL);
+    VERIFY_CHECK(nrings != NULL);
+    VERIFY_CHECK(m != NULL);
+    if (n <= 0) {
+        return 1;
+    }
+    total = 0;
+    for (x = 0; x < n; x++) {
+        VERIFY_CHECK(nrings[x] > 0);
+        VERIFY_CHECK(INT_MAX - total > nrings[x]);
+        total += nrings[x];
+    }
+    ens = (secp256k1_scalar *)checked_malloc(cb, sizeof(*ens) * total);
+    rgej = (secp256k1_gej *)checked_malloc(cb, sizeof(*rgej) * total);
+    az = (secp256k1_fe *)checked_malloc(cb, sizeof(*az) * total);
+    azi = (secp256k1_fe *)checked_malloc(cb, sizeof(*azi) * total);
+    rlast = (unsigned char (*)[33])checked_malloc(cb, sizeof(*rlast) * total);
+    rsig = (int *)checked_malloc(cb, sizeof(*rsig) * total * 5);
+    rring = rsig + total;
+    rpos = rring + total;
+    rsize = rpos + total;
+    active = rsize + total;
+    ok = (int *)checked_malloc(cb, sizeof(*ok) * n);
+    /* Derive the first challenge of every ring from its signature's e0. */
+    k = 0;
+    maxsize = 0;
+    for (x = 0; x < n; x++) {
+        ok[x] = 1;
+        count = 0;
+        for (i = 0; i < nrings[x]; i++) {
+            VERIFY_CHECK(INT_MAX - count > rsizes[x][i]);
+            secp256k1_borromean_hash(tmp, m[x], mlen, e0[x], 32, i, 0);
+            secp256k1_scalar_set_b32(&ens[k], tmp, &overflow);
+            if (overflow) {
+                ok[x] = 0;
+            }
+            rsig[k] = x;
+            rring[k] = i;
+            rpos[k] = count;
+            rsize[k] = rsizes[x][i];
+            if (rsize[k] > maxsize) {
+                maxsize = rsize[k];
+            }
+            count += rsizes[x][i];
+            k++;
+        }
+    }
+    for (j = 0; j < maxsize; j++) {
+        /* Compute the j-th r value of every ring that is still being walked. */
+        nactive = 0;
+        for (k = 0; k < total; k++) {
+            x = rsig[k];
+            if (!ok[x] || j >= rsize[k]) {
+                continue;
+            }
+            i = rpos[k] + j;
+            if (secp256k1_scalar_is_zero(&s[x][i]) || secp256k1_scalar_is_zero(&ens[k]) || secp256k1_gej_is_infinity(&pubs[x][i])) {
+                ok[x] = 0;
+                continue;
+            }
+            secp256k1_ecmult(ecmult_ctx, &rgej[k], &pubs[x][i], &ens[k], &s[x][i]);
+            if (secp256k1_gej_is_infinity(&rgej[k])) {
+                ok[x] = 0;
+                continue;
+            }
+            az[nactive] = rgej[k].z;
+            active[nactive++] = k;
+        }
+        secp256k1_fe_inv_all_var(nactive, azi, az);
+        /* Serialize them and hash each into its ring's next challenge. */
+        for (i = 0; i < nactive; i++) {
+            k = active[i];
+            secp256k1_ge_set_gej_zinv(&rge, &rgej[k], &azi[i]);
+            secp256k1_eckey_pubkey_serialize(&rge, tmp, &size, 1);
+            if (j != rsize[k] - 1) {
+                secp256k1_borromean_hash(tmp, m[rsig[k]], mlen, tmp, 33, rring[k], j + 1);
+                secp256k1_scalar_set_b32(&ens[k], tmp, &overflow);
+                if (overflow) {
+                    ok[rsig[k]] = 0;
+                }
+            } else {
+                memcpy(rlast[k], tmp, 33);
+            }
+        }
+    }
+    ret = 1;
+    k = 0;
+    for (x = 0; x < n; x++) {
+        if (!ok[x]) {
+            ret = 0;
+            k += nrings[x];
+            continue;
+        }
+        secp256k1_sha256_initialize(&sha256_e0);
+        for (i = 0; i < nrings[x]; i++) {
+            secp256k1_sha256_write(&sha256_e0, rlast[k++], 33);
+        }
+        secp256k1_sha256_write(&sha256_e0, m[x], mlen);
+        secp256k1_sha256_finalize(&sha256_e0, tmp);
+        if (memcmp(e0[x], tmp, 32) != 0) {
+            ret = 0;
+        }
+    }
+    free(ok);
+    free(rsig);
+    free(rlast);
+    free(azi);
+    free(az);
+    free(rgej);
+    free(ens);
+    return ret;
+}
+
 int secp256k1_borromean_sign(const secp256k1_ecmult_context* ecmult_ctx, const secp256k1_ecmult_gen_context *ecmult_gen_ctx,
  unsigned char *e0, secp256k1_scalar *s, const secp256k1_gej *pubs, const secp256k1_scalar *k, const secp256k1_scalar *sec,
  const int *rsizes, const int *secidx, int nrings, const unsigned char *m, int mlen) {
@@ -157,6 +157,22 @@ int secp256k1_rangeproof_verify(const secp256k1_context* ctx, uint64_t *min_valu
      NULL, NULL, NULL, NULL, NULL, min_value, max_value, commit, proof, plen);
 }
 
+int secp256k1_rangeproof_verify_batch(const secp256k1_context* ctx, uint64_t *min_values, uint64_t *max_values,
+ const unsigned char * const *commits, const unsigned char * const *proofs, const int *plens, int n) {
+    ARG_CHECK(ctx != NULL);
+    ARG_CHECK(min_values != NULL);
+    ARG_CHECK(max_values != NULL);
+    ARG_CHECK(commits != NULL);
+    ARG_CHECK(proofs != NULL);
+    ARG_CHECK(plens != NULL);
+    ARG_CHECK(n >= 0);
+    ARG_CHECK(secp256k1_ecmult_context_is_built(&ctx->ecmult_ctx));
+    ARG_CHECK(secp256k1_pedersen_context_is_built(&ctx->pedersen_ctx));
+    ARG_CHECK(secp256k1_rangeproof_context_is_built(&ctx->rangeproof_ctx));
+    return secp256k1_rangeproof_verify_batch_impl(&ctx->ecmult_ctx, &ctx->pedersen_ctx, &ctx->rangeproof_ctx, &ctx->error_callback,
+     min_values, max_values, commits, proofs, plens, n);
+}
+
 int secp256k1_rangeproof_sign(const secp256k1_context* ctx, unsigned char *proof, int *plen, uint64_t min_value,
  const unsigned char *commit, const unsigned char *blind, const unsigned char *nonce, int exp, int min_bits, uint64_t value){
     ARG_CHECK(ctx != NULL);
@@ -14,6 +14,21 @@ typedef struct {
     secp256k1_ge_storage (*prec)[1005];
 } secp256k1_rangeproof_context;
 
+/** A parsed range proof: the Borromean ring signature it carries plus what is needed to rewind it. */
+typedef struct {
+    secp256k1_gej pubs[128];
+    secp256k1_scalar s[128];
+    int rsizes[32];
+    int rings;
+    int offset_post_header;
+    uint64_t scale;
+    unsigned char m[32];
+    const unsigned char *e0;
+} secp256k1_rangeproof_verify_data;
+
+/** Maximum number of proofs walked together by secp256k1_rangeproof_verify_batch_impl. */
+#define SECP256K1_RANGEPROOF_BATCH_MAX 16
+
 
 static void secp256k1_rangeproof_context_init(secp256k1_rangeproof_context* ctx);
 static void secp256k1_rangeproof_context_build(secp256k1_rangeproof_context* ctx, const secp256k1_callback* cb);
@@ -28,4 +43,9 @@ static int secp256k1_rangeproof_verify_impl(const secp256k1_ecmult_context* ecmu
  unsigned char *blindout, uint64_t *value_out, unsigned char *message_out, int *outlen, const unsigned char *nonce,
  uint64_t *min_value, uint64_t *max_value, const unsigned char *commit, const unsigned char *proof, int plen);
 
+static int secp256k1_rangeproof_verify_batch_impl(const secp256k1_ecmult_context* ecmult_ctx,
+ const secp256k1_pedersen_context* pedersen_ctx, const secp256k1_rangeproof_context* rangeproof_ctx, const secp256k1_callback* cb,
+ uint64_t *min_values, uint64_t *max_values, const unsigned char * const *commits, const unsigned char * const *proofs,
+ const int *plens, int n);
+
 #endif
@@ -593,38 +593,30 @@ SECP256K1_INLINE static int secp256k1_rangeproof_getheader_impl(int *offset, int
     return 1;
 }
 
-/* Verifies range proof (len plen) for 33-byte commit, the min/max values proven are put in the min/max arguments; returns 0 on failure 1 on success.*/
-SECP256K1_INLINE static int secp256k1_rangeproof_verify_impl(const secp256k1_ecmult_context* ecmult_ctx,
- const secp256k1_ecmult_gen_context* ecmult_gen_ctx,
- const secp256k1_pedersen_context* pedersen_ctx, const secp256k1_rangeproof_context* rangeproof_ctx,
- unsigned char *blindout, uint64_t *value_out, unsigned char *message_out, int *outlen, const unsigned char *nonce,
+/* Parses a range proof (len plen) for 33-byte commit and expands it into the ring signature to check; the min/max
+ * values proven are put in the min/max arguments. Returns 0 if the proof is malformed, 1 otherwise.*/
+SECP256K1_INLINE static int secp256k1_rangeproof_verify_prepare(const secp256k1_pedersen_context* pedersen_ctx,
+ const secp256k1_rangeproof_context* rangeproof_ctx, secp256k1_rangeproof_verify_data *data,
  uint64_t *min_value, uint64_t *max_value, const unsigned char *commit, const unsigned char *proof, int plen) {
     secp256k1_gej accj;
-    secp256k1_gej pubs[128];
     secp256k1_ge c;
-    secp256k1_scalar s[128];
-    secp256k1_scalar evalues[128]; /* Challenges, only used during proof rewind. */
     secp256k1_sha256_t sha256_m;
-    int rsizes[32];
-    int ret;
+    int *rsizes;
     int i;
-    size_t size;
     int exp;
     int mantissa;
     int offset;
     int rings;
     int overflow;
     int npub;
-    int offset_post_header;
-    uint64_t scale;
     unsigned char signs[31];
     unsigned char m[33];
-    const unsigned char *e0;
     offset = 0;
-    if (!secp256k1_rangeproof_getheader_impl(&offset, &exp, &mantissa, &scale, min_value, max_value, proof, plen)) {
+    if (!secp256k1_rangeproof_getheader_impl(&offset, &exp, &mantissa, &data->scale, min_value, max_value, proof, plen)) {
         return 0;
     }
-    offset_post_header = offset;
+    data->offset_post_header = offset;
+    rsizes = data->rsizes;
     rings = 1;
     rsizes[0] = 1;
     npub = 1;
@@ -641,6 +633,7 @@ SECP256K1_INLINE static int secp256k1_rangeproof_verify_impl(const secp256k1_ecm
         }
     }
     VERIFY_CHECK(rings <= 32);
+    data->rings = rings;
     if (plen - offset < 32 * (npub + rings - 1) + 32 + ((rings+6) >> 3)) {
         return 0;
     }
@@ -669,7 +662,7 @@ SECP256K1_INLINE static int secp256k1_rangeproof_verify_impl(const secp256k1_ecm
             return 0;
         }
         secp256k1_sha256_write(&sha256_m, m, 33);
-        secp256k1_gej_set_ge(&pubs[npub], &c);
+        secp256k1_gej_set_ge(&data->pubs[npub], &c);
         secp256k1_gej_add_ge_var(&accj, &accj, &c, NULL);
         offset += 32;
         npub += rsizes[i];
@@ -678,16 +671,16 @@ SECP256K1_INLINE static int secp256k1_rangeproof_verify_impl(const secp256k1_ecm
     if (!secp256k1_eckey_pubkey_parse(&c, commit, 33)) {
         return 0;
     }
-    secp256k1_gej_add_ge_var(&pubs[npub], &accj, &c, NULL);
-    if (secp256k1_gej_is_infinity(&pubs[npub])) {
+    secp256k1_gej_add_ge_var(&data->pubs[npub], &accj, &c, NULL);
+    if (secp256k1_gej_is_infinity(&data->pubs[npub])) {
         return 0;
     }
-    secp256k1_rangeproof_pub_expand(rangeproof_ctx, pubs, exp, rsizes, rings);
+    secp256k1_rangeproof_pub_expand(rangeproof_ctx, data->pubs, exp, rsizes, rings);
     npub += rsizes[rings - 1];
-    e0 = &proof[offset];
+    data->e0 = &proof[offset];
     offset += 32;
     for (i = 0; i < npub; i++) {
-        secp256k1_scalar_set_b32(&s[i], &proof[offset], &overflow);
+        secp256k1_scalar_set_b32(&data->s[i], &proof[offset], &overflow);
         if (overflow) {
             return 0;
         }
@@ -697,8 +690,26 @@ SECP256K1_INLINE static int secp256k1_rangeproof_verify_impl(const secp256k1_ecm
         /*Extra data found, reject.*/
         return 0;
     }
-    secp256k1_sha256_finalize(&sha256_m, m);
-    ret = secp256k1_borromean_verify(ecmult_ctx, nonce ? evalues : NULL, e0, s, pubs, rsizes, rings, m, 32);
+    secp256k1_sha256_finalize(&sha256_m, data->m);
+    return 1;
+}
+
+/* Verifies range proof (len plen) for 33-byte commit, the min/max values proven are put in the min/max arguments; returns 0 on failure 1 on success.*/
+SECP256K1_INLINE static int secp256k1_rangeproof_verify_impl(const secp256k1_ecmult_context* ecmult_ctx,
+ const secp256k1_ecmult_gen_context* ecmult_gen_ctx,
+ const secp256k1_pedersen_context* pedersen_ctx, const secp256k1_rangeproof_context* rangeproof_ctx,
+ unsigned char *blindout, uint64_t *value_out, unsigned char *message_out, int *outlen, const unsigned char *nonce,
+ uint64_t *min_value, uint64_t *max_value, const unsigned char *commit, const unsigned char *proof, int plen) {
+    secp256k1_rangeproof_verify_data data;
+    secp256k1_gej accj;
+    secp256k1_ge c;
+    secp256k1_scalar evalues[128]; /* Challenges, only used during proof rewind. */
+    int ret;
+    size_t size;
+    if (!secp256k1_rangeproof_verify_prepare(pedersen_ctx, rangeproof_ctx, &data, min_value, max_value, commit, proof, plen)) {
+        return 0;
+    }
+    ret = secp256k1_borromean_verify(ecmult_ctx, nonce ? evalues : NULL, data.e0, data.s, data.pubs, data.rsizes, data.rings, data.m, 32);
     if (ret && nonce) {
         /* Given the nonce, try rewinding the witness to recover its initial state. */
         secp256k1_scalar blind;
@@ -707,12 +718,12 @@ SECP256K1_INLINE static int secp256k1_rangeproof_verify_impl(const secp256k1_ecm
         if (!ecmult_gen_ctx) {
             return 0;
         }
-        if (!secp256k1_rangeproof_rewind_inner(&blind, &vv, message_out, outlen, evalues, s, rsizes, rings, nonce, commit, proof, offset_post_header)) {
+        if (!secp256k1_rangeproof_rewind_inner(&blind, &vv, message_out, outlen, evalues, data.s, data.rsizes, data.rings, nonce, commit, proof, data.offset_post_header)) {
             return 0;
         }
         /* Unwind apparently successful, see if the commitment can be reconstructed. */
         /* FIXME: should check vv is in the mantissa's range. */
-        vv = (vv * scale) + *min_value;
+        vv = (vv * data.scale) + *min_value;
         secp256k1_pedersen_ecmult(ecmult_gen_ctx, pedersen_ctx, &accj, &blind, vv);
         if (secp256k1_gej_is_infinity(&accj)) {
             return 0;
@@ -733,4 +744,52 @@ SECP256K1_INLINE static int secp256k1_rangeproof_verify_impl(const secp256k1_ecm
     return ret;
 }
 
+/* Verifies n range proofs, walking the ring signatures of up to SECP256K1_RANGEPROOF_BATCH_MAX of them together;
+ * the min/max values proven are put in the min_values/max_values arrays. Returns 1 only if every proof is valid.*/
+static int secp256k1_rangeproof_verify_batch_impl(const secp256k1_ecmult_context* ecmult_ctx,
+ const secp256k1_pedersen_context* pedersen_ctx, const secp256k1_rangeproof_context* rangeproof_ctx, const secp256k1_callback* cb,
+ uint64_t *min_values, uint64_t *max_values, const unsigned char * const *commits, const unsigned char * const *proofs,
+ const int *plens, int n) {
+    secp256k1_rangeproof_verify_data *data;
+    const unsigned char *e0[SECP256K1_RANGEPROOF_BATCH_MAX];
+    const secp256k1_scalar *s[SECP256K1_RANGEPROOF_BATCH_MAX];
+    const secp256k1_gej *pubs[SECP256K1_RANGEPROOF_BATCH_MAX];
+    const int *rsizes[SECP256K1_RANGEPROOF_BATCH_MAX];
+    const unsigned char *m[SECP256K1_RANGEPROOF_BATCH_MAX];
+    int nrings[SECP256K1_RANGEPROOF_BATCH_MAX];
+    int ret;
+    int done;
+    int i;
+    int cnt;
+    if (n <= 0) {
+        return 1;
+    }
+    data = (secp256k1_rangeproof_verify_data *)checked_malloc(cb, sizeof(*data) * SECP256K1_RANGEPROOF_BATCH_MAX);
+    ret = 1;
+    for (done = 0; ret && done < n; done += cnt) {
+        cnt = n - done;
+        if (cnt > SECP256K1_RANGEPROOF_BATCH_MAX) {
+            cnt = SECP256K1_RANGEPROOF_BATCH_MAX;
+        }
+        for (i = 0; i < cnt; i++) {
+            if (!secp256k1_rangeproof_verify_prepare(pedersen_ctx, rangeproof_ctx, &data[i], &min_values[done + i], &max_values[done + i],
+             commits[done + i], proofs[done + i], plens[done + i])) {
+                ret = 0;
+                break;
+            }
+            e0[i] = data[i].e0;
+            s[i] = data[i].s;
+            pubs[i] = data[i].pubs;
+            rsizes[i] = data[i].rsizes;
+            m[i] = data[i].m;
+            nrings[i] = data[i].rings;
+        }
+        if (ret) {
+            ret = secp256k1_borromean_verify_batch(ecmult_ctx, cb, e0, s, pubs, rsizes, nrings, m, 32, cnt);
+        }
+    }
+    free(data);
+    return ret;
+}
+
 #endif
@@ -80,6 +80,11 @@ void test_pedersen(void) {
 
 void test_borromean(void) {
     unsigned char e0[32];
+    const unsigned char *e0p = e0;
+    const secp256k1_scalar *sp;
+    const secp256k1_gej *pubsp;
+    const int *rsizesp;
+    const unsigned char *mp;
     secp256k1_scalar s[64];
     secp256k1_gej pubs[64];
     secp256k1_scalar k[8];
@@ -127,9 +132,15 @@ void test_borromean(void) {
     }
     CHECK(secp256k1_borromean_sign(&ctx->ecmult_ctx, &ctx->ecmult_gen_ctx, e0, s, pubs, k, sec, rsizes, secidx, nrings, m, 32));
     CHECK(secp256k1_borromean_verify(&ctx->ecmult_ctx, NULL, e0, s, pubs, rsizes, nrings, m, 32));
+    sp = s;
+    pubsp = pubs;
+    rsizesp = rsizes;
+    mp = m;
+    CHECK(secp256k1_borromean_verify_batch(&ctx->ecmult_ctx, &ctx->error_callback, &e0p, &sp, &pubsp, &rsizesp, &nrings, &mp, 32, 1));
     i = secp256k1_rand32() % c;
     secp256k1_scalar_negate(&s[i],&s[i]);
     CHECK(!secp256k1_borromean_verify(&ctx->ecmult_ctx, NULL, e0, s, pubs, rsizes, nrings, m, 32));
+    CHECK(!secp256k1_borromean_verify_batch(&ctx->ecmult_ctx, &ctx->error_callback, &e0p, &sp, &pubsp, &rsizesp, &nrings, &mp, 32, 1));
     secp256k1_scalar_negate(&s[i],&s[i]);
     secp256k1_scalar_set_int(&one, 1);
     for(j = 0; j < 4; j++) {
@@ -265,6 +276,50 @@ void test_rangeproof(void) {
     }
 }
 
+void test_rangeproof_batch(void) {
+    unsigned char commits[20][33];
+    unsigned char proofs[20][5134];
+    unsigned char blind[32];
+    const unsigned char *commitp[20];
+    const unsigned char *proofp[20];
+    int plens[20];
+    uint64_t minvs[20];
+    uint64_t maxvs[20];
+    uint64_t minv;
+    uint64_t maxv;
+    uint64_t v;
+    int i;
+    int n;
+    /* More proofs than are walked together, with a mix of ring layouts. */
+    n = 20;
+    for (i = 0; i < n; i++) {
+        v = secp256k1_rands64(0, UINT64_MAX >> (secp256k1_rand32()&63));
+        secp256k1_rand256(blind);
+        CHECK(secp256k1_pedersen_commit(ctx, commits[i], blind, v));
+        plens[i] = 5134;
+        CHECK(secp256k1_rangeproof_sign(ctx, proofs[i], &plens[i], 0, commits[i], blind, commits[i], i % 3, (i * 7) % 65, v));
+        commitp[i] = commits[i];
+        proofp[i] = proofs[i];
+    }
+    CHECK(secp256k1_rangeproof_verify_batch(ctx, minvs, maxvs, commitp, proofp, plens, n));
+    for (i = 0; i < n; i++) {
+        CHECK(secp256k1_rangeproof_verify(ctx, &minv, &maxv, commitp[i], proofp[i], plens[i]));
+        CHECK(minvs[i] == minv);
+        CHECK(maxvs[i] == maxv);
+    }
+    CHECK(secp256k1_rangeproof_verify_batch(ctx, minvs, maxvs, commitp, proofp, plens, 0));
+    /* A single bad proof anywhere fails the whole batch. */
+    i = secp256k1_rand32() % n;
+    proofs[i][plens[i] - 1] ^= 1;
+    CHECK(!secp256k1_rangeproof_verify_batch(ctx, minvs, maxvs, commitp, proofp, plens, n));
+    proofs[i][plens[i] - 1] ^= 1;
+    commitp[i] = commits[(i + 1) % n];
+    CHECK(!secp256k1_rangeproof_verify_batch(ctx, minvs, maxvs, commitp, proofp, plens, n));
+    commitp[i] = commits[i];
+    plens[i]--;
+    CHECK(!secp256k1_rangeproof_verify_batch(ctx, minvs, maxvs, commitp, proofp, plens, n));
+}
+
 void run_rangeproof_tests(void) {
     int i;
     secp256k1_pedersen_context_initialize(ctx);
@@ -276,6 +331,7 @@ void run_rangeproof_tests(void) {
         test_borromean();
     }
     test_rangeproof();
+    test_rangeproof_batch();
 }
 
 #endif
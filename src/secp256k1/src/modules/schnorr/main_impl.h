@@ -70,6 +70,33 @@ int secp256k1_schnorr_verify(const secp256k1_context* ctx, const unsigned char *
     return secp256k1_schnorr_sig_verify(&ctx->ecmult_ctx, sig64, &q, secp256k1_schnorr_msghash_sha256, msg32);
 }
 
+int secp256k1_schnorr_verify_batch(const secp256k1_context* ctx, const unsigned char * const *sig64s, const unsigned char * const *msg32s, const secp256k1_pubkey * const *pubkeys, size_t n) {
+    secp256k1_ge *q;
+    size_t i;
+    int ret;
+    VERIFY_CHECK(ctx != NULL);
+    ARG_CHECK(secp256k1_ecmult_context_is_built(&ctx->ecmult_ctx));
+    ARG_CHECK(n == 0 || sig64s != NULL);
+    ARG_CHECK(n == 0 || msg32s != NULL);
+    ARG_CHECK(n == 0 || pubkeys != NULL);
+
+    for (i = 0; i < n; i++) {
+        ARG_CHECK(sig64s[i] != NULL);
+        ARG_CHECK(msg32s[i] != NULL);
+        ARG_CHECK(pubkeys[i] != NULL);
+    }
+    if (n == 0) {
+        return 1;
+    }
+    q = (secp256k1_ge*)checked_malloc(&ctx->error_callback, sizeof(secp256k1_ge) * n);
+    for (i = 0; i < n; i++) {
+        secp256k1_pubkey_load(ctx, &q[i], pubkeys[i]);
+    }
+    ret = secp256k1_schnorr_sig_verify_batch(&ctx->ecmult_ctx, &ctx->error_callback, n, sig64s, q, secp256k1_schnorr_msghash_sha256, msg32s);
+    free(q);
+    return ret;
+}
+
 int secp256k1_schnorr_recover(const secp256k1_context* ctx, secp256k1_pubkey *pubkey, const unsigned char *sig64, const unsigned char *msg32) {
     secp256k1_ge q;
 
@@ -10,10 +10,15 @@
 #include "scalar.h"
 #include "group.h"
 
+/** Maximum number of signatures combined into a single multi-multiplication by
+ *  secp256k1_schnorr_sig_verify_batch; larger batches are split into chunks. */
+#define SECP256K1_SCHNORR_BATCH_MAX 64
+
 typedef void (*secp256k1_schnorr_msghash)(unsigned char *h32, const unsigned char *r32, const unsigned char *msg32);
 
 static int secp256k1_schnorr_sig_sign(const secp256k1_ecmult_gen_context* ctx, unsigned char *sig64, const secp256k1_scalar *key, const secp256k1_scalar *nonce, const secp256k1_ge *pubnonce, secp256k1_schnorr_msghash hash, const unsigned char *msg32);
 static int secp256k1_schnorr_sig_verify(const secp256k1_ecmult_context* ctx, const unsigned char *sig64, const secp256k1_ge *pubkey, secp256k1_schnorr_msghash hash, const unsigned char *msg32);
+static int secp256k1_schnorr_sig_verify_batch(const secp256k1_ecmult_context* ctx, const secp256k1_callback *cb, size_t n, const unsigned char * const *sig64s, const secp256k1_ge *pubkeys, secp256k1_schnorr_msghash hash, const unsigned char * const *msg32s);
 static int secp256k1_schnorr_sig_recover(const secp256k1_ecmult_context* ctx, const unsigned char *sig64, secp256k1_ge *pubkey, secp256k1_schnorr_msghash hash, const unsigned char *msg32);
 static int secp256k1_schnorr_sig_combine(unsigned char *sig64, size_t n, const unsigned char * const *sig64ins);
 
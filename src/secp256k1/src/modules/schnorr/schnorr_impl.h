@@ -141,6 +141,179 @@ static int secp256k1_schnorr_sig_verify(const secp256k1_ecmult_context* ctx, con
     return secp256k1_fe_equal_var(&Rx, &Ra.x);
 }
 
+/** Batch verification of up to SECP256K1_SCHNORR_BATCH_MAX signatures.
+ *
+ *  Every signature satisfies -R_i + h_i * Q_i + s_i * G == 0, with R_i the point with
+ *  x coordinate r_i and even y. Rather than checking each equation with its own
+ *  multiplication, pick 128-bit weights a_i (a_0 = 1) derived from a hash of the whole
+ *  batch and check the single combination
+ *
+ *    sum(a_i * -R_i) + sum(a_i * h_i * Q_i) + (sum(a_i * s_i)) * G == 0
+ *
+ *  with one interleaved wNAF multi-multiplication, so the 256 doublings are shared by
+ *  the whole batch and the G term is only evaluated once. An invalid signature makes
+ *  this fail except with negligible probability. A failure does not say which
+ *  signature is bad; callers wanting that must fall back to single verification.
+ */
+static int secp256k1_schnorr_sig_verify_batch_chunk(const secp256k1_ecmult_context* ctx, size_t n, const unsigned char * const *sig64s, const secp256k1_ge *pubkeys, secp256k1_schnorr_msghash hash, const unsigned char * const *msg32s, secp256k1_ge *pre, secp256k1_gej *prej, secp256k1_fe *zr, int *wnaf) {
+    secp256k1_fe az[2 * SECP256K1_SCHNORR_BATCH_MAX];
+    secp256k1_fe zi[2 * SECP256K1_SCHNORR_BATCH_MAX];
+    int bits[2 * SECP256K1_SCHNORR_BATCH_MAX];
+    int wnaf_g[256];
+    int bits_g;
+    int maxbits;
+    unsigned char seed[32];
+    secp256k1_sha256_t sha;
+    secp256k1_scalar sg;
+    secp256k1_gej r;
+    secp256k1_ge tmp;
+    size_t i, k;
+
+    VERIFY_CHECK(n <= SECP256K1_SCHNORR_BATCH_MAX);
+
+    /* The weights must not be predictable before the signatures are fixed, so
+     * commit to everything being verified. */
+    secp256k1_sha256_initialize(&sha);
+    for (i = 0; i < n; i++) {
+        secp256k1_fe px = pubkeys[i].x, py = pubkeys[i].y;
+        unsigned char buf[32];
+        secp256k1_sha256_write(&sha, sig64s[i], 64);
+        secp256k1_sha256_write(&sha, msg32s[i], 32);
+        secp256k1_fe_normalize_var(&px);
+        secp256k1_fe_normalize_var(&py);
+        secp256k1_fe_get_b32(buf, &px);
+        secp256k1_sha256_write(&sha, buf, 32);
+        secp256k1_fe_get_b32(buf, &py);
+        secp256k1_sha256_write(&sha, buf, 32);
+    }
+    secp256k1_sha256_finalize(&sha, seed);
+
+    secp256k1_scalar_clear(&sg);
+    maxbits = 0;
+    for (i = 0; i < n; i++) {
+        secp256k1_scalar a, h, s;
+        secp256k1_ge R;
+        secp256k1_gej Pj;
+        secp256k1_fe Rx;
+        unsigned char buf[32];
+        int overflow;
+
+        if (secp256k1_ge_is_infinity(&pubkeys[i])) {
+            return 0;
+        }
+        hash(buf, sig64s[i], msg32s[i]);
+        overflow = 0;
+        secp256k1_scalar_set_b32(&h, buf, &overflow);
+        if (overflow || secp256k1_scalar_is_zero(&h)) {
+            return 0;
+        }
+        overflow = 0;
+        secp256k1_scalar_set_b32(&s, sig64s[i] + 32, &overflow);
+        if (overflow) {
+            return 0;
+        }
+        if (!secp256k1_fe_set_b32(&Rx, sig64s[i])) {
+            return 0;
+        }
+        if (!secp256k1_ge_set_xo_var(&R, &Rx, 0)) {
+            return 0;
+        }
+        secp256k1_ge_neg(&R, &R);
+
+        if (i == 0) {
+            secp256k1_scalar_set_int(&a, 1);
+        } else {
+            unsigned char idx[4];
+            idx[0] = i >> 24; idx[1] = i >> 16; idx[2] = i >> 8; idx[3] = i;
+            secp256k1_sha256_initialize(&sha);
+            secp256k1_sha256_write(&sha, seed, 32);
+            secp256k1_sha256_write(&sha, idx, 4);
+            secp256k1_sha256_finalize(&sha, buf);
+            memset(buf, 0, 16);
+            secp256k1_scalar_set_b32(&a, buf, NULL);
+        }
+        secp256k1_scalar_mul(&s, &s, &a);
+        secp256k1_scalar_add(&sg, &sg, &s);
+        secp256k1_scalar_mul(&h, &h, &a);
+
+        /* Odd multiples of -R_i (weight a_i) and Q_i (weight a_i * h_i). */
+        for (k = 0; k < 2; k++) {
+            size_t j = 2 * i + k;
+            secp256k1_gej_set_ge(&Pj, k == 0 ? &R : &pubkeys[i]);
+            secp256k1_ecmult_odd_multiples_table(ECMULT_TABLE_SIZE(WINDOW_A), prej + j * ECMULT_TABLE_SIZE(WINDOW_A), zr + j * ECMULT_TABLE_SIZE(WINDOW_A), &Pj);
+            az[j] = prej[(j + 1) * ECMULT_TABLE_SIZE(WINDOW_A) - 1].z;
+            bits[j] = secp256k1_ecmult_wnaf(wnaf + j * 256, 256, k == 0 ? &a : &h, WINDOW_A);
+            if (bits[j] > maxbits) {
+                maxbits = bits[j];
+            }
+        }
+    }
+
+    /* Make all tables affine with a single inversion, walking each one backwards
+     * through its z ratios like secp256k1_ge_set_table_gej_var does. */
+    secp256k1_fe_inv_all_var(2 * n, zi, az);
+    for (i = 0; i < 2 * n; i++) {
+        size_t j = ECMULT_TABLE_SIZE(WINDOW_A) - 1;
+        size_t off = i * ECMULT_TABLE_SIZE(WINDOW_A);
+        secp256k1_ge_set_gej_zinv(&pre[off + j], &prej[off + j], &zi[i]);
+        while (j > 0) {
+            secp256k1_fe_mul(&zi[i], &zi[i], &zr[off + j]);
+            j--;
+            secp256k1_ge_set_gej_zinv(&pre[off + j], &prej[off + j], &zi[i]);
+        }
+    }
+
+    bits_g = secp256k1_ecmult_wnaf(wnaf_g, 256, &sg, WINDOW_G);
+    if (bits_g > maxbits) {
+        maxbits = bits_g;
+    }
+
+    secp256k1_gej_set_infinity(&r);
+    for (k = maxbits; k > 0; k--) {
+        int b = k - 1;
+        int v;
+        secp256k1_gej_double_var(&r, &r, NULL);
+        for (i = 0; i < 2 * n; i++) {
+            if (b < bits[i] && (v = wnaf[i * 256 + b])) {
+                ECMULT_TABLE_GET_GE(&tmp, pre + i * ECMULT_TABLE_SIZE(WINDOW_A), v, WINDOW_A);
+                secp256k1_gej_add_ge_var(&r, &r, &tmp, NULL);
+            }
+        }
+        if (b < bits_g && (v = wnaf_g[b])) {
+            ECMULT_TABLE_GET_GE_STORAGE(&tmp, *ctx->pre_g, v, WINDOW_G);
+            secp256k1_gej_add_ge_var(&r, &r, &tmp, NULL);
+        }
+    }
+    return secp256k1_gej_is_infinity(&r);
+}
+
+static int secp256k1_schnorr_sig_verify_batch(const secp256k1_ecmult_context* ctx, const secp256k1_callback *cb, size_t n, const unsigned char * const *sig64s, const secp256k1_ge *pubkeys, secp256k1_schnorr_msghash hash, const unsigned char * const *msg32s) {
+    size_t chunk = n < SECP256K1_SCHNORR_BATCH_MAX ? n : SECP256K1_SCHNORR_BATCH_MAX;
+    secp256k1_ge *pre;
+    secp256k1_gej *prej;
+    secp256k1_fe *zr;
+    int *wnaf;
+    size_t i;
+    int ret = 1;
+
+    if (n == 0) {
+        return 1;
+    }
+    pre = (secp256k1_ge*)checked_malloc(cb, sizeof(secp256k1_ge) * 2 * chunk * ECMULT_TABLE_SIZE(WINDOW_A));
+    prej = (secp256k1_gej*)checked_malloc(cb, sizeof(secp256k1_gej) * 2 * chunk * ECMULT_TABLE_SIZE(WINDOW_A));
+    zr = (secp256k1_fe*)checked_malloc(cb, sizeof(secp256k1_fe) * 2 * chunk * ECMULT_TABLE_SIZE(WINDOW_A));
+    wnaf = (int*)checked_malloc(cb, sizeof(int) * 2 * chunk * 256);
+    for (i = 0; ret && i < n; i += chunk) {
+        size_t now = n - i < chunk ? n - i : chunk;
+        ret = secp256k1_schnorr_sig_verify_batch_chunk(ctx, now, sig64s + i, pubkeys + i, hash, msg32s + i, pre, prej, zr, wnaf);
+    }
+    free(wnaf);
+    free(zr);
+    free(prej);
+    free(pre);
+    return ret;
+}
+
 static int secp256k1_schnorr_sig_recover(const secp256k1_ecmult_context* ctx, const unsigned char *sig64, secp256k1_ge *pubkey, secp256k1_schnorr_msghash hash, const unsigned char *msg32) {
     secp256k1_gej Qj, Rj;
     secp256k1_ge Ra;
@@ -156,6 +156,44 @@ void test_schnorr_recovery(void) {
     }
 }
 
+void test_schnorr_batch(void) {
+    unsigned char privkey[32];
+    unsigned char msg32[70][32];
+    unsigned char sig64[70][64];
+    secp256k1_pubkey pubkey[70];
+    const unsigned char *sigs[70];
+    const unsigned char *msgs[70];
+    const secp256k1_pubkey *pubs[70];
+    size_t n = 1 + secp256k1_rand_int(70);
+    size_t i, bad;
+
+    for (i = 0; i < n; i++) {
+        secp256k1_scalar key;
+        random_scalar_order_test(&key);
+        secp256k1_scalar_get_b32(privkey, &key);
+        secp256k1_rand256_test(msg32[i]);
+        CHECK(secp256k1_ec_pubkey_create(ctx, &pubkey[i], privkey) == 1);
+        CHECK(secp256k1_schnorr_sign(ctx, sig64[i], msg32[i], privkey, NULL, NULL) == 1);
+        sigs[i] = sig64[i];
+        msgs[i] = msg32[i];
+        pubs[i] = &pubkey[i];
+    }
+    CHECK(secp256k1_schnorr_verify_batch(ctx, sigs, msgs, pubs, 0) == 1);
+    CHECK(secp256k1_schnorr_verify_batch(ctx, sigs, msgs, pubs, n) == 1);
+
+    /* Any single damaged signature, message or key makes the whole batch fail. */
+    bad = secp256k1_rand_int(n);
+    sig64[bad][secp256k1_rand_bits(6)] += 1 + secp256k1_rand_int(255);
+    CHECK(secp256k1_schnorr_verify_batch(ctx, sigs, msgs, pubs, n) == 0);
+    CHECK(secp256k1_schnorr_verify(ctx, sig64[bad], msg32[bad], &pubkey[bad]) == 0);
+    CHECK(secp256k1_schnorr_sign(ctx, sig64[bad], msg32[bad], privkey, NULL, NULL) == 1);
+    CHECK(secp256k1_schnorr_verify_batch(ctx, sigs, msgs, pubs, n) == (bad == n - 1));
+    if (n > 1) {
+        pubs[bad] = &pubkey[(bad + 1) % n];
+        CHECK(secp256k1_schnorr_verify_batch(ctx, sigs, msgs, pubs, n) == 0);
+    }
+}
+
 void run_schnorr_tests(void) {
     int i;
     for (i = 0; i < 32*count; i++) {
@@ -170,6 +208,9 @@ void run_schnorr_tests(void) {
     for (i = 0; i < 10 * count; i++) {
          test_schnorr_threshold();
     }
+    for (i = 0; i < count; i++) {
+         test_schnorr_batch();
+    }
 }
 
 #endif
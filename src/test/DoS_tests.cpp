@@ -106,6 +106,28 @@ BOOST_AUTO_TEST_CASE(DoS_bantime)
     BOOST_CHECK(!CNode::IsBanned(addr));
 }
 
+BOOST_AUTO_TEST_CASE(DoS_getdata_without_block_data)
+{
+    // Blocks below a UTXO snapshot are in the active chain without their data
+    CBlockIndex* pindex = chainActive.Tip();
+    CAddress addr(ip(0xa0b0c001));
+    CNode dummyNode(INVALID_SOCKET, addr, "", true);
+    dummyNode.nVersion = 1;
+
+    pindex->nStatus &= ~BLOCK_HAVE_DATA;
+    dummyNode.vRecvGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
+    ProcessMessages(&dummyNode);
+    BOOST_CHECK(dummyNode.vRecvGetData.empty());
+    BOOST_CHECK_EQUAL(dummyNode.nSendSize, 0U);
+
+    // With the data it is served
+    pindex->nStatus |= BLOCK_HAVE_DATA;
+    dummyNode.vRecvGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
+    ProcessMessages(&dummyNode);
+    BOOST_CHECK(dummyNode.vRecvGetData.empty());
+    BOOST_CHECK(dummyNode.nSendSize > 0);
+}
+
 CTransaction RandomOrphan()
 {
     std::map<uint256, COrphanTx>::iterator it;
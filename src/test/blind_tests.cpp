@@ -3,7 +3,10 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "blind.h"
+#include "chainparams.h"
 #include "coins.h"
+#include "main.h"
+#include "script/sigcache.h"
 
 #include <boost/test/unit_test.hpp>
 
@@ -108,6 +111,40 @@ BOOST_AUTO_TEST_CASE(naive_blinding_test)
         BOOST_CHECK(!tx4.vout[2].nValue.IsAmount());
         BOOST_CHECK(cache.VerifyAmounts(tx4));
 
+        // Deferred rangeproof checking only hands back the blinded outputs
+        CTransaction tx4final(tx4);
+        std::vector<const CTxOutValue*> vRangeproofs;
+        BOOST_CHECK(cache.VerifyAmounts(tx4final, tx4final.nTxFee, &vRangeproofs));
+        BOOST_CHECK(vRangeproofs.size() == 2);
+        BOOST_CHECK(vRangeproofs[0] == &tx4final.vout[0].nValue);
+        BOOST_CHECK(vRangeproofs[1] == &tx4final.vout[2].nValue);
+        BOOST_CHECK(VerifyRangeproof(*vRangeproofs[0]));
+        BOOST_CHECK(VerifyRangeproof(*vRangeproofs[1]));
+        CTxOutValue badValue = tx4.vout[0].nValue;
+        badValue.vchRangeproof[badValue.vchRangeproof.size() / 2] ^= 1;
+        BOOST_CHECK(!VerifyRangeproof(badValue));
+
+        // The caching checker only remembers proofs when asked to store them
+        CRangeproofCacheStats stats = GetRangeproofCacheStats();
+        BOOST_CHECK(CachingRangeproofChecker(false).VerifyRangeproof(*vRangeproofs[0]));
+        BOOST_CHECK(CachingRangeproofChecker(true).VerifyRangeproof(*vRangeproofs[0]));
+        BOOST_CHECK(CachingRangeproofChecker(false).VerifyRangeproof(*vRangeproofs[0]));
+        BOOST_CHECK(!CachingRangeproofChecker(true).VerifyRangeproof(badValue));
+        BOOST_CHECK(!CachingRangeproofChecker(true).VerifyRangeproof(badValue));
+        CRangeproofCacheStats stats2 = GetRangeproofCacheStats();
+        BOOST_CHECK(stats2.nHits == stats.nHits + 1);
+        BOOST_CHECK(stats2.nMisses == stats.nMisses + 4);
+        BOOST_CHECK(stats2.nEntries == stats.nEntries + 1);
+
+        // A bad rangeproof gets its own reject reason, not an amount mismatch
+        cache.SetBestBlock(Params().HashGenesisBlock());
+        CValidationState state;
+        BOOST_CHECK(CheckInputs(tx4final, state, cache, false, SCRIPT_VERIFY_NONE, false));
+        CMutableTransaction txBad(tx4final);
+        txBad.vout[0].nValue = badValue;
+        BOOST_CHECK(!CheckInputs(CTransaction(txBad), state, cache, false, SCRIPT_VERIFY_NONE, false));
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-txns-rangeproof-invalid");
+
         CAmount unblinded_amount;
         BOOST_CHECK(UnblindOutput(key1, tx4.vout[0], unblinded_amount, blind4) == 0);
         BOOST_CHECK(UnblindOutput(key2, tx4.vout[0], unblinded_amount, blind4) == 1);
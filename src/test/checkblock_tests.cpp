@@ -8,14 +8,25 @@
 
 
 
+#include "chainparams.h"
 #include "clientversion.h"
+#include "hash.h"
+#include "key.h"
 #include "main.h"
+#include "miner.h"
+#include "pow.h"
+#include "streams.h"
+#include "txdb.h"
+#include "util.h"
 #include "utiltime.h"
 
+#include <algorithm>
 #include <cstdio>
 
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/path.hpp>
+#include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/test/unit_test.hpp>
 
 
@@ -66,4 +77,253 @@ BOOST_AUTO_TEST_CASE(May15)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(checkblock_cached)
+{
+    // The shared genesis block may have been checked already
+    CBlock block = Params().GenesisBlock();
+    block.fChecked = false;
+    CValidationState state;
+    BOOST_CHECK(CheckBlock(block, state, false, false));
+    BOOST_CHECK(!block.fChecked);
+    BOOST_CHECK(CheckBlock(block, state));
+    BOOST_CHECK(block.fChecked);
+    CBlock copy = block;
+    BOOST_CHECK(copy.fChecked);
+    block.SetNull();
+    BOOST_CHECK(!block.fChecked);
+}
+
+BOOST_AUTO_TEST_CASE(import_block_file)
+{
+    // Junk, the (already known) genesis block twice, and a record cut short
+    boost::filesystem::path path = GetDataDir() / "import_test.dat";
+    const CBlock& genesis = Params().GenesisBlock();
+    unsigned int nSize = ::GetSerializeSize(genesis, SER_DISK, CLIENT_VERSION);
+    {
+        CAutoFile file(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        file << FLATDATA("junk");
+        for (int i = 0; i < 2; i++)
+            file << FLATDATA(Params().MessageStart()) << nSize << genesis;
+        file << FLATDATA(Params().MessageStart()) << nSize << FLATDATA("cut short");
+    }
+
+    // The pipeline gets through all of it, and has nothing to add
+    int nHeight = chainActive.Height();
+    BOOST_CHECK(!LoadExternalBlockFile(fopen(path.string().c_str(), "rb")));
+    BOOST_CHECK_EQUAL(chainActive.Height(), nHeight);
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(import_block_file_order)
+{
+    // Blocks only connect on a chain whose proofs need no signatures, so
+    // swap in one of those, with databases of its own, for this test
+    FlushStateToDisk();
+    CBlockTreeDB* pblocktreeSaved = pblocktree;
+    CCoinsViewCache* pcoinsTipSaved = pcoinsTip;
+    {
+        LOCK(cs_main);
+        UnloadBlockIndex();
+        pindexBestHeader = NULL;
+    }
+    SelectParams(CBaseChainParams::UNITTEST, CScript() << OP_TRUE);
+    CBlockTreeDB blocktree(1 << 20, true);
+    CCoinsViewDB coinsdb(1 << 20, true);
+    CCoinsViewCache coinstip(&coinsdb);
+    pblocktree = &blocktree;
+    pcoinsTip = &coinstip;
+    BOOST_REQUIRE(InitBlockIndex());
+
+    // Four blocks on top of the genesis block. The second and the fourth
+    // carry, in a coinbase output, a whole record of a block forking off the
+    // genesis block, which is only found when scanning inside them.
+    std::vector<CBlock> vBlocks, vForks;
+    {
+        LOCK(cs_main);
+        boost::scoped_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(CScript() << OP_TRUE));
+        CBlock block = pblocktemplate->block;
+        for (int i = 1; i <= 2; i++) {
+            CBlock fork = block;
+            CMutableTransaction txCoinbase(fork.vtx[0]);
+            txCoinbase.vin[0].scriptSig = CScript() << 10 + i << OP_0;
+            fork.vtx[0] = txCoinbase;
+            fork.hashMerkleRoot = fork.BuildMerkleTree();
+            vForks.push_back(fork);
+        }
+        for (int i = 1; i <= 4; i++) {
+            CMutableTransaction txCoinbase(block.vtx[0]);
+            txCoinbase.vin[0].scriptSig = CScript() << i << OP_0;
+            if (i % 2 == 0) {
+                const CBlock& fork = vForks[i / 2 - 1];
+                CDataStream ss(SER_DISK, CLIENT_VERSION);
+                ss << FLATDATA(Params().MessageStart()) << (unsigned int)::GetSerializeSize(fork, SER_DISK, CLIENT_VERSION) << fork;
+                txCoinbase.vout[0].scriptPubKey = CScript() << std::vector<unsigned char>(ss.begin(), ss.end()) << OP_DROP << OP_TRUE;
+            }
+            block.vtx[0] = txCoinbase;
+            block.hashMerkleRoot = block.BuildMerkleTree();
+            vBlocks.push_back(block);
+            block.hashPrevBlock = block.GetHash();
+            block.nTime++;
+        }
+    }
+
+    // Stored as a block file, the third block ahead of its parent, and both
+    // of them inside the claimed length of a record torn by a crash. The
+    // second block is followed by a witness-stripped record, and the fourth
+    // by the zero padding of a preallocated file.
+    CDiskBlockPos pos(1, 0);
+    boost::filesystem::path path = GetBlockPosFilename(pos, "blk");
+    BOOST_REQUIRE(!boost::filesystem::exists(path));
+    {
+        CAutoFile file(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
+        MessageStartChars pchStripped;
+        memcpy(pchStripped, Params().MessageStart(), MESSAGE_START_SIZE);
+        pchStripped[0] ^= 0xff;
+        static const char pchPadding[64] = {};
+        int vOrder[] = {0, 2, 1, 3};
+        BOOST_FOREACH(int i, vOrder) {
+            unsigned int nSize = ::GetSerializeSize(vBlocks[i], SER_DISK, CLIENT_VERSION);
+            if (i == 2)
+                file << FLATDATA(Params().MessageStart()) << (unsigned int)(sizeof("torn") + 8 + nSize + 10) << FLATDATA("torn");
+            file << FLATDATA(Params().MessageStart()) << nSize << vBlocks[i];
+            if (i == 1) {
+                file.SetVersion(CLIENT_VERSION | SERIALIZE_VERSION_MASK_NO_WITNESS);
+                nSize = ::GetSerializeSize(vBlocks[0], SER_DISK, CLIENT_VERSION | SERIALIZE_VERSION_MASK_NO_WITNESS);
+                file << FLATDATA(pchStripped) << nSize << vBlocks[0];
+                file.SetVersion(CLIENT_VERSION);
+            }
+        }
+        file.write(pchPadding, sizeof(pchPadding));
+    }
+
+    // Each block waits for its parent, so they connect in chain order
+    BOOST_CHECK(LoadExternalBlockFile(fopen(path.string().c_str(), "rb"), &pos));
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE_EQUAL(chainActive.Height(), 4);
+        for (int i = 0; i < 4; i++) {
+            BOOST_CHECK(chainActive[i + 1]->GetBlockHash() == vBlocks[i].GetHash());
+            BOOST_CHECK_EQUAL(chainActive[i + 1]->nFile, 1);
+        }
+        BOOST_CHECK(chainActive[3]->nDataPos < chainActive[2]->nDataPos);
+        // The stripped record and the padding ended the blocks before them,
+        // so the records inside those were never read
+        BOOST_FOREACH(const CBlock& fork, vForks)
+            BOOST_CHECK(!mapBlockIndex.count(fork.GetHash()));
+    }
+
+    // Back to the chain the other tests use
+    FlushStateToDisk();
+    {
+        LOCK(cs_main);
+        UnloadBlockIndex();
+        pindexBestHeader = NULL;
+    }
+    SelectParams(CBaseChainParams::UNITTEST);
+    pblocktree = pblocktreeSaved;
+    pcoinsTip = pcoinsTipSaved;
+    BOOST_CHECK(LoadBlockIndex());
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(proof_batch_check)
+{
+    // 2-of-3 federation challenge. Only signatures a script can't succeed
+    // without are batched, so it verifies them with CHECKMULTISIGVERIFY.
+    CScript challenge = CScript() << OP_2;
+    CKey vKeys[3];
+    for (int i = 0; i < 3; i++) {
+        vKeys[i].MakeNewKey(true);
+        challenge << ToByteVector(vKeys[i].GetPubKey());
+    }
+    challenge << OP_3 << OP_CHECKMULTISIGVERIFY << OP_TRUE;
+
+    std::vector<CBlockHeader> vHeaders(20);
+    for (unsigned int i = 0; i < vHeaders.size(); i++) {
+        CBlockHeader& header = vHeaders[i];
+        header.hashPrevBlock = i;
+        header.nTime = i;
+        header.proof.challenge = challenge;
+        // Alternate between the signer sets {0,1} and {0,2}. CHECKMULTISIG
+        // tries the keys from the last one down, so either set skips a key
+        // before its remaining signatures are required
+        uint256 hash = SerializeHash(header);
+        header.proof.solution = CScript() << OP_0;
+        int vSigners[] = {0, i % 2 ? 2 : 1};
+        BOOST_FOREACH(int j, vSigners) {
+            std::vector<unsigned char> vchSig;
+            BOOST_CHECK(vKeys[j].Sign(hash, vchSig));
+            header.proof.solution << vchSig;
+        }
+        BOOST_CHECK(CheckProof(header));
+    }
+
+    // Only the signatures the proof can't do without are batched
+    CSignatureBatch batch;
+    BOOST_CHECK(CheckProof(vHeaders[0], batch));
+    BOOST_CHECK_EQUAL(batch.size(), 2U);
+    BOOST_CHECK(batch.Verify());
+
+    // The whole group verifies as a batch, flagging every header
+    std::vector<char> vValid(vHeaders.size(), false);
+    CProofBatchCheck check;
+    for (unsigned int i = 0; i < vHeaders.size(); i++)
+        check.Add(vHeaders[i], vValid[i]);
+    BOOST_CHECK(check());
+    BOOST_CHECK_EQUAL(std::count(vValid.begin(), vValid.end(), true), (int)vHeaders.size());
+
+    // A single bad signature anywhere fails the whole group, flagging none
+    vHeaders[7].nTime++;
+    BOOST_CHECK(!CheckProof(vHeaders[7]));
+    vValid.assign(vHeaders.size(), false);
+    BOOST_CHECK(!check());
+    BOOST_CHECK_EQUAL(std::count(vValid.begin(), vValid.end(), true), 0);
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_interned_proof)
+{
+    CBlockHeader header;
+    header.proof = CProof(CScript() << OP_TRUE << OP_DROP << OP_1, CScript() << std::vector<unsigned char>(100, 2));
+    CBlockHeader header2 = header;
+    header2.nTime = 1;
+    header2.proof.solution = CScript() << std::vector<unsigned char>(100, 3);
+
+    // Index entries share one copy of their challenge, and keep no solution
+    CBlockIndexMemoryStats statsBefore = GetBlockIndexMemoryStats();
+    CBlockIndex index(header), index2(header2);
+    BOOST_CHECK(index.pchallenge == index2.pchallenge);
+    BOOST_CHECK(index.GetChallenge() == header.proof.challenge);
+    BOOST_CHECK(index.hashSolution != index2.hashSolution);
+    BOOST_CHECK(index.GetBlockHeader().proof.solution.empty());
+
+    // Only entries added to the block index count towards the savings, not temporaries like these
+    CBlockIndexMemoryStats stats = GetBlockIndexMemoryStats();
+    BOOST_CHECK_EQUAL(stats.nSolutionBytesSaved, statsBefore.nSolutionBytesSaved);
+    AddBlockIndexMemoryStats(header.proof);
+    AddBlockIndexMemoryStats(header2.proof);
+    stats = GetBlockIndexMemoryStats();
+    BOOST_CHECK(stats.nChallengeBytesSaved >= statsBefore.nChallengeBytesSaved + header.proof.challenge.size());
+    // Each entry keeps the hash of its solution instead
+    BOOST_CHECK_EQUAL(header.proof.solution.size(), 102U);
+    BOOST_CHECK_EQUAL(stats.nSolutionBytesSaved, statsBefore.nSolutionBytesSaved + 2 * (102 - 32));
+    // Solutions still held in memory, before they are written or while recently used, save nothing
+    AddHeldSolutionMemoryStats(header2.proof.solution.size());
+    stats = GetBlockIndexMemoryStats();
+    BOOST_CHECK_EQUAL(stats.nSolutionBytesSaved, statsBefore.nSolutionBytesSaved + 102 - 2 * 32);
+    AddHeldSolutionMemoryStats(-(int64_t)header2.proof.solution.size());
+    stats = GetBlockIndexMemoryStats();
+    BOOST_CHECK_EQUAL(stats.nSolutionBytesSaved, statsBefore.nSolutionBytesSaved + 2 * (102 - 32));
+
+    // The database record carries the full proof
+    uint256 hash = header.GetHash();
+    index.phashBlock = &hash;
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << CDiskBlockIndex(&index, header.proof.solution);
+    CDiskBlockIndex diskindex;
+    ss >> diskindex;
+    BOOST_CHECK(diskindex.proof.challenge == header.proof.challenge);
+    BOOST_CHECK(diskindex.proof.solution == header.proof.solution);
+    BOOST_CHECK(diskindex.GetBlockHash() == hash);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
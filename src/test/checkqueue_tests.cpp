@@ -0,0 +1,159 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+/** Counts how many checks ran and how many were deleted */
+struct CCheckCounter
+{
+    boost::mutex mutex;
+    int nRun;
+    int nDeleted;
+
+    CCheckCounter() : nRun(0), nDeleted(0) {}
+};
+
+class CCountingCheck
+{
+private:
+    CCheckCounter* pcounter;
+    bool fResult;
+
+public:
+    CCountingCheck(CCheckCounter* pcounterIn, bool fResultIn = true) : pcounter(pcounterIn), fResult(fResultIn) {}
+
+    ~CCountingCheck()
+    {
+        boost::unique_lock<boost::mutex> lock(pcounter->mutex);
+        pcounter->nDeleted++;
+    }
+
+    bool operator()()
+    {
+        boost::unique_lock<boost::mutex> lock(pcounter->mutex);
+        pcounter->nRun++;
+        return fResult;
+    }
+};
+
+/** Run the rounds on queue with nThreads worker threads, which exit at the end */
+static void RunRounds(CCheckQueue<CCountingCheck>& queue, int nThreads)
+{
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CCountingCheck>::Thread, &queue));
+
+    // All checks run and are deleted, whatever the sizes of the batches added
+    for (int nRound = 0; nRound < 20; nRound++) {
+        CCheckCounter counter;
+        int nAdded = 0;
+        {
+            CCheckQueueControl<CCountingCheck> control(&queue);
+            for (int i = 0; i <= nRound * 10; i += 1 + i / 3) {
+                std::vector<CCountingCheck*> vChecks;
+                for (int j = 0; j < i; j++)
+                    vChecks.push_back(new CCountingCheck(&counter));
+                nAdded += vChecks.size();
+                control.Add(vChecks);
+                BOOST_CHECK(vChecks.empty());
+            }
+            BOOST_CHECK(control.Wait());
+        }
+        BOOST_CHECK_EQUAL(counter.nRun, nAdded);
+        BOOST_CHECK_EQUAL(counter.nDeleted, nAdded);
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    // A failing check fails the round, and everything is still deleted
+    {
+        CCheckCounter counter;
+        CCheckQueueControl<CCountingCheck> control(&queue);
+        std::vector<CCountingCheck*> vChecks;
+        for (int i = 0; i < 1000; i++)
+            vChecks.push_back(new CCountingCheck(&counter, i != 500));
+        control.Add(vChecks);
+        for (int i = 0; i < 100; i++)
+            vChecks.push_back(new CCountingCheck(&counter));
+        control.Add(vChecks);
+        BOOST_CHECK(!control.Wait());
+        BOOST_CHECK_EQUAL(counter.nDeleted, 1100);
+        BOOST_CHECK(counter.nRun <= 1100);
+    }
+
+    // The master can take the check that failed, to find out why
+    {
+        CCheckCounter counter;
+        CCheckQueueControl<CCountingCheck> control(&queue);
+        std::vector<CCountingCheck*> vChecks;
+        for (int i = 0; i < 1000; i++)
+            vChecks.push_back(new CCountingCheck(&counter, i != 500));
+        control.Add(vChecks);
+        CCountingCheck* pcheckFailed = NULL;
+        BOOST_CHECK(!control.Wait(&pcheckFailed));
+        BOOST_CHECK(pcheckFailed != NULL);
+        BOOST_CHECK_EQUAL(counter.nDeleted, 999);
+        BOOST_CHECK(pcheckFailed && !(*pcheckFailed)());
+        delete pcheckFailed;
+        BOOST_CHECK_EQUAL(counter.nDeleted, 1000);
+    }
+
+    // The failure doesn't carry over to the next round
+    {
+        CCheckCounter counter;
+        CCheckQueueControl<CCountingCheck> control(&queue);
+        BOOST_CHECK(queue.IsIdle());
+        std::vector<CCountingCheck*> vChecks(1, new CCountingCheck(&counter));
+        control.Add(vChecks);
+        CCountingCheck* pcheckFailed = NULL;
+        BOOST_CHECK(control.Wait(&pcheckFailed));
+        BOOST_CHECK(pcheckFailed == NULL);
+        BOOST_CHECK_EQUAL(counter.nRun, 1);
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+/** Run the rounds on a new queue with nThreads worker threads, spreading them over nSlots slots */
+static void RunRounds(int nThreads, unsigned int nSlots)
+{
+    CCheckQueue<CCountingCheck> queue(16, nSlots);
+    RunRounds(queue, nThreads);
+}
+
+BOOST_AUTO_TEST_SUITE(checkqueue_tests)
+
+BOOST_AUTO_TEST_CASE(checkqueue_master_only)
+{
+    RunRounds(0, 4);
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_workers)
+{
+    RunRounds(3, 16);
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_shared_slots)
+{
+    // More threads than slots
+    RunRounds(7, 3);
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_workers_exit)
+{
+    // Work handed to the slots of workers that have exited still gets done
+    CCheckQueue<CCountingCheck> queue(16, 8);
+    RunRounds(queue, 5);
+    RunRounds(queue, 2);
+    RunRounds(queue, 0);
+    RunRounds(queue, 7);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
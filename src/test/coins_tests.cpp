@@ -4,11 +4,15 @@
 
 #include "coins.h"
 #include "random.h"
+#include "txdb.h"
 #include "uint256.h"
+#include "util.h"
 
 #include <vector>
 #include <map>
 
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 
 namespace
@@ -41,7 +45,7 @@ public:
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, const CCoinsCommitment* pcommitment)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             map_[it->first.first] = it->second.coins;
@@ -58,6 +62,37 @@ public:
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+//! An in-memory coin database, exposing the raw database
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true) {}
+
+    CLevelDBWrapper& GetDB() { return db; }
+};
+
+//! Apply the transactions of block to view the way ConnectBlock does, storing the undo data in index
+void ConnectTestBlock(const CBlock& block, CBlockIndex& index, CCoinsViewCache& view)
+{
+    CBlockUndo blockundo;
+    CValidationState state;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        CTxUndo undo;
+        UpdateCoins(block.vtx[i], state, view, undo, index.nHeight);
+        if (i > 0)
+            blockundo.vtxundo.push_back(undo);
+    }
+    CDiskBlockPos pos(999, 0);
+    boost::filesystem::path path = GetBlockPosFilename(pos, "rev");
+    if (boost::filesystem::exists(path))
+        pos.nPos = boost::filesystem::file_size(path);
+    BOOST_CHECK(blockundo.WriteToDisk(pos, index.pprev->GetBlockHash()));
+    index.nFile = pos.nFile;
+    index.nUndoPos = pos.nPos;
+    index.nStatus |= BLOCK_HAVE_UNDO;
+    view.SetBestBlock(index.GetBlockHash());
+}
 }
 
 BOOST_AUTO_TEST_SUITE(coins_tests)
@@ -83,6 +118,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool synced_a_cache = false;
 
     // A simple map to track what we expect the cache stack to represent.
     std::map<uint256, CCoins> result;
@@ -139,6 +175,12 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
 
         if (insecure_rand() % 100 == 0) {
             // Every 100 iterations, change the cache stack.
+            if (stack.size() > 0 && insecure_rand() % 4 == 0) {
+                // Write the tip's changes down but keep using it, possibly dropping unmodified entries.
+                stack.back()->Sync();
+                stack.back()->Trim(insecure_rand() % 2 ? 0 : stack.back()->DynamicMemoryUsage() / 2);
+                synced_a_cache = true;
+            }
             if (stack.size() > 0 && insecure_rand() % 2 == 0) {
                 stack.back()->Flush();
                 delete stack.back();
@@ -173,6 +215,577 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(synced_a_cache);
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_sync)
+{
+    CCoinsViewTest base;
+    CCoinsViewCache cache(&base);
+    size_t nEmptyUsage = cache.DynamicMemoryUsage();
+    uint256 txid = GetRandHash();
+    {
+        CCoinsModifier coins = cache.ModifyCoins(txid);
+        coins->vout.resize(2);
+        coins->vout[0].nValue = 1;
+        coins->vout[1].nValue = CTxOutValue(std::vector<unsigned char>(CTxOutValue::nCommitmentSize, 2), std::vector<unsigned char>(4000));
+    }
+    // Rangeproofs count towards the memory usage
+    size_t nUsage = cache.DynamicMemoryUsage();
+    BOOST_CHECK(nUsage >= nEmptyUsage + 4000);
+
+    // Syncing writes the entry, but keeps it cached
+    BOOST_CHECK(cache.Sync());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), nUsage);
+    CCoins coins;
+    BOOST_CHECK(base.GetCoins(txid, coins));
+    BOOST_CHECK_EQUAL(coins.vout.size(), 2U);
+
+    // Until taken modifications are written, the emptied entry hides the base's copy
+    {
+        CCoinsModifier coins = cache.ModifyCoins(txid);
+        BOOST_CHECK(coins->Spend(1));
+        BOOST_CHECK(coins->Spend(0));
+    }
+    BOOST_CHECK(cache.DynamicMemoryUsage() + 4000 <= nUsage);
+    CCoinsMap mapModified;
+    cache.TakeModified(mapModified);
+    BOOST_CHECK_EQUAL(mapModified.size(), 1U);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+    BOOST_CHECK(base.HaveCoins(txid));
+    BOOST_CHECK(!cache.HaveCoins(txid));
+    cache.Trim(0);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+
+    // Unmodified entries are what Trim drops
+    CCoinsViewCache cache2(&base);
+    BOOST_CHECK(cache2.HaveCoins(txid));
+    {
+        CCoinsModifier coins = cache2.ModifyCoins(GetRandHash());
+        coins->vout.resize(1);
+        coins->vout[0].nValue = 1;
+    }
+    cache2.Trim(0);
+    BOOST_CHECK_EQUAL(cache2.GetCacheSize(), 1U);
+    BOOST_CHECK(base.BatchWrite(mapModified, uint256(0), NULL));
+    BOOST_CHECK(!cache2.HaveCoins(txid));
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_sync_trim_spend)
+{
+    // A synced entry that its parent cache has dropped since is still spent
+    // in the base when the child is flushed
+    CCoinsViewTest base;
+    CCoinsViewCache parent(&base);
+    CCoinsViewCache* child = new CCoinsViewCache(&parent);
+    uint256 txid = GetRandHash();
+    {
+        CCoinsModifier coins = child->ModifyCoins(txid);
+        coins->vout.resize(1);
+        coins->vout[0].nValue = 1;
+    }
+    BOOST_CHECK(child->Sync());
+    BOOST_CHECK(parent.Sync());
+    parent.Trim(0);
+    BOOST_CHECK_EQUAL(parent.GetCacheSize(), 0U);
+    BOOST_CHECK(base.HaveCoins(txid));
+
+    {
+        CCoinsModifier coins = child->ModifyCoins(txid);
+        BOOST_CHECK(coins->Spend(0));
+    }
+    BOOST_CHECK(child->Flush());
+    delete child;
+    BOOST_CHECK_EQUAL(parent.GetCacheSize(), 1U);
+    BOOST_CHECK(!parent.HaveCoins(txid));
+    BOOST_CHECK(parent.Flush());
+    CCoins coins;
+    BOOST_CHECK(!base.GetCoins(txid, coins) || coins.IsPruned());
+    CCoinsViewCache cache(&base);
+    BOOST_CHECK(!cache.HaveCoins(txid));
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_spent_memory)
+{
+    // Spent outputs no longer hold on to their rangeproofs in the cache
+    CCoinsViewTest base;
+    CCoinsViewCache cache(&base);
+    uint256 txid = GetRandHash();
+    {
+        CCoinsModifier coins = cache.ModifyCoins(txid);
+        coins->vout.resize(10);
+        for (unsigned int i = 0; i < coins->vout.size(); i++) {
+            coins->vout[i].nValue.vchCommitment[0] = 0x08;
+            coins->vout[i].nValue.vchRangeproof.resize(2000, i);
+            coins->vout[i].scriptPubKey = CScript() << OP_TRUE;
+        }
+    }
+    size_t nUsageUnspent = cache.DynamicMemoryUsage();
+    BOOST_CHECK(nUsageUnspent > 10 * 2000);
+    for (unsigned int i = 0; i < 9; i++)
+        BOOST_CHECK(cache.ModifyCoins(txid)->Spend(i));
+    BOOST_CHECK(cache.DynamicMemoryUsage() < nUsageUnspent / 5);
+    const CCoins* coins = cache.AccessCoins(txid);
+    BOOST_CHECK(coins->IsAvailable(9) && !coins->IsAvailable(0));
+    BOOST_CHECK_EQUAL(coins->vout[9].nValue.vchRangeproof.size(), 2000U);
+    BOOST_CHECK_EQUAL(coins->vout[9].nValue.vchRangeproof[0], 9);
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_per_output)
+{
+    CCoinsViewDBTest base;
+    CLevelDBWrapper& db = base.GetDB();
+    uint256 txid = GetRandHash();
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.nHeight = 5;
+    coins.vout.resize(3);
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        coins.vout[i].nValue = i + 1;
+        coins.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+    coins.vout[1].SetNull();
+
+    // A record in the old per-transaction format is split up by the upgrade
+    BOOST_CHECK(db.Write(std::make_pair('c', txid), coins));
+    BOOST_CHECK(db.Write('V', (int)COINS_DB_FORMAT_COMPRESSED_AMOUNTS));
+    BOOST_CHECK(base.Upgrade());
+    int nFormat = 0;
+    BOOST_CHECK(db.Read('V', nFormat));
+    BOOST_CHECK_EQUAL(nFormat, COINS_DB_FORMAT_TX_INDEX);
+    BOOST_CHECK(!db.Exists(std::make_pair('c', txid)));
+    BOOST_CHECK(db.Exists(std::make_pair('u', txid)));
+    BOOST_CHECK(db.Exists(std::make_pair('o', COutPoint(txid, 0))));
+    BOOST_CHECK(!db.Exists(std::make_pair('o', COutPoint(txid, 1))));
+    BOOST_CHECK(db.Exists(std::make_pair('o', COutPoint(txid, 2))));
+    CCoins coinsRead;
+    BOOST_CHECK(base.GetCoins(txid, coinsRead));
+    BOOST_CHECK(coinsRead == coins);
+    BOOST_CHECK(base.HaveCoins(txid));
+    BOOST_CHECK(!base.HaveCoins(GetRandHash()));
+
+    // Spending an output only erases that output
+    {
+        CCoinsViewCache cache(&base);
+        BOOST_CHECK(cache.ModifyCoins(txid)->Spend(0));
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!db.Exists(std::make_pair('o', COutPoint(txid, 0))));
+    BOOST_CHECK(db.Exists(std::make_pair('o', COutPoint(txid, 2))));
+    BOOST_CHECK(base.GetCoins(txid, coinsRead));
+    BOOST_CHECK(coinsRead.vout[0].IsNull());
+    BOOST_CHECK(!coinsRead.vout[2].IsNull());
+
+    // A transaction replacing a spent one with the same txid is written in
+    // full, even where the database still has an output of the old one
+    {
+        CCoinsViewCache cache(&base);
+        BOOST_CHECK(cache.ModifyCoins(txid)->Spend(2));
+        BOOST_CHECK(!cache.HaveCoins(txid));
+        {
+            CCoinsModifier modifier = cache.ModifyCoins(txid);
+            modifier->nHeight = 7;
+            modifier->vout.resize(3);
+            modifier->vout[2].nValue = 10;
+            modifier->vout[2].scriptPubKey = CScript() << OP_TRUE;
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(base.GetCoins(txid, coinsRead));
+    BOOST_CHECK_EQUAL(coinsRead.nHeight, 7);
+    BOOST_CHECK_EQUAL(coinsRead.vout.size(), 3U);
+    BOOST_CHECK(coinsRead.vout[2].nValue.GetAmount() == 10);
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_tx_index)
+{
+    CCoinsViewDBTest base;
+    CLevelDBWrapper& db = base.GetDB();
+    uint256 txid = GetRandHash();
+    uint256 hashBlock = GetRandHash();
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.nHeight = 5;
+    coins.vout.resize(1);
+    coins.vout[0].nValue = 1;
+    coins.vout[0].scriptPubKey = CScript() << OP_TRUE;
+
+    // A database with outputs but no index gets one, and its best block is
+    // moved out of sight of older versions
+    {
+        CCoinsViewCache cache(&base);
+        *cache.ModifyCoins(txid) = coins;
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(db.Erase(std::make_pair('u', txid)));
+    BOOST_CHECK(db.Write('B', hashBlock));
+    BOOST_CHECK(db.Write('V', (int)COINS_DB_FORMAT_PER_OUTPUT));
+    BOOST_CHECK(!base.HaveCoins(txid));
+    BOOST_CHECK(base.Upgrade());
+    int nFormat = 0;
+    BOOST_CHECK(db.Read('V', nFormat));
+    BOOST_CHECK_EQUAL(nFormat, COINS_DB_FORMAT_TX_INDEX);
+    BOOST_CHECK(base.HaveCoins(txid));
+    CCoins coinsRead;
+    BOOST_CHECK(base.GetCoins(txid, coinsRead));
+    BOOST_CHECK(coinsRead == coins);
+    BOOST_CHECK(base.GetBestBlock() == hashBlock);
+    BOOST_CHECK(!db.Exists('B'));
+    BOOST_CHECK(base.Upgrade());
+
+    // Spending the last output erases the index entry
+    {
+        CCoinsViewCache cache(&base);
+        BOOST_CHECK(cache.ModifyCoins(txid)->Spend(0));
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!db.Exists(std::make_pair('u', txid)));
+    BOOST_CHECK(!base.HaveCoins(txid));
+
+    // A best block written by an older version means the set is stale
+    BOOST_CHECK(db.Write('B', hashBlock));
+    BOOST_CHECK(!base.Upgrade());
+}
+
+static CCoins MakeCoins(int nHeight, unsigned int nOutputs)
+{
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.nHeight = nHeight;
+    coins.vout.resize(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        coins.vout[i].nValue = insecure_rand() % 100000 + 1;
+        coins.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+    return coins;
+}
+
+static bool LoadSnapshotFile(CCoinsViewDB& view, const boost::filesystem::path& path, const uint256& hashExpected, std::string& strError)
+{
+    CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    CCoinsSnapshotHeader header;
+    CCoinsStats stats;
+    return view.LoadSnapshot(file, hashExpected, header, stats, strError);
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_snapshot)
+{
+    boost::filesystem::path path = GetDataDir() / "utxo_test.dat";
+    uint256 hashBlock = GetRandHash();
+    CBlockIndex index;
+    index.nHeight = 10;
+    index.nChainTx = 42;
+    mapBlockIndex[hashBlock] = &index;
+
+    CCoinsViewDBTest source;
+    std::vector<uint256> vTxid;
+    {
+        CCoinsViewCache cache(&source);
+        for (int i = 0; i < 50; i++) {
+            vTxid.push_back(GetRandHash());
+            *cache.ModifyCoins(vTxid.back()) = MakeCoins(i, 1 + i % 4);
+        }
+        cache.ModifyCoins(vTxid[3])->Spend(0);
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+    }
+    std::pair<uint256, COutPoint> withdraw(GetRandHash(), COutPoint(GetRandHash(), 1));
+    COutPoint spender(GetRandHash(), 0);
+    BOOST_CHECK(source.GetDB().Write(std::make_pair('w', withdraw), spender));
+
+    CCoinsStats stats;
+    {
+        CAutoFile file(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(source.DumpSnapshot(file, stats));
+    }
+    CCoinsStats statsSource;
+    BOOST_CHECK(source.GetStats(statsSource));
+    BOOST_CHECK(stats.hashSerialized == statsSource.hashSerialized);
+    BOOST_CHECK_EQUAL(stats.nTransactions, 50U);
+    BOOST_CHECK_EQUAL(stats.nHeight, 10);
+
+    // A node with a set of its own, which any failed load must leave alone
+    CCoinsViewDBTest target;
+    uint256 txidOld = GetRandHash(), hashOld = GetRandHash();
+    {
+        CCoinsViewCache cache(&target);
+        *cache.ModifyCoins(txidOld) = MakeCoins(1, 2);
+        cache.SetBestBlock(hashOld);
+        BOOST_CHECK(cache.Flush());
+    }
+    std::string strError;
+    BOOST_CHECK(!LoadSnapshotFile(target, path, GetRandHash(), strError));
+    BOOST_CHECK(target.HaveCoins(txidOld));
+    BOOST_CHECK(target.GetBestBlock() == hashOld);
+
+    // So must a damaged file
+    boost::filesystem::path pathDamaged = GetDataDir() / "utxo_test_damaged.dat";
+    boost::filesystem::remove(pathDamaged);
+    boost::filesystem::copy_file(path, pathDamaged);
+    {
+        FILE* file = fopen(pathDamaged.string().c_str(), "r+b");
+        fseek(file, boost::filesystem::file_size(pathDamaged) / 2, SEEK_SET);
+        int ch = fgetc(file);
+        fseek(file, -1, SEEK_CUR);
+        fputc(ch ^ 0x20, file);
+        fclose(file);
+    }
+    strError.clear();
+    BOOST_CHECK(!LoadSnapshotFile(target, pathDamaged, stats.hashSerialized, strError));
+    BOOST_CHECK(!strError.empty());
+    BOOST_CHECK(target.HaveCoins(txidOld));
+    BOOST_CHECK(target.GetBestBlock() == hashOld);
+
+    // And one whose spent withdraws differ from those the hash was taken over
+    boost::filesystem::path pathForged = GetDataDir() / "utxo_test_forged.dat";
+    COutPoint spenderForged(GetRandHash(), 0);
+    BOOST_CHECK(source.GetDB().Write(std::make_pair('w', withdraw), spenderForged));
+    {
+        CAutoFile file(fopen(pathForged.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        CCoinsStats statsForged;
+        BOOST_CHECK(source.DumpSnapshot(file, statsForged));
+        BOOST_CHECK(statsForged.hashSerialized != stats.hashSerialized);
+    }
+    BOOST_CHECK(source.GetDB().Write(std::make_pair('w', withdraw), spender));
+    strError.clear();
+    BOOST_CHECK(!LoadSnapshotFile(target, pathForged, stats.hashSerialized, strError));
+    BOOST_CHECK(!strError.empty());
+    BOOST_CHECK(target.HaveCoins(txidOld));
+    BOOST_CHECK(target.GetBestBlock() == hashOld);
+
+    // The intact file replaces the set
+    BOOST_CHECK(LoadSnapshotFile(target, path, stats.hashSerialized, strError));
+    BOOST_CHECK(target.GetBestBlock() == hashBlock);
+    BOOST_CHECK(!target.HaveCoins(txidOld));
+    BOOST_FOREACH(const uint256& txid, vTxid) {
+        CCoins coinsSource, coinsTarget;
+        BOOST_CHECK(source.GetCoins(txid, coinsSource));
+        BOOST_CHECK(target.GetCoins(txid, coinsTarget));
+        BOOST_CHECK(coinsSource == coinsTarget);
+    }
+    BOOST_CHECK(target.GetWithdrawSpent(withdraw) == spender);
+    CCoinsStats statsTarget;
+    BOOST_CHECK(target.GetStats(statsTarget));
+    BOOST_CHECK(statsTarget.hashSerialized == stats.hashSerialized);
+    BOOST_CHECK(target.Upgrade());
+
+    // It comes with the commitment a walk over the same set computes
+    CCoinsCommitment commitmentSource, commitmentTarget;
+    BOOST_CHECK(source.Upgrade());
+    BOOST_CHECK(source.GetCommitment(commitmentSource));
+    BOOST_CHECK(target.GetCommitment(commitmentTarget));
+    BOOST_CHECK(commitmentTarget.GetHash() == commitmentSource.GetHash());
+    BOOST_CHECK_EQUAL(commitmentTarget.nTransactions, stats.nTransactions);
+    BOOST_CHECK_EQUAL(commitmentTarget.nTransactionOutputs, stats.nTransactionOutputs);
+
+    // The header names the block the dumped set is at, also once the set has moved on
+    uint256 hashNext = GetRandHash();
+    CBlockIndex indexNext;
+    indexNext.nHeight = 11;
+    indexNext.nChainTx = 43;
+    mapBlockIndex[hashNext] = &indexNext;
+    {
+        CCoinsViewCache cache(&source);
+        cache.ModifyCoins(vTxid[4])->Spend(0);
+        cache.SetBestBlock(hashNext);
+        BOOST_CHECK(cache.Flush());
+    }
+    boost::filesystem::path pathNext = GetDataDir() / "utxo_test_next.dat";
+    CCoinsStats statsNext;
+    {
+        CAutoFile file(fopen(pathNext.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(source.DumpSnapshot(file, statsNext));
+    }
+    BOOST_CHECK(source.GetStats(statsSource));
+    BOOST_CHECK(statsNext.hashBlock == hashNext);
+    BOOST_CHECK(statsNext.hashSerialized == statsSource.hashSerialized);
+    for (int i = 0; i < 2; i++) {
+        CAutoFile file(fopen((i == 0 ? path : pathNext).string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        unsigned char pchMessageStart[MESSAGE_START_SIZE];
+        CCoinsSnapshotHeader header;
+        file >> FLATDATA(pchMessageStart) >> header;
+        BOOST_CHECK(header.hashBlock == (i == 0 ? hashBlock : hashNext));
+        BOOST_CHECK_EQUAL(header.nChainTx, i == 0 ? 42U : 43U);
+    }
+
+    mapBlockIndex.erase(hashBlock);
+    mapBlockIndex.erase(hashNext);
+    boost::filesystem::remove(path);
+    boost::filesystem::remove(pathNext);
+    boost::filesystem::remove(pathDamaged);
+    boost::filesystem::remove(pathForged);
+}
+
+BOOST_AUTO_TEST_CASE(coins_commitment)
+{
+    // The hash doesn't depend on the order elements come and go in
+    uint256 a = GetRandHash(), b = GetRandHash(), c = GetRandHash();
+    CMuHash3072 empty, x, y;
+    x.Insert(a);
+    x.Insert(b);
+    x.Insert(c);
+    x.Remove(b);
+    y.Insert(c);
+    y.Insert(a);
+    BOOST_CHECK(x == y);
+    BOOST_CHECK(x != empty);
+    y.Remove(a);
+    y.Remove(c);
+    BOOST_CHECK(y == empty);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << x;
+    BOOST_CHECK_EQUAL(ss.size(), (size_t)CMuHash3072::BYTE_SIZE);
+    CMuHash3072 z;
+    ss >> z;
+    BOOST_CHECK(z == x);
+    z.Insert(b);
+    BOOST_CHECK(z != x);
+
+    // Connecting transactions through a stack of caches keeps the
+    // database's commitment equal to one computed over the whole set
+    CCoinsViewDBTest base;
+    BOOST_CHECK(base.Upgrade());
+    CCoinsCommitment commitment;
+    BOOST_CHECK(base.GetCommitment(commitment));
+    BOOST_CHECK(commitment.GetHash() == empty.GetHash());
+
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vout.resize(3);
+    for (unsigned int i = 0; i < txFund.vout.size(); i++) {
+        txFund.vout[i].nValue = 1000 * (i + 1);
+        txFund.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+    CMutableTransaction txSpend;
+    txSpend.vin.resize(2);
+    txSpend.vin[0].prevout = COutPoint(txFund.GetHash(), 0);
+    txSpend.vin[1].prevout = COutPoint(txFund.GetHash(), 2);
+    txSpend.vout.resize(1);
+    txSpend.vout[0].nValue = 4000;
+    txSpend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+
+    CValidationState state;
+    {
+        CCoinsViewCache cache(&base);
+        CTxUndo undo;
+        UpdateCoins(txFund, state, cache, undo, 1);
+        BOOST_CHECK(cache.Flush());
+    }
+    {
+        CCoinsViewCache cache(&base);
+        CCoinsViewCache child(&cache);
+        CTxUndo undo;
+        UpdateCoins(txSpend, state, child, undo, 2);
+        BOOST_CHECK(child.Flush());
+        BOOST_CHECK(cache.Sync());
+    }
+    BOOST_CHECK(base.GetCommitment(commitment));
+    BOOST_CHECK_EQUAL(commitment.nTransactions, 2U);
+    BOOST_CHECK_EQUAL(commitment.nTransactionOutputs, 2U);
+    BOOST_CHECK_EQUAL(commitment.nBlindedOutputs, 0U);
+    BOOST_CHECK_EQUAL(commitment.nTotalAmount, (CAmount)6000);
+
+    BOOST_CHECK(base.GetDB().Erase('C'));
+    BOOST_CHECK(base.Upgrade());
+    CCoinsCommitment commitmentFull;
+    BOOST_CHECK(base.GetCommitment(commitmentFull));
+    BOOST_CHECK(commitmentFull.GetHash() == commitment.GetHash());
+    BOOST_CHECK_EQUAL(commitmentFull.nTransactions, commitment.nTransactions);
+    BOOST_CHECK_EQUAL(commitmentFull.nTotalAmount, commitment.nTotalAmount);
+
+    // A block creating a blinded output and explicit ones carrying a nonce
+    // or a rangeproof, and one spending them again after they went through
+    // the database
+    uint256 vHashes[3] = {1, 2, 3};
+    CBlockIndex vIndex[3];
+    for (int i = 0; i < 3; i++) {
+        vIndex[i].phashBlock = &vHashes[i];
+        vIndex[i].nHeight = i + 2;
+        vIndex[i].pprev = i ? &vIndex[i - 1] : NULL;
+    }
+    CBlock vBlocks[2];
+    for (int i = 0; i < 2; i++) {
+        CMutableTransaction txCoinbase;
+        txCoinbase.vin.resize(1);
+        txCoinbase.vin[0].scriptSig = CScript() << vIndex[i + 1].nHeight;
+        txCoinbase.vout.resize(1);
+        txCoinbase.vout[0].nValue = 0;
+        txCoinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        vBlocks[i].vtx.push_back(txCoinbase);
+    }
+
+    CMutableTransaction txMixed;
+    txMixed.vin.resize(2);
+    txMixed.vin[0].prevout = COutPoint(txSpend.GetHash(), 0);
+    txMixed.vin[1].prevout = COutPoint(txFund.GetHash(), 1);
+    txMixed.vout.resize(4);
+    // The set doesn't look into value commitments, so any will do
+    std::vector<unsigned char> vchBlinded(CTxOutValue::nCommitmentSize, 0x5a);
+    vchBlinded[0] = 2;
+    txMixed.vout[0].nValue = CTxOutValue(vchBlinded, std::vector<unsigned char>(100, 0xa5));
+    txMixed.vout[1].nValue = 1000;
+    txMixed.vout[1].nValue.vchNonceCommitment.assign(CTxOutValue::nCommitmentSize, 3);
+    txMixed.vout[2].nValue = 500;
+    txMixed.vout[2].nValue.vchRangeproof.assign(100, 0xa5);
+    txMixed.vout[3].nValue = 500;
+    for (unsigned int i = 0; i < txMixed.vout.size(); i++)
+        txMixed.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    vBlocks[0].vtx.push_back(txMixed);
+
+    CMutableTransaction txSpendMixed;
+    txSpendMixed.vin.resize(3);
+    for (unsigned int i = 0; i < txSpendMixed.vin.size(); i++)
+        txSpendMixed.vin[i].prevout = COutPoint(txMixed.GetHash(), i);
+    txSpendMixed.vout.resize(1);
+    txSpendMixed.vout[0].nValue = 1500;
+    txSpendMixed.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    vBlocks[1].vtx.push_back(txSpendMixed);
+
+    CCoinsCommitment vCommitments[3];
+    {
+        CCoinsViewCache cache(&base);
+        cache.SetBestBlock(vHashes[0]);
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(base.GetCommitment(vCommitments[0]));
+    for (int i = 0; i < 2; i++) {
+        CCoinsViewCache cache(&base);
+        ConnectTestBlock(vBlocks[i], vIndex[i + 1], cache);
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(base.GetCommitment(vCommitments[i + 1]));
+    }
+    BOOST_CHECK_EQUAL(vCommitments[1].nTransactions, 2U);
+    BOOST_CHECK_EQUAL(vCommitments[1].nTransactionOutputs, 5U);
+    BOOST_CHECK_EQUAL(vCommitments[1].nBlindedOutputs, 1U);
+    BOOST_CHECK_EQUAL(vCommitments[1].nTotalAmount, (CAmount)2000);
+    BOOST_CHECK_EQUAL(vCommitments[2].nTransactions, 4U);
+    BOOST_CHECK_EQUAL(vCommitments[2].nTransactionOutputs, 4U);
+    BOOST_CHECK_EQUAL(vCommitments[2].nBlindedOutputs, 0U);
+    BOOST_CHECK_EQUAL(vCommitments[2].nTotalAmount, (CAmount)2000);
+
+    // Spending the outputs read back took out exactly what creating them put in
+    BOOST_CHECK(base.GetDB().Erase('C'));
+    BOOST_CHECK(base.Upgrade());
+    BOOST_CHECK(base.GetCommitment(commitmentFull));
+    BOOST_CHECK(commitmentFull.GetHash() == vCommitments[2].GetHash());
+
+    // Disconnecting each block returns the commitment to what it was before the block
+    for (int i = 1; i >= 0; i--) {
+        CCoinsViewCache cache(&base);
+        bool fClean = false;
+        BOOST_CHECK(DisconnectBlock(vBlocks[i], state, &vIndex[i + 1], cache, &fClean));
+        BOOST_CHECK(fClean);
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(base.GetCommitment(commitment));
+        BOOST_CHECK(commitment.GetHash() == vCommitments[i].GetHash());
+        BOOST_CHECK_EQUAL(commitment.nTransactions, vCommitments[i].nTransactions);
+        BOOST_CHECK_EQUAL(commitment.nTransactionOutputs, vCommitments[i].nTransactionOutputs);
+        BOOST_CHECK_EQUAL(commitment.nBlindedOutputs, vCommitments[i].nBlindedOutputs);
+        BOOST_CHECK_EQUAL(commitment.nTotalAmount, vCommitments[i].nTotalAmount);
+    }
+    boost::filesystem::remove(GetBlockPosFilename(CDiskBlockPos(999, 0), "rev"));
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,7 +2,11 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "clientversion.h"
+#include "coins.h"
 #include "compressor.h"
+#include "streams.h"
+#include "undo.h"
 #include "util.h"
 
 #include <stdint.h>
@@ -61,4 +65,82 @@ BOOST_AUTO_TEST_CASE(compress_amounts)
         BOOST_CHECK(TestDecode(i));
 }
 
+static CTxOut RoundTrip(const CTxOut& in, size_t& nSize)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    CTxOut out(in);
+    ss << CTxOutCompressor(out);
+    nSize = ss.size();
+    CTxOut ret;
+    ss >> REF(CTxOutCompressor(ret));
+    BOOST_CHECK(ss.empty());
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(compress_txout_values)
+{
+    CScript script = CScript() << OP_TRUE;
+    size_t nSize;
+
+    // Explicit amounts take a marker byte plus the compressed amount
+    CTxOut explicitOut(CTxOutValue(50 * COIN), script);
+    BOOST_CHECK(RoundTrip(explicitOut, nSize) == explicitOut);
+    BOOST_CHECK_EQUAL(nSize, 1 + 1 + 2);
+
+    // Blinded values are kept in full
+    std::vector<unsigned char> vchCommitment(CTxOutValue::nCommitmentSize, 0x5a);
+    vchCommitment[0] = 0x02;
+    CTxOut blindedOut(CTxOutValue(vchCommitment, std::vector<unsigned char>(100, 0x17)), script);
+    blindedOut.nValue.vchNonceCommitment.assign(33, 0x03);
+    BOOST_CHECK(RoundTrip(blindedOut, nSize) == blindedOut);
+    BOOST_CHECK_EQUAL(nSize, 33 + 1 + 100 + 1 + 33 + 2);
+
+    // Explicit amounts written in full by older versions still decode
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << explicitOut.nValue;
+    CScriptCompressor cscript(REF(explicitOut.scriptPubKey));
+    ss << cscript;
+    CTxOut legacyOut;
+    ss >> REF(CTxOutCompressor(legacyOut));
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK(legacyOut == explicitOut);
+
+    // Explicit amounts carrying a nonce commitment or rangeproof are kept in full
+    CTxOut nonceOut(explicitOut);
+    nonceOut.nValue.vchNonceCommitment.assign(33, 0x02);
+    BOOST_CHECK(RoundTrip(nonceOut, nSize) == nonceOut);
+    BOOST_CHECK_EQUAL(nSize, 33 + 1 + 1 + 33 + 2);
+    CTxOut proofOut(explicitOut);
+    proofOut.nValue.vchRangeproof.assign(40, 0x33);
+    BOOST_CHECK(RoundTrip(proofOut, nSize) == proofOut);
+    BOOST_CHECK_EQUAL(nSize, 33 + 1 + 40 + 1 + 2);
+}
+
+BOOST_AUTO_TEST_CASE(compress_coins_undo_nonce)
+{
+    // The spent output's nonce commitment is part of the signature hash, so
+    // it must survive the coins database and undo data unchanged.
+    CTxOut out(CTxOutValue(50 * COIN), CScript() << OP_TRUE);
+    out.nValue.vchNonceCommitment.assign(33, 0x02);
+
+    CMutableTransaction mtx;
+    mtx.vout.push_back(out);
+    mtx.vout.push_back(CTxOut(CTxOutValue(COIN), CScript() << OP_TRUE));
+    CCoins coins(mtx, 100);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << coins;
+    CCoins coinsRead;
+    ss >> coinsRead;
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK(coinsRead == coins);
+    BOOST_CHECK(coinsRead.vout[0].nValue.vchNonceCommitment == out.nValue.vchNonceCommitment);
+
+    CTxInUndo undo(out, false, 100, 1);
+    ss << undo;
+    CTxInUndo undoRead;
+    ss >> undoRead;
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK(undoRead.txout == out);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "hash.h"
 #include "random.h"
 #include "utilstrencodings.h"
 
@@ -282,4 +283,23 @@ BOOST_AUTO_TEST_CASE(rfc6979_hmac_sha256)
             ("7597887cbd76321f32e30440679a22cf7f8d9d2eac390e581fea091ce202ba94"));
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    // Every implementation must agree with the plain double hash, for any
+    // number of inputs (exercising the 8-way, 4-way and single tails).
+    const int vAllowed[] = {0, SHA256_USE_SSE41, SHA256_USE_SSE41 | SHA256_USE_AVX2, SHA256_USE_ALL};
+    for (unsigned int a = 0; a < sizeof(vAllowed) / sizeof(vAllowed[0]); a++) {
+        SHA256AutoDetect(vAllowed[a]);
+        for (int i = 1; i <= 32; i++) {
+            std::vector<unsigned char> in(64 * i), out1(32 * i), out2(32 * i);
+            GetRandBytes(&in[0], in.size());
+            for (int j = 0; j < i; j++)
+                CHash256().Write(&in[64 * j], 64).Finalize(&out1[32 * j]);
+            SHA256D64(&out2[0], &in[0], i);
+            BOOST_CHECK(out1 == out2);
+        }
+    }
+    SHA256AutoDetect();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
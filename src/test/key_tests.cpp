@@ -142,6 +142,22 @@ BOOST_AUTO_TEST_CASE(key_test1)
         BOOST_CHECK(!pubkey2C.Verify(hashMsg, sign1C));
         BOOST_CHECK( pubkey2C.Verify(hashMsg, sign2C));
 
+        // batch verification
+
+        CSignatureBatch batch;
+        BOOST_CHECK(batch.Verify());
+        BOOST_CHECK(batch.Add(pubkey1, hashMsg, sign1));
+        BOOST_CHECK(batch.Add(pubkey2C, hashMsg, sign2C));
+        BOOST_CHECK(batch.Add(pubkey1C, hashMsg, sign1C));
+        BOOST_CHECK(batch.size() == 3);
+        BOOST_CHECK(batch.Verify());
+        BOOST_CHECK(batch.Add(pubkey1, hashMsg, sign2));
+        BOOST_CHECK(!batch.Verify());
+        batch.clear();
+        BOOST_CHECK(!batch.Add(pubkey1, hashMsg, vector<unsigned char>(sign1.begin(), sign1.end() - 1)));
+        BOOST_CHECK(!batch.Add(CPubKey(), hashMsg, sign1));
+        BOOST_CHECK(batch.size() == 0);
+
         // compact signatures (with key recovery)
 
         vector<unsigned char> csign1, csign2, csign1C, csign2C;
@@ -0,0 +1,426 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "parentchain.h"
+
+#include "chainparams.h"
+#include "rpcprotocol.h"
+#include "util.h"
+#include "utilstrencodings.h"
+
+#include <map>
+#include <stdexcept>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+using namespace json_spirit;
+using namespace std;
+
+/** Parent chain backend answering from a map, counting calls */
+class CMockParentChain : public CParentChainBackend
+{
+public:
+    map<uint256, int> mapConfirmations;
+    int nCalls;
+    unsigned int nMaxBatch;
+    bool fDown;
+
+    CMockParentChain() : nCalls(0), nMaxBatch(0), fDown(false) {}
+
+    void GetConfirmations(const vector<uint256>& vHash, vector<int>& vConfirmations)
+    {
+        nCalls++;
+        if (fDown)
+            throw runtime_error("couldn't connect to server");
+        nMaxBatch = max(nMaxBatch, (unsigned int)vHash.size());
+        vConfirmations.clear();
+        BOOST_FOREACH(const uint256& hash, vHash) {
+            map<uint256, int>::const_iterator it = mapConfirmations.find(hash);
+            vConfirmations.push_back(it == mapConfirmations.end() ? -1 : it->second);
+        }
+    }
+};
+
+static void CountResolved(int* pnResolved)
+{
+    (*pnResolved)++;
+}
+
+/**
+ * Answer one batch of getblock calls the way bitcoind does, from
+ * mapConfirmations, but with the replies in reverse order.
+ */
+static void ServeGetBlock(boost::asio::io_service* io_service, boost::asio::ip::tcp::acceptor* acceptor, const map<uint256, int>* mapConfirmations)
+{
+    try {
+        boost::asio::ip::tcp::socket socket(*io_service);
+        acceptor->accept(socket);
+        boost::asio::streambuf buf;
+        boost::asio::read_until(socket, buf, "\r\n\r\n");
+        istream stream(&buf);
+        int nProto = 0;
+        string strMethod, strURI;
+        map<string, string> mapHeaders;
+        ReadHTTPRequestLine(stream, nProto, strMethod, strURI);
+        ReadHTTPHeaders(stream, mapHeaders);
+        size_t nLen = atoi(mapHeaders["content-length"]);
+        if (buf.size() < nLen)
+            boost::asio::read(socket, buf, boost::asio::transfer_exactly(nLen - buf.size()));
+        string strRequest(nLen, '\0');
+        stream.read(&strRequest[0], nLen);
+
+        Value valRequest;
+        if (!read_string(strRequest, valRequest))
+            return;
+        const Array& vRequest = valRequest.get_array();
+        Array vReply;
+        for (Array::const_reverse_iterator it = vRequest.rbegin(); it != vRequest.rend(); it++) {
+            const Object& request = it->get_obj();
+            uint256 hash(find_value(request, "params").get_array()[0].get_str());
+            map<uint256, int>::const_iterator mi = mapConfirmations->find(hash);
+            if (mi == mapConfirmations->end()) {
+                vReply.push_back(JSONRPCReplyObj(Value::null, JSONRPCError(-5, "Block not found"), find_value(request, "id")));
+            } else {
+                Object result;
+                result.push_back(Pair("confirmations", mi->second));
+                vReply.push_back(JSONRPCReplyObj(result, Value::null, find_value(request, "id")));
+            }
+        }
+        string strReply = HTTPReply(HTTP_OK, write_string(Value(vReply), false), false);
+        boost::asio::write(socket, boost::asio::buffer(strReply));
+    } catch (const std::exception&) {
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(parentchain_tests)
+
+BOOST_AUTO_TEST_CASE(parentchain_deferred_lookup)
+{
+    CMockParentChain backend;
+    CParentChainConfirmations confirmations(&backend, 60);
+    int nResolved = 0;
+    confirmations.SetResolvedCallback(boost::bind(&CountResolved, &nResolved));
+
+    uint256 hashDeep = 1, hashShallow = 2, hashUnknown = 3;
+    backend.mapConfirmations[hashDeep] = 20;
+    backend.mapConfirmations[hashShallow] = 5;
+
+    // Nothing is known before a refresh, and the backend isn't asked inline
+    bool fPending = false;
+    BOOST_CHECK(!confirmations.IsConfirmed(hashDeep, 10, fPending));
+    BOOST_CHECK(fPending);
+    BOOST_CHECK(!confirmations.IsConfirmed(hashShallow, 10, fPending));
+    BOOST_CHECK(!confirmations.IsConfirmed(hashUnknown, 10, fPending));
+    BOOST_CHECK(fPending);
+    BOOST_CHECK(!confirmations.IsConfirmed(hashDeep, 10, fPending));
+    BOOST_CHECK_EQUAL(backend.nCalls, 0);
+    BOOST_CHECK_EQUAL(confirmations.GetPendingLookups(), 4U);
+    BOOST_CHECK_EQUAL(confirmations.GetPendingCount(), 3U);
+
+    // One batch resolves all of them
+    BOOST_CHECK(confirmations.Refresh(1000));
+    BOOST_CHECK_EQUAL(backend.nCalls, 1);
+    BOOST_CHECK_EQUAL(nResolved, 1);
+    BOOST_CHECK_EQUAL(confirmations.GetPendingCount(), 0U);
+
+    BOOST_CHECK(confirmations.IsConfirmed(hashDeep, 10, fPending));
+    BOOST_CHECK(!fPending);
+    BOOST_CHECK(!confirmations.IsConfirmed(hashShallow, 10, fPending));
+    BOOST_CHECK(!fPending);
+    BOOST_CHECK(confirmations.IsConfirmed(hashShallow, 5, fPending));
+    BOOST_CHECK(!confirmations.IsConfirmed(hashUnknown, 0, fPending));
+    BOOST_CHECK(!fPending);
+    BOOST_CHECK_EQUAL(confirmations.GetPendingLookups(), 4U);
+
+    // Fresh entries aren't asked for again; stale ones are
+    BOOST_CHECK(confirmations.Refresh(1030));
+    BOOST_CHECK_EQUAL(backend.nCalls, 1);
+    backend.mapConfirmations[hashShallow] = 12;
+    BOOST_CHECK(confirmations.Refresh(1060));
+    BOOST_CHECK_EQUAL(backend.nCalls, 2);
+    BOOST_CHECK_EQUAL(nResolved, 1);
+    BOOST_CHECK(confirmations.IsConfirmed(hashShallow, 10, fPending));
+}
+
+BOOST_AUTO_TEST_CASE(parentchain_backend_down)
+{
+    CMockParentChain backend;
+    CParentChainConfirmations confirmations(&backend, 60);
+    uint256 hash = 1;
+    backend.mapConfirmations[hash] = 20;
+    backend.fDown = true;
+
+    // A failing backend leaves lookups pending instead of failing them
+    bool fPending = false;
+    BOOST_CHECK(!confirmations.IsConfirmed(hash, 10, fPending));
+    BOOST_CHECK(!confirmations.Refresh(1000));
+    BOOST_CHECK(!confirmations.IsConfirmed(hash, 10, fPending));
+    BOOST_CHECK(fPending);
+
+    backend.fDown = false;
+    BOOST_CHECK(confirmations.Refresh(1001));
+    BOOST_CHECK(confirmations.IsConfirmed(hash, 10, fPending));
+    BOOST_CHECK(!fPending);
+}
+
+BOOST_AUTO_TEST_CASE(parentchain_batching)
+{
+    CMockParentChain backend;
+    CParentChainConfirmations confirmations(&backend, 60);
+    bool fPending = false;
+    for (unsigned int i = 0; i < MAX_PARENTCHAIN_BATCH * 2 + 1; i++)
+        confirmations.IsConfirmed(uint256(i + 1), 1, fPending);
+    BOOST_CHECK(confirmations.Refresh(1000));
+    BOOST_CHECK_EQUAL(backend.nCalls, 3);
+    BOOST_CHECK_EQUAL(backend.nMaxBatch, MAX_PARENTCHAIN_BATCH);
+    BOOST_CHECK_EQUAL(confirmations.GetPendingCount(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(parentchain_cache_eviction)
+{
+    CMockParentChain backend;
+    CParentChainConfirmations confirmations(&backend, 60);
+    bool fPending = false;
+    for (unsigned int i = 0; i < MAX_PARENTCHAIN_CACHE; i++) {
+        backend.mapConfirmations[uint256(i + 1)] = 10;
+        confirmations.IsConfirmed(uint256(i + 1), 1, fPending);
+        if (i + 1 == MAX_PARENTCHAIN_BATCH)
+            BOOST_CHECK(confirmations.Refresh(1000));
+    }
+    BOOST_CHECK(confirmations.Refresh(1030));
+
+    // Only the entries that became stale are refreshed
+    backend.nMaxBatch = 0;
+    BOOST_CHECK(confirmations.Refresh(1060));
+    BOOST_CHECK_EQUAL(backend.nMaxBatch, MAX_PARENTCHAIN_BATCH);
+
+    // A new entry pushes out the least recently refreshed one
+    BOOST_CHECK(!confirmations.IsConfirmed(uint256(MAX_PARENTCHAIN_CACHE + 1), 0, fPending));
+    backend.nMaxBatch = 0;
+    BOOST_CHECK(confirmations.Refresh(1060));
+    BOOST_CHECK_EQUAL(backend.nMaxBatch, 1U);
+    BOOST_CHECK(confirmations.IsConfirmed(uint256(1), 1, fPending));
+    BOOST_CHECK(!confirmations.IsConfirmed(uint256(MAX_PARENTCHAIN_BATCH + 1), 1, fPending));
+    BOOST_CHECK(fPending);
+    BOOST_CHECK(confirmations.IsConfirmed(uint256(MAX_PARENTCHAIN_BATCH + 2), 1, fPending));
+    BOOST_CHECK(!fPending);
+}
+
+BOOST_AUTO_TEST_CASE(parentchain_rpc_backend)
+{
+    map<uint256, int> mapConfirmations;
+    uint256 hashDeep = 1, hashShallow = 2, hashUnknown = 3;
+    mapConfirmations[hashDeep] = 20;
+    mapConfirmations[hashShallow] = 5;
+
+    boost::asio::io_service io_service;
+    boost::asio::ip::tcp::acceptor acceptor(io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    boost::thread server(boost::bind(&ServeGetBlock, &io_service, &acceptor, &mapConfirmations));
+    mapArgs["-rpcuser"] = "user";
+    mapArgs["-rpcpassword"] = "password";
+    CParentChainRPCBackend backend(itostr(acceptor.local_endpoint().port()));
+
+    // Replies are matched up with their requests by id
+    vector<uint256> vHash;
+    vHash.push_back(hashShallow);
+    vHash.push_back(hashUnknown);
+    vHash.push_back(hashDeep);
+    vector<int> vConfirmations;
+    backend.GetConfirmations(vHash, vConfirmations);
+    server.join();
+    BOOST_CHECK_EQUAL(vConfirmations.size(), 3U);
+    BOOST_CHECK_EQUAL(vConfirmations[0], 5);
+    BOOST_CHECK_EQUAL(vConfirmations[1], -1);
+    BOOST_CHECK_EQUAL(vConfirmations[2], 20);
+
+    // An unreachable server throws
+    acceptor.close();
+    BOOST_CHECK_THROW(backend.GetConfirmations(vHash, vConfirmations), std::exception);
+    mapArgs.erase("-rpcuser");
+    mapArgs.erase("-rpcpassword");
+}
+
+/** Make a parent chain header on top of hashPrev with enough work for nBits */
+static CBlockHeader MineHeader(const uint256& hashPrev, uint32_t nTime, uint32_t nBits = 0x207fffff)
+{
+    CBlockHeader header;
+    header.nVersion = 2;
+    header.hashPrevBlock = hashPrev;
+    header.nTime = nTime;
+    header.bitcoinproof = CBitcoinProof(nBits, 0);
+    uint256 bnTarget;
+    bnTarget.SetCompact(nBits);
+    while (header.GetHash() > bnTarget)
+        header.bitcoinproof.solution++;
+    return header;
+}
+
+/** Parent chain rules like bitcoin's regtest, anchored at hashAnchor */
+static CParentChainParams RegtestParentChain(const uint256& hashAnchor)
+{
+    CParentChainParams params;
+    params.hashAnchor = hashAnchor;
+    params.nAnchorHeight = 0;
+    params.bnProofOfWorkLimit = ~uint256(0) >> 1;
+    params.nTargetTimespan = 14 * 24 * 60 * 60;
+    params.nTargetSpacing = 10 * 60;
+    params.fAllowMinDifficultyBlocks = true;
+    params.fNoRetargeting = true;
+    return params;
+}
+
+BOOST_AUTO_TEST_CASE(parentchain_header_store)
+{
+    boost::filesystem::path path = GetDataDir() / "parentheaders_test.dat";
+    boost::filesystem::remove(path);
+
+    vector<CBlockHeader> vHeaders;
+    vHeaders.push_back(MineHeader(12345, 1));
+    for (int i = 1; i < 12; i++)
+        vHeaders.push_back(MineHeader(vHeaders.back().GetHash(), i + 1));
+    CParentChainParams params = RegtestParentChain(vHeaders[0].GetHash());
+
+    {
+        // Nothing but the anchor can start the store
+        CParentHeaderStore store(path, params);
+        BOOST_CHECK(store.Load());
+        int nAdded = 0;
+        string strError;
+        vector<CBlockHeader> vNoAnchor(vHeaders.begin() + 1, vHeaders.end());
+        BOOST_CHECK(!store.AddHeaders(vNoAnchor, nAdded, strError));
+        BOOST_CHECK_EQUAL(nAdded, 0);
+
+        BOOST_CHECK(store.AddHeaders(vHeaders, nAdded, strError));
+        BOOST_CHECK_EQUAL(nAdded, 12);
+        BOOST_CHECK_EQUAL(store.Height(), 11);
+        BOOST_CHECK(store.GetBestHash() == vHeaders.back().GetHash());
+        BOOST_CHECK_EQUAL(boost::filesystem::file_size(path), 12 * CParentHeaderStore::RECORD_SIZE);
+
+        // Re-adding is a no-op; a header which doesn't connect is refused
+        BOOST_CHECK(store.AddHeaders(vHeaders, nAdded, strError));
+        BOOST_CHECK_EQUAL(nAdded, 0);
+        vector<CBlockHeader> vOrphan(1, MineHeader(54321, 100));
+        BOOST_CHECK(!store.AddHeaders(vOrphan, nAdded, strError));
+        BOOST_CHECK_EQUAL(nAdded, 0);
+
+        bool fPending = false;
+        BOOST_CHECK_EQUAL(store.GetConfirmations(vHeaders[2].GetHash()), 10);
+        BOOST_CHECK(store.IsConfirmed(vHeaders[2].GetHash(), 10, fPending));
+        BOOST_CHECK(!fPending);
+        BOOST_CHECK(!store.IsConfirmed(vHeaders[3].GetHash(), 10, fPending));
+        BOOST_CHECK(!fPending);
+        BOOST_CHECK(!store.IsConfirmed(vOrphan[0].GetHash(), 1, fPending));
+        BOOST_CHECK(fPending);
+        BOOST_CHECK_EQUAL(store.GetPendingLookups(), 1U);
+
+        // A longer fork from header 5 takes over the best chain
+        vector<CBlockHeader> vFork;
+        vFork.push_back(MineHeader(vHeaders[5].GetHash(), 1000));
+        for (int i = 1; i < 8; i++)
+            vFork.push_back(MineHeader(vFork.back().GetHash(), 1000 + i));
+        BOOST_CHECK(store.AddHeaders(vFork, nAdded, strError));
+        BOOST_CHECK_EQUAL(nAdded, 8);
+        BOOST_CHECK(store.GetBestHash() == vFork.back().GetHash());
+        BOOST_CHECK_EQUAL(store.GetConfirmations(vHeaders[6].GetHash()), 0);
+        BOOST_CHECK_EQUAL(store.GetConfirmations(vHeaders[2].GetHash()), 12);
+    }
+
+    // Everything comes back from the file; a partial trailing record is dropped
+    FILE* file = fopen(path.string().c_str(), "ab");
+    fwrite("partial", 1, 7, file);
+    fclose(file);
+    {
+        CParentHeaderStore store(path, params);
+        BOOST_CHECK(store.Load());
+        BOOST_CHECK_EQUAL(store.Height(), 13);
+        BOOST_CHECK_EQUAL(store.GetConfirmations(vHeaders[2].GetHash()), 12);
+        BOOST_CHECK_EQUAL(store.GetConfirmations(vHeaders[6].GetHash()), 0);
+        BOOST_CHECK_EQUAL(boost::filesystem::file_size(path), 20 * CParentHeaderStore::RECORD_SIZE);
+    }
+
+    // A file that starts anywhere else than the anchor is refused
+    {
+        CParentHeaderStore store(path, RegtestParentChain(vHeaders[1].GetHash()));
+        BOOST_CHECK(!store.Load());
+    }
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(parentchain_header_difficulty)
+{
+    boost::filesystem::path path = GetDataDir() / "parentheaders_test.dat";
+    boost::filesystem::remove(path);
+
+    // Retargeting every 4 headers of a second, with a target harder than the limit
+    const uint32_t nBits = 0x2000ffff;
+    CBlockHeader anchor = MineHeader(12345, 10000, nBits);
+    CParentChainParams params = RegtestParentChain(anchor.GetHash());
+    params.nAnchorHeight = 8;
+    params.nTargetTimespan = 4;
+    params.nTargetSpacing = 1;
+    params.fAllowMinDifficultyBlocks = false;
+    params.fNoRetargeting = false;
+    uint32_t nLimitBits = params.bnProofOfWorkLimit.GetCompact();
+
+    CParentHeaderStore store(path, params);
+    BOOST_CHECK(store.Load());
+    int nAdded = 0;
+    string strError;
+    vector<CBlockHeader> vHeaders(1, anchor);
+    vHeaders.push_back(MineHeader(vHeaders.back().GetHash(), 10001, nBits));
+    vHeaders.push_back(MineHeader(vHeaders.back().GetHash(), 10002, nBits));
+    vHeaders.push_back(MineHeader(vHeaders.back().GetHash(), 10004, nBits));
+    BOOST_CHECK(store.AddHeaders(vHeaders, nAdded, strError));
+    BOOST_CHECK_EQUAL(nAdded, 4);
+    BOOST_CHECK_EQUAL(store.Height(), 11);
+
+    // An extension with the easiest target doesn't carry the required work
+    uint32_t nTimeNext = vHeaders.back().nTime + params.nTargetSpacing;
+    vector<CBlockHeader> vEasy(1, MineHeader(vHeaders.back().GetHash(), nTimeNext, nLimitBits));
+    BOOST_CHECK(!store.AddHeaders(vEasy, nAdded, strError));
+    BOOST_CHECK_EQUAL(nAdded, 0);
+
+    // Neither does one that is late, unless the parent chain allows that
+    vEasy[0] = MineHeader(vHeaders.back().GetHash(), nTimeNext + 100 * params.nTargetSpacing, nLimitBits);
+    BOOST_CHECK(!store.AddHeaders(vEasy, nAdded, strError));
+    {
+        boost::filesystem::path pathMinDifficulty = GetDataDir() / "parentheaders_test_mindifficulty.dat";
+        boost::filesystem::remove(pathMinDifficulty);
+        CParentChainParams paramsMinDifficulty = params;
+        paramsMinDifficulty.fAllowMinDifficultyBlocks = true;
+        CParentHeaderStore storeMinDifficulty(pathMinDifficulty, paramsMinDifficulty);
+        vector<CBlockHeader> vLate(vHeaders.begin(), vHeaders.begin() + 3);
+        vLate.push_back(MineHeader(vHeaders[2].GetHash(), vHeaders[2].nTime + 3 * params.nTargetSpacing, nLimitBits));
+        BOOST_CHECK(storeMinDifficulty.AddHeaders(vLate, nAdded, strError));
+        BOOST_CHECK_EQUAL(nAdded, 4);
+        boost::filesystem::remove(pathMinDifficulty);
+    }
+
+    // The interval took as long as intended, so the target stays
+    vector<CBlockHeader> vNext(1, MineHeader(vHeaders.back().GetHash(), nTimeNext, nBits));
+    for (int i = 1; i < 4; i++)
+        vNext.push_back(MineHeader(vNext.back().GetHash(), nTimeNext, nBits));
+    BOOST_CHECK(store.AddHeaders(vNext, nAdded, strError));
+    BOOST_CHECK_EQUAL(nAdded, 4);
+
+    // That one was over at once: the next target is four times harder
+    uint256 bnHarder;
+    bnHarder.SetCompact(nBits);
+    bnHarder /= 4;
+    uint32_t nTimeLast = nTimeNext + 1;
+    vector<CBlockHeader> vSame(1, MineHeader(vNext.back().GetHash(), nTimeLast, nBits));
+    BOOST_CHECK(!store.AddHeaders(vSame, nAdded, strError));
+    vector<CBlockHeader> vHarder(1, MineHeader(vNext.back().GetHash(), nTimeLast, bnHarder.GetCompact()));
+    BOOST_CHECK(store.AddHeaders(vHarder, nAdded, strError));
+    BOOST_CHECK_EQUAL(nAdded, 1);
+    BOOST_CHECK_EQUAL(store.Height(), 16);
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
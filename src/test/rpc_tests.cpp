@@ -7,9 +7,12 @@
 
 #include "base58.h"
 #include "netbase.h"
+#include "validationstats.h"
 
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 using namespace std;
 using namespace json_spirit;
@@ -162,4 +165,68 @@ BOOST_AUTO_TEST_CASE(rpc_boostasiotocnetaddr)
     BOOST_CHECK_EQUAL(BoostAsioToCNetAddr(boost::asio::ip::address::from_string("::ffff:127.0.0.1")).ToString(), "127.0.0.1");
 }
 
+BOOST_AUTO_TEST_CASE(rpc_validationstats)
+{
+    ResetValidationStats();
+    for (int i = 0; i < 99; i++)
+        RecordValidationTime(VALIDATION_SCRIPT, 10);
+    RecordValidationTime(VALIDATION_SCRIPT, 1000);
+    // A batch counts as that many checks of the average duration
+    RecordValidationTime(VALIDATION_CHECK_PROOF, 300, 3);
+    RecordMempoolStage(MEMPOOL_RECEIVED);
+    RecordMempoolStage(MEMPOOL_RECEIVED);
+    RecordMempoolStage(MEMPOOL_CHECKED);
+
+    Value result;
+    BOOST_CHECK_NO_THROW(result = CallRPC("getvalidationstats true"));
+    Object phases = find_value(result.get_obj(), "phases").get_obj();
+    Object script = find_value(phases, "script").get_obj();
+    BOOST_CHECK_EQUAL(find_value(script, "count").get_int64(), 100);
+    BOOST_CHECK_EQUAL(find_value(script, "total_us").get_int64(), 1990);
+    BOOST_CHECK_EQUAL(find_value(script, "p50_us").get_int64(), 11); // 10 falls in the 10-11 bucket
+    BOOST_CHECK_EQUAL(find_value(script, "p99_us").get_int64(), 1000);
+    BOOST_CHECK_EQUAL(find_value(script, "max_us").get_int64(), 1000);
+    Object checkproof = find_value(phases, "checkproof").get_obj();
+    BOOST_CHECK_EQUAL(find_value(checkproof, "count").get_int64(), 3);
+    BOOST_CHECK_EQUAL(find_value(checkproof, "max_us").get_int64(), 100);
+    Object mempool = find_value(result.get_obj(), "mempool").get_obj();
+    BOOST_CHECK_EQUAL(find_value(mempool, "received").get_int64(), 2);
+    BOOST_CHECK_EQUAL(find_value(mempool, "checked").get_int64(), 1);
+    BOOST_CHECK_EQUAL(find_value(mempool, "accepted").get_int64(), 0);
+
+    // The reset took effect after returning the statistics
+    BOOST_CHECK_NO_THROW(result = CallRPC("getvalidationstats"));
+    script = find_value(find_value(result.get_obj(), "phases").get_obj(), "script").get_obj();
+    BOOST_CHECK_EQUAL(find_value(script, "count").get_int64(), 0);
+    BOOST_CHECK_EQUAL(find_value(script, "p99_us").get_int64(), 0);
+    BOOST_CHECK_THROW(CallRPC("getvalidationstats true true"), runtime_error);
+}
+
+static void RecordScriptTimes(int nTimes)
+{
+    for (int i = 0; i < nTimes; i++)
+        RecordValidationTime(VALIDATION_SCRIPT, 10);
+}
+
+BOOST_AUTO_TEST_CASE(validationstats_threads)
+{
+    ResetValidationStats();
+    RecordScriptTimes(5);
+
+    // Samples of threads that have exited are kept
+    boost::thread_group threads;
+    for (int i = 0; i < 4; i++)
+        threads.create_thread(boost::bind(RecordScriptTimes, 1000));
+    threads.join_all();
+
+    CValidationStats stats = GetAndResetValidationStats();
+    BOOST_CHECK_EQUAL(stats.phases[VALIDATION_SCRIPT].nCount, 4005U);
+    BOOST_CHECK_EQUAL(stats.phases[VALIDATION_SCRIPT].nTotal, 40050);
+    BOOST_CHECK_EQUAL(GetValidationStats().phases[VALIDATION_SCRIPT].nCount, 0U);
+
+    RecordScriptTimes(1);
+    BOOST_CHECK_EQUAL(GetValidationStats().phases[VALIDATION_SCRIPT].nCount, 1U);
+    ResetValidationStats();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
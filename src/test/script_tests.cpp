@@ -11,6 +11,7 @@
 #include "main.h"
 #include "script/script.h"
 #include "script/script_error.h"
+#include "script/sigcache.h"
 #include "script/sign.h"
 #include "util.h"
 
@@ -660,6 +661,63 @@ BOOST_AUTO_TEST_CASE(script_CHECKMULTISIG23)
     BOOST_CHECK_MESSAGE(err == SCRIPT_ERR_INVALID_STACK_OPERATION, ScriptErrorString(err));
 }    
 
+BOOST_AUTO_TEST_CASE(script_CHECKMULTISIG23_batched)
+{
+    ScriptError err;
+    CKey key1, key2, key3;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(true);
+    key3.MakeNewKey(true);
+
+    // Only CHECKMULTISIGVERIFY needs its signatures to be valid
+    CScript scriptPubKey23;
+    scriptPubKey23 << OP_2 << ToByteVector(key1.GetPubKey()) << ToByteVector(key2.GetPubKey()) << ToByteVector(key3.GetPubKey()) << OP_3 << OP_CHECKMULTISIGVERIFY << OP_TRUE;
+
+    CMutableTransaction txFrom23 = BuildCreditingTransaction(scriptPubKey23);
+    CTransaction txTo23(BuildSpendingTransaction(CScript(), txFrom23));
+
+    // Signed by the first two keys: the keys are tried from the last one
+    // down, so the third is tried and skipped right away, and only the two
+    // signatures the script then needs are batched
+    std::vector<CKey> keys;
+    keys.push_back(key1); keys.push_back(key2);
+    CScript goodsig = sign_multisig(scriptPubKey23, keys, txTo23);
+    CSignatureBatch batch;
+    BOOST_CHECK(VerifyScript(goodsig, scriptPubKey23, flags, BatchingTransactionSignatureChecker(&txTo23, 0, 0, -1, -1, 0, batch), &err));
+    BOOST_CHECK_MESSAGE(err == SCRIPT_ERR_OK, ScriptErrorString(err));
+    BOOST_CHECK_EQUAL(batch.size(), 2U);
+    BOOST_CHECK(batch.Verify());
+
+    // Signed by the last two keys: either signature may still fail and
+    // leave another key to try, so both are verified right away
+    keys.clear();
+    keys.push_back(key2); keys.push_back(key3);
+    batch.clear();
+    BOOST_CHECK(VerifyScript(sign_multisig(scriptPubKey23, keys, txTo23), scriptPubKey23, flags, BatchingTransactionSignatureChecker(&txTo23, 0, 0, -1, -1, 0, batch), &err));
+    BOOST_CHECK_EQUAL(batch.size(), 0U);
+
+    // A CHECKMULTISIG result may be used either way, so none of its
+    // signatures are batched
+    CScript scriptPubKey23NoVerify;
+    scriptPubKey23NoVerify << OP_2 << ToByteVector(key1.GetPubKey()) << ToByteVector(key2.GetPubKey()) << ToByteVector(key3.GetPubKey()) << OP_3 << OP_CHECKMULTISIG;
+    CMutableTransaction txFromNoVerify = BuildCreditingTransaction(scriptPubKey23NoVerify);
+    CTransaction txToNoVerify(BuildSpendingTransaction(CScript(), txFromNoVerify));
+    keys.clear();
+    keys.push_back(key1); keys.push_back(key2);
+    batch.clear();
+    BOOST_CHECK(VerifyScript(sign_multisig(scriptPubKey23NoVerify, keys, txToNoVerify), scriptPubKey23NoVerify, flags, BatchingTransactionSignatureChecker(&txToNoVerify, 0, 0, -1, -1, 0, batch), &err));
+    BOOST_CHECK_EQUAL(batch.size(), 0U);
+
+    // A bad required signature passes the script but fails the batch
+    keys.clear();
+    keys.push_back(key2); keys.push_back(key1);
+    CScript badsig = sign_multisig(scriptPubKey23, keys, txTo23);
+    batch.clear();
+    BOOST_CHECK(VerifyScript(badsig, scriptPubKey23, flags, BatchingTransactionSignatureChecker(&txTo23, 0, 0, -1, -1, 0, batch), &err));
+    BOOST_CHECK(!batch.Verify());
+    BOOST_CHECK(!VerifyScript(badsig, scriptPubKey23, flags, CachingTransactionSignatureChecker(&txTo23, 0, 0, -1, -1, 0, false), &err));
+}
+
 BOOST_AUTO_TEST_CASE(script_combineSigs)
 {
     // Test the CombineSignatures function
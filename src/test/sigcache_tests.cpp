@@ -0,0 +1,151 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "key.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "uint256.h"
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_AUTO_TEST_SUITE(sigcache_tests)
+
+BOOST_AUTO_TEST_CASE(sigcache_get_set)
+{
+    CSignatureCache cache;
+    cache.Setup(1000 * CSignatureCache::ENTRY_SIZE);
+    BOOST_CHECK_EQUAL(cache.Capacity(), 1000U);
+
+    CKey key;
+    key.MakeNewKey(true);
+    uint256 hash = GetRandHash();
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(hash, vchSig));
+
+    uint256 entry;
+    cache.ComputeEntry(entry, hash, vchSig, key.GetPubKey());
+    BOOST_CHECK(!cache.Get(entry, false));
+    cache.Set(entry);
+    BOOST_CHECK(cache.Get(entry, false));
+    BOOST_CHECK(cache.Get(entry, false));
+
+    // Any other signature, hash or key misses
+    uint256 entryOther;
+    std::vector<unsigned char> vchSigOther(vchSig);
+    vchSigOther.push_back(0);
+    cache.ComputeEntry(entryOther, hash, vchSigOther, key.GetPubKey());
+    BOOST_CHECK(!cache.Get(entryOther, false));
+    cache.ComputeEntry(entryOther, GetRandHash(), vchSig, key.GetPubKey());
+    BOOST_CHECK(!cache.Get(entryOther, false));
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    cache.ComputeEntry(entryOther, hash, vchSig, keyOther.GetPubKey());
+    BOOST_CHECK(!cache.Get(entryOther, false));
+
+    // Each cache salts its entries differently
+    CSignatureCache cacheOther;
+    cacheOther.ComputeEntry(entryOther, hash, vchSig, key.GetPubKey());
+    BOOST_CHECK(entryOther != entry);
+
+    // Without a table nothing is cached
+    CSignatureCache cacheEmpty;
+    cacheEmpty.Set(entry);
+    BOOST_CHECK(!cacheEmpty.Get(entry, false));
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_erase_on_hit)
+{
+    // A single slot, which every entry maps to
+    CSignatureCache cache;
+    cache.Setup(CSignatureCache::ENTRY_SIZE);
+    uint256 entry1 = GetRandHash(), entry2 = GetRandHash();
+
+    // An entry hit with fErase stays until something else needs its slot
+    cache.Set(entry1);
+    BOOST_CHECK(cache.Get(entry1, true));
+    BOOST_CHECK(cache.Get(entry1, false));
+    cache.Set(entry2);
+    BOOST_CHECK(cache.Get(entry2, false));
+    BOOST_CHECK(!cache.Get(entry1, false));
+
+    // Setting an entry again makes it a regular one
+    cache.Set(entry1);
+    BOOST_CHECK(cache.Get(entry1, true));
+    cache.Set(entry1);
+    cache.Set(entry2);
+    BOOST_CHECK(cache.Get(entry1, false) != cache.Get(entry2, false));
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_eviction)
+{
+    CSignatureCache cache;
+    cache.Setup(1000 * CSignatureCache::ENTRY_SIZE);
+    std::vector<uint256> vEntries;
+    for (int i = 0; i < 4000; i++) {
+        vEntries.push_back(GetRandHash());
+        cache.Set(vEntries.back());
+    }
+
+    // The table fills up, and never holds more than its capacity
+    unsigned int nHits = 0;
+    for (unsigned int i = 0; i < vEntries.size(); i++)
+        nHits += cache.Get(vEntries[i], false);
+    BOOST_CHECK(nHits <= 1000);
+    BOOST_CHECK(nHits >= 990);
+
+    // Entries seen in a block go first: once all cached entries are
+    // erasable, new ones no longer push each other out
+    for (unsigned int i = 0; i < vEntries.size(); i++)
+        cache.Get(vEntries[i], true);
+    std::vector<uint256> vNew;
+    for (int i = 0; i < 500; i++) {
+        vNew.push_back(GetRandHash());
+        cache.Set(vNew.back());
+    }
+    for (unsigned int i = 0; i < vNew.size(); i++)
+        BOOST_CHECK(cache.Get(vNew[i], false));
+}
+
+static void LookupEntries(CSignatureCache* cache, const std::vector<uint256>* vEntries, const std::vector<uint256>* vMissing, unsigned int* nFalseHits)
+{
+    for (int nRound = 0; nRound < 20; nRound++) {
+        for (unsigned int i = 0; i < vEntries->size(); i++)
+            cache->Get((*vEntries)[i], false);
+        for (unsigned int i = 0; i < vMissing->size(); i++)
+            *nFalseHits += cache->Get((*vMissing)[i], false);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_concurrent)
+{
+    // Lookups run without a lock while entries are set and moved around
+    CSignatureCache cache;
+    cache.Setup(1000 * CSignatureCache::ENTRY_SIZE);
+    std::vector<uint256> vEntries, vMissing;
+    for (int i = 0; i < 2000; i++) {
+        vEntries.push_back(GetRandHash());
+        vMissing.push_back(GetRandHash());
+    }
+
+    std::vector<unsigned int> vFalseHits(4, 0);
+    boost::thread_group threads;
+    for (unsigned int i = 0; i < vFalseHits.size(); i++)
+        threads.create_thread(boost::bind(LookupEntries, &cache, &vEntries, &vMissing, &vFalseHits[i]));
+    for (unsigned int i = 0; i < vEntries.size(); i++)
+        cache.Set(vEntries[i]);
+    threads.join_all();
+
+    for (unsigned int i = 0; i < vFalseHits.size(); i++)
+        BOOST_CHECK_EQUAL(vFalseHits[i], 0U);
+    unsigned int nHits = 0;
+    for (unsigned int i = 0; i < vEntries.size(); i++)
+        nHits += cache.Get(vEntries[i], false);
+    BOOST_CHECK(nHits >= 990);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
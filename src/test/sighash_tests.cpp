@@ -3,6 +3,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "data/sighash.json.h"
+#include "blind.h"
+#include "key.h"
 #include "main.h"
 #include "random.h"
 #include "serialize.h"
@@ -127,4 +129,43 @@ BOOST_AUTO_TEST_CASE(sighash_from_data)
 }
 #endif // 0
 
+BOOST_AUTO_TEST_CASE(sighash_precomputed)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CMutableTransaction mtx;
+    mtx.vin.resize(4);
+    for (unsigned int i = 0; i < mtx.vin.size(); i++) {
+        mtx.vin[i].prevout = COutPoint(i + 1, i);
+        mtx.vin[i].scriptSig << OP_1;
+        mtx.vin[i].nSequence = i;
+    }
+    mtx.vout.resize(3);
+    for (unsigned int i = 0; i < mtx.vout.size(); i++) {
+        mtx.vout[i].nValue = (i + 1) * COIN;
+        mtx.vout[i].scriptPubKey << OP_TRUE;
+    }
+    // Blind two of the outputs, so that they carry rangeproofs
+    std::vector<uint256> vInputBlinds(mtx.vin.size()), vOutputBlinds(mtx.vout.size());
+    std::vector<CPubKey> vOutputPubKeys(mtx.vout.size());
+    vOutputPubKeys[0] = vOutputPubKeys[2] = key.GetPubKey();
+    BlindOutputs(vInputBlinds, vOutputBlinds, vOutputPubKeys, mtx);
+    BOOST_CHECK(!mtx.vout[0].nValue.IsAmount());
+    BOOST_CHECK(mtx.vout[1].nValue.IsAmount());
+
+    CTransaction tx(mtx);
+    PrecomputedTransactionData txdata(tx);
+    CScript scriptCode = CScript() << OP_DUP << OP_CODESEPARATOR << OP_CHECKSIG;
+    const int vHashTypes[] = {SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE};
+    for (unsigned int t = 0; t < 3; t++) {
+        for (int nAnyoneCanPay = 0; nAnyoneCanPay <= SIGHASH_ANYONECANPAY; nAnyoneCanPay += SIGHASH_ANYONECANPAY) {
+            int nHashType = vHashTypes[t] | nAnyoneCanPay;
+            for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++) {
+                CTxOutValue nValue(nIn * COIN);
+                BOOST_CHECK(SignatureHash(scriptCode, nValue, tx, nIn, nHashType, &txdata) == SignatureHash(scriptCode, nValue, tx, nIn, nHashType));
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
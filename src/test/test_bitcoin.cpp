@@ -5,6 +5,7 @@
 #define BOOST_TEST_MODULE Bitcoin Test Suite
 
 #include "blind.h"
+#include "crypto/sha256.h"
 #include "key.h"
 #include "main.h"
 #include "pubkey.h"
@@ -35,11 +36,13 @@ struct TestingSetup {
     TestingSetup() {
         ECC_Verify_Start();
         ECC_Blinding_Start();
+        SHA256AutoDetect();
         ECC_Start();
         SetupEnvironment();
         fPrintToDebugLog = false; // don't want to write to debug.log file
         fCheckBlockIndex = true;
         SelectParams(CBaseChainParams::UNITTEST);
+        InitSignatureCache();
         noui_connect();
 #ifdef ENABLE_WALLET
         bitdb.MakeMock();
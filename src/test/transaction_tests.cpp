@@ -5,6 +5,7 @@
 #include "data/tx_invalid.json.h"
 #include "data/tx_valid.json.h"
 
+#include "blind.h"
 #include "clientversion.h"
 #include "key.h"
 #include "keystore.h"
@@ -18,6 +19,7 @@
 
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
+#include <boost/filesystem/operations.hpp>
 #include <boost/test/unit_test.hpp>
 #include <boost/assign/list_of.hpp>
 #include "json/json_spirit_writer_template.h"
@@ -366,4 +368,172 @@ BOOST_AUTO_TEST_CASE(test_IsStandard)
     BOOST_CHECK(!IsStandardTx(t, reason));
 }
 
+BOOST_AUTO_TEST_CASE(test_witness_stripped_serialization)
+{
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << OP_0 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50*CENT;
+    coinbase.vout[0].scriptPubKey << OP_TRUE;
+
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbase.GetHash(), 0);
+    spend.vin[0].scriptSig << std::vector<unsigned char>(65, 1);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 49*CENT;
+    spend.vout[0].scriptPubKey << OP_TRUE;
+    spend.nTxFee = CENT;
+
+    CBlock block;
+    block.vtx.push_back(CTransaction(coinbase));
+    block.vtx.push_back(CTransaction(spend));
+    uint256 hashMerkleRoot = block.BuildMerkleTree();
+
+    CDataStream ssFull(SER_DISK, CLIENT_VERSION);
+    ssFull << block;
+    CDataStream ssStripped(SER_DISK, CLIENT_VERSION | SERIALIZE_VERSION_MASK_NO_WITNESS);
+    ssStripped << block;
+    BOOST_CHECK(ssStripped.size() < ssFull.size());
+
+    CBlock stripped;
+    ssStripped >> stripped;
+    BOOST_CHECK(ssStripped.empty());
+    BOOST_REQUIRE_EQUAL(stripped.vtx.size(), 2U);
+    for (unsigned int i = 0; i < 2; i++) {
+        BOOST_CHECK(stripped.vtx[i].GetHash() == block.vtx[i].GetHash());
+        BOOST_CHECK(stripped.vtx[i].GetWitnessHash() == block.vtx[i].GetWitnessHash());
+        BOOST_CHECK(stripped.vtx[i].GetFullHash() == block.vtx[i].GetFullHash());
+    }
+    BOOST_CHECK(stripped.BuildMerkleTree() == hashMerkleRoot);
+
+    // The coinbase keeps its witness, other transactions lose it
+    BOOST_CHECK(stripped.vtx[0].vin[0].scriptSig == coinbase.vin[0].scriptSig);
+    BOOST_CHECK(stripped.vtx[1].vin[0].scriptSig.empty());
+    BOOST_CHECK(stripped.vtx[1].vout[0].nValue.IsAmount());
+    BOOST_CHECK_EQUAL(stripped.vtx[1].vout[0].nValue.GetAmount(), 49*CENT);
+
+    // Stripping a stripped block again is lossless
+    CDataStream ssRestripped(SER_DISK, CLIENT_VERSION | SERIALIZE_VERSION_MASK_NO_WITNESS);
+    ssRestripped << stripped;
+    ssStripped << block;
+    BOOST_CHECK(ssRestripped.str() == ssStripped.str());
+}
+
+static void CheckSinglePassHash(const CTransaction& tx)
+{
+    BOOST_CHECK(tx.GetHash() == SerializeHash(tx, SER_GETHASH, PROTOCOL_VERSION | (tx.IsCoinBase() ? 0 : SERIALIZE_VERSION_MASK_NO_WITNESS)));
+    BOOST_CHECK(tx.GetWitnessHash() == SerializeHash(tx, SER_GETHASH, PROTOCOL_VERSION | SERIALIZE_VERSION_MASK_ONLY_WITNESS));
+    bool fBitcoinTx = true;
+    BOOST_FOREACH(const CTxOut& txout, tx.vout)
+        fBitcoinTx &= txout.nValue.IsAmount();
+    if (fBitcoinTx)
+        BOOST_CHECK(tx.GetBitcoinHash() == SerializeHash(tx, SER_GETHASH, PROTOCOL_VERSION | SERIALIZE_VERSION_MASK_BITCOIN_TX));
+}
+
+BOOST_AUTO_TEST_CASE(test_single_pass_hash)
+{
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << OP_0 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50*CENT;
+    coinbase.vout[0].scriptPubKey << OP_TRUE;
+    CheckSinglePassHash(coinbase);
+    // Inputs spanning more than one SHA256 block before the digests part ways
+    coinbase.vin[0].scriptSig << std::vector<unsigned char>(100, 2);
+    CheckSinglePassHash(coinbase);
+
+    CMutableTransaction spend;
+    spend.vin.resize(2);
+    spend.vin[0].prevout = COutPoint(coinbase.GetHash(), 0);
+    spend.vin[0].scriptSig << std::vector<unsigned char>(65, 1);
+    spend.vin[1].prevout = COutPoint(coinbase.GetHash(), 1);
+    spend.vout.resize(2);
+    spend.vout[0].nValue = 30*CENT;
+    spend.vout[0].scriptPubKey << OP_TRUE;
+    spend.vout[1].nValue = 19*CENT;
+    spend.nTxFee = CENT;
+    CheckSinglePassHash(spend);
+
+    // Confidential outputs, with rangeproofs in the witness
+    CKey key;
+    key.MakeNewKey(true);
+    std::vector<uint256> vInputBlinds(2), vOutputBlinds(2);
+    std::vector<CPubKey> vOutputPubKeys(2, key.GetPubKey());
+    BlindOutputs(vInputBlinds, vOutputBlinds, vOutputPubKeys, spend);
+    BOOST_CHECK(!spend.vout[0].nValue.IsAmount());
+    CheckSinglePassHash(spend);
+}
+
+BOOST_AUTO_TEST_CASE(test_block_witness)
+{
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << OP_0 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50*CENT;
+
+    CMutableTransaction spend;
+    spend.vin.resize(2);
+    spend.vin[0].prevout = COutPoint(coinbase.GetHash(), 0);
+    spend.vin[0].scriptSig << std::vector<unsigned char>(65, 1);
+    spend.vin[1].prevout = COutPoint(coinbase.GetHash(), 1);
+    spend.vin[1].scriptSig << std::vector<unsigned char>(33, 2);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 50*CENT;
+    spend.vout[0].nValue.vchRangeproof = std::vector<unsigned char>(100, 3);
+
+    CBlock block;
+    block.vtx.push_back(CTransaction(coinbase));
+    block.vtx.push_back(CTransaction(spend));
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION | SERIALIZE_VERSION_MASK_NO_WITNESS);
+    ss << block;
+    CBlock stripped;
+    ss >> stripped;
+
+    CBlockWitness blockwitness(block);
+    BOOST_CHECK_EQUAL(blockwitness.vtxwit.size(), 1U);
+    CDataStream ssWitness(SER_DISK, CLIENT_VERSION);
+    ssWitness << blockwitness;
+    CBlockWitness blockwitnessRead;
+    ssWitness >> blockwitnessRead;
+
+    CBlock restored = stripped;
+    BOOST_CHECK(blockwitnessRead.ApplyTo(restored));
+    CDataStream ssFull(SER_DISK, CLIENT_VERSION), ssRestored(SER_DISK, CLIENT_VERSION);
+    ssFull << block;
+    ssRestored << restored;
+    BOOST_CHECK(ssFull.str() == ssRestored.str());
+
+    // A witness that doesn't match the transaction's witness hash is rejected.
+    // Each check starts over from the witness as read back.
+    CBlockWitness blockwitnessBad = blockwitnessRead;
+    blockwitnessBad.vtxwit[0].vScriptSig[1] = CScript() << OP_TRUE;
+    restored = stripped;
+    BOOST_CHECK(!blockwitnessBad.ApplyTo(restored));
+    // So is one with a rangeproof missing
+    blockwitnessBad = blockwitnessRead;
+    blockwitnessBad.vtxwit[0].vRangeproof.clear();
+    restored = stripped;
+    BOOST_CHECK(!blockwitnessBad.ApplyTo(restored));
+
+    // The witness hash doesn't cover rangeproofs, so a different one on disk
+    // is caught by the checksum of the witness record instead
+    CDiskBlockPos pos(99, 0);
+    BOOST_CHECK(blockwitness.WriteToDisk(pos, block.GetHash()));
+    BOOST_CHECK(blockwitnessRead.ReadFromDisk(pos, block.GetHash()));
+    ssWitness << blockwitness;
+    size_t nOffset = ssWitness.str().find(std::string(100, 3));
+    BOOST_REQUIRE(nOffset != std::string::npos);
+    FILE* file = OpenWitnessFile(CDiskBlockPos(pos.nFile, pos.nPos + nOffset));
+    BOOST_REQUIRE(file);
+    fputc(4, file);
+    fclose(file);
+    BOOST_CHECK(!blockwitnessRead.ReadFromDisk(pos, block.GetHash()));
+    boost::filesystem::remove(GetBlockPosFilename(pos, "wit"));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,16 +9,111 @@
 #include "uint256.h"
 
 #include <stdint.h>
+#include <string.h>
 
+#include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
 
-void static BatchWriteCoins(CLevelDBBatch &batch, const uint256 &hash, const CCoins &coins) {
-    if (coins.IsPruned())
-        batch.Erase(make_pair('c', hash));
+/**
+ * One unspent output as stored in the coin database (under its outpoint),
+ * along with the metadata of its transaction.
+ */
+class CDiskCoinsOutput
+{
+private:
+    CCoins &coins;
+    unsigned int n;
+
+public:
+    CDiskCoinsOutput(CCoins &coinsIn, unsigned int nIn) : coins(coinsIn), n(nIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        unsigned int nCode = 0;
+        if (!ser_action.ForRead())
+            nCode = (unsigned int)coins.nHeight * 2 + (coins.fCoinBase ? 1 : 0);
+        READWRITE(VARINT(coins.nVersion));
+        READWRITE(VARINT(nCode));
+        if (ser_action.ForRead()) {
+            coins.nHeight = nCode / 2;
+            coins.fCoinBase = nCode & 1;
+            if (coins.vout.size() <= n)
+                coins.vout.resize(n + 1);
+        }
+        READWRITE(REF(CTxOutCompressor(coins.vout[n])));
+    }
+};
+
+/**
+ * Which outputs of a transaction the coin database holds, stored under its
+ * txid so that looking a transaction up takes point reads instead of a seek.
+ * Indexes are stored as gaps from the previous one.
+ */
+class CDiskCoinsIndex
+{
+public:
+    std::vector<unsigned int> vUnspent;
+
+    CDiskCoinsIndex() {}
+
+    explicit CDiskCoinsIndex(const CCoins &coins) {
+        for (unsigned int i = 0; i < coins.vout.size(); i++)
+            if (!coins.vout[i].IsNull())
+                vUnspent.push_back(i);
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        unsigned int nCount = vUnspent.size();
+        READWRITE(VARINT(nCount));
+        if (ser_action.ForRead())
+            vUnspent.resize(nCount);
+        unsigned int nNext = 0;
+        for (unsigned int i = 0; i < nCount; i++) {
+            unsigned int nGap = ser_action.ForRead() ? 0 : vUnspent[i] - nNext;
+            READWRITE(VARINT(nGap));
+            vUnspent[i] = nNext + nGap;
+            nNext = vUnspent[i] + 1;
+        }
+    }
+};
+
+/** Write the index of the outputs of coins that are unspent, or erase it if there are none */
+void static BatchWriteCoinsIndex(CLevelDBBatch &batch, const uint256 &hash, const CCoins &coins) {
+    CDiskCoinsIndex index(coins);
+    if (index.vUnspent.empty())
+        batch.Erase(make_pair('u', hash));
     else
-        batch.Write(make_pair('c', hash), coins);
+        batch.Write(make_pair('u', hash), index);
+}
+
+/** Write the outputs of entry which became unspent, and erase the ones which were spent */
+size_t static BatchWriteCoins(CLevelDBBatch &batch, const uint256 &hash, CCoinsCacheEntry &entry) {
+    const CCoins &coins = entry.coins;
+    const vector<bool> &vUnspentInBase = entry.vUnspentInBase;
+    bool fReplaced = entry.flags & CCoinsCacheEntry::REPLACED;
+    size_t nChanged = 0;
+    for (unsigned int i = 0; i < max(coins.vout.size(), vUnspentInBase.size()); i++) {
+        bool fUnspent = i < coins.vout.size() && !coins.vout[i].IsNull();
+        bool fInBase = i < vUnspentInBase.size() && vUnspentInBase[i];
+        if (fUnspent && (fReplaced || !fInBase)) {
+            batch.Write(make_pair('o', COutPoint(hash, i)), CDiskCoinsOutput(entry.coins, i));
+            nChanged++;
+        } else if (!fUnspent && fInBase) {
+            batch.Erase(make_pair('o', COutPoint(hash, i)));
+            nChanged++;
+        }
+    }
+    if (nChanged > 0)
+        BatchWriteCoinsIndex(batch, hash, coins);
+    return nChanged;
 }
 
 void static BatchWriteWithdraw(CLevelDBBatch &batch, const pair<uint256, COutPoint> &outpoint, const COutPoint& spender) {
@@ -28,19 +123,31 @@ void static BatchWriteWithdraw(CLevelDBBatch &batch, const pair<uint256, COutPoi
         batch.Erase(make_pair('w', outpoint));
 }
 
+// The best block lives under 'H' rather than the 'B' of databases older
+// versions can read: finding no best block, they do not take the set for
+// one they could validate the tip against.
 void static BatchWriteHashBestChain(CLevelDBBatch &batch, const uint256 &hash) {
-    batch.Write('B', hash);
+    batch.Write('H', hash);
 }
 
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe) {
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair('c', txid), coins);
+    CDiskCoinsIndex index;
+    if (!db.Read(make_pair('u', txid), index))
+        return false;
+    coins.Clear();
+    BOOST_FOREACH(unsigned int n, index.vUnspent) {
+        CDiskCoinsOutput output(coins, n);
+        if (!db.Read(make_pair('o', COutPoint(txid, n)), output))
+            throw runtime_error(strprintf("%s : output %s:%u missing from coin database", __func__, txid.ToString(), n));
+    }
+    return true;
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair('c', txid));
+    return db.Exists(make_pair('u', txid));
 }
 
 COutPoint CCoinsViewDB::GetWithdrawSpent(const pair<uint256, COutPoint> &outpoint) const {
@@ -52,22 +159,26 @@ COutPoint CCoinsViewDB::GetWithdrawSpent(const pair<uint256, COutPoint> &outpoin
 
 uint256 CCoinsViewDB::GetBestBlock() const {
     uint256 hashBestChain;
-    if (!db.Read('B', hashBestChain))
+    if (!db.Read('H', hashBestChain))
         return uint256(0);
     return hashBestChain;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+bool CCoinsViewDB::GetCommitment(CCoinsCommitment &commitment) const {
+    return db.Read('C', commitment);
+}
+
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsCommitment *pcommitment) {
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.flags & CCoinsCacheEntry::WITHDRAW)
+            if (it->second.flags & CCoinsCacheEntry::WITHDRAW) {
                 BatchWriteWithdraw(batch, it->first, it->second.withdrawSpent);
-            else
-                BatchWriteCoins(batch, it->first.first, it->second.coins);
-            changed++;
+                changed++;
+            } else
+                changed += BatchWriteCoins(batch, it->first.first, it->second);
         }
         count++;
         CCoinsMap::iterator itOld = it++;
@@ -75,11 +186,91 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     }
     if (hashBlock != uint256(0))
         BatchWriteHashBestChain(batch, hashBlock);
+    if (pcommitment != NULL)
+        batch.Write('C', *pcommitment);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed outputs (of %u transactions) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
+bool CCoinsViewDB::Upgrade() {
+    if (IsLoadingSnapshot())
+        return error("%s : coin database holds a partially loaded UTXO snapshot", __func__);
+
+    int nFormat = 0;
+    db.Read('V', nFormat);
+    if (nFormat >= COINS_DB_FORMAT_TX_INDEX && db.Exists('B'))
+        return error("%s : coin database was written to by an older version, it needs to be rebuilt with -reindex", __func__);
+    if (nFormat < COINS_DB_FORMAT_PER_OUTPUT && !UpgradePerOutput())
+        return false;
+    if (nFormat == COINS_DB_FORMAT_PER_OUTPUT && !UpgradeTxIndex())
+        return false;
+    if (!db.Exists('C') && !InitCommitment())
+        return false;
+    return true;
+}
+
+bool CCoinsViewDB::UpgradePerOutput() {
+    // Split each per-transaction record into one record per unspent output.
+    // Entries written before explicit amounts were compressed are still
+    // readable, and come out compressed. Every batch replaces whole records,
+    // so an interrupted upgrade just continues where it stopped.
+    LogPrintf("Upgrading coin database to one entry per output...\n");
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    pcursor->Seek(std::string(1, 'c'));
+    CLevelDBBatch batch;
+    size_t nRewritten = 0, nPending = 0;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            if (slKey.size() == 0 || slKey[0] != 'c')
+                break;
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            uint256 txhash;
+            ssKey >> chType >> txhash;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CCoins coins;
+            ssValue >> coins;
+            for (unsigned int i = 0; i < coins.vout.size(); i++)
+                if (!coins.vout[i].IsNull())
+                    batch.Write(make_pair('o', COutPoint(txhash, i)), CDiskCoinsOutput(coins, i));
+            BatchWriteCoinsIndex(batch, txhash, coins);
+            batch.Erase(make_pair('c', txhash));
+            nRewritten++;
+            if (++nPending >= 10000) {
+                if (!db.WriteBatch(batch))
+                    return false;
+                batch = CLevelDBBatch();
+                nPending = 0;
+            }
+            pcursor->Next();
+        } catch (std::exception &e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    if (!FinishUpgrade(batch))
+        return false;
+    LogPrintf("Upgraded %u coin database entries\n", (unsigned int)nRewritten);
+    return true;
+}
+
+bool CCoinsViewDB::FinishUpgrade(CLevelDBBatch &batch) {
+    uint256 hashBestChain;
+    if (db.Read('B', hashBestChain)) {
+        BatchWriteHashBestChain(batch, hashBestChain);
+        batch.Erase('B');
+    }
+    batch.Write('V', (int)COINS_DB_FORMAT_TX_INDEX);
+    if (!db.WriteBatch(batch, true))
+        return false;
+    LogPrintf("WARNING: the upgraded coin database cannot be used by older versions. "
+              "Downgrading will rebuild it from the block files, after which this version needs -reindex.\n");
+    return true;
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
 }
 
@@ -88,6 +279,11 @@ bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
     return Write(make_pair('b', blockindex.GetBlockHash()), blockindex);
 }
 
+bool CBlockTreeDB::ReadBlockIndex(const uint256& hash, CDiskBlockIndex& blockindex)
+{
+    return Read(make_pair('b', hash), blockindex);
+}
+
 bool CBlockTreeDB::WriteBlockFileInfo(int nFile, const CBlockFileInfo &info) {
     return Write(make_pair('f', nFile), info);
 }
@@ -116,56 +312,459 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read('l', nFile);
 }
 
+/** Add the unspent outputs of one transaction to stats and the UTXO set hash */
+static void ApplyStats(CCoinsStats &stats, CHashWriter &ss, const uint256 &txhash, const CCoins &coins) {
+    ss << txhash;
+    ss << VARINT(coins.nVersion);
+    ss << (coins.fCoinBase ? 'c' : 'n');
+    ss << VARINT(coins.nHeight);
+    stats.nTransactions++;
+    for (unsigned int i=0; i<coins.vout.size(); i++) {
+        const CTxOut &out = coins.vout[i];
+        if (!out.IsNull()) {
+            stats.nTransactionOutputs++;
+            ss << VARINT(i+1);
+            ss << out;
+        }
+    }
+    // Sized as a record for the whole transaction, as they used to be stored
+    stats.nSerializedSize += 32 + ::GetSerializeSize(coins, SER_DISK, CLIENT_VERSION);
+    ss << VARINT(0);
+}
+
+/**
+ * Add a spent withdraw to the UTXO set hash. These follow all transactions,
+ * and their count ends the hash: withdraw records are of fixed size, so it
+ * tells where the transactions stop.
+ */
+static void ApplyWithdrawStats(CHashWriter &ss, const pair<uint256, COutPoint> &outpoint, const COutPoint &spender) {
+    ss << 'w' << outpoint << spender;
+}
+
+/**
+ * Read the spent withdraw pcursor points at, leaving pcursor past it.
+ * Returns false once all spent withdraws have been read.
+ */
+static bool ReadNextWithdraw(leveldb::Iterator *pcursor, pair<uint256, COutPoint> &outpoint, COutPoint &spender) {
+    if (!pcursor->Valid())
+        return false;
+    leveldb::Slice slKey = pcursor->key();
+    if (slKey.size() == 0 || slKey[0] != 'w')
+        return false;
+    CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+    char chType;
+    ssKey >> chType >> outpoint;
+    leveldb::Slice slValue = pcursor->value();
+    CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+    ssValue >> spender;
+    pcursor->Next();
+    return true;
+}
+
+/**
+ * Read the outputs of the transaction pcursor points at into coins, leaving
+ * pcursor past them. Returns false once all transactions have been read.
+ */
+static bool ReadNextCoins(leveldb::Iterator *pcursor, uint256 &txhash, CCoins &coins) {
+    coins.Clear();
+    bool fFound = false;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        if (slKey.size() == 0 || slKey[0] != 'o')
+            break;
+        CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+        char chType;
+        COutPoint outpoint;
+        ssKey >> chType >> outpoint;
+        if (fFound && outpoint.hash != txhash)
+            break;
+        txhash = outpoint.hash;
+        fFound = true;
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+        CDiskCoinsOutput output(coins, outpoint.n);
+        ssValue >> output;
+    }
+    return fFound;
+}
+
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
     boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+    pcursor->Seek(std::string(1, 'o'));
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
+    // The outputs of a transaction are adjacent; gather them to hash it as a whole
+    uint256 txhash = 0;
+    CCoins coins;
+    try {
+        while (ReadNextCoins(pcursor.get(), txhash, coins)) {
+            boost::this_thread::interruption_point();
+            ApplyStats(stats, ss, txhash, coins);
+        }
+        pcursor->Seek(std::string(1, 'w'));
+        uint64_t nWithdraws = 0;
+        pair<uint256, COutPoint> outpoint;
+        COutPoint spender;
+        while (ReadNextWithdraw(pcursor.get(), outpoint, spender)) {
+            boost::this_thread::interruption_point();
+            ApplyWithdrawStats(ss, outpoint, spender);
+            nWithdraws++;
+        }
+        ss << VARINT(nWithdraws);
+    } catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
+    stats.hashSerialized = ss.GetHash();
+    return true;
+}
+
+/** Compute the commitment to the whole set, for a database written before it was kept */
+bool CCoinsViewDB::InitCommitment() {
+    LogPrintf("Computing UTXO set commitment...\n");
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    pcursor->Seek(std::string(1, 'o'));
+    CCoinsCommitment commitment;
+    uint256 txhash = 0;
+    CCoins coins;
+    try {
+        while (ReadNextCoins(pcursor.get(), txhash, coins)) {
+            boost::this_thread::interruption_point();
+            commitment.AddCoins(txhash, coins);
+        }
+    } catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    if (!db.Write('C', commitment, true))
+        return false;
+    LogPrintf("UTXO set commitment %s over %u transactions\n", commitment.GetHash().ToString(), (unsigned int)commitment.nTransactions);
+    return true;
+}
+
+/** Index the outputs of each transaction, for a database written before the index was kept */
+bool CCoinsViewDB::UpgradeTxIndex() {
+    // Rewriting an index entry is harmless, so an interrupted upgrade simply
+    // starts over.
+    LogPrintf("Upgrading coin database to index outputs by transaction...\n");
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    pcursor->Seek(std::string(1, 'o'));
+    CLevelDBBatch batch;
+    size_t nIndexed = 0, nPending = 0;
+    uint256 txhash = 0;
+    CCoins coins;
+    try {
+        while (ReadNextCoins(pcursor.get(), txhash, coins)) {
+            boost::this_thread::interruption_point();
+            BatchWriteCoinsIndex(batch, txhash, coins);
+            nIndexed++;
+            if (++nPending >= 10000) {
+                if (!db.WriteBatch(batch))
+                    return false;
+                batch = CLevelDBBatch();
+                nPending = 0;
+            }
+        }
+    } catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    if (!FinishUpgrade(batch))
+        return false;
+    LogPrintf("Indexed %u transactions\n", (unsigned int)nIndexed);
+    return true;
+}
+
+/** Snapshot file stream keeping a checksum of everything read or written through it */
+class CHashedSnapshotFile
+{
+private:
+    CAutoFile &file;
+    CHashWriter hasher;
+
+public:
+    int nType;
+    int nVersion;
+
+    CHashedSnapshotFile(CAutoFile &fileIn) : file(fileIn), hasher(SER_DISK, CLIENT_VERSION), nType(SER_DISK), nVersion(CLIENT_VERSION) {}
+
+    CHashedSnapshotFile& read(char *pch, size_t nSize) {
+        file.read(pch, nSize);
+        hasher.write(pch, nSize);
+        return (*this);
+    }
+
+    CHashedSnapshotFile& write(const char *pch, size_t nSize) {
+        file.write(pch, nSize);
+        hasher.write(pch, nSize);
+        return (*this);
+    }
+
+    template<typename T>
+    CHashedSnapshotFile& operator<<(const T& obj) {
+        ::Serialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+
+    template<typename T>
+    CHashedSnapshotFile& operator>>(T& obj) {
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+
+    // invalidates the object
+    uint256 GetHash() { return hasher.GetHash(); }
+};
+
+/**
+ * Snapshot file layout: network magic, CCoinsSnapshotHeader, then one record
+ * per transaction ('o', txid, CCoins) in txid order, one per spent withdraw
+ * ('w', outpoint, spender), a terminating 0, the transaction and withdraw
+ * counts and finally the double-SHA256 of everything after the magic.
+ */
+bool CCoinsViewDB::DumpSnapshot(CAutoFile &file, CCoinsStats &stats) const {
+    // Iterators read from an implicit snapshot of the database
+    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
+    CCoinsSnapshotHeader header;
+    // The best block must be read from that snapshot too, as a flush may
+    // have written another since the iterator was created
+    pcursor->Seek(std::string(1, 'H'));
+    if (!pcursor->Valid() || pcursor->key() != leveldb::Slice("H", 1))
+        return error("%s : no best block", __func__);
+    try {
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> header.hashBlock;
+    } catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    BlockMap::const_iterator mi = mapBlockIndex.find(header.hashBlock);
+    if (mi == mapBlockIndex.end())
+        return error("%s : best block %s not in block index", __func__, header.hashBlock.ToString());
+    header.nChainTx = mi->second->nChainTx;
+    stats.hashBlock = header.hashBlock;
+    stats.nHeight = mi->second->nHeight;
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << stats.hashBlock;
+    uint64_t nWithdraws = 0;
+    try {
+        file << FLATDATA(Params().MessageStart());
+        CHashedSnapshotFile hashedfile(file);
+        hashedfile << header;
+
+        pcursor->Seek(std::string(1, 'o'));
+        uint256 txhash = 0;
+        CCoins coins;
+        while (ReadNextCoins(pcursor.get(), txhash, coins)) {
+            boost::this_thread::interruption_point();
+            ApplyStats(stats, ss, txhash, coins);
+            hashedfile << 'o' << txhash << coins;
+        }
+
+        pcursor->Seek(std::string(1, 'w'));
+        pair<uint256, COutPoint> outpoint;
+        COutPoint spender;
+        while (ReadNextWithdraw(pcursor.get(), outpoint, spender)) {
+            boost::this_thread::interruption_point();
+            ApplyWithdrawStats(ss, outpoint, spender);
+            hashedfile << 'w' << outpoint << spender;
+            nWithdraws++;
+        }
+        ss << VARINT(nWithdraws);
+
+        hashedfile << '\0' << stats.nTransactions << nWithdraws;
+        file << hashedfile.GetHash();
+    } catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    stats.hashSerialized = ss.GetHash();
+    return true;
+}
+
+bool CCoinsViewDB::IsLoadingSnapshot() const {
+    return db.Exists('L');
+}
+
+/** Erase all unspent outputs, their index and withdraw records */
+bool CCoinsViewDB::WipeCoins() {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CLevelDBBatch batch;
+    size_t nPending = 0;
+    for (pcursor->Seek(std::string(1, 'o')); pcursor->Valid(); pcursor->Next()) {
         try {
             leveldb::Slice slKey = pcursor->key();
             CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
             ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
+            if (chType == 'o') {
+                COutPoint outpoint;
+                ssKey >> outpoint;
+                batch.Erase(make_pair(chType, outpoint));
+            } else if (chType == 'u') {
                 uint256 txhash;
                 ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
+                batch.Erase(make_pair(chType, txhash));
+            } else if (chType == 'w') {
+                pair<uint256, COutPoint> outpoint;
+                ssKey >> outpoint;
+                batch.Erase(make_pair(chType, outpoint));
+            } else
+                break;
+        } catch (std::exception &e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+        if (++nPending >= 100000) {
+            if (!db.WriteBatch(batch))
+                return false;
+            batch = CLevelDBBatch();
+            nPending = 0;
+        }
+    }
+    return db.WriteBatch(batch);
+}
+
+/**
+ * Read a snapshot file from the start, verifying its checksum and computing
+ * its stats. With fWrite, its records are also written to the database, in
+ * large batches which, as the file is sorted, each cover one key range, and
+ * accounted for in commitment.
+ */
+bool CCoinsViewDB::ReadSnapshot(CAutoFile &file, CCoinsSnapshotHeader &header, CCoinsStats &stats, bool fWrite, CCoinsCommitment &commitment, string &strError) {
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    uint64_t nWithdraws = 0;
+    CLevelDBBatch batch;
+    size_t nPending = 0;
+    try {
+        if (fseek(file.Get(), 0, SEEK_SET) != 0)
+            throw runtime_error("cannot rewind");
+        unsigned char pchMessageStart[MESSAGE_START_SIZE];
+        file >> FLATDATA(pchMessageStart);
+        if (memcmp(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0) {
+            strError = "Snapshot is for a different network";
+            return false;
+        }
+        CHashedSnapshotFile hashedfile(file);
+        hashedfile >> header;
+        if (header.nVersion != CCoinsSnapshotHeader::CURRENT_VERSION) {
+            strError = strprintf("Unsupported snapshot version %d", header.nVersion);
+            return false;
+        }
+        stats.hashBlock = header.hashBlock;
+        ss << stats.hashBlock;
+
+        while (true) {
+            boost::this_thread::interruption_point();
+            char chType;
+            hashedfile >> chType;
+            if (chType == 'o') {
+                uint256 txhash;
+                CCoins coins;
+                hashedfile >> txhash >> coins;
+                if (coins.IsPruned())
+                    throw runtime_error("transaction without unspent outputs");
+                if (nWithdraws > 0)
+                    throw runtime_error("transaction after withdraw records");
+                ApplyStats(stats, ss, txhash, coins);
+                if (fWrite) {
+                    commitment.AddCoins(txhash, coins);
+                    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+                        if (!coins.vout[i].IsNull()) {
+                            batch.Write(make_pair('o', COutPoint(txhash, i)), CDiskCoinsOutput(coins, i));
+                            nPending++;
+                        }
                     }
+                    BatchWriteCoinsIndex(batch, txhash, coins);
+                    nPending++;
+                }
+            } else if (chType == 'w') {
+                pair<uint256, COutPoint> outpoint;
+                COutPoint spender;
+                hashedfile >> outpoint >> spender;
+                ApplyWithdrawStats(ss, outpoint, spender);
+                if (fWrite) {
+                    batch.Write(make_pair('w', outpoint), spender);
+                    nPending++;
+                }
+                nWithdraws++;
+            } else if (chType == 0) {
+                ss << VARINT(nWithdraws);
+                break;
+            } else {
+                throw runtime_error("unknown record type");
+            }
+            if (nPending >= 100000) {
+                if (!db.WriteBatch(batch)) {
+                    strError = "Failed to write to coin database";
+                    return false;
                 }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
+                batch = CLevelDBBatch();
+                nPending = 0;
             }
-            pcursor->Next();
-        } catch (std::exception &e) {
-            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
+
+        uint64_t nTransactionsIn, nWithdrawsIn;
+        hashedfile >> nTransactionsIn >> nWithdrawsIn;
+        uint256 hashChecksum = hashedfile.GetHash();
+        uint256 hashChecksumIn;
+        file >> hashChecksumIn;
+        if (hashChecksumIn != hashChecksum || nTransactionsIn != stats.nTransactions || nWithdrawsIn != nWithdraws)
+            throw runtime_error("checksum mismatch");
+    } catch (std::exception &e) {
+        LogPrintf("%s : Deserialize or I/O error - %s\n", __func__, e.what());
+        strError = "Snapshot file is truncated or corrupt";
+        return false;
+    }
+    if (fWrite && !db.WriteBatch(batch)) {
+        strError = "Failed to write to coin database";
+        return false;
     }
-    stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
     stats.hashSerialized = ss.GetHash();
     return true;
 }
 
+bool CCoinsViewDB::LoadSnapshot(CAutoFile &file, const uint256 &hashExpected, CCoinsSnapshotHeader &header, CCoinsStats &stats, string &strError) {
+    // Check the whole file before touching the database, then read it again to load it
+    CCoinsCommitment commitment;
+    if (!ReadSnapshot(file, header, stats, false, commitment, strError))
+        return false;
+    if (stats.hashSerialized != hashExpected) {
+        strError = strprintf("Snapshot hashes to %s, expected %s", stats.hashSerialized.ToString(), hashExpected.ToString());
+        return false;
+    }
+
+    // From here until the final write the database holds neither the old
+    // set nor the new one. The marker makes Upgrade() refuse it at startup,
+    // so it gets rebuilt with -reindex if loading is interrupted.
+    LogPrintf("Loading UTXO snapshot at block %s...\n", header.hashBlock.ToString());
+    if (!db.Write('L', header.hashBlock, true) || !WipeCoins()) {
+        strError = "Failed to write to coin database";
+        return false;
+    }
+    CCoinsSnapshotHeader headerLoaded;
+    CCoinsStats statsLoaded;
+    if (!ReadSnapshot(file, headerLoaded, statsLoaded, true, commitment, strError))
+        return false;
+    if (statsLoaded.hashSerialized != stats.hashSerialized) {
+        strError = "Snapshot file changed while loading";
+        return false;
+    }
+
+    CLevelDBBatch batch;
+    BatchWriteHashBestChain(batch, header.hashBlock);
+    batch.Write('C', commitment);
+    batch.Erase('L');
+    if (!db.WriteBatch(batch, true)) {
+        strError = "Failed to write to coin database";
+        return false;
+    }
+    LogPrintf("Loaded %u transactions from UTXO snapshot\n", (unsigned int)stats.nTransactions);
+    return true;
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(make_pair('t', txid), pos);
 }
@@ -189,6 +788,21 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+bool CBlockTreeDB::WriteSnapshotBase(const uint256 &hash, unsigned int nChainTx) {
+    if (hash == 0)
+        return Erase('S');
+    return Write('S', make_pair(hash, nChainTx));
+}
+
+bool CBlockTreeDB::ReadSnapshotBase(uint256 &hash, unsigned int &nChainTx) {
+    pair<uint256, unsigned int> base;
+    if (!Read('S', base))
+        return false;
+    hash = base.first;
+    nChainTx = base.second;
+    return true;
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
@@ -218,10 +832,12 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 pindexNew->nFile          = diskindex.nFile;
                 pindexNew->nDataPos       = diskindex.nDataPos;
                 pindexNew->nUndoPos       = diskindex.nUndoPos;
+                pindexNew->nWitnessPos    = diskindex.nWitnessPos;
                 pindexNew->nVersion       = diskindex.nVersion;
                 pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
                 pindexNew->nTime          = diskindex.nTime;
-                pindexNew->proof          = diskindex.proof;
+                pindexNew->SetProof(diskindex.proof);
+                AddBlockIndexMemoryStats(diskindex.proof);
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nTx            = diskindex.nTx;
 
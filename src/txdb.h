@@ -24,6 +24,37 @@ static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
 
+//! Coin database format in which explicit amounts are stored compressed
+static const int COINS_DB_FORMAT_COMPRESSED_AMOUNTS = 1;
+//! Coin database format with one entry per unspent output, keyed by outpoint
+static const int COINS_DB_FORMAT_PER_OUTPUT = 2;
+//! Coin database format which also indexes the unspent outputs of each
+//! transaction, and keeps the best block where older versions don't look
+static const int COINS_DB_FORMAT_TX_INDEX = 3;
+
+/** Header of a UTXO set snapshot file, following the network magic bytes */
+class CCoinsSnapshotHeader
+{
+public:
+    static const int CURRENT_VERSION = 1;
+    int nVersion;
+    //! Block the snapshot was taken at
+    uint256 hashBlock;
+    //! Number of transactions in the chain up to and including hashBlock
+    unsigned int nChainTx;
+
+    CCoinsSnapshotHeader() : nVersion(CURRENT_VERSION), hashBlock(0), nChainTx(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(this->nVersion);
+        READWRITE(hashBlock);
+        READWRITE(nChainTx);
+    }
+};
+
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
@@ -36,8 +67,34 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     COutPoint GetWithdrawSpent(const std::pair<uint256, COutPoint> &outpoint) const;
     uint256 GetBestBlock() const;
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool GetCommitment(CCoinsCommitment &commitment) const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CCoinsCommitment *pcommitment);
     bool GetStats(CCoinsStats &stats) const;
+
+    //! Rewrite entries stored in an older format, and compute the commitment
+    //! if there is none yet. Only does work the first time. Fails if an older
+    //! version has written to the database since it was upgraded.
+    bool Upgrade();
+
+    //! Write the whole set, including spent withdraw records, as of one best
+    //! block to a snapshot file. Requires cs_main, for the block index.
+    bool DumpSnapshot(CAutoFile &file, CCoinsStats &stats) const;
+    /**
+     * Replace the whole set with the contents of a snapshot file, which must
+     * be intact and hash to hashExpected (see gettxoutsetinfo's
+     * hash_serialized). Leaves stats.nHeight to the caller.
+     */
+    bool LoadSnapshot(CAutoFile &file, const uint256 &hashExpected, CCoinsSnapshotHeader &header, CCoinsStats &stats, std::string &strError);
+    //! Whether loading a snapshot was interrupted after the old set was erased
+    bool IsLoadingSnapshot() const;
+
+private:
+    bool UpgradePerOutput();
+    bool UpgradeTxIndex();
+    bool FinishUpgrade(CLevelDBBatch &batch);
+    bool InitCommitment();
+    bool WipeCoins();
+    bool ReadSnapshot(CAutoFile &file, CCoinsSnapshotHeader &header, CCoinsStats &stats, bool fWrite, CCoinsCommitment &commitment, std::string &strError);
 };
 
 /** Access to the block database (blocks/index/) */
@@ -50,6 +107,7 @@ private:
     void operator=(const CBlockTreeDB&);
 public:
     bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
+    bool ReadBlockIndex(const uint256& hash, CDiskBlockIndex& blockindex);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
     bool WriteBlockFileInfo(int nFile, const CBlockFileInfo &fileinfo);
     bool ReadLastBlockFile(int &nFile);
@@ -60,6 +118,9 @@ public:
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    //! Record the block the UTXO set was loaded at (0 for none)
+    bool WriteSnapshotBase(const uint256 &hash, unsigned int nChainTx);
+    bool ReadSnapshotBase(uint256 &hash, unsigned int &nChainTx);
     bool LoadBlockIndexGuts();
 };
 
@@ -0,0 +1,216 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "validationstats.h"
+
+#include "utiltime.h"
+
+#include <algorithm>
+#include <set>
+#include <string.h>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace {
+
+/** Bucket holding a latency: the exact value below 4, then four buckets per power of two */
+int GetBucket(int64_t nMicros)
+{
+    if (nMicros < 4)
+        return nMicros < 0 ? 0 : (int)nMicros;
+    int nBits = 2;
+    while (nMicros >> (nBits + 1))
+        nBits++;
+    int nBucket = 4 * (nBits - 1) + (int)((nMicros >> (nBits - 2)) & 3);
+    return nBucket < CLatencyHistogram::BUCKETS ? nBucket : CLatencyHistogram::BUCKETS - 1;
+}
+
+/** Largest latency that falls in a bucket */
+int64_t GetBucketLimit(int nBucket)
+{
+    if (nBucket < 4)
+        return nBucket;
+    int nBits = nBucket / 4 + 1;
+    return ((int64_t)(5 + nBucket % 4) << (nBits - 2)) - 1;
+}
+
+const char* const vPhaseNames[VALIDATION_PHASE_COUNT] = {
+    "checkheader",
+    "checkproof",
+    "verifyamounts",
+    "rangeproof",
+    "script",
+    "withdraw",
+    "connectblock",
+    "flushcoins",
+    "writedisk",
+    "mempoolaccept",
+};
+
+const char* const vStageNames[MEMPOOL_STAGE_COUNT] = {
+    "received",
+    "checked",
+    "inputsfound",
+    "amountsverified",
+    "policypassed",
+    "accepted",
+};
+
+/**
+ * Statistics recorded by one thread. Only that thread adds to them, so their
+ * lock is contended only while the statistics are being read.
+ */
+struct CThreadValidationStats
+{
+    boost::mutex cs;
+    CValidationStats stats;
+};
+
+void MergeValidationStats(CValidationStats& to, const CValidationStats& from)
+{
+    for (int i = 0; i < VALIDATION_PHASE_COUNT; i++) {
+        CLatencyHistogram& histogram = to.phases[i];
+        const CLatencyHistogram& other = from.phases[i];
+        histogram.nCount += other.nCount;
+        histogram.nTotal += other.nTotal;
+        histogram.nMax = std::max(histogram.nMax, other.nMax);
+        for (int j = 0; j < CLatencyHistogram::BUCKETS; j++)
+            histogram.vBuckets[j] += other.vBuckets[j];
+    }
+    for (int i = 0; i < MEMPOOL_STAGE_COUNT; i++)
+        to.nMempoolStages[i] += from.nMempoolStages[i];
+}
+
+/** Guards the set of threads' statistics and those of exited threads */
+boost::mutex cs_validationstats;
+std::set<CThreadValidationStats*> setThreadStats;
+CValidationStats retiredStats;
+
+void ReleaseThreadStats(CThreadValidationStats* pthreadStats)
+{
+    boost::unique_lock<boost::mutex> lock(cs_validationstats);
+    MergeValidationStats(retiredStats, pthreadStats->stats);
+    setThreadStats.erase(pthreadStats);
+    delete pthreadStats;
+}
+
+boost::thread_specific_ptr<CThreadValidationStats> threadStats(ReleaseThreadStats);
+
+CThreadValidationStats& GetThreadStats()
+{
+    CThreadValidationStats* pthreadStats = threadStats.get();
+    if (!pthreadStats) {
+        pthreadStats = new CThreadValidationStats();
+        boost::unique_lock<boost::mutex> lock(cs_validationstats);
+        setThreadStats.insert(pthreadStats);
+        threadStats.reset(pthreadStats);
+    }
+    return *pthreadStats;
+}
+
+/** Sum of the statistics of all threads, optionally clearing them. Requires cs_validationstats. */
+CValidationStats CollectValidationStats(bool fReset)
+{
+    CValidationStats stats = retiredStats;
+    if (fReset)
+        retiredStats = CValidationStats();
+    for (std::set<CThreadValidationStats*>::iterator it = setThreadStats.begin(); it != setThreadStats.end(); ++it) {
+        boost::unique_lock<boost::mutex> lock((*it)->cs);
+        MergeValidationStats(stats, (*it)->stats);
+        if (fReset)
+            (*it)->stats = CValidationStats();
+    }
+    return stats;
+}
+
+}
+
+CLatencyHistogram::CLatencyHistogram() : nCount(0), nTotal(0), nMax(0)
+{
+    memset(vBuckets, 0, sizeof(vBuckets));
+}
+
+void CLatencyHistogram::Add(int64_t nMicros, unsigned int nCountIn)
+{
+    if (nCountIn == 0)
+        return;
+    int64_t nEach = nMicros / nCountIn;
+    nCount += nCountIn;
+    nTotal += nMicros;
+    if (nEach > nMax)
+        nMax = nEach;
+    vBuckets[GetBucket(nEach)] += nCountIn;
+}
+
+CValidationStats::CValidationStats() : nSince(GetTime())
+{
+    memset(nMempoolStages, 0, sizeof(nMempoolStages));
+}
+
+int64_t CLatencyHistogram::Percentile(double dFraction) const
+{
+    if (nCount == 0)
+        return 0;
+    uint64_t nRank = (uint64_t)(dFraction * nCount);
+    if (nRank >= nCount)
+        nRank = nCount - 1;
+    uint64_t nSeen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        nSeen += vBuckets[i];
+        if (nSeen > nRank)
+            return std::min(GetBucketLimit(i), nMax);
+    }
+    return nMax;
+}
+
+const char* GetValidationPhaseName(ValidationPhase phase)
+{
+    return vPhaseNames[phase];
+}
+
+const char* GetMempoolStageName(MempoolStage stage)
+{
+    return vStageNames[stage];
+}
+
+void RecordValidationTime(ValidationPhase phase, int64_t nMicros, unsigned int nCount)
+{
+    CThreadValidationStats& threadStats = GetThreadStats();
+    boost::unique_lock<boost::mutex> lock(threadStats.cs);
+    threadStats.stats.phases[phase].Add(nMicros, nCount);
+}
+
+void RecordMempoolStage(MempoolStage stage)
+{
+    CThreadValidationStats& threadStats = GetThreadStats();
+    boost::unique_lock<boost::mutex> lock(threadStats.cs);
+    threadStats.stats.nMempoolStages[stage]++;
+}
+
+CValidationStats GetValidationStats()
+{
+    boost::unique_lock<boost::mutex> lock(cs_validationstats);
+    return CollectValidationStats(false);
+}
+
+CValidationStats GetAndResetValidationStats()
+{
+    boost::unique_lock<boost::mutex> lock(cs_validationstats);
+    return CollectValidationStats(true);
+}
+
+void ResetValidationStats()
+{
+    GetAndResetValidationStats();
+}
+
+CValidationTimer::CValidationTimer(ValidationPhase phaseIn) : phase(phaseIn), nStart(GetTimeMicros())
+{
+}
+
+CValidationTimer::~CValidationTimer()
+{
+    RecordValidationTime(phase, GetTimeMicros() - nStart);
+}
@@ -0,0 +1,96 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_VALIDATIONSTATS_H
+#define BITCOIN_VALIDATIONSTATS_H
+
+#include <stdint.h>
+
+/** Timed phases of block and transaction validation */
+enum ValidationPhase
+{
+    VALIDATION_CHECK_HEADER = 0, //! Context-free and contextual checks of a new header, including its proof
+    VALIDATION_CHECK_PROOF,      //! Verifying a block proof (per proof; batches are averaged)
+    VALIDATION_VERIFY_AMOUNTS,   //! Commitment tally of a transaction
+    VALIDATION_RANGEPROOF,       //! Verifying a rangeproof
+    VALIDATION_SCRIPT,           //! Verifying an input script (per input; batches are averaged)
+    VALIDATION_WITHDRAW,         //! Verifying an input spending a withdraw lock (per input; batches are averaged)
+    VALIDATION_CONNECT_BLOCK,    //! Connecting a block to the coins view, all checks included
+    VALIDATION_FLUSH_COINS,      //! Writing the coins cache to the database
+    VALIDATION_WRITE_DISK,       //! Writing block, witness or undo data to the block files
+    VALIDATION_MEMPOOL_ACCEPT,   //! Processing a transaction for the memory pool, accepted or not
+    VALIDATION_PHASE_COUNT
+};
+
+/** Stages a transaction passes on its way into the memory pool */
+enum MempoolStage
+{
+    MEMPOOL_RECEIVED = 0,        //! Submitted for acceptance
+    MEMPOOL_CHECKED,             //! Passed the context-free and standardness checks
+    MEMPOOL_INPUTS_FOUND,        //! All inputs are available
+    MEMPOOL_AMOUNTS_VERIFIED,    //! Amounts and rangeproofs verified
+    MEMPOOL_POLICY_PASSED,       //! Passed the fee, priority and sigop policy
+    MEMPOOL_ACCEPTED,            //! Scripts verified and added to the pool
+    MEMPOOL_STAGE_COUNT
+};
+
+/**
+ * Histogram of latencies in microseconds. Buckets are a quarter of a power of
+ * two wide, so percentiles are accurate to within about 25%.
+ */
+class CLatencyHistogram
+{
+public:
+    static const int BUCKETS = 160;
+
+    uint64_t nCount;
+    int64_t nTotal;
+    int64_t nMax;
+    uint64_t vBuckets[BUCKETS];
+
+    CLatencyHistogram();
+
+    /** Add nCount samples which took nMicros microseconds together */
+    void Add(int64_t nMicros, unsigned int nCount = 1);
+
+    /** Latency below which a fraction dFraction of the samples fall (an upper estimate) */
+    int64_t Percentile(double dFraction) const;
+};
+
+struct CValidationStats
+{
+    CLatencyHistogram phases[VALIDATION_PHASE_COUNT];
+    uint64_t nMempoolStages[MEMPOOL_STAGE_COUNT];
+    int64_t nSince; //! Time the statistics were last reset
+
+    CValidationStats();
+};
+
+/** Name of a phase or stage, as reported by getvalidationstats */
+const char* GetValidationPhaseName(ValidationPhase phase);
+const char* GetMempoolStageName(MempoolStage stage);
+
+/** Record that nCount checks of a phase took nMicros microseconds together */
+void RecordValidationTime(ValidationPhase phase, int64_t nMicros, unsigned int nCount = 1);
+void RecordMempoolStage(MempoolStage stage);
+
+/** Statistics summed over all threads since they were last reset */
+CValidationStats GetValidationStats();
+/** Return the statistics and reset them in one step, so no samples are lost in between */
+CValidationStats GetAndResetValidationStats();
+void ResetValidationStats();
+
+/** Records the time from its construction to its destruction under a phase */
+class CValidationTimer
+{
+private:
+    ValidationPhase phase;
+    int64_t nStart;
+
+public:
+    explicit CValidationTimer(ValidationPhase phaseIn);
+    ~CValidationTimer();
+};
+
+#endif // BITCOIN_VALIDATIONSTATS_H
@@ -978,12 +978,24 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
             if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
                 ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
 
+            // Only load the witness of blocks with transactions of ours
             CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            ReadBlockFromDisk(block, pindex, false);
+            bool fInvolvesMe = false;
+            BOOST_FOREACH(const CTransaction& tx, block.vtx)
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
+                if (mapWallet.count(tx.GetHash()) || IsMine(tx) || IsFromMe(tx)) {
+                    fInvolvesMe = true;
+                    break;
+                }
+            }
+            if (fInvolvesMe && ReadBlockWitnessFromDisk(block, pindex))
+            {
+                BOOST_FOREACH(CTransaction& tx, block.vtx)
+                {
+                    if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
+                        ret++;
+                }
             }
             pindex = chainActive.Next(pindex);
             if (GetTime() >= nNow + 60) {